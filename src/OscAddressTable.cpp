@@ -0,0 +1,218 @@
+//
+//  OscAddressTable.cpp
+//
+
+#include "OscAddressTable.h"
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	const size_t	kInitialCapacity	= 256;
+
+	bool matchCharacter( const char*& pattern, char c )
+	{
+		switch ( *pattern ) {
+		case '?':
+			++pattern;
+			return c != '/';
+		case '[': {
+			const char* p	= pattern + 1;
+			bool negated	= *p == '!';
+			if ( negated ) {
+				++p;
+			}
+			bool matched = false;
+			for ( ; *p != 0 && *p != ']'; ++p ) {
+				if ( p[ 1 ] == '-' && p[ 2 ] != 0 && p[ 2 ] != ']' ) {
+					matched = matched || ( c >= p[ 0 ] && c <= p[ 2 ] );
+					p += 2;
+				} else {
+					matched = matched || c == *p;
+				}
+			}
+			pattern = *p == ']' ? p + 1 : p;
+			return c != '/' && matched != negated;
+		}
+		default:
+			return *pattern++ == c;
+		}
+	}
+}
+
+OscAddressTable::Slots::Slots( size_t capacity )
+	: mSlots( new atomic<const Entry*>[ capacity ] ), mMask( capacity - 1 )
+{
+	for ( size_t i = 0; i < capacity; ++i ) {
+		mSlots[ i ].store( nullptr, memory_order_relaxed );
+	}
+}
+
+OscAddressTable& OscAddressTable::get()
+{
+	static OscAddressTable table;
+	return table;
+}
+
+OscAddressTable::OscAddressTable()
+	: mSlots( new Slots( kInitialCapacity ) ), mNumEntries( 0 ), mMaxAddresses( 65536 )
+{
+	memset( mChunks, 0, sizeof( mChunks ) );
+}
+
+OscAddressTable::~OscAddressTable()
+{
+	delete mSlots.load();
+	for ( Entry* chunk : mChunks ) {
+		delete[] chunk;
+	}
+}
+
+uint32_t OscAddressTable::hashAddress( const char* address, size_t length )
+{
+	uint32_t hash = kHashOffset;
+	for ( size_t i = 0; i < length; ++i ) {
+		hash ^= static_cast<uint8_t>( address[ i ] );
+		hash *= kHashPrime;
+	}
+	return hash;
+}
+
+uint32_t OscAddressTable::find( const Slots& slots, const char* address, size_t length, uint32_t hash )
+{
+	// linear probing, the table is never more than half full
+	for ( size_t i = hash & slots.mMask; ; i = ( i + 1 ) & slots.mMask ) {
+		const Entry* entry = slots.mSlots[ i ].load( memory_order_acquire );
+		if ( entry == nullptr ) {
+			return kInvalidId;
+		}
+		if ( entry->mHash == hash && entry->mAddress.size() == length && memcmp( entry->mAddress.data(), address, length ) == 0 ) {
+			return entry->mId;
+		}
+	}
+}
+
+void OscAddressTable::insert( Slots& slots, const Entry* entry )
+{
+	size_t i = entry->mHash & slots.mMask;
+	while ( slots.mSlots[ i ].load( memory_order_relaxed ) != nullptr ) {
+		i = ( i + 1 ) & slots.mMask;
+	}
+	slots.mSlots[ i ].store( entry, memory_order_release );
+}
+
+uint32_t OscAddressTable::find( const char* address, size_t length, uint32_t hash ) const
+{
+	return find( *mSlots.load( memory_order_acquire ), address, length, hash );
+}
+
+uint32_t OscAddressTable::find( const string& address ) const
+{
+	return find( address.data(), address.size(), hashAddress( address.data(), address.size() ) );
+}
+
+uint32_t OscAddressTable::intern( const string& address )
+{
+	return intern( address.data(), address.size(), hashAddress( address.data(), address.size() ) );
+}
+
+uint32_t OscAddressTable::intern( const char* address, size_t length, uint32_t hash )
+{
+	uint32_t id = find( address, length, hash );
+	if ( id != kInvalidId ) {
+		return id;
+	}
+
+	lock_guard<mutex> lock( mMutex );
+
+	// someone may have added it while we waited for the lock
+	Slots* slots = mSlots.load( memory_order_relaxed );
+	id = find( *slots, address, length, hash );
+	if ( id != kInvalidId ) {
+		return id;
+	}
+
+	size_t numEntries = mNumEntries.load( memory_order_relaxed );
+	if ( numEntries >= mMaxAddresses || numEntries >= kMaxChunks * kChunkSize ) {
+		return kInvalidId;
+	}
+
+	Entry*& chunk = mChunks[ numEntries >> kChunkBits ];
+	if ( chunk == nullptr ) {
+		chunk = new Entry[ kChunkSize ];
+	}
+	Entry& entry	= chunk[ numEntries & ( kChunkSize - 1 ) ];
+	entry.mAddress.assign( address, length );
+	entry.mHash		= hash;
+	entry.mId		= static_cast<uint32_t>( numEntries );
+
+	// grown at half full, readers still probing the old slots keep them until destruction
+	if ( ( numEntries + 1 ) * 2 > slots->mMask + 1 ) {
+		Slots* grown = new Slots( ( slots->mMask + 1 ) * 2 );
+		for ( size_t i = 0; i < numEntries; ++i ) {
+			insert( *grown, &getEntry( static_cast<uint32_t>( i ) ) );
+		}
+		mRetiredSlots.emplace_back( slots );
+		mSlots.store( grown, memory_order_release );
+		slots = grown;
+	}
+
+	insert( *slots, &entry );
+	mNumEntries.store( numEntries + 1, memory_order_release );
+
+	return entry.mId;
+}
+
+void OscAddressTable::setMaxAddresses( size_t maxAddresses )
+{
+	lock_guard<mutex> lock( mMutex );
+	mMaxAddresses = maxAddresses;
+}
+
+bool OscAddressTable::matchPattern( const char* pattern, const char* address )
+{
+	while ( *pattern != 0 ) {
+		if ( *pattern == '*' ) {
+			// try every run of characters up to the end of this part of the address
+			while ( *pattern == '*' ) {
+				++pattern;
+			}
+			for ( const char* p = address; ; ++p ) {
+				if ( matchPattern( pattern, p ) ) {
+					return true;
+				}
+				if ( *p == 0 || *p == '/' ) {
+					return false;
+				}
+			}
+		}
+
+		if ( *pattern == '{' ) {
+			const char* pEnd = strchr( pattern, '}' );
+			if ( pEnd == nullptr ) {
+				return false;
+			}
+			// each alternative followed by the rest of the pattern
+			for ( const char* pAlternative = pattern + 1; pAlternative <= pEnd; ) {
+				const char* pNext = pAlternative;
+				while ( *pNext != ',' && pNext < pEnd ) {
+					++pNext;
+				}
+				size_t length = pNext - pAlternative;
+				if ( strncmp( pAlternative, address, length ) == 0 && memchr( address, '/', length ) == nullptr &&
+					matchPattern( pEnd + 1, address + length ) ) {
+					return true;
+				}
+				pAlternative = pNext + 1;
+			}
+			return false;
+		}
+
+		if ( *address == 0 || !matchCharacter( pattern, *address ) ) {
+			return false;
+		}
+		++address;
+	}
+	return *address == 0;
+}
@@ -0,0 +1,103 @@
+//
+//  OscAddressTable.h
+//
+//	Interns OSC addresses as small integer IDs
+//
+//	Every address set on a message, or given a handler, is stored
+//	once and given a 32-bit ID, so routing and caches can compare and
+//	hash IDs instead of strings. Parsing only looks addresses up, so
+//	a message for a known address allocates nothing for it, and
+//	received packets can't fill the table with made up addresses. Looking an address up never
+//	locks: the table is open addressed, entries never move or change
+//	once published, and growing the table publishes a new array
+//	while readers finish with the old one. Only adding an address
+//	takes a lock.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class OscAddressTable
+{
+public:
+	//! Returned for addresses that are not in the table
+	static const uint32_t		kInvalidId = 0xFFFFFFFF;
+
+	//! Returns the table OscTree interns its addresses in
+	static OscAddressTable&		get();
+
+	//! Returns the ID of the \a length characters at \a address, adding
+	//! it if needed. \a hash must be hashAddress( address, length ).
+	//! Returns kInvalidId once the table holds getMaxAddresses() addresses.
+	uint32_t					intern( const char* address, size_t length, uint32_t hash );
+	uint32_t					intern( const std::string& address );
+	//! Returns the ID of \a address, or kInvalidId if it was never interned. Never locks.
+	uint32_t					find( const char* address, size_t length, uint32_t hash ) const;
+	uint32_t					find( const std::string& address ) const;
+
+	//! Returns the address with \a id, which must be valid
+	const std::string&			getAddress( uint32_t id ) const { return getEntry( id ).mAddress; }
+	//! Returns the hash of the address with \a id, which must be valid
+	uint32_t					getHash( uint32_t id ) const { return getEntry( id ).mHash; }
+	size_t						getNumAddresses() const { return mNumEntries.load( std::memory_order_acquire ); }
+
+	//! Limits the number of addresses that can be interned. Messages
+	//! with addresses past the limit keep their own copy. 65536 by default.
+	void						setMaxAddresses( size_t maxAddresses );
+	size_t						getMaxAddresses() const { return mMaxAddresses; }
+
+	//! 32-bit FNV-1a hash of the \a length characters at \a address
+	static uint32_t				hashAddress( const char* address, size_t length );
+	//! Returns true if \a address matches the OSC address \a pattern, where '?' matches any
+	//! character, '*' any run of characters, "[a-z]" and "[!abc]" one character from or not
+	//! from a set, and "{fader,mute}" any of a list of strings, none of them matching a '/'
+	static bool					matchPattern( const char* pattern, const char* address );
+
+	static const uint32_t		kHashOffset	= 2166136261u;
+	static const uint32_t		kHashPrime	= 16777619u;
+
+	OscAddressTable();
+	~OscAddressTable();
+protected:
+	OscAddressTable( const OscAddressTable& );
+	OscAddressTable&			operator=( const OscAddressTable& );
+
+	struct Entry
+	{
+		std::string				mAddress;
+		uint32_t				mHash;
+		uint32_t				mId;
+	};
+
+	struct Slots
+	{
+		explicit Slots( size_t capacity );
+
+		std::unique_ptr<std::atomic<const Entry*>[]>	mSlots;
+		size_t					mMask;
+	};
+
+	// IDs index into fixed size chunks of entries, so an entry never moves
+	static const size_t			kChunkBits	= 10;
+	static const size_t			kChunkSize	= 1 << kChunkBits;
+	static const size_t			kMaxChunks	= 1024;
+
+	const Entry&				getEntry( uint32_t id ) const { return mChunks[ id >> kChunkBits ][ id & ( kChunkSize - 1 ) ]; }
+	static uint32_t				find( const Slots& slots, const char* address, size_t length, uint32_t hash );
+	static void					insert( Slots& slots, const Entry* entry );
+
+	std::atomic<Slots*>			mSlots;
+	std::atomic<size_t>			mNumEntries;
+	Entry*						mChunks[ kMaxChunks ];
+	size_t						mMaxAddresses;
+
+	// writers only, the slots a reader may still be probing are kept until destruction
+	std::mutex					mMutex;
+	std::vector<std::unique_ptr<Slots>>	mRetiredSlots;
+};
@@ -0,0 +1,723 @@
+//
+//  OscArchive.cpp
+//
+
+#include "OscArchive.h"
+#include "OscAddressTable.h"
+#include "cinder/Log.h"
+#include "cinder/Utilities.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+using namespace ci;
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	// Staged records are written once this many bytes are pending
+	const size_t	kStagingSize	= 1024 * 1024;
+
+	const char		kSegmentMagic[ 8 ]	= { 'O', 'S', 'C', 'A', 'R', 'C', '1', '\0' };
+	const char		kIndexMagic[ 8 ]	= { 'O', 'S', 'C', 'A', 'I', 'X', '1', '\0' };
+
+	// seconds from 1900, where time tags start, to 1970
+	const uint64_t	kEpochOffset		= 2208988800ull;
+
+	size_t ceil4( size_t size )
+	{
+		return ( size + 3 ) & ~static_cast<size_t>( 3 );
+	}
+
+	size_t ceil8( size_t size )
+	{
+		return ( size + 7 ) & ~static_cast<size_t>( 7 );
+	}
+
+	bool compareTimeTags( const OscArchive::IndexEntry& a, const OscArchive::IndexEntry& b )
+	{
+		return a.mTimeTag < b.mTimeTag;
+	}
+
+	struct Element
+	{
+		const char*		mData;
+		size_t			mSize;
+		uint64_t		mTimeTag;
+	};
+
+	// Calls \a indexMessage( data, size, addressLength, hash, timeTag ) for every
+	// message in the packet, walking only as far as each message's address.
+	// Malformed messages and bundles are left out, their packet is still archived.
+	template<typename IndexFn>
+	void walkPacket( const char* data, size_t size, uint64_t timeTag, const IndexFn& indexMessage )
+	{
+		vector<Element> stack;
+		Element root = { data, size, timeTag };
+
+		// most packets are a lone message, which needs no stack
+		bool isRoot = true;
+		while ( isRoot || !stack.empty() ) {
+			Element element = root;
+			if ( !isRoot ) {
+				element = stack.back();
+				stack.pop_back();
+			}
+			isRoot = false;
+
+			if ( element.mSize == 0 ) {
+				continue;
+			}
+
+			if ( element.mData[ 0 ] == '/' ) {
+				uint32_t hash		= OscAddressTable::kHashOffset;
+				const char* pEnd	= element.mData;
+				const char* pBlockEnd	= element.mData + element.mSize;
+				while ( pEnd < pBlockEnd && *pEnd != 0 ) {
+					hash = ( hash ^ static_cast<uint8_t>( *pEnd ) ) * OscAddressTable::kHashPrime;
+					++pEnd;
+				}
+				if ( pEnd < pBlockEnd ) {
+					indexMessage( element.mData, element.mSize, static_cast<size_t>( pEnd - element.mData ), hash, element.mTimeTag );
+				}
+				continue;
+			}
+
+			if ( element.mSize < 16 || memcmp( element.mData, "#bundle", 8 ) != 0 ) {
+				continue;
+			}
+
+			// an immediate bundle keeps the time tag of what it's in
+			uint64_t bundleTimeTag;
+			memcpy( &bundleTimeTag, element.mData + 8, 8 );
+			if ( bundleTimeTag == OscTree::TimeTag().mTimeTag ) {
+				bundleTimeTag = element.mTimeTag;
+			}
+
+			size_t first			= stack.size();
+			const char* pBlockEnd	= element.mData + element.mSize;
+			const char* pBegin		= element.mData + 16;
+			while ( pBlockEnd - pBegin >= 4 ) {
+				int32_t elementSize;
+				memcpy( &elementSize, pBegin, 4 );
+				if ( elementSize < 0 || elementSize > pBlockEnd - pBegin - 4 ) {
+					break;
+				}
+				Element child = { pBegin + 4, static_cast<size_t>( elementSize ), bundleTimeTag };
+				stack.push_back( child );
+				pBegin += 4 + elementSize;
+			}
+			reverse( stack.begin() + first, stack.end() );
+		}
+	}
+}
+
+fs::path OscArchive::getSegmentPath( const fs::path& directory, size_t segment )
+{
+	char name[ 32 ];
+	snprintf( name, sizeof( name ), "segment-%06u.osca", static_cast<unsigned>( segment ) );
+	return directory / name;
+}
+
+fs::path OscArchive::getIndexPath( const fs::path& path )
+{
+	return fs::path( path.string() + ".idx" );
+}
+
+OscTree::TimeTag OscArchive::toTimeTag( system_clock::time_point time )
+{
+	int64_t ns			= duration_cast<nanoseconds>( time.time_since_epoch() ).count();
+	uint64_t seconds	= static_cast<uint64_t>( ns / 1000000000 ) + kEpochOffset;
+	uint64_t fraction	= ( static_cast<uint64_t>( ns % 1000000000 ) << 32 ) / 1000000000;
+	return OscTree::TimeTag( ( seconds << 32 ) | fraction );
+}
+
+OscArchive::ExcInvalidArchive::ExcInvalidArchive( const fs::path& path, const string& reason )
+{
+	mMessage = "Invalid archive: " + path.string() + " (" + reason + ")";
+}
+
+OscArchiveWriterRef OscArchiveWriter::create( const fs::path& directory, size_t segmentSize )
+{
+	return make_shared<OscArchiveWriter>( directory, segmentSize );
+}
+
+OscArchiveWriter::OscArchiveWriter( const fs::path& directory, size_t segmentSize )
+	: mDirectory( directory ), mSegmentSize( segmentSize ), mSegment( 0 ), mOffset( sizeof( OscArchive::SegmentHeader ) ),
+	mNumPackets( 0 ), mNumMessages( 0 ), mFailed( false ), mStopped( false ), mNumFlushesRequested( 0 ), mNumFlushesCompleted( 0 ), 
+	mFile( nullptr ), mFileSegment( 0 )
+{
+	if ( !fs::exists( directory ) && !fs::create_directories( directory ) ) {
+		throw OscArchive::ExcInvalidArchive( directory, "could not create directory" );
+	}
+
+	// a reader would carry on into the segments of an older archive
+	for ( size_t i = 0; fs::exists( OscArchive::getSegmentPath( directory, i ) ); ++i ) {
+		fs::path path = OscArchive::getSegmentPath( directory, i );
+		fs::remove( path );
+		fs::remove( OscArchive::getIndexPath( path ) );
+	}
+
+	// later segments are opened by the writer thread
+	fs::path path;
+	if ( !openSegment( 0, path ) ) {
+		if ( mFile == nullptr ) {
+			throw OscArchive::ExcInvalidArchive( path, "could not open for writing" );
+		}
+		fclose( mFile );
+		throw OscArchive::ExcInvalidArchive( path, "could not write header" );
+	}
+
+	mStaging.reserve( kStagingSize * 2 );
+	mThread = thread( &OscArchiveWriter::run, this );
+}
+
+OscArchiveWriter::~OscArchiveWriter()
+{
+	// the writer seals the last segment before it stops
+	{
+		lock_guard<mutex> lock( mMutex );
+		if ( !mFailed ) {
+			queueBlock( true );
+		}
+		mStopped = true;
+		mWakeup.notify_one();
+	}
+	mThread.join();
+
+	if ( mFile != nullptr ) {
+		fclose( mFile );
+	}
+}
+
+bool OscArchiveWriter::openSegment( size_t segment, fs::path& path )
+{
+	path			= OscArchive::getSegmentPath( mDirectory, segment );
+	mFile			= fopen( path.string().c_str(), "wb" );
+	mFileSegment	= segment;
+	if ( mFile == nullptr ) {
+		return false;
+	}
+
+	OscArchive::SegmentHeader header;
+	memcpy( header.mMagic, kSegmentMagic, sizeof( kSegmentMagic ) );
+	header.mVersion		= OscArchive::kVersion;
+	header.mHeaderSize	= sizeof( OscArchive::SegmentHeader );
+	header.mSegment		= static_cast<uint32_t>( segment );
+	header.mReserved	= 0;
+
+	return fwrite( &header, sizeof( header ), 1, mFile ) == 1;
+}
+
+bool OscArchiveWriter::sealSegment( Block& block, fs::path& path )
+{
+	path = OscArchive::getSegmentPath( mDirectory, block.mSegment );
+	bool closed	= fclose( mFile ) == 0;
+	mFile		= nullptr;
+	if ( !closed ) {
+		return false;
+	}
+
+	// packets are written in arrival order, their bundles' time tags needn't be
+	vector<OscArchive::IndexEntry>& entries = block.mEntries;
+	stable_sort( entries.begin(), entries.end(), compareTimeTags );
+
+	fs::path indexPath	= OscArchive::getIndexPath( path );
+	FILE* indexFile		= fopen( indexPath.string().c_str(), "wb" );
+	if ( indexFile == nullptr ) {
+		// a reader rebuilds the missing index instead
+		CI_LOG_E( "Could not write archive index " << indexPath );
+		return true;
+	}
+
+	OscArchive::IndexHeader header;
+	memcpy( header.mMagic, kIndexMagic, sizeof( kIndexMagic ) );
+	header.mVersion			= OscArchive::kVersion;
+	header.mNumAddresses	= static_cast<uint32_t>( block.mAddresses.size() );
+	header.mNumEntries		= entries.size();
+	header.mFirstTimeTag	= entries.empty() ? 0 : entries.front().mTimeTag;
+	header.mLastTimeTag		= entries.empty() ? 0 : entries.back().mTimeTag;
+	header.mSegmentSize		= block.mSegmentSize;
+
+	vector<uint8_t> data( sizeof( header ) );
+	memcpy( data.data(), &header, sizeof( header ) );
+	for ( const string& address : block.mAddresses ) {
+		size_t offset	= data.size();
+		uint32_t length	= static_cast<uint32_t>( address.size() );
+		data.resize( offset + 4 + ceil4( length ), 0 );
+		memcpy( data.data() + offset, &length, 4 );
+		memcpy( data.data() + offset + 4, address.data(), length );
+	}
+	data.resize( ceil8( data.size() ), 0 );
+
+	bool written = fwrite( data.data(), 1, data.size(), indexFile ) == data.size() &&
+		fwrite( entries.data(), sizeof( OscArchive::IndexEntry ), entries.size(), indexFile ) == entries.size();
+	written = fclose( indexFile ) == 0 && written;
+	if ( !written ) {
+		// a partial index would be rebuilt anyway, don't leave it lying around
+		CI_LOG_E( "Could not write archive index " << indexPath << ": " << strerror( errno ) );
+		fs::remove( indexPath );
+	}
+
+	return true;
+}
+
+void OscArchiveWriter::write( const BufferRef& buffer )
+{
+	write( buffer->getData(), buffer->getSize() );
+}
+
+void OscArchiveWriter::write( const OscTree& tree )
+{
+	BufferRef buffer = tree.toBuffer();
+	write( buffer->getData(), buffer->getSize() );
+}
+
+void OscArchiveWriter::write( const void* data, size_t numBytes )
+{
+	write( data, numBytes, OscArchive::toTimeTag( system_clock::now() ) );
+}
+
+void OscArchiveWriter::write( const void* data, size_t numBytes, OscTree::TimeTag timeTag )
+{
+	lock_guard<mutex> lock( mMutex );
+	writeLocked( data, numBytes, timeTag.mTimeTag );
+}
+
+void OscArchiveWriter::write( const BufferRef* packets, size_t numPackets )
+{
+	uint64_t timeTag = OscArchive::toTimeTag( system_clock::now() ).mTimeTag;
+
+	lock_guard<mutex> lock( mMutex );
+	for ( size_t i = 0; i < numPackets; ++i ) {
+		writeLocked( packets[ i ]->getData(), packets[ i ]->getSize(), timeTag );
+	}
+}
+
+void OscArchiveWriter::writeLocked( const void* data, size_t numBytes, uint64_t timeTag )
+{
+	if ( mFailed ) {
+		return;
+	}
+
+	size_t recordSize = sizeof( OscArchive::RecordHeader ) + ceil8( numBytes );
+	if ( mOffset + recordSize > mSegmentSize && mOffset > sizeof( OscArchive::SegmentHeader ) ) {
+		queueBlock( true );
+	}
+
+	OscArchive::RecordHeader header;
+	header.mTimeTag		= timeTag;
+	header.mSize		= static_cast<uint32_t>( numBytes );
+	header.mReserved	= 0;
+
+	size_t offset = mStaging.size();
+	mStaging.resize( offset + recordSize );
+
+	uint8_t* pStaging = mStaging.data() + offset;
+	memcpy( pStaging, &header, sizeof( header ) );
+	memcpy( pStaging + sizeof( header ), data, numBytes );
+	memset( pStaging + sizeof( header ) + numBytes, 0, recordSize - sizeof( header ) - numBytes );
+
+	const char* pPacket			= reinterpret_cast<const char*>( pStaging + sizeof( header ) );
+	const uint64_t packetOffset	= mOffset + sizeof( header );
+	walkPacket( pPacket, numBytes, timeTag, [ & ]( const char* message, size_t size, size_t addressLength, uint32_t hash, uint64_t messageTimeTag ) {
+		OscArchive::IndexEntry entry;
+		entry.mTimeTag	= messageTimeTag;
+		entry.mOffset	= packetOffset + ( message - pPacket );
+		entry.mSize		= static_cast<uint32_t>( size );
+		entry.mAddress	= getAddressIndex( message, addressLength, hash );
+		mEntries.push_back( entry );
+		++mNumMessages;
+	} );
+
+	mOffset += recordSize;
+	++mNumPackets;
+
+	if ( mStaging.size() >= kStagingSize ) {
+		queueBlock( false );
+	}
+}
+
+void OscArchiveWriter::queueBlock( bool seal )
+{
+	mBlocks.push_back( Block() );
+	Block& block		= mBlocks.back();
+	block.mSegment		= mSegment;
+	block.mSeal			= seal;
+	block.mSegmentSize	= mOffset;
+	block.mData.swap( mStaging );
+
+	if ( !mSpareStaging.empty() ) {
+		mStaging.swap( mSpareStaging.back() );
+		mSpareStaging.pop_back();
+	} else {
+		mStaging.reserve( kStagingSize * 2 );
+	}
+
+	if ( seal ) {
+		// the next segment starts with an index of its own
+		block.mEntries.swap( mEntries );
+		block.mAddresses.swap( mAddresses );
+		mAddressIndices.clear();
+		mUninternedAddresses.clear();
+		mOffset = sizeof( OscArchive::SegmentHeader );
+		++mSegment;
+	}
+
+	mWakeup.notify_one();
+}
+
+uint32_t OscArchiveWriter::getAddressIndex( const char* address, size_t length, uint32_t hash )
+{
+	uint32_t id = OscAddressTable::get().find( address, length, hash );
+	if ( id == OscAddressTable::kInvalidId ) {
+		auto iter = mUninternedAddresses.find( string( address, length ) );
+		if ( iter != mUninternedAddresses.end() ) {
+			return iter->second;
+		}
+		uint32_t index = static_cast<uint32_t>( mAddresses.size() );
+		mAddresses.push_back( string( address, length ) );
+		mUninternedAddresses[ mAddresses.back() ] = index;
+		return index;
+	}
+
+	if ( id >= mAddressIndices.size() ) {
+		mAddressIndices.resize( id + 1, static_cast<uint32_t>( OscAddressTable::kInvalidId ) );
+	}
+	if ( mAddressIndices[ id ] == OscAddressTable::kInvalidId ) {
+		mAddressIndices[ id ] = static_cast<uint32_t>( mAddresses.size() );
+		mAddresses.push_back( string( address, length ) );
+	}
+	return mAddressIndices[ id ];
+}
+
+void OscArchiveWriter::flush()
+{
+	unique_lock<mutex> lock( mMutex );
+	if ( !mStaging.empty() && !mFailed ) {
+		queueBlock( false );
+	}
+	uint64_t flush = ++mNumFlushesRequested;
+	mWakeup.notify_one();
+	mFlushed.wait( lock, [ & ]() { return mNumFlushesCompleted >= flush; } );
+}
+
+void OscArchiveWriter::run()
+{
+	unique_lock<mutex> lock( mMutex );
+	while ( true ) {
+		mWakeup.wait( lock, [ this ]() { return mStopped || !mBlocks.empty() || mNumFlushesRequested > mNumFlushesCompleted; } );
+
+		uint64_t numFlushesRequested	= mNumFlushesRequested;
+		bool stopped					= mStopped;
+		bool failed						= mFailed;
+		deque<Block> blocks;
+		blocks.swap( mBlocks );
+
+		// once the archive stopped, what was staged before is dropped too
+		lock.unlock();
+		bool written = true;
+		fs::path path;
+		for ( size_t i = 0; !failed && written && i < blocks.size(); ++i ) {
+			written = writeBlock( blocks[ i ], path );
+		}
+		if ( !failed && written && mFile != nullptr && numFlushesRequested > mNumFlushesCompleted ) {
+			path	= OscArchive::getSegmentPath( mDirectory, mFileSegment );
+			written	= fflush( mFile ) == 0;
+		}
+		lock.lock();
+
+		if ( !written ) {
+			fail( path );
+		}
+		for ( auto& block : blocks ) {
+			if ( mSpareStaging.size() < 2 ) {
+				block.mData.clear();
+				mSpareStaging.push_back( move( block.mData ) );
+			}
+		}
+		mNumFlushesCompleted = numFlushesRequested;
+		mFlushed.notify_all();
+
+		if ( stopped ) {
+			break;
+		}
+	}
+}
+
+bool OscArchiveWriter::writeBlock( Block& block, fs::path& path )
+{
+	if ( mFile == nullptr && !openSegment( block.mSegment, path ) ) {
+		return false;
+	}
+
+	path = OscArchive::getSegmentPath( mDirectory, block.mSegment );
+	if ( !block.mData.empty() && fwrite( block.mData.data(), 1, block.mData.size(), mFile ) != block.mData.size() ) {
+		return false;
+	}
+
+	return !block.mSeal || sealSegment( block, path );
+}
+
+void OscArchiveWriter::fail( const fs::path& path )
+{
+	// the disk is full or gone, keep what made it and drop the rest
+	CI_LOG_E( "Archive write to " << path << " failed, archiving stopped: " << strerror( errno ) );
+	mFailed = true;
+	mStaging.clear();
+	mEntries.clear();
+	mBlocks.clear();
+	if ( mFile != nullptr ) {
+		fclose( mFile );
+		mFile = nullptr;
+	}
+}
+
+size_t OscArchiveWriter::getNumPackets() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumPackets;
+}
+
+size_t OscArchiveWriter::getNumMessages() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumMessages;
+}
+
+size_t OscArchiveWriter::getNumSegments() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mSegment + 1;
+}
+
+bool OscArchiveWriter::isFailed() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mFailed;
+}
+
+OscArchiveReaderRef OscArchiveReader::create( const fs::path& directory )
+{
+	return make_shared<OscArchiveReader>( directory );
+}
+
+OscArchiveReader::OscArchiveReader( const fs::path& directory )
+{
+	size_t numSegments = 0;
+	while ( fs::exists( OscArchive::getSegmentPath( directory, numSegments ) ) ) {
+		++numSegments;
+	}
+
+	// segments are loaded in place, a rebuilt index must not move
+	mSegments.resize( numSegments );
+	for ( size_t i = 0; i < numSegments; ++i ) {
+		Segment& segment		= mSegments[ i ];
+		fs::path path			= OscArchive::getSegmentPath( directory, i );
+		segment.mFile			= OscMappedFile::create( path );
+		segment.mEntries		= nullptr;
+		segment.mNumEntries		= 0;
+		segment.mIndexRebuilt	= false;
+
+		if ( segment.mFile->getSize() < sizeof( OscArchive::SegmentHeader ) ) {
+			throw OscArchive::ExcInvalidArchive( path, "truncated header" );
+		}
+		const OscArchive::SegmentHeader* header = reinterpret_cast<const OscArchive::SegmentHeader*>( segment.mFile->getData() );
+		if ( memcmp( header->mMagic, kSegmentMagic, sizeof( kSegmentMagic ) ) != 0 ) {
+			throw OscArchive::ExcInvalidArchive( path, "bad magic" );
+		}
+		if ( header->mVersion != OscArchive::kVersion ) {
+			throw OscArchive::ExcInvalidArchive( path, "unsupported version " + toString( header->mVersion ) );
+		}
+		if ( header->mHeaderSize < sizeof( OscArchive::SegmentHeader ) || header->mHeaderSize % 8 != 0 ) {
+			throw OscArchive::ExcInvalidArchive( path, "bad header size " + toString( header->mHeaderSize ) );
+		}
+
+		if ( !loadIndex( segment, OscArchive::getIndexPath( path ) ) ) {
+			rebuildIndex( segment );
+		}
+
+		segment.mAddressIds.resize( segment.mAddresses.size() );
+		for ( size_t j = 0; j < segment.mAddresses.size(); ++j ) {
+			segment.mAddressIds[ j ] = OscAddressTable::get().find( segment.mAddresses[ j ] );
+		}
+	}
+}
+
+bool OscArchiveReader::loadIndex( Segment& segment, const fs::path& path )
+{
+	if ( !fs::exists( path ) ) {
+		return false;
+	}
+
+	try {
+		segment.mIndexFile = OscMappedFile::create( path );
+	} catch ( const OscMappedFile::ExcMapFailed& ) {
+		return false;
+	}
+
+	const uint8_t* data	= segment.mIndexFile->getData();
+	size_t size			= segment.mIndexFile->getSize();
+	if ( size < sizeof( OscArchive::IndexHeader ) ) {
+		return false;
+	}
+
+	// an index that doesn't match its segment is rebuilt
+	const OscArchive::IndexHeader* header = reinterpret_cast<const OscArchive::IndexHeader*>( data );
+	if ( memcmp( header->mMagic, kIndexMagic, sizeof( kIndexMagic ) ) != 0 || header->mVersion != OscArchive::kVersion ||
+		header->mSegmentSize != segment.mFile->getSize() ) {
+		return false;
+	}
+
+	size_t offset = sizeof( OscArchive::IndexHeader );
+	segment.mAddresses.clear();
+	for ( uint32_t i = 0; i < header->mNumAddresses; ++i ) {
+		uint32_t length;
+		if ( offset + 4 > size ) {
+			return false;
+		}
+		memcpy( &length, data + offset, 4 );
+		if ( length > size - offset - 4 ) {
+			return false;
+		}
+		segment.mAddresses.push_back( string( reinterpret_cast<const char*>( data + offset + 4 ), length ) );
+		offset += 4 + ceil4( length );
+	}
+	offset = ceil8( offset );
+
+	if ( offset > size || header->mNumEntries > ( size - offset ) / sizeof( OscArchive::IndexEntry ) ) {
+		return false;
+	}
+
+	// query() trusts the entries, so each has to be a message of the
+	// segment with an address in its table, in time tag order
+	const OscArchive::IndexEntry* entries	= reinterpret_cast<const OscArchive::IndexEntry*>( data + offset );
+	const size_t numEntries					= static_cast<size_t>( header->mNumEntries );
+	const uint64_t segmentSize				= segment.mFile->getSize();
+	const uint64_t headerSize				= reinterpret_cast<const OscArchive::SegmentHeader*>( segment.mFile->getData() )->mHeaderSize;
+	for ( size_t i = 0; i < numEntries; ++i ) {
+		const OscArchive::IndexEntry& entry = entries[ i ];
+		if ( entry.mOffset < headerSize + sizeof( OscArchive::RecordHeader ) || entry.mOffset > segmentSize || 
+			entry.mSize > segmentSize - entry.mOffset || entry.mAddress >= segment.mAddresses.size() || 
+			( i > 0 && entry.mTimeTag < entries[ i - 1 ].mTimeTag ) ) {
+			return false;
+		}
+	}
+
+	segment.mEntries	= entries;
+	segment.mNumEntries	= numEntries;
+
+	return true;
+}
+
+void OscArchiveReader::rebuildIndex( Segment& segment )
+{
+	segment.mIndexFile.reset();
+	segment.mRebuiltEntries.clear();
+	segment.mAddresses.clear();
+
+	unordered_map<string, uint32_t> addressIndices;
+
+	const uint8_t* data	= segment.mFile->getData();
+	size_t size			= segment.mFile->getSize();
+	size_t offset		= reinterpret_cast<const OscArchive::SegmentHeader*>( data )->mHeaderSize;
+
+	while ( offset + sizeof( OscArchive::RecordHeader ) <= size ) {
+		const OscArchive::RecordHeader* record = reinterpret_cast<const OscArchive::RecordHeader*>( data + offset );
+		if ( record->mSize > size - offset - sizeof( OscArchive::RecordHeader ) ) {
+			// truncated record at the end of a segment that was never sealed
+			break;
+		}
+
+		const char* pPacket = reinterpret_cast<const char*>( data + offset + sizeof( OscArchive::RecordHeader ) );
+		walkPacket( pPacket, record->mSize, record->mTimeTag, [ & ]( const char* message, size_t messageSize, size_t addressLength, uint32_t, uint64_t timeTag ) {
+			string address( message, addressLength );
+			auto iter = addressIndices.find( address );
+			if ( iter == addressIndices.end() ) {
+				iter = addressIndices.insert( make_pair( address, static_cast<uint32_t>( segment.mAddresses.size() ) ) ).first;
+				segment.mAddresses.push_back( address );
+			}
+
+			OscArchive::IndexEntry entry;
+			entry.mTimeTag	= timeTag;
+			entry.mOffset	= reinterpret_cast<const uint8_t*>( message ) - data;
+			entry.mSize		= static_cast<uint32_t>( messageSize );
+			entry.mAddress	= iter->second;
+			segment.mRebuiltEntries.push_back( entry );
+		} );
+
+		offset += sizeof( OscArchive::RecordHeader ) + ceil8( record->mSize );
+	}
+
+	stable_sort( segment.mRebuiltEntries.begin(), segment.mRebuiltEntries.end(), compareTimeTags );
+
+	segment.mEntries		= segment.mRebuiltEntries.data();
+	segment.mNumEntries		= segment.mRebuiltEntries.size();
+	segment.mIndexRebuilt	= true;
+}
+
+size_t OscArchiveReader::query( const string& pattern, OscTree::TimeTag begin, OscTree::TimeTag end, vector<Message>& messages ) const
+{
+	size_t first = messages.size();
+
+	vector<char> matches;
+	for ( const Segment& segment : mSegments ) {
+		if ( segment.mNumEntries == 0 || segment.mEntries[ 0 ].mTimeTag >= end.mTimeTag ||
+			segment.mEntries[ segment.mNumEntries - 1 ].mTimeTag < begin.mTimeTag ) {
+			continue;
+		}
+
+		// each address in the segment is matched once, not once per message
+		matches.assign( segment.mAddresses.size(), 0 );
+		bool any = false;
+		for ( size_t i = 0; i < segment.mAddresses.size(); ++i ) {
+			matches[ i ] = OscAddressTable::matchPattern( pattern.c_str(), segment.mAddresses[ i ].c_str() ) ? 1 : 0;
+			any = any || matches[ i ] != 0;
+		}
+		if ( !any ) {
+			continue;
+		}
+
+		OscArchive::IndexEntry key;
+		key.mTimeTag = begin.mTimeTag;
+		const OscArchive::IndexEntry* pEnd		= segment.mEntries + segment.mNumEntries;
+		const OscArchive::IndexEntry* pEntry	= lower_bound( segment.mEntries, pEnd, key, compareTimeTags );
+		for ( ; pEntry < pEnd && pEntry->mTimeTag < end.mTimeTag; ++pEntry ) {
+			if ( matches[ pEntry->mAddress ] == 0 ) {
+				continue;
+			}
+			Message message;
+			message.mTimeTag	= OscTree::TimeTag( pEntry->mTimeTag );
+			message.mAddressId	= segment.mAddressIds[ pEntry->mAddress ];
+			message.mData		= segment.mFile->getData() + pEntry->mOffset;
+			message.mSize		= pEntry->mSize;
+			messages.push_back( message );
+		}
+	}
+
+	// segments are in the order packets were written, which bundled time tags needn't follow
+	stable_sort( messages.begin() + first, messages.end(), []( const Message& a, const Message& b ) {
+		return a.mTimeTag.mTimeTag < b.mTimeTag.mTimeTag;
+	} );
+
+	return messages.size() - first;
+}
+
+size_t OscArchiveReader::getNumMessages() const
+{
+	size_t numMessages = 0;
+	for ( const Segment& segment : mSegments ) {
+		numMessages += segment.mNumEntries;
+	}
+	return numMessages;
+}
+
+size_t OscArchiveReader::getNumIndicesRebuilt() const
+{
+	size_t numRebuilt = 0;
+	for ( const Segment& segment : mSegments ) {
+		numRebuilt += segment.mIndexRebuilt ? 1 : 0;
+	}
+	return numRebuilt;
+}
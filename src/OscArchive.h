@@ -0,0 +1,284 @@
+//
+//  OscArchive.h
+//
+//	Long term storage of OSC traffic, queried by time and address
+//
+//	An archive is a directory of segments, each an append-only file
+//	of encoded packets laid out like a capture, with a sidecar index
+//	written when the segment is sealed. The index lists every message
+//	in the segment, bundles included, sorted by time tag, with the
+//	message's offset in the segment and its address as an index into
+//	the segment's own address table. A query for an address pattern
+//	between two time tags binary searches each segment's index and
+//	returns pointers to the messages in the memory mapped segments,
+//	without parsing or copying a single packet.
+//
+//	A message is indexed under the time tag of the bundle it came in,
+//	or the time it was written for a message on its own or in an
+//	immediate bundle.
+//
+//	Segment file layout ( segment-000000.osca ):
+//		SegmentHeader	magic "OSCARC1\0", version, header size, segment number
+//		Record			time tag, size, reserved, packet data
+//						padded with zeroes to a multiple of 8 bytes
+//		Record			...
+//
+//	Index file layout ( segment-000000.osca.idx ):
+//		IndexHeader		magic "OSCAIX1\0", version, number of addresses and
+//						messages, first and last time tag, segment size
+//		Address			length, characters padded with zeroes to a multiple of 4 bytes
+//		Address			...
+//		IndexEntry		time tag, offset of the message, size, address,
+//						starting at a multiple of 8 bytes
+//		IndexEntry		...
+//
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "cinder/Buffer.h"
+#include "cinder/Exception.h"
+#include "cinder/Filesystem.h"
+#include "OscMappedFile.h"
+#include "OscTree.h"
+
+class OscArchiveReader;
+class OscArchiveWriter;
+typedef std::shared_ptr<OscArchiveReader>	OscArchiveReaderRef;
+typedef std::shared_ptr<OscArchiveWriter>	OscArchiveWriterRef;
+
+namespace OscArchive
+{
+	struct SegmentHeader
+	{
+		char		mMagic[ 8 ];
+		uint32_t	mVersion;
+		uint32_t	mHeaderSize;
+		uint32_t	mSegment;
+		uint32_t	mReserved;
+	};
+
+	struct RecordHeader
+	{
+		//! Time tag the packet was written at
+		uint64_t	mTimeTag;
+		uint32_t	mSize;
+		uint32_t	mReserved;
+	};
+
+	struct IndexHeader
+	{
+		char		mMagic[ 8 ];
+		uint32_t	mVersion;
+		uint32_t	mNumAddresses;
+		uint64_t	mNumEntries;
+		uint64_t	mFirstTimeTag;
+		uint64_t	mLastTimeTag;
+		//! Size of the segment when it was sealed
+		uint64_t	mSegmentSize;
+	};
+
+	struct IndexEntry
+	{
+		uint64_t	mTimeTag;
+		//! Offset of the message in the segment
+		uint64_t	mOffset;
+		uint32_t	mSize;
+		//! Index into the segment's address table
+		uint32_t	mAddress;
+	};
+
+	static const uint32_t	kVersion	= 1;
+
+	//! Returns the path of segment \a segment of the archive in \a directory
+	ci::fs::path			getSegmentPath( const ci::fs::path& directory, size_t segment );
+	//! Returns the path of the sidecar index for the segment at \a path
+	ci::fs::path			getIndexPath( const ci::fs::path& path );
+
+	//! Converts a wall clock time to an OSC time tag, seconds since 1900 in 32.32 fixed point
+	OscTree::TimeTag		toTimeTag( std::chrono::system_clock::time_point time );
+
+	//! Base class for archive exceptions
+	class Exception : public ci::Exception
+	{
+	};
+
+	class ExcInvalidArchive : public Exception
+	{
+	public:
+		ExcInvalidArchive( const ci::fs::path& path, const std::string& reason );
+
+		virtual const char* what() const throw()
+		{
+			return mMessage.c_str();
+		}
+	protected:
+		std::string			mMessage;
+	};
+}
+
+//! Appends packets to an archive. Writes are staged in memory and
+//! handed in large blocks to a writer thread, and a packet is only
+//! walked as far as its message addresses to index it, so the writer
+//! keeps up with a full capture rate and callers never wait on the
+//! disk. Once a segment reaches its size the writer thread seals it:
+//! its index is sorted and written, and the next segment started. A
+//! failed write to disk is logged and stops the archive, later packets
+//! are dropped and the last segment is left for a reader to index.
+class OscArchiveWriter
+{
+public:
+	//! Creates a new archive in \a directory, replacing any segments already in it.
+	//! Segments are sealed once they hold \a segmentSize bytes of packets.
+	static OscArchiveWriterRef	create( const ci::fs::path& directory, size_t segmentSize = 64 * 1024 * 1024 );
+	//! Seals the last segment
+	~OscArchiveWriter();
+
+	//! Appends a packet, stamped with the current time
+	void						write( const void* data, size_t numBytes );
+	//! Appends a packet, stamped with \a timeTag, as when importing a capture
+	void						write( const void* data, size_t numBytes, OscTree::TimeTag timeTag );
+	//! Appends a packet, stamped with the current time
+	void						write( const ci::BufferRef& buffer );
+	//! Appends a message or bundle, stamped with the current time
+	void						write( const OscTree& tree );
+	//! Appends \a numPackets packets at once, all stamped with the current time
+	void						write( const ci::BufferRef* packets, size_t numPackets );
+	//! Writes all staged records to disk, blocks until they are. The current
+	//! segment's index is only written once it is sealed.
+	void						flush();
+
+	//! Returns the number of packets written so far
+	size_t						getNumPackets() const;
+	//! Returns the number of messages indexed so far, counting each message in a bundle
+	size_t						getNumMessages() const;
+	size_t						getNumSegments() const;
+	//! Returns true if a write to disk failed and the archive stopped
+	bool						isFailed() const;
+	const ci::fs::path&			getDirectory() const { return mDirectory; }
+
+	OscArchiveWriter( const ci::fs::path& directory, size_t segmentSize );
+protected:
+	OscArchiveWriter( const OscArchiveWriter& );
+	OscArchiveWriter&			operator=( const OscArchiveWriter& );
+
+	//! Records staged for the writer thread. The last block of a
+	//! segment carries the segment's index, and seals it once written.
+	struct Block
+	{
+		size_t								mSegment;
+		std::vector<uint8_t>				mData;
+		bool								mSeal;
+		uint64_t							mSegmentSize;
+		std::vector<OscArchive::IndexEntry>	mEntries;
+		std::vector<std::string>			mAddresses;
+	};
+
+	void						writeLocked( const void* data, size_t numBytes, uint64_t timeTag );
+	uint32_t					getAddressIndex( const char* address, size_t length, uint32_t hash );
+	//! Hands what is staged to the writer thread, sealing the segment if \a seal is true
+	void						queueBlock( bool seal );
+
+	//! Runs on the writer thread, writing each block handed to it
+	void						run();
+	//! The rest are called on the writer thread without the lock, or before it starts.
+	//! Each returns false if a write failed, with the path of the file in \a path.
+	bool						writeBlock( Block& block, ci::fs::path& path );
+	bool						openSegment( size_t segment, ci::fs::path& path );
+	bool						sealSegment( Block& block, ci::fs::path& path );
+	//! Called with the lock held
+	void						fail( const ci::fs::path& path );
+
+	mutable std::mutex			mMutex;
+	std::condition_variable		mWakeup;
+	std::condition_variable		mFlushed;
+	std::thread					mThread;
+	ci::fs::path				mDirectory;
+	size_t						mSegmentSize;
+	size_t						mSegment;
+	uint64_t					mOffset;
+	size_t						mNumPackets;
+	size_t						mNumMessages;
+	bool						mFailed;
+	bool						mStopped;
+	uint64_t					mNumFlushesRequested;
+	uint64_t					mNumFlushesCompleted;
+	std::vector<uint8_t>		mStaging;
+	std::deque<Block>			mBlocks;
+	// staging buffers the writer thread is done with, to stage into again
+	std::vector<std::vector<uint8_t>>	mSpareStaging;
+
+	// the current segment's index, handed to the writer when it is sealed
+	std::vector<OscArchive::IndexEntry>		mEntries;
+	std::vector<std::string>				mAddresses;
+	// segment address of every interned address ID, kInvalidId until it's seen
+	std::vector<uint32_t>					mAddressIndices;
+	// addresses that didn't fit in the address table
+	std::unordered_map<std::string, uint32_t>	mUninternedAddresses;
+
+	// only used by the writer thread once it's started
+	FILE*						mFile;
+	size_t						mFileSegment;
+};
+
+//! Reads an archive through memory mappings. Messages are returned
+//! as pointers into the mappings and are valid as long as the reader.
+class OscArchiveReader
+{
+public:
+	struct Message
+	{
+		OscTree::TimeTag		mTimeTag;
+		//! The interned ID of the message's address, see OscAddressTable. kInvalidId if
+		//! it was never interned, the address is also at the start of mData.
+		uint32_t				mAddressId;
+		const uint8_t*			mData;
+		uint32_t				mSize;
+
+		//! Returns a buffer over the message in place, OscTree( getBuffer() ) parses it
+		ci::BufferRef			getBuffer() const { return ci::Buffer::create( const_cast<uint8_t*>( mData ), mSize ); }
+	};
+
+	//! Opens the archive in \a directory. The index of a segment is rebuilt by
+	//! scanning it if it is missing, as for a segment that was never sealed,
+	//! or if any of its entries isn't a message of the segment.
+	static OscArchiveReaderRef	create( const ci::fs::path& directory );
+
+	//! Appends every message whose address matches \a pattern and whose time tag is
+	//! at least \a begin and before \a end to \a messages, in time tag order.
+	//! Returns the number of messages appended.
+	size_t						query( const std::string& pattern, OscTree::TimeTag begin, OscTree::TimeTag end, std::vector<Message>& messages ) const;
+
+	size_t						getNumSegments() const { return mSegments.size(); }
+	size_t						getNumMessages() const;
+	//! Returns the number of segments whose index had to be rebuilt
+	size_t						getNumIndicesRebuilt() const;
+
+	OscArchiveReader( const ci::fs::path& directory );
+protected:
+	struct Segment
+	{
+		OscMappedFileRef		mFile;
+		OscMappedFileRef		mIndexFile;
+		const OscArchive::IndexEntry*		mEntries;
+		size_t					mNumEntries;
+		std::vector<OscArchive::IndexEntry>	mRebuiltEntries;
+		//! The segment's address table, and the interned ID of each address
+		std::vector<std::string>	mAddresses;
+		std::vector<uint32_t>	mAddressIds;
+		bool					mIndexRebuilt;
+	};
+
+	bool						loadIndex( Segment& segment, const ci::fs::path& path );
+	void						rebuildIndex( Segment& segment );
+
+	std::vector<Segment>		mSegments;
+};
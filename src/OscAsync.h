@@ -0,0 +1,178 @@
+//
+//  OscAsync.h
+//
+//	C++20 coroutine interface to OSC transports
+//
+//		OscTask receive( OscReceiver& receiver )
+//		{
+//			for ( ;; ) {
+//				OscTree packet = co_await receiver.next();
+//				...
+//			}
+//		}
+//
+//	Receivers and senders run on their transport's executor, one
+//	thread can serve any number of endpoints. A packet that arrives
+//	while its receiver is busy is queued, and awaiting it later does
+//	not suspend. Only available when the compiler supports coroutines,
+//	OSC_HAS_COROUTINES is defined when it does.
+//
+
+#pragma once
+
+#if defined( __cpp_impl_coroutine ) && __cpp_impl_coroutine >= 201902L
+	#define OSC_HAS_COROUTINES
+#endif
+
+#if defined( OSC_HAS_COROUTINES )
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include "OscTransport.h"
+#include "OscTree.h"
+
+//! Return type for coroutines that run detached. The coroutine starts
+//! right away and frees itself once it finishes.
+struct OscTask
+{
+	struct promise_type
+	{
+		OscTask					get_return_object() { return OscTask(); }
+		std::suspend_never		initial_suspend() noexcept { return {}; }
+		std::suspend_never		final_suspend() noexcept { return {}; }
+		void					return_void() {}
+		void					unhandled_exception() { std::terminate(); }
+	};
+};
+
+//! Awaitable packets from a transport. Only one coroutine can wait on a receiver at a time.
+class OscReceiver
+{
+public:
+	struct PacketAwaitable
+	{
+		OscReceiver*			mReceiver;
+
+		bool					await_ready() const { return !mReceiver->mQueue.empty() || mReceiver->mClosed; }
+		void					await_suspend( std::coroutine_handle<> handle ) { mReceiver->mWaiter = handle; }
+		ci::BufferRef			await_resume() { return mReceiver->pop(); }
+	};
+
+	struct MessageAwaitable : PacketAwaitable
+	{
+		OscTree					await_resume()
+		{
+			ci::BufferRef packet = mReceiver->pop();
+			return packet ? OscTree( packet ) : OscTree();
+		}
+	};
+
+	explicit OscReceiver( const OscTransportRef& transport )
+		: mTransport( transport ), mClosed( false )
+	{
+		mTransport->setReceiveHandler( [ this ]( const ci::BufferRef& packet )
+		{
+			receive( packet );
+		} );
+	}
+
+	~OscReceiver()
+	{
+		mTransport->setReceiveHandler( nullptr );
+	}
+
+	//! Waits for the next packet and returns it parsed. Returns an empty OscTree once the receiver is closed.
+	MessageAwaitable			next() { return MessageAwaitable{ { this } }; }
+	//! Waits for the next packet and returns it as received, for callers that only look at part of it.
+	//! Returns nullptr once the receiver is closed.
+	PacketAwaitable				nextPacket() { return PacketAwaitable{ this }; }
+
+	//! Stops receiving and wakes a waiting coroutine. Packets already queued can still be read.
+	void						close()
+	{
+		mClosed = true;
+		mTransport->setReceiveHandler( nullptr );
+		wake();
+	}
+
+	bool						isClosed() const { return mClosed && mQueue.empty(); }
+	size_t						getNumQueued() const { return mQueue.size(); }
+
+protected:
+	OscReceiver( const OscReceiver& );
+	OscReceiver&				operator=( const OscReceiver& );
+
+	void						receive( const ci::BufferRef& packet )
+	{
+		mQueue.push_back( packet );
+		wake();
+	}
+
+	void						wake()
+	{
+		// resumed through the executor, so packets arriving in a burst
+		// are handed over in one batch rather than on the socket's stack
+		if ( mWaiter ) {
+			std::coroutine_handle<> waiter = mWaiter;
+			mWaiter = nullptr;
+			mTransport->getExecutor()->post( [ waiter ]()
+			{
+				waiter.resume();
+			} );
+		}
+	}
+
+	ci::BufferRef				pop()
+	{
+		ci::BufferRef packet;
+		if ( !mQueue.empty() ) {
+			packet = mQueue.front();
+			mQueue.pop_front();
+		}
+		return packet;
+	}
+
+	OscTransportRef				mTransport;
+	std::deque<ci::BufferRef>	mQueue;
+	std::coroutine_handle<>		mWaiter;
+	bool						mClosed;
+};
+
+//! Awaitable sends on a transport
+class OscSender
+{
+public:
+	struct SendAwaitable
+	{
+		OscTransportRef			mTransport;
+		ci::BufferRef			mPacket;
+		bool					mSent;
+
+		bool					await_ready() const { return false; }
+		void					await_suspend( std::coroutine_handle<> handle )
+		{
+			mTransport->send( mPacket, [ this, handle ]( bool sent )
+			{
+				mSent = sent;
+				handle.resume();
+			} );
+		}
+		bool					await_resume() const { return mSent; }
+	};
+
+	explicit OscSender( const OscTransportRef& transport )
+		: mTransport( transport )
+	{
+	}
+
+	//! Encodes \a tree and waits until it is sent. Returns false if sending failed.
+	SendAwaitable				send( const OscTree& tree ) { return SendAwaitable{ mTransport, tree.toBuffer(), false }; }
+	//! Waits until \a packet is sent. Returns false if sending failed.
+	SendAwaitable				send( const ci::BufferRef& packet ) { return SendAwaitable{ mTransport, packet, false }; }
+
+protected:
+	OscTransportRef				mTransport;
+};
+
+#endif
@@ -0,0 +1,221 @@
+//
+//  OscBatchDecoder.cpp
+//
+
+#include "OscBatchDecoder.h"
+#include <algorithm>
+
+#if defined( _MSC_VER )
+	#include <xmmintrin.h>
+	#define OSC_PREFETCH( address )		_mm_prefetch( reinterpret_cast<const char*>( address ), _MM_HINT_T0 )
+#else
+	#define OSC_PREFETCH( address )		__builtin_prefetch( address )
+#endif
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	inline size_t ceil4( size_t size )
+	{
+		return ( size + 3 ) & ~static_cast<size_t>( 3 );
+	}
+
+	// true if the string ending at \a p is padded with zeros up to the
+	// next multiple of four bytes from \a pBlockBegin, inside the block
+	bool isZeroPadded( const char* pBlockBegin, const char* p, const char* pBlockEnd )
+	{
+		const char* q = pBlockBegin + ceil4( p - pBlockBegin );
+		if ( q > pBlockEnd ) {
+			return false;
+		}
+		for ( ; p < q; ++p ) {
+			if ( *p != 0 ) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+OscMessageBatch::OscMessageBatch()
+{
+	mFirstArguments.push_back( 0 );
+}
+
+void OscMessageBatch::clear()
+{
+	mPackets.clear();
+	mParseErrors.clear();
+	mAddressIds.clear();
+	mAddresses.clear();
+	mPacketIndices.clear();
+	mTimeTags.clear();
+	mTypeTags.clear();
+	mFirstArguments.resize( 1 );
+	mArgumentTypeTags.clear();
+	mArgumentData.clear();
+	mArgumentSizes.clear();
+}
+
+OscBatchDecoder::OscBatchDecoder()
+{
+}
+
+size_t OscBatchDecoder::decode( const vector<BufferRef>& packets, OscMessageBatch& batch )
+{
+	return decode( packets.data(), packets.size(), batch );
+}
+
+size_t OscBatchDecoder::decode( const BufferRef* packets, size_t numPackets, OscMessageBatch& batch )
+{
+	size_t numDecoded = 0;
+	for ( size_t i = 0; i < numPackets; ++i ) {
+		// the next packet is fetched while this one is parsed
+		if ( i + 1 < numPackets ) {
+			OSC_PREFETCH( packets[ i + 1 ]->getData() );
+		}
+
+		const BufferRef& packet	= packets[ i ];
+		uint32_t packetIndex	= static_cast<uint32_t>( batch.mPackets.size() );
+		batch.mPackets.push_back( packet );
+
+		// a packet that fails to parse leaves no messages behind
+		size_t numMessages		= batch.mAddressIds.size();
+		size_t numArguments		= batch.mArgumentData.size();
+
+		OscTree::ParseError error = decodePacket( static_cast<const char*>( packet->getData() ), packet->getSize(), packetIndex, batch );
+		batch.mParseErrors.push_back( error );
+
+		if ( error == OscTree::PARSE_OK ) {
+			++numDecoded;
+		} else {
+			batch.mAddressIds.resize( numMessages );
+			batch.mAddresses.resize( numMessages );
+			batch.mPacketIndices.resize( numMessages );
+			batch.mTimeTags.resize( numMessages );
+			batch.mTypeTags.resize( numMessages );
+			batch.mFirstArguments.resize( numMessages + 1 );
+			batch.mArgumentTypeTags.resize( numArguments );
+			batch.mArgumentData.resize( numArguments );
+			batch.mArgumentSizes.resize( numArguments );
+		}
+	}
+
+	return numDecoded;
+}
+
+OscTree::ParseError OscBatchDecoder::decodePacket( const char* data, size_t size, uint32_t packetIndex, OscMessageBatch& batch )
+{
+	mStack.clear();
+	Element root = { data, size, OscTree::TimeTag().mTimeTag };
+	mStack.push_back( root );
+
+	while ( !mStack.empty() ) {
+		Element element = mStack.back();
+		mStack.pop_back();
+
+		if ( element.mSize == 0 || element.mData[ 0 ] != '#' ) {
+			OscTree::ParseError error = decodeMessage( element, packetIndex, batch );
+			if ( error != OscTree::PARSE_OK ) {
+				return error;
+			}
+			continue;
+		}
+
+		if ( element.mSize < 16 || memcmp( element.mData, "#bundle", 8 ) != 0 ) {
+			return OscTree::PARSE_MALFORMED_BUNDLE;
+		}
+
+		uint64_t timeTag;
+		memcpy( &timeTag, element.mData + 8, 8 );
+
+		// elements are pushed in order and then reversed, so they come off the stack in order
+		size_t first			= mStack.size();
+		const char* pBlockEnd	= element.mData + element.mSize;
+		const char* pBegin		= element.mData + 16;
+		while ( pBegin < pBlockEnd ) {
+			int32_t elementSize = -1;
+			if ( pBlockEnd - pBegin >= 4 ) {
+				memcpy( &elementSize, pBegin, 4 );
+			}
+			if ( elementSize < 0 || elementSize > pBlockEnd - pBegin - 4 ) {
+				return OscTree::PARSE_TRUNCATED;
+			}
+
+			Element child = { pBegin + 4, static_cast<size_t>( elementSize ), timeTag };
+			mStack.push_back( child );
+			pBegin += 4 + elementSize;
+		}
+		reverse( mStack.begin() + first, mStack.end() );
+	}
+
+	return OscTree::PARSE_OK;
+}
+
+OscTree::ParseError OscBatchDecoder::decodeMessage( const Element& element, uint32_t packetIndex, OscMessageBatch& batch )
+{
+	const char* data		= element.mData;
+	const char* pBlockEnd	= data + element.mSize;
+
+	// the address is hashed while looking for its terminator, as OscTree does
+	uint32_t hash		= OscAddressTable::kHashOffset;
+	const char* pEnd	= data;
+	while ( pEnd < pBlockEnd && *pEnd != 0 ) {
+		hash = ( hash ^ static_cast<uint8_t>( *pEnd ) ) * OscAddressTable::kHashPrime;
+		++pEnd;
+	}
+	if ( pEnd == pBlockEnd || *data != '/' || !isZeroPadded( data, pEnd + 1, pBlockEnd ) ) {
+		return OscTree::PARSE_MALFORMED_ADDRESS;
+	}
+
+	// received addresses are looked up rather than interned, a message
+	// for an unknown one keeps its place, along with the rest of the packet
+	OscTree::StringView address( data, pEnd - data );
+	uint32_t addressId = OscAddressTable::get().find( data, pEnd - data, hash );
+
+	const char* pBegin	= data + ceil4( pEnd + 1 - data );
+	pEnd				= pBegin < pBlockEnd ? static_cast<const char*>( memchr( pBegin, 0, pBlockEnd - pBegin ) ) : nullptr;
+	if ( pEnd == nullptr || *pBegin != ',' || !isZeroPadded( data, pEnd + 1, pBlockEnd ) ) {
+		return OscTree::PARSE_MALFORMED_TYPE_TAGS;
+	}
+
+	const char* pTypeTags		= pBegin + 1;
+	const char* pTypeTagsEnd	= pEnd;
+	pBegin = data + ceil4( pEnd + 1 - data );
+
+	for ( const char* pTypeTag = pTypeTags; pTypeTag < pTypeTagsEnd; ++pTypeTag ) {
+		const OscTree::TypeTag typeTag		= static_cast<OscTree::TypeTag>( *pTypeTag );
+		const OscTree::TypeTagCodec& codec	= OscTree::getTypeTagCodec( typeTag );
+		size_t available					= pBegin < pBlockEnd ? pBlockEnd - pBegin : 0;
+
+		ptrdiff_t sz = codec.mSize( pBegin, available );
+		if ( sz < 0 ) {
+			return static_cast<OscTree::ParseError>( -sz );
+		}
+
+		// a codec with a value offset, like a blob, keeps its length in front of the value
+		uint32_t size = static_cast<uint32_t>( sz );
+		if ( codec.mValueOffset > 0 ) {
+			int32_t valueSize;
+			memcpy( &valueSize, pBegin, sizeof( valueSize ) );
+			size = static_cast<uint32_t>( valueSize );
+		}
+
+		batch.mArgumentTypeTags.push_back( *pTypeTag );
+		batch.mArgumentData.push_back( sz > 0 ? reinterpret_cast<const uint8_t*>( pBegin + codec.mValueOffset ) : nullptr );
+		batch.mArgumentSizes.push_back( size );
+
+		pBegin += sz;
+	}
+
+	batch.mAddressIds.push_back( addressId );
+	batch.mAddresses.push_back( address );
+	batch.mPacketIndices.push_back( packetIndex );
+	batch.mTimeTags.push_back( element.mTimeTag );
+	batch.mTypeTags.push_back( pTypeTags );
+	batch.mFirstArguments.push_back( static_cast<uint32_t>( batch.mArgumentData.size() ) );
+
+	return OscTree::PARSE_OK;
+}
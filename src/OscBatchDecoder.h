@@ -0,0 +1,132 @@
+//
+//  OscBatchDecoder.h
+//
+//	Decodes many packets at once into flat arrays
+//
+//	Parsing a packet into an OscTree allocates a tree, a vector of
+//	children and a buffer per argument. A receiver that drains dozens
+//	of datagrams per wakeup can instead decode them all in one pass
+//	into an OscMessageBatch, which keeps the packets and records each
+//	message and argument as entries in parallel arrays, pointing into
+//	the packets rather than copying out of them. The arrays keep
+//	their capacity between batches, so a warmed up decoder does not
+//	allocate at all. Blob sizes and bundle element sizes are read in
+//	this machine's byte order, as OscTree encodes them.
+//
+//		OscMessageBatch batch;
+//		decoder.decode( packets.data(), packets.size(), batch );
+//		for ( size_t i = 0; i < batch.getNumMessages(); ++i ) {
+//			if ( batch.getAddressId( i ) == faderId ) {
+//				float value = batch.get<float>( batch.getFirstArgument( i ) );
+//			}
+//		}
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "cinder/Buffer.h"
+#include "OscTree.h"
+
+//! Messages decoded by OscBatchDecoder, as a struct of arrays. Message i has the
+//! arguments from getFirstArgument( i ) up to getFirstArgument( i + 1 ).
+class OscMessageBatch
+{
+public:
+	OscMessageBatch();
+
+	//! Removes every message and releases the packets, keeping the arrays' capacity
+	void						clear();
+
+	size_t						getNumPackets() const { return mPackets.size(); }
+	size_t						getNumMessages() const { return mAddressIds.size(); }
+	size_t						getNumArguments() const { return mArgumentData.size(); }
+
+	const ci::BufferRef&		getPacket( size_t packet ) const { return mPackets[ packet ]; }
+	//! Returns why a packet failed to parse, its messages are left out of the batch
+	OscTree::ParseError			getParseError( size_t packet ) const { return mParseErrors[ packet ]; }
+
+	//! Returns the interned address ID of a message, see OscAddressTable. OscAddressTable::kInvalidId
+	//! for an address that was never interned, as received addresses are only looked up.
+	uint32_t					getAddressId( size_t message ) const { return mAddressIds[ message ]; }
+	//! Returns the address of a message where it lies in its packet, interned or not
+	OscTree::StringView			getAddress( size_t message ) const { return mAddresses[ message ]; }
+	//! Returns the index of the packet a message came from
+	uint32_t					getPacketIndex( size_t message ) const { return mPacketIndices[ message ]; }
+	//! Returns the time tag of the bundle a message came in, TimeTag() for a message on its own
+	OscTree::TimeTag			getTimeTag( size_t message ) const { return OscTree::TimeTag( mTimeTags[ message ] ); }
+	//! Returns the index of the first argument of a message, valid up to getNumMessages()
+	uint32_t					getFirstArgument( size_t message ) const { return mFirstArguments[ message ]; }
+	size_t						getNumArguments( size_t message ) const { return mFirstArguments[ message + 1 ] - mFirstArguments[ message ]; }
+	//! Returns the type tags of a message where they lie in its packet, without the leading comma
+	OscTree::StringView			getTypeTags( size_t message ) const { return OscTree::StringView( mTypeTags[ message ], getNumArguments( message ) ); }
+
+	OscTree::TypeTag			getTypeTag( size_t argument ) const { return mArgumentTypeTags[ argument ]; }
+	//! Returns the value of an argument where it lies in its packet. Strings are null terminated,
+	//! arguments without a value such as T and F have no data.
+	const uint8_t*				getArgumentData( size_t argument ) const { return mArgumentData[ argument ]; }
+	//! Returns the size of a value in bytes, the length of a blob, padding included for a string
+	uint32_t					getArgumentSize( size_t argument ) const { return mArgumentSizes[ argument ]; }
+	//! Copies a fixed size argument out of its packet, as OscTree::getValue() does. The type tag is not checked.
+	template<typename T>
+	T							get( size_t argument ) const
+	{
+		T value;
+		memcpy( &value, mArgumentData[ argument ], sizeof( T ) );
+		return value;
+	}
+
+	//! The arrays themselves, for consumers that sweep one field across every message
+	const std::vector<uint32_t>&		getAddressIds() const { return mAddressIds; }
+	const std::vector<uint32_t>&		getFirstArguments() const { return mFirstArguments; }
+	const std::vector<char>&			getArgumentTypeTags() const { return mArgumentTypeTags; }
+	const std::vector<const uint8_t*>&	getArgumentData() const { return mArgumentData; }
+	const std::vector<uint32_t>&		getArgumentSizes() const { return mArgumentSizes; }
+
+protected:
+	friend class OscBatchDecoder;
+
+	std::vector<ci::BufferRef>			mPackets;
+	std::vector<OscTree::ParseError>	mParseErrors;
+
+	// one per message, mFirstArguments has one more to end the last message
+	std::vector<uint32_t>				mAddressIds;
+	std::vector<OscTree::StringView>	mAddresses;
+	std::vector<uint32_t>				mPacketIndices;
+	std::vector<uint64_t>				mTimeTags;
+	std::vector<const char*>			mTypeTags;
+	std::vector<uint32_t>				mFirstArguments;
+
+	// one per argument, the type tags of a message are contiguous
+	std::vector<char>					mArgumentTypeTags;
+	std::vector<const uint8_t*>			mArgumentData;
+	std::vector<uint32_t>				mArgumentSizes;
+};
+
+class OscBatchDecoder
+{
+public:
+	OscBatchDecoder();
+
+	//! Decodes \a numPackets packets into \a batch, after any messages already in it.
+	//! Returns the number of packets that parsed without errors. Addresses are only
+	//! looked up, a message for one that was never interned is kept with kInvalidId.
+	size_t						decode( const ci::BufferRef* packets, size_t numPackets, OscMessageBatch& batch );
+	size_t						decode( const std::vector<ci::BufferRef>& packets, OscMessageBatch& batch );
+
+protected:
+	struct Element
+	{
+		const char*				mData;
+		size_t					mSize;
+		uint64_t				mTimeTag;
+	};
+
+	OscTree::ParseError			decodePacket( const char* data, size_t size, uint32_t packetIndex, OscMessageBatch& batch );
+	OscTree::ParseError			decodeMessage( const Element& element, uint32_t packetIndex, OscMessageBatch& batch );
+
+	// bundles are walked with an explicit stack that is reused between packets
+	std::vector<Element>		mStack;
+};
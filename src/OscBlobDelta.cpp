@@ -0,0 +1,319 @@
+//
+//  OscBlobDelta.cpp
+//
+
+#include "OscBlobDelta.h"
+#include "OscAddressTable.h"
+#include <cstring>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+	#include <emmintrin.h>
+	#define OSC_SSE2
+#endif
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	// Blobs are compared in blocks of this many bytes
+	const size_t	kBlockSize	= 16;
+
+	uint64_t getStreamKey( uint32_t addressId, size_t argument )
+	{
+		return ( static_cast<uint64_t>( addressId ) << 32 ) | static_cast<uint32_t>( argument );
+	}
+
+	// XORs a block of \a next with \a previous into \a out and copies it to \a previous.
+	// Returns false, and writes nothing, if the block didn't change.
+	inline bool diffBlock( const uint8_t* next, uint8_t* previous, uint8_t* out )
+	{
+#if defined( OSC_SSE2 )
+		__m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( next ) );
+		__m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( previous ) );
+		__m128i x = _mm_xor_si128( a, b );
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi8( x, _mm_setzero_si128() ) ) == 0xFFFF ) {
+			return false;
+		}
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( out ), x );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( previous ), a );
+#else
+		uint64_t a[ 2 ], b[ 2 ];
+		memcpy( a, next, kBlockSize );
+		memcpy( b, previous, kBlockSize );
+		uint64_t x[ 2 ] = { a[ 0 ] ^ b[ 0 ], a[ 1 ] ^ b[ 1 ] };
+		if ( ( x[ 0 ] | x[ 1 ] ) == 0 ) {
+			return false;
+		}
+		memcpy( out, x, kBlockSize );
+		memcpy( previous, a, kBlockSize );
+#endif
+		return true;
+	}
+
+	// XORs \a size bytes of \a run into \a frame
+	inline void applyRun( uint8_t* frame, const uint8_t* run, size_t size )
+	{
+		size_t i = 0;
+#if defined( OSC_SSE2 )
+		for ( ; i + kBlockSize <= size; i += kBlockSize ) {
+			__m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( frame + i ) );
+			__m128i x = _mm_loadu_si128( reinterpret_cast<const __m128i*>( run + i ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( frame + i ), _mm_xor_si128( a, x ) );
+		}
+#endif
+		for ( ; i < size; ++i ) {
+			frame[ i ] ^= run[ i ];
+		}
+	}
+
+	// Writes the runs of changed blocks between \a previous and \a next to \a out,
+	// and updates \a previous to \a next. Returns the number of bytes written.
+	size_t diffFrames( const uint8_t* next, uint8_t* previous, size_t size, uint8_t* out )
+	{
+		uint8_t* pOut	= out;
+		uint8_t* pRun	= nullptr;
+		size_t runBegin	= 0;
+
+		auto closeRun = [ & ]()
+		{
+			if ( pRun != nullptr ) {
+				OscBlobDelta::RunHeader run = { static_cast<uint32_t>( runBegin ), static_cast<uint32_t>( pOut - pRun - sizeof( run ) ) };
+				memcpy( pRun, &run, sizeof( run ) );
+				pRun = nullptr;
+			}
+		};
+
+		size_t i = 0;
+		for ( ; i + kBlockSize <= size; i += kBlockSize ) {
+			uint8_t* pBlock = pRun != nullptr ? pOut : pOut + sizeof( OscBlobDelta::RunHeader );
+			if ( !diffBlock( next + i, previous + i, pBlock ) ) {
+				closeRun();
+				continue;
+			}
+			if ( pRun == nullptr ) {
+				pRun		= pOut;
+				runBegin	= i;
+			}
+			pOut = pBlock + kBlockSize;
+		}
+
+		// the last bytes of a blob that isn't a multiple of the block size
+		if ( i < size && memcmp( next + i, previous + i, size - i ) != 0 ) {
+			if ( pRun == nullptr ) {
+				pRun		= pOut;
+				runBegin	= i;
+				pOut		+= sizeof( OscBlobDelta::RunHeader );
+			}
+			for ( ; i < size; ++i ) {
+				*pOut++			= next[ i ] ^ previous[ i ];
+				previous[ i ]	= next[ i ];
+			}
+		}
+		closeRun();
+
+		return pOut - out;
+	}
+}
+
+void OscBlobDelta::registerTypeTag( OscTree::TypeTag typeTag )
+{
+	OscTree::registerTypeTag( typeTag, OscTree::getTypeTagCodec( 'b' ) );
+}
+
+OscBlobDeltaEncoderRef OscBlobDeltaEncoder::create( size_t minSize, OscTree::TypeTag typeTag )
+{
+	return make_shared<OscBlobDeltaEncoder>( minSize, typeTag );
+}
+
+OscBlobDeltaEncoder::OscBlobDeltaEncoder( size_t minSize, OscTree::TypeTag typeTag )
+	: mMinSize( minSize ), mTypeTag( typeTag ), mKeyframeInterval( 30 ), mNumKeyframes( 0 ),
+	mNumDifferences( 0 ), mNumBytesIn( 0 ), mNumBytesOut( 0 )
+{
+	OscBlobDelta::registerTypeTag( typeTag );
+}
+
+void OscBlobDeltaEncoder::encode( OscTree& message )
+{
+	// streams are told apart by address, a message without an ID has none
+	if ( !message.isMessage() || message.getAddressId() == OscAddressTable::kInvalidId ) {
+		return;
+	}
+
+	for ( size_t i = 0; i < message.getNumChildren(); ++i ) {
+		OscTree& child = message.getChild( i );
+		const BufferRef& value = child.getValue();
+		if ( child.getTypeTag() != 'b' || !value || value->getSize() < mMinSize ) {
+			continue;
+		}
+
+		uint64_t key	= getStreamKey( message.getAddressId(), i );
+		auto iter		= mStreams.find( key );
+		if ( iter == mStreams.end() ) {
+			Stream stream;
+			stream.mSequence			= 0;
+			stream.mFramesSinceKeyframe	= 0;
+			stream.mForceKeyframe		= true;
+			iter = mStreams.insert( make_pair( key, stream ) ).first;
+		}
+
+		BufferRef frame = encodeFrame( iter->second, static_cast<const uint8_t*>( value->getData() ), value->getSize() );
+		child = OscTree::makeBlobRef( frame, mTypeTag );
+	}
+}
+
+BufferRef OscBlobDeltaEncoder::encodeFrame( Stream& stream, const uint8_t* data, size_t size )
+{
+	OscBlobDelta::FrameHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.mSequence		= stream.mSequence + 1;
+	header.mBaseSequence	= stream.mSequence;
+	header.mSize			= static_cast<uint32_t>( size );
+
+	bool keyframe = stream.mForceKeyframe || stream.mFrame.size() != size || stream.mFramesSinceKeyframe + 1 >= mKeyframeInterval;
+
+	// a run is at least a block and a header, and runs are a block apart
+	size_t numBytes = 0;
+	if ( !keyframe ) {
+		mScratch.resize( size + size / 4 + kBlockSize + sizeof( OscBlobDelta::RunHeader ) * 2 );
+		numBytes = diffFrames( data, stream.mFrame.data(), size, mScratch.data() );
+		keyframe = numBytes >= size;
+	}
+
+	BufferRef frame;
+	if ( keyframe ) {
+		header.mKind = OscBlobDelta::FRAME_KEY;
+		frame = Buffer::create( sizeof( header ) + size );
+		memcpy( static_cast<uint8_t*>( frame->getData() ) + sizeof( header ), data, size );
+		stream.mFrame.assign( data, data + size );
+		stream.mFramesSinceKeyframe	= 0;
+		stream.mForceKeyframe		= false;
+		++mNumKeyframes;
+	} else {
+		header.mKind = OscBlobDelta::FRAME_DIFFERENCE;
+		frame = Buffer::create( sizeof( header ) + numBytes );
+		memcpy( static_cast<uint8_t*>( frame->getData() ) + sizeof( header ), mScratch.data(), numBytes );
+		++stream.mFramesSinceKeyframe;
+		++mNumDifferences;
+	}
+	memcpy( frame->getData(), &header, sizeof( header ) );
+	stream.mSequence = header.mSequence;
+
+	mNumBytesIn		+= size;
+	mNumBytesOut	+= frame->getSize();
+
+	return frame;
+}
+
+void OscBlobDeltaEncoder::forceKeyframes()
+{
+	for ( auto& stream : mStreams ) {
+		stream.second.mForceKeyframe = true;
+	}
+}
+
+OscBlobDeltaDecoderRef OscBlobDeltaDecoder::create( OscTree::TypeTag typeTag )
+{
+	return make_shared<OscBlobDeltaDecoder>( typeTag );
+}
+
+OscBlobDeltaDecoder::OscBlobDeltaDecoder( OscTree::TypeTag typeTag )
+	: mTypeTag( typeTag ), mNumMissed( 0 )
+{
+	OscBlobDelta::registerTypeTag( typeTag );
+}
+
+bool OscBlobDeltaDecoder::decode( OscTree& message )
+{
+	if ( !message.isMessage() ) {
+		return true;
+	}
+
+	bool decoded = true;
+	for ( size_t i = 0; i < message.getNumChildren(); ++i ) {
+		OscTree& child = message.getChild( i );
+		const BufferRef& value = child.getValue();
+		if ( child.getTypeTag() != mTypeTag || !value ) {
+			continue;
+		}
+
+		uint64_t key	= getStreamKey( message.getAddressId(), i );
+		auto iter		= mStreams.find( key );
+		if ( iter == mStreams.end() ) {
+			Stream stream;
+			stream.mSequence	= 0;
+			stream.mValid		= false;
+			iter = mStreams.insert( make_pair( key, stream ) ).first;
+		}
+
+		Stream& stream = iter->second;
+		if ( message.getAddressId() == OscAddressTable::kInvalidId ||
+			!decodeFrame( stream, static_cast<const uint8_t*>( value->getData() ), value->getSize() ) ) {
+			++mNumMissed;
+			decoded = false;
+			continue;
+		}
+		child = OscTree::makeBlobRef( stream.mFrame );
+	}
+
+	return decoded;
+}
+
+bool OscBlobDeltaDecoder::decodeFrame( Stream& stream, const uint8_t* data, size_t size )
+{
+	OscBlobDelta::FrameHeader header;
+	if ( size < sizeof( header ) ) {
+		return false;
+	}
+	memcpy( &header, data, sizeof( header ) );
+	data += sizeof( header );
+	size -= sizeof( header );
+
+	if ( header.mKind == OscBlobDelta::FRAME_KEY ) {
+		if ( size != header.mSize ) {
+			return false;
+		}
+		// a frame someone still holds is left to them
+		if ( !stream.mFrame || !stream.mFrame.unique() || stream.mFrame->getSize() != size ) {
+			stream.mFrame = Buffer::create( size );
+		}
+		memcpy( stream.mFrame->getData(), data, size );
+		stream.mSequence	= header.mSequence;
+		stream.mValid		= true;
+		return true;
+	}
+
+	// a difference only applies to the frame it was made from
+	if ( header.mKind != OscBlobDelta::FRAME_DIFFERENCE || !stream.mValid || header.mBaseSequence != stream.mSequence ||
+		stream.mFrame->getSize() != header.mSize ) {
+		stream.mValid = false;
+		return false;
+	}
+
+	if ( !stream.mFrame.unique() ) {
+		BufferRef frame = Buffer::create( header.mSize );
+		memcpy( frame->getData(), stream.mFrame->getData(), header.mSize );
+		stream.mFrame = frame;
+	}
+
+	uint8_t* frame = static_cast<uint8_t*>( stream.mFrame->getData() );
+	for ( size_t offset = 0; offset < size; ) {
+		OscBlobDelta::RunHeader run;
+		if ( size - offset < sizeof( run ) ) {
+			stream.mValid = false;
+			return false;
+		}
+		memcpy( &run, data + offset, sizeof( run ) );
+		offset += sizeof( run );
+
+		if ( run.mSize > size - offset || run.mOffset > header.mSize || run.mSize > header.mSize - run.mOffset ) {
+			stream.mValid = false;
+			return false;
+		}
+		applyRun( frame + run.mOffset, data + offset, run.mSize );
+		offset += run.mSize;
+	}
+	stream.mSequence = header.mSequence;
+
+	return true;
+}
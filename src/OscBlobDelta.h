@@ -0,0 +1,155 @@
+//
+//  OscBlobDelta.h
+//
+//	Sends streams of large, slowly changing blobs as differences
+//
+//	A stream is one blob argument of the messages sent to an address,
+//	like a sensor image or texture sent every frame. The encoder keeps
+//	the last frame of each stream, and replaces each new blob with the
+//	XOR of the changed 16-byte blocks, skipping the unchanged ones, in
+//	an argument tagged 'x'. The decoder XORs the blocks into its own
+//	copy of the frame and hands it back as an ordinary blob, without
+//	copying it. A keyframe with the whole blob is sent every so often,
+//	when the size changes, and whenever a difference would be larger,
+//	so a receiver that lost a difference recovers at the next one.
+//
+//	Frame layout, the value of an 'x' blob:
+//		FrameHeader	kind, sequence, sequence it applies to, blob size
+//		Keyframe	the whole blob
+//		Difference	Run			offset, size, XOR of the run's bytes
+//					Run			...
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "cinder/Buffer.h"
+#include "OscTree.h"
+
+class OscBlobDeltaEncoder;
+class OscBlobDeltaDecoder;
+typedef std::shared_ptr<OscBlobDeltaEncoder>	OscBlobDeltaEncoderRef;
+typedef std::shared_ptr<OscBlobDeltaDecoder>	OscBlobDeltaDecoderRef;
+
+namespace OscBlobDelta
+{
+	enum FrameKind : uint8_t
+	{
+		FRAME_KEY,
+		FRAME_DIFFERENCE
+	};
+
+	struct FrameHeader
+	{
+		FrameKind	mKind;
+		uint8_t		mReserved[ 3 ];
+		uint32_t	mSequence;
+		//! The sequence of the frame a difference applies to
+		uint32_t	mBaseSequence;
+		//! Size of the whole blob
+		uint32_t	mSize;
+	};
+
+	struct RunHeader
+	{
+		uint32_t	mOffset;
+		uint32_t	mSize;
+	};
+
+	//! The type tag delta frames are sent with
+	static const OscTree::TypeTag	kTypeTag	= 'x';
+
+	//! Registers \a typeTag with the parser as a blob. Done by the encoder and
+	//! decoder when they are created, which has to be before parsing starts.
+	void				registerTypeTag( OscTree::TypeTag typeTag = kTypeTag );
+}
+
+//! Not thread safe, encode from one thread at a time
+class OscBlobDeltaEncoder
+{
+public:
+	//! Blobs smaller than \a minSize are left as they are
+	static OscBlobDeltaEncoderRef	create( size_t minSize = 1024, OscTree::TypeTag typeTag = OscBlobDelta::kTypeTag );
+
+	//! Replaces every blob of at least the minimum size in \a message with a frame of its stream
+	void					encode( OscTree& message );
+
+	//! Sends a keyframe every \a interval frames of a stream, 30 by default
+	void					setKeyframeInterval( uint32_t interval ) { mKeyframeInterval = interval; }
+	//! Sends a keyframe for the next frame of every stream, as when a receiver joins
+	void					forceKeyframes();
+
+	uint64_t				getNumKeyframes() const { return mNumKeyframes; }
+	uint64_t				getNumDifferences() const { return mNumDifferences; }
+	//! Returns the size of the blobs encoded so far
+	uint64_t				getNumBytesIn() const { return mNumBytesIn; }
+	//! Returns the size of the frames they were encoded as
+	uint64_t				getNumBytesOut() const { return mNumBytesOut; }
+
+	OscBlobDeltaEncoder( size_t minSize, OscTree::TypeTag typeTag );
+protected:
+	OscBlobDeltaEncoder( const OscBlobDeltaEncoder& );
+	OscBlobDeltaEncoder&	operator=( const OscBlobDeltaEncoder& );
+
+	struct Stream
+	{
+		std::vector<uint8_t>	mFrame;
+		uint32_t				mSequence;
+		uint32_t				mFramesSinceKeyframe;
+		bool					mForceKeyframe;
+	};
+
+	ci::BufferRef			encodeFrame( Stream& stream, const uint8_t* data, size_t size );
+
+	size_t					mMinSize;
+	OscTree::TypeTag		mTypeTag;
+	uint32_t				mKeyframeInterval;
+	// keyed by address ID and argument index
+	std::unordered_map<uint64_t, Stream>	mStreams;
+	// differences are written here first, in case a keyframe turns out smaller
+	std::vector<uint8_t>	mScratch;
+
+	uint64_t				mNumKeyframes;
+	uint64_t				mNumDifferences;
+	uint64_t				mNumBytesIn;
+	uint64_t				mNumBytesOut;
+};
+
+//! Not thread safe, decode from one thread at a time
+class OscBlobDeltaDecoder
+{
+public:
+	static OscBlobDeltaDecoderRef	create( OscTree::TypeTag typeTag = OscBlobDelta::kTypeTag );
+
+	//! Replaces every frame in \a message with the blob it encodes. The blob shares the
+	//! decoder's copy of the frame, which is copied rather than changed by the next frame
+	//! if the blob is still held. Returns false if a difference came without the frame it
+	//! applies to, that argument is left as it is until the stream's next keyframe. Streams
+	//! are told apart by address ID, and parsing doesn't intern received addresses, so the
+	//! addresses to decode must be interned first, by a handler or OscAddressTable::intern().
+	bool					decode( OscTree& message );
+
+	//! Returns the number of differences that could not be applied
+	uint64_t				getNumMissed() const { return mNumMissed; }
+
+	OscBlobDeltaDecoder( OscTree::TypeTag typeTag );
+protected:
+	OscBlobDeltaDecoder( const OscBlobDeltaDecoder& );
+	OscBlobDeltaDecoder&	operator=( const OscBlobDeltaDecoder& );
+
+	struct Stream
+	{
+		ci::BufferRef			mFrame;
+		uint32_t				mSequence;
+		bool					mValid;
+	};
+
+	bool					decodeFrame( Stream& stream, const uint8_t* data, size_t size );
+
+	OscTree::TypeTag		mTypeTag;
+	std::unordered_map<uint64_t, Stream>	mStreams;
+	uint64_t				mNumMissed;
+};
@@ -0,0 +1,157 @@
+//
+//  OscBufferPool.cpp
+//
+
+#include "OscBufferPool.h"
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	// the buffer belongs to its slot
+	struct NoDelete
+	{
+		void operator()( Buffer* ) const {}
+	};
+}
+
+// Builds a slot's control block in the slot, and puts the slot back on its
+// free list once the control block is gone. Deallocating is the last thing a
+// control block does, so the slot isn't handed out while its old one is still
+// in use. Holds the slabs, so a buffer keeps them alive.
+template<typename T>
+class OscBufferPool::SlotAllocator
+{
+public:
+	typedef T	value_type;
+
+	SlotAllocator( const shared_ptr<Slabs>& slabs, Slot* slot )
+		: mSlabs( slabs ), mSlot( slot )
+	{
+	}
+
+	template<typename U>
+	SlotAllocator( const SlotAllocator<U>& other )
+		: mSlabs( other.mSlabs ), mSlot( other.mSlot )
+	{
+	}
+
+	T* allocate( size_t n )
+	{
+		// a standard library with a larger control block gets it from the heap
+		if ( n * sizeof( T ) <= sizeof( mSlot->mControlBlock ) && alignof( T ) <= alignof( decltype( mSlot->mControlBlock ) ) ) {
+			return reinterpret_cast<T*>( &mSlot->mControlBlock );
+		}
+		return static_cast<T*>( ::operator new( n * sizeof( T ) ) );
+	}
+
+	void deallocate( T* p, size_t )
+	{
+		if ( static_cast<void*>( p ) != static_cast<void*>( &mSlot->mControlBlock ) ) {
+			::operator delete( p );
+		}
+		OscBufferPool::release( mSlot );
+	}
+
+	template<typename U>
+	bool operator==( const SlotAllocator<U>& other ) const { return mSlot == other.mSlot; }
+	template<typename U>
+	bool operator!=( const SlotAllocator<U>& other ) const { return mSlot != other.mSlot; }
+
+	shared_ptr<Slabs>	mSlabs;
+	Slot*				mSlot;
+};
+
+OscBufferPoolRef OscBufferPool::create( size_t numMtuSlots, size_t numJumboSlots, size_t numDatagramSlots )
+{
+	return make_shared<OscBufferPool>( numMtuSlots, numJumboSlots, numDatagramSlots );
+}
+
+OscBufferPool::OscBufferPool( size_t numMtuSlots, size_t numJumboSlots, size_t numDatagramSlots )
+	: mSlabs( make_shared<Slabs>() ), mNumFallbacks( 0 )
+{
+	// smallest slots first, acquire() takes the first class that fits
+	addSizeClass( kMtuSlotSize, numMtuSlots );
+	addSizeClass( kJumboSlotSize, numJumboSlots );
+	addSizeClass( kDatagramSlotSize, numDatagramSlots );
+}
+
+void OscBufferPool::addSizeClass( size_t slotSize, size_t numSlots )
+{
+	if ( numSlots == 0 ) {
+		return;
+	}
+
+	unique_ptr<SizeClass> sizeClass( new SizeClass() );
+	sizeClass->mSlotSize = slotSize;
+	sizeClass->mLock.clear();
+	sizeClass->mData.resize( slotSize * numSlots );
+	sizeClass->mSlots.resize( numSlots );
+	sizeClass->mFree.reserve( numSlots );
+
+	// the free list is a stack, so the first slot is handed out first
+	for ( size_t i = numSlots; i > 0; --i ) {
+		Slot& slot = sizeClass->mSlots[ i - 1 ];
+		slot.mSizeClass	= sizeClass.get();
+		slot.mBuffer.reset( new Buffer( sizeClass->mData.data() + ( i - 1 ) * slotSize, slotSize ) );
+		sizeClass->mFree.push_back( &slot );
+	}
+
+	mSlabs->mSizeClasses.push_back( move( sizeClass ) );
+}
+
+BufferRef OscBufferPool::acquire( size_t size )
+{
+	// a class with no free slot spills into the next larger one
+	for ( const auto& sizeClass : mSlabs->mSizeClasses ) {
+		if ( sizeClass->mSlotSize < size ) {
+			continue;
+		}
+
+		Slot* slot = nullptr;
+		sizeClass->lock();
+		if ( !sizeClass->mFree.empty() ) {
+			slot = sizeClass->mFree.back();
+			sizeClass->mFree.pop_back();
+		}
+		sizeClass->unlock();
+
+		if ( slot != nullptr ) {
+			slot->mBuffer->setSize( size );
+			return BufferRef( slot->mBuffer.get(), NoDelete(), SlotAllocator<Buffer>( mSlabs, slot ) );
+		}
+	}
+
+	mNumFallbacks.fetch_add( 1, memory_order_relaxed );
+	return Buffer::create( size );
+}
+
+void OscBufferPool::release( Slot* slot )
+{
+	// the lock orders whoever released the slot last before the next acquire()
+	SizeClass& sizeClass = *slot->mSizeClass;
+	sizeClass.lock();
+	sizeClass.mFree.push_back( slot );
+	sizeClass.unlock();
+}
+
+size_t OscBufferPool::getNumAvailable() const
+{
+	size_t numAvailable = 0;
+	for ( const auto& sizeClass : mSlabs->mSizeClasses ) {
+		sizeClass->lock();
+		numAvailable += sizeClass->mFree.size();
+		sizeClass->unlock();
+	}
+	return numAvailable;
+}
+
+size_t OscBufferPool::getNumSlots() const
+{
+	size_t numSlots = 0;
+	for ( const auto& sizeClass : mSlabs->mSizeClasses ) {
+		numSlots += sizeClass->mSlots.size();
+	}
+	return numSlots;
+}
@@ -0,0 +1,116 @@
+//
+//  OscBufferPool.h
+//
+//	Recycled receive buffers
+//
+//	The pool carves a few large slabs into fixed size slots, in
+//	classes sized for an ethernet MTU, a jumbo frame and the largest
+//	UDP datagram. Acquiring hands out a ci::BufferRef that views a
+//	slot, the slot goes back to its class' free list once the last
+//	reference to it is released. The reference's control block is
+//	built in storage kept with the slot, so a steady stream of
+//	packets is received without touching the heap, and it keeps the
+//	slabs alive, so buffers may outlive the pool.
+//
+//	Only the receive buffer is recycled. Parsing a packet eagerly
+//	into an OscTree copies its arguments into the tree, which
+//	allocates, and a lazy parse refers to the slot instead, keeping
+//	it from the pool for as long as the tree lives, though each value
+//	read from it still costs a small view. decompressBuffer()
+//	allocates its result, as the uncompressed size isn't known up
+//	front, zlib's uncompress() into a slot doesn't. OscPacket and
+//	OscBatchDecoder read a pooled packet fully in place.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "cinder/Buffer.h"
+
+class OscBufferPool;
+typedef std::shared_ptr<OscBufferPool>	OscBufferPoolRef;
+
+class OscBufferPool
+{
+public:
+	//! Fits a datagram on a 1500 byte MTU network
+	static const size_t		kMtuSlotSize		= 2048;
+	//! Fits a datagram on a 9000 byte jumbo frame network
+	static const size_t		kJumboSlotSize		= 9216;
+	//! Fits the largest UDP datagram
+	static const size_t		kDatagramSlotSize	= 65536;
+
+	static OscBufferPoolRef	create( size_t numMtuSlots = 256, size_t numJumboSlots = 32, size_t numDatagramSlots = 4 );
+
+	//! Returns a buffer of \a size bytes from the smallest free slot that
+	//! fits it. Falls back to the heap if there is no free slot large enough.
+	//! Safe to call from any thread, and to release buffers on any thread,
+	//! before or after the pool is destroyed.
+	ci::BufferRef			acquire( size_t size );
+
+	//! Returns the number of slots not in use
+	size_t					getNumAvailable() const;
+	size_t					getNumSlots() const;
+	//! Returns how often acquire() had to fall back to the heap
+	uint64_t				getNumFallbacks() const { return mNumFallbacks.load( std::memory_order_relaxed ); }
+
+	OscBufferPool( size_t numMtuSlots, size_t numJumboSlots, size_t numDatagramSlots );
+protected:
+	OscBufferPool( const OscBufferPool& );
+	OscBufferPool&			operator=( const OscBufferPool& );
+
+	// Room for the control block of a slot's BufferRef, which holds
+	// the buffer, a no-op deleter and a SlotAllocator
+	static const size_t		kControlBlockSize	= 128;
+
+	struct SizeClass;
+
+	struct Slot
+	{
+		SizeClass*					mSizeClass;
+		std::unique_ptr<ci::Buffer>	mBuffer;
+		std::aligned_storage<kControlBlockSize>::type	mControlBlock;
+	};
+
+	struct SizeClass
+	{
+		void lock()
+		{
+			while ( mLock.test_and_set( std::memory_order_acquire ) ) {
+				std::this_thread::yield();
+			}
+		}
+
+		void unlock()
+		{
+			mLock.clear( std::memory_order_release );
+		}
+
+		size_t						mSlotSize;
+		std::vector<uint8_t>		mData;
+		std::vector<Slot>			mSlots;
+		// slots not handed out, reserved up front so releasing never allocates
+		std::vector<Slot*>			mFree;
+		std::atomic_flag			mLock;
+	};
+
+	// Shared by the pool and every slot handed out
+	struct Slabs
+	{
+		std::vector<std::unique_ptr<SizeClass>>	mSizeClasses;
+	};
+
+	template<typename T>
+	class SlotAllocator;
+
+	void					addSizeClass( size_t slotSize, size_t numSlots );
+	static void				release( Slot* slot );
+
+	std::shared_ptr<Slabs>	mSlabs;
+	std::atomic<uint64_t>	mNumFallbacks;
+};
@@ -0,0 +1,414 @@
+//
+//  OscCapture.cpp
+//
+
+#include "OscCapture.h"
+#include "cinder/Log.h"
+#include "cinder/Utilities.h"
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+using namespace ci;
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	// Staged records are handed to the writer once this many bytes are pending
+	const size_t	kStagingSize	= 256 * 1024;
+
+	const char		kFileMagic[ 8 ]		= { 'O', 'S', 'C', 'C', 'A', 'P', '1', '\0' };
+	const char		kIndexMagic[ 8 ]	= { 'O', 'S', 'C', 'I', 'D', 'X', '1', '\0' };
+
+	size_t ceil8( size_t size )
+	{
+		return ( size + 7 ) & ~static_cast<size_t>( 7 );
+	}
+}
+
+fs::path OscCapture::getIndexPath( const fs::path& path )
+{
+	return fs::path( path.string() + ".idx" );
+}
+
+OscCapture::ExcInvalidCapture::ExcInvalidCapture( const fs::path& path, const string& reason )
+{
+	mMessage = "Invalid capture: " + path.string() + " (" + reason + ")";
+}
+
+OscCaptureWriterRef OscCaptureWriter::create( const fs::path& path )
+{
+	return make_shared<OscCaptureWriter>( path );
+}
+
+OscCaptureWriter::OscCaptureWriter( const fs::path& path )
+	: mPath( path ), mOffset( 0 ), mNumPackets( 0 ), mFailed( false ), mStopped( false ), mNumFlushesRequested( 0 ), mNumFlushesCompleted( 0 ), 
+	mFile( nullptr ), mIndexFile( nullptr ), mNumIndexed( 0 )
+{
+	mFile		= fopen( path.string().c_str(), "wb" );
+	mIndexFile	= fopen( OscCapture::getIndexPath( path ).string().c_str(), "wb" );
+	if ( mFile == nullptr || mIndexFile == nullptr ) {
+		if ( mFile != nullptr ) {
+			fclose( mFile );
+		}
+		if ( mIndexFile != nullptr ) {
+			fclose( mIndexFile );
+		}
+		throw OscCapture::ExcInvalidCapture( path, "could not open for writing" );
+	}
+
+	mStaging.reserve( kStagingSize * 2 );
+	mIndexStaging.reserve( kStagingSize / sizeof( uint64_t ) );
+	mWriting.reserve( kStagingSize * 2 );
+	mIndexWriting.reserve( kStagingSize / sizeof( uint64_t ) );
+
+	OscCapture::FileHeader header;
+	memcpy( header.mMagic, kFileMagic, sizeof( kFileMagic ) );
+	header.mVersion		= OscCapture::kVersion;
+	header.mHeaderSize	= sizeof( OscCapture::FileHeader );
+	header.mStartTime	= duration_cast<nanoseconds>( system_clock::now().time_since_epoch() ).count();
+	header.mReserved	= 0;
+	mOffset				= sizeof( header );
+	if ( fwrite( &header, sizeof( header ), 1, mFile ) != 1 || !writeIndexHeader( 0 ) ) {
+		fclose( mFile );
+		fclose( mIndexFile );
+		throw OscCapture::ExcInvalidCapture( path, "could not write header" );
+	}
+
+	mStart	= steady_clock::now();
+	mThread	= thread( &OscCaptureWriter::run, this );
+}
+
+OscCaptureWriter::~OscCaptureWriter()
+{
+	// the writer writes what is left before it stops
+	{
+		lock_guard<mutex> lock( mMutex );
+		mStopped = true;
+		mWakeup.notify_one();
+	}
+	mThread.join();
+
+	fclose( mFile );
+	fclose( mIndexFile );
+}
+
+void OscCaptureWriter::write( const BufferRef& buffer )
+{
+	write( buffer->getData(), buffer->getSize() );
+}
+
+void OscCaptureWriter::write( const void* data, size_t numBytes )
+{
+	OscCapture::RecordHeader header;
+	header.mTime		= duration_cast<nanoseconds>( steady_clock::now() - mStart ).count();
+	header.mSize		= static_cast<uint32_t>( numBytes );
+	header.mReserved	= 0;
+
+	size_t recordSize	= sizeof( header ) + ceil8( numBytes );
+
+	lock_guard<mutex> lock( mMutex );
+	if ( mFailed ) {
+		return;
+	}
+
+	size_t offset = mStaging.size();
+	mStaging.resize( offset + recordSize );
+
+	uint8_t* pStaging = mStaging.data() + offset;
+	memcpy( pStaging, &header, sizeof( header ) );
+	memcpy( pStaging + sizeof( header ), data, numBytes );
+	memset( pStaging + sizeof( header ) + numBytes, 0, recordSize - sizeof( header ) - numBytes );
+
+	mIndexStaging.push_back( mOffset );
+	mOffset += recordSize;
+	++mNumPackets;
+
+	// only wakes the writer once per block, if it's still writing
+	// the last one it takes this one as soon as it's done
+	if ( offset < kStagingSize && mStaging.size() >= kStagingSize ) {
+		mWakeup.notify_one();
+	}
+}
+
+void OscCaptureWriter::flush()
+{
+	unique_lock<mutex> lock( mMutex );
+	uint64_t flush = ++mNumFlushesRequested;
+	mWakeup.notify_one();
+	mFlushed.wait( lock, [ & ]() { return mNumFlushesCompleted >= flush; } );
+}
+
+void OscCaptureWriter::run()
+{
+	unique_lock<mutex> lock( mMutex );
+	while ( true ) {
+		mWakeup.wait( lock, [ this ]() { return mStopped || mNumFlushesRequested > mNumFlushesCompleted || mStaging.size() >= kStagingSize; } );
+
+		// takes the staged block and leaves the empty one to stage into
+		uint64_t numFlushesRequested	= mNumFlushesRequested;
+		bool stopped					= mStopped;
+		bool failed						= mFailed;
+		bool flush						= stopped || numFlushesRequested > mNumFlushesCompleted;
+		swap( mStaging, mWriting );
+		swap( mIndexStaging, mIndexWriting );
+
+		// once the recording stopped, what was staged before is dropped too
+		lock.unlock();
+		bool written = failed || writeBlock( flush );
+		mWriting.clear();
+		mIndexWriting.clear();
+		lock.lock();
+
+		if ( !written ) {
+			fail();
+		}
+		mNumFlushesCompleted = numFlushesRequested;
+		mFlushed.notify_all();
+
+		if ( stopped ) {
+			break;
+		}
+	}
+}
+
+bool OscCaptureWriter::writeBlock( bool flush )
+{
+	bool written = true;
+
+	// the capture is written before its index so an index
+	// entry never points past the end of the capture
+	if ( written && !mWriting.empty() ) {
+		written = fwrite( mWriting.data(), 1, mWriting.size(), mFile ) == mWriting.size();
+	}
+	if ( written && !mIndexWriting.empty() ) {
+		written = fwrite( mIndexWriting.data(), sizeof( uint64_t ), mIndexWriting.size(), mIndexFile ) == mIndexWriting.size();
+		if ( written ) {
+			mNumIndexed += mIndexWriting.size();
+
+			// the count goes last, until it matches the offsets a reader rebuilds the index
+			written = fseek( mIndexFile, 0, SEEK_SET ) == 0 && writeIndexHeader( mNumIndexed ) && fseek( mIndexFile, 0, SEEK_END ) == 0;
+		}
+	}
+	if ( written && flush ) {
+		written = fflush( mFile ) == 0 && fflush( mIndexFile ) == 0;
+	}
+
+	return written;
+}
+
+bool OscCaptureWriter::writeIndexHeader( uint64_t numRecords )
+{
+	OscCapture::IndexHeader header;
+	memcpy( header.mMagic, kIndexMagic, sizeof( kIndexMagic ) );
+	header.mVersion		= OscCapture::kIndexVersion;
+	header.mReserved	= 0;
+	header.mNumRecords	= numRecords;
+	return fwrite( &header, sizeof( header ), 1, mIndexFile ) == 1;
+}
+
+void OscCaptureWriter::fail()
+{
+	// the disk is full or gone, keep what made it and drop the rest
+	CI_LOG_E( "Capture write to " << mPath << " failed, recording stopped: " << strerror( errno ) );
+	mFailed = true;
+	mStaging.clear();
+	mIndexStaging.clear();
+}
+
+size_t OscCaptureWriter::getNumPackets() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumPackets;
+}
+
+bool OscCaptureWriter::isFailed() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mFailed;
+}
+
+OscCaptureReaderRef OscCaptureReader::create( const fs::path& path )
+{
+	return make_shared<OscCaptureReader>( path );
+}
+
+OscCaptureReader::OscCaptureReader( const fs::path& path )
+	: mHeader( nullptr ), mIndex( nullptr ), mIndexRebuilt( false ), mNumPackets( 0 )
+{
+	mFile = OscMappedFile::create( path );
+	if ( mFile->getSize() < sizeof( OscCapture::FileHeader ) ) {
+		throw OscCapture::ExcInvalidCapture( path, "truncated header" );
+	}
+
+	mHeader = reinterpret_cast<const OscCapture::FileHeader*>( mFile->getData() );
+	if ( memcmp( mHeader->mMagic, kFileMagic, sizeof( kFileMagic ) ) != 0 ) {
+		throw OscCapture::ExcInvalidCapture( path, "bad magic" );
+	}
+	if ( mHeader->mVersion != OscCapture::kVersion ) {
+		throw OscCapture::ExcInvalidCapture( path, "unsupported version " + toString( mHeader->mVersion ) );
+	}
+	if ( mHeader->mHeaderSize < sizeof( OscCapture::FileHeader ) || mHeader->mHeaderSize % 8 != 0 ) {
+		throw OscCapture::ExcInvalidCapture( path, "bad header size " + toString( mHeader->mHeaderSize ) );
+	}
+
+	if ( !loadIndex( OscCapture::getIndexPath( path ) ) ) {
+		rebuildIndex();
+	}
+}
+
+bool OscCaptureReader::loadIndex( const fs::path& path )
+{
+	if ( !fs::exists( path ) ) {
+		return false;
+	}
+
+	try {
+		mIndexFile = OscMappedFile::create( path );
+	} catch ( const OscMappedFile::ExcMapFailed& ) {
+		return false;
+	}
+
+	const size_t headerSize = sizeof( OscCapture::IndexHeader );
+	if ( mIndexFile->getSize() < headerSize ) {
+		return false;
+	}
+
+	const OscCapture::IndexHeader* header = reinterpret_cast<const OscCapture::IndexHeader*>( mIndexFile->getData() );
+	if ( memcmp( header->mMagic, kIndexMagic, sizeof( kIndexMagic ) ) != 0 || header->mVersion != OscCapture::kIndexVersion ) {
+		return false;
+	}
+
+	// a capture that was not closed cleanly can have index entries
+	// that were never counted, or a count ahead of its entries
+	const uint64_t* index	= reinterpret_cast<const uint64_t*>( mIndexFile->getData() + headerSize );
+	size_t numEntries		= ( mIndexFile->getSize() - headerSize ) / sizeof( uint64_t );
+	if ( header->mNumRecords != numEntries ) {
+		return false;
+	}
+
+	// getPacket() trusts the index, so every record has to lie in
+	// the capture and begin where or after the one before it ends
+	const uint64_t fileSize	= mFile->getSize();
+	uint64_t end			= mHeader->mHeaderSize;
+	for ( size_t i = 0; i < numEntries; ++i ) {
+		uint64_t offset = index[ i ];
+		if ( offset < end || offset % 8 != 0 || offset > fileSize || fileSize - offset < sizeof( OscCapture::RecordHeader ) ) {
+			return false;
+		}
+		const OscCapture::RecordHeader* record = reinterpret_cast<const OscCapture::RecordHeader*>( mFile->getData() + offset );
+		if ( record->mSize > fileSize - offset - sizeof( OscCapture::RecordHeader ) ) {
+			return false;
+		}
+		end = offset + sizeof( OscCapture::RecordHeader ) + ceil8( record->mSize );
+	}
+
+	mIndex		= index;
+	mNumPackets	= numEntries;
+
+	return true;
+}
+
+void OscCaptureReader::rebuildIndex()
+{
+	mIndexFile.reset();
+	mRebuiltIndex.clear();
+
+	const uint8_t* data	= mFile->getData();
+	size_t size			= mFile->getSize();
+	size_t offset		= mHeader->mHeaderSize;
+
+	while ( offset + sizeof( OscCapture::RecordHeader ) <= size ) {
+		const OscCapture::RecordHeader* record = reinterpret_cast<const OscCapture::RecordHeader*>( data + offset );
+		if ( offset + sizeof( OscCapture::RecordHeader ) + record->mSize > size ) {
+			// truncated record at the end of the capture
+			break;
+		}
+		mRebuiltIndex.push_back( offset );
+		offset += sizeof( OscCapture::RecordHeader ) + ceil8( record->mSize );
+	}
+
+	mIndex			= mRebuiltIndex.data();
+	mNumPackets		= mRebuiltIndex.size();
+	mIndexRebuilt	= true;
+}
+
+OscCaptureReader::Packet OscCaptureReader::getPacket( size_t index ) const
+{
+	const uint8_t* pRecord = mFile->getData() + mIndex[ index ];
+	const OscCapture::RecordHeader* record = reinterpret_cast<const OscCapture::RecordHeader*>( pRecord );
+
+	Packet packet;
+	packet.mTime	= record->mTime;
+	packet.mData	= pRecord + sizeof( OscCapture::RecordHeader );
+	packet.mSize	= record->mSize;
+
+	return packet;
+}
+
+const double OscReplay::kAsFastAsPossible = 0.0;
+
+double OscReplay::Stats::getPacketsPerSecond() const
+{
+	return mSeconds > 0.0 ? mNumPackets / mSeconds : 0.0;
+}
+
+double OscReplay::Stats::getMegabytesPerSecond() const
+{
+	return mSeconds > 0.0 ? ( mNumBytes / ( 1024.0 * 1024.0 ) ) / mSeconds : 0.0;
+}
+
+OscReplay::OscReplay( const OscCaptureReaderRef& reader )
+	: mReader( reader ), mCanceled( false )
+{
+}
+
+OscReplay::Stats OscReplay::run( const PacketHandler& handler, double speed )
+{
+	mCanceled = false;
+
+	Stats stats;
+	stats.mNumPackets	= 0;
+	stats.mNumBytes		= 0;
+	stats.mSeconds		= 0.0;
+
+	size_t numPackets = mReader->getNumPackets();
+	if ( numPackets == 0 ) {
+		return stats;
+	}
+
+	const bool paced		= speed > 0.0;
+	const int64_t firstTime	= mReader->getPacket( 0 ).mTime;
+	const auto start		= steady_clock::now();
+
+	for ( size_t i = 0; i < numPackets && !mCanceled; ++i ) {
+		OscCaptureReader::Packet packet = mReader->getPacket( i );
+
+		if ( paced ) {
+			auto due = start + duration_cast<steady_clock::duration>( nanoseconds( static_cast<int64_t>( ( packet.mTime - firstTime ) / speed ) ) );
+
+			// sleep while the packet is far off, then yield until it
+			// is due, sleep_until alone overshoots by up to a scheduler tick
+			auto now = steady_clock::now();
+			if ( due - now > milliseconds( 2 ) ) {
+				this_thread::sleep_until( due - milliseconds( 1 ) );
+			}
+			while ( steady_clock::now() < due ) {
+				this_thread::yield();
+			}
+		}
+
+		// the capture is read-only, the non-owning buffer just
+		// gives OscTree something to parse without copying
+		BufferRef buffer = Buffer::create( const_cast<uint8_t*>( packet.mData ), packet.mSize );
+		handler( OscTree( buffer ) );
+
+		++stats.mNumPackets;
+		stats.mNumBytes += packet.mSize;
+	}
+
+	stats.mSeconds = duration_cast<duration<double>>( steady_clock::now() - start ).count();
+
+	return stats;
+}
@@ -0,0 +1,234 @@
+//
+//  OscCapture.h
+//
+//	Binary capture of raw OSC packets, and replay of captures
+//	through the OscTree parser
+//
+//	A capture is an append-only file of timestamped packets
+//	with a sidecar index ( <capture>.idx ) holding the offset
+//	of every record. All records are 8-byte aligned so a
+//	memory mapped capture can be read in place.
+//
+//	Capture file layout:
+//		FileHeader	magic "OSCCAP1\0", version, header size, start time
+//		Record		time (ns since start), size, reserved, packet data
+//					padded with zeroes to a multiple of 8 bytes
+//		Record		...
+//
+//	Index file layout:
+//		IndexHeader	magic "OSCIDX1\0", version, reserved, number of records
+//		uint64_t	offset of record 0 in the capture file
+//		uint64_t	...
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cinder/Buffer.h"
+#include "cinder/Exception.h"
+#include "cinder/Filesystem.h"
+#include "OscMappedFile.h"
+#include "OscTree.h"
+
+class OscCaptureReader;
+class OscCaptureWriter;
+typedef std::shared_ptr<OscCaptureReader>	OscCaptureReaderRef;
+typedef std::shared_ptr<OscCaptureWriter>	OscCaptureWriterRef;
+
+namespace OscCapture
+{
+	struct FileHeader
+	{
+		char		mMagic[ 8 ];
+		uint32_t	mVersion;
+		uint32_t	mHeaderSize;
+		//! Wall clock time the capture started, in nanoseconds since the epoch
+		int64_t		mStartTime;
+		uint64_t	mReserved;
+	};
+
+	struct RecordHeader
+	{
+		//! Arrival time in nanoseconds since the capture started
+		int64_t		mTime;
+		uint32_t	mSize;
+		uint32_t	mReserved;
+	};
+
+	struct IndexHeader
+	{
+		char		mMagic[ 8 ];
+		uint32_t	mVersion;
+		uint32_t	mReserved;
+		//! Number of offsets that follow, rewritten each time the index is flushed
+		uint64_t	mNumRecords;
+	};
+
+	static const uint32_t	kVersion		= 1;
+	static const uint32_t	kIndexVersion	= 2;
+
+	//! Returns the path of the sidecar index for the capture at \a path
+	ci::fs::path			getIndexPath( const ci::fs::path& path );
+
+	//! Base class for capture exceptions
+	class Exception : public ci::Exception
+	{
+	};
+
+	class ExcInvalidCapture : public Exception
+	{
+	public:
+		ExcInvalidCapture( const ci::fs::path& path, const std::string& reason );
+
+		virtual const char* what() const throw()
+		{
+			return mMessage.c_str();
+		}
+	protected:
+		std::string			mMessage;
+	};
+}
+
+//! Appends packets to a capture file. Writes are staged in memory
+//! and handed in large blocks to a writer thread, so recording from
+//! the receive path costs a timestamp and a memcpy per packet and
+//! never waits on the disk. A failed write to disk is logged and
+//! stops the recording, later packets are dropped.
+class OscCaptureWriter
+{
+public:
+	//! Creates a new capture at \a path, truncating any existing file and index
+	static OscCaptureWriterRef	create( const ci::fs::path& path );
+	~OscCaptureWriter();
+
+	//! Appends a packet, stamped with the current time
+	void						write( const void* data, size_t numBytes );
+	//! Appends a packet, stamped with the current time
+	void						write( const ci::BufferRef& buffer );
+	//! Writes all staged records and index entries to disk, blocks until they are
+	void						flush();
+
+	//! Returns the number of packets written so far
+	size_t						getNumPackets() const;
+	//! Returns true if a write to disk failed and recording stopped
+	bool						isFailed() const;
+	const ci::fs::path&			getPath() const { return mPath; }
+
+	OscCaptureWriter( const ci::fs::path& path );
+protected:
+	OscCaptureWriter( const OscCaptureWriter& );
+	OscCaptureWriter&			operator=( const OscCaptureWriter& );
+
+	//! Runs on the writer thread, writing each block handed to it
+	void						run();
+	//! Writes mWriting and mIndexWriting to disk, on the writer thread without the lock.
+	//! Returns false if a write failed.
+	bool						writeBlock( bool flush );
+	bool						writeIndexHeader( uint64_t numRecords );
+	//! Called with the lock held
+	void						fail();
+
+	mutable std::mutex						mMutex;
+	std::condition_variable					mWakeup;
+	std::condition_variable					mFlushed;
+	std::thread								mThread;
+	ci::fs::path							mPath;
+	std::chrono::steady_clock::time_point	mStart;
+	uint64_t								mOffset;
+	size_t									mNumPackets;
+	bool									mFailed;
+	bool									mStopped;
+	uint64_t								mNumFlushesRequested;
+	uint64_t								mNumFlushesCompleted;
+	std::vector<uint8_t>					mStaging;
+	std::vector<uint64_t>					mIndexStaging;
+
+	// only used by the writer thread once it's started
+	FILE*									mFile;
+	FILE*									mIndexFile;
+	uint64_t								mNumIndexed;
+	std::vector<uint8_t>					mWriting;
+	std::vector<uint64_t>					mIndexWriting;
+};
+
+//! Reads a capture through a memory mapping. Packets are returned
+//! as pointers into the mapping and are valid as long as the reader.
+class OscCaptureReader
+{
+public:
+	struct Packet
+	{
+		//! Arrival time in nanoseconds since the capture started
+		int64_t					mTime;
+		const uint8_t*			mData;
+		uint32_t				mSize;
+	};
+
+	//! Opens the capture at \a path. The index is rebuilt by scanning
+	//! the capture if it is missing, was not closed cleanly or has an
+	//! offset that isn't a record of the capture.
+	static OscCaptureReaderRef	create( const ci::fs::path& path );
+
+	size_t						getNumPackets() const { return mNumPackets; }
+	Packet						getPacket( size_t index ) const;
+	//! Returns the wall clock time the capture started, in nanoseconds since the epoch
+	int64_t						getStartTime() const { return mHeader->mStartTime; }
+	//! Returns true if the index had to be rebuilt from the capture
+	bool						isIndexRebuilt() const { return mIndexRebuilt; }
+
+	OscCaptureReader( const ci::fs::path& path );
+protected:
+	bool						loadIndex( const ci::fs::path& path );
+	void						rebuildIndex();
+
+	OscMappedFileRef			mFile;
+	OscMappedFileRef			mIndexFile;
+	const OscCapture::FileHeader*	mHeader;
+	const uint64_t*				mIndex;
+	std::vector<uint64_t>		mRebuiltIndex;
+	bool						mIndexRebuilt;
+	size_t						mNumPackets;
+};
+
+//! Feeds a capture back through the OscTree parser, at the original
+//! timing, scaled in time or as fast as possible. Running as fast
+//! as possible makes a replay a realistic parser throughput benchmark.
+class OscReplay
+{
+public:
+	typedef std::function<void( const OscTree& )>	PacketHandler;
+
+	struct Stats
+	{
+		size_t					mNumPackets;
+		size_t					mNumBytes;
+		double					mSeconds;
+
+		double					getPacketsPerSecond() const;
+		double					getMegabytesPerSecond() const;
+	};
+
+	//! Pass as the speed to ignore packet timestamps
+	static const double			kAsFastAsPossible;
+
+	explicit OscReplay( const OscCaptureReaderRef& reader );
+
+	//! Parses every packet in the capture and passes it to \a handler.
+	//! A \a speed of 1 replays at the original timing, 2 at twice the
+	//! speed and so on. Blocks until the replay finishes or is canceled.
+	Stats						run( const PacketHandler& handler, double speed = 1.0 );
+	//! Stops a replay running on another thread
+	void						cancel() { mCanceled = true; }
+
+protected:
+	OscCaptureReaderRef			mReader;
+	std::atomic<bool>			mCanceled;
+};
@@ -0,0 +1,191 @@
+//
+//  OscColumnarSink.cpp
+//
+
+#include "OscColumnarSink.h"
+#include <cstring>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+	#include <emmintrin.h>
+	#define OSC_SSE2
+#endif
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	// the size of the values collected for a type tag, zero for those that can't be
+	uint32_t getValueSize( OscTree::TypeTag typeTag )
+	{
+		switch ( typeTag ) {
+		case 'i':
+		case 'f':
+		case 'c':
+		case 'r':
+		case 'm':
+			return 4;
+		case 'h':
+		case 'd':
+		case 't':
+			return 8;
+		}
+		return 0;
+	}
+
+	inline uint32_t swap32( uint32_t value )
+	{
+		return ( value >> 24 ) | ( ( value >> 8 ) & 0x0000FF00 ) | ( ( value << 8 ) & 0x00FF0000 ) | ( value << 24 );
+	}
+
+	inline uint64_t swap64( uint64_t value )
+	{
+		return ( static_cast<uint64_t>( swap32( static_cast<uint32_t>( value ) ) ) << 32 ) | swap32( static_cast<uint32_t>( value >> 32 ) );
+	}
+}
+
+OscColumnarSink::ExcUnsupportedTypeTag::ExcUnsupportedTypeTag( OscTree::TypeTag typeTag )
+{
+	mMessage = string( "Type tag can't be collected in a column: " ) +
+		( typeTag != 0 ? string( 1, static_cast<char>( typeTag ) ) : string( "none" ) );
+}
+
+OscColumnarSink::OscColumnarSink( ByteOrder byteOrder )
+	: mByteOrder( byteOrder )
+{
+}
+
+size_t OscColumnarSink::addSignature( const string& address, const string& typeTags )
+{
+	Signature signature;
+	signature.mIsPrefix	= !address.empty() && address.back() == '*';
+	signature.mAddress	= signature.mIsPrefix ? address.substr( 0, address.size() - 1 ) : address;
+	signature.mTypeTags	= typeTags;
+	for ( char typeTag : typeTags ) {
+		Column column;
+		column.mSize		= getValueSize( static_cast<OscTree::TypeTag>( typeTag ) );
+		column.mNumValues	= 0;
+		if ( column.mSize == 0 ) {
+			throw ExcUnsupportedTypeTag( static_cast<OscTree::TypeTag>( typeTag ) );
+		}
+		signature.mColumns.push_back( column );
+	}
+	mSignatures.push_back( signature );
+
+	// addresses that matched nothing so far may match this one
+	mSignatureCache.clear();
+
+	return mSignatures.size() - 1;
+}
+
+size_t OscColumnarSink::findSignature( uint32_t addressId )
+{
+	unordered_map<uint32_t, size_t>::const_iterator iter = mSignatureCache.find( addressId );
+	if ( iter != mSignatureCache.end() ) {
+		return iter->second;
+	}
+
+	const string& address	= OscAddressTable::get().getAddress( addressId );
+	size_t found			= kNoSignature;
+	for ( size_t i = 0; i < mSignatures.size(); ++i ) {
+		const Signature& signature = mSignatures[ i ];
+		if ( signature.mIsPrefix ? address.compare( 0, signature.mAddress.size(), signature.mAddress ) == 0 : address == signature.mAddress ) {
+			found = i;
+			break;
+		}
+	}
+	mSignatureCache[ addressId ] = found;
+	return found;
+}
+
+void OscColumnarSink::append( const OscMessageBatch& batch )
+{
+	mFirstRows.resize( mSignatures.size() );
+	for ( size_t i = 0; i < mSignatures.size(); ++i ) {
+		mFirstRows[ i ] = getNumRows( i );
+	}
+
+	const vector<const uint8_t*>& data = batch.getArgumentData();
+	for ( size_t i = 0; i < batch.getNumMessages(); ++i ) {
+		// only interned addresses have a signature
+		uint32_t addressId = batch.getAddressId( i );
+		size_t index = addressId != OscAddressTable::kInvalidId ? findSignature( addressId ) : kNoSignature;
+		if ( index == kNoSignature ) {
+			continue;
+		}
+
+		Signature& signature			= mSignatures[ index ];
+		const OscTree::StringView tags	= batch.getTypeTags( i );
+		if ( tags.size() != signature.mTypeTags.size() || memcmp( tags.data(), signature.mTypeTags.data(), tags.size() ) != 0 ) {
+			continue;
+		}
+
+		size_t argument = batch.getFirstArgument( i );
+		for ( Column& column : signature.mColumns ) {
+			size_t offset	= column.mNumValues * column.mSize;
+			size_t numWords	= ( offset + column.mSize + 7 ) / 8;
+			if ( numWords > column.mValues.size() ) {
+				column.mValues.resize( numWords );
+			}
+			memcpy( reinterpret_cast<uint8_t*>( column.mValues.data() ) + offset, data[ argument++ ], column.mSize );
+			++column.mNumValues;
+		}
+		signature.mAddressIds.push_back( batch.getAddressId( i ) );
+		signature.mTimeTags.push_back( batch.getTimeTag( i ).mTimeTag );
+	}
+
+	// swapping a whole column at once instead of every value as it's copied
+	if ( mByteOrder == BYTE_ORDER_SWAPPED ) {
+		const uint64_t immediate = OscTree::TimeTag().mTimeTag;
+		for ( size_t i = 0; i < mSignatures.size(); ++i ) {
+			Signature& signature = mSignatures[ i ];
+			for ( Column& column : signature.mColumns ) {
+				swapBytes( column, mFirstRows[ i ] );
+			}
+
+			// a message on its own has the TimeTag() the decoder gave it, not the peer's
+			for ( size_t row = mFirstRows[ i ]; row < signature.mTimeTags.size(); ++row ) {
+				if ( signature.mTimeTags[ row ] != immediate ) {
+					signature.mTimeTags[ row ] = swap64( signature.mTimeTags[ row ] );
+				}
+			}
+		}
+	}
+}
+
+void OscColumnarSink::swapBytes( Column& column, size_t first )
+{
+	if ( column.mSize == 8 ) {
+		for ( size_t i = first; i < column.mNumValues; ++i ) {
+			column.mValues[ i ] = swap64( column.mValues[ i ] );
+		}
+		return;
+	}
+
+	uint32_t* values	= reinterpret_cast<uint32_t*>( column.mValues.data() );
+	size_t i			= first;
+#if defined( OSC_SSE2 )
+	// SSE2 has no byte shuffle, so swap the bytes of each half and then the halves
+	for ( ; i + 4 <= column.mNumValues; i += 4 ) {
+		__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( values + i ) );
+		v = _mm_or_si128( _mm_srli_epi16( v, 8 ), _mm_slli_epi16( v, 8 ) );
+		v = _mm_shufflelo_epi16( _mm_shufflehi_epi16( v, _MM_SHUFFLE( 2, 3, 0, 1 ) ), _MM_SHUFFLE( 2, 3, 0, 1 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( values + i ), v );
+	}
+#endif
+	for ( ; i < column.mNumValues; ++i ) {
+		values[ i ] = swap32( values[ i ] );
+	}
+}
+
+void OscColumnarSink::clear()
+{
+	for ( Signature& signature : mSignatures ) {
+		for ( Column& column : signature.mColumns ) {
+			column.mValues.clear();
+			column.mNumValues = 0;
+		}
+		signature.mAddressIds.clear();
+		signature.mTimeTags.clear();
+	}
+}
@@ -0,0 +1,111 @@
+//
+//  OscColumnarSink.h
+//
+//	Collects numeric message streams into columns
+//
+//	A signature is an address, or an address prefix ending in '*',
+//	together with the type tags its messages carry, like "/sensor/*"
+//	with "fff". Every message of a decoded batch that matches a
+//	signature becomes a row: the value of each argument is appended
+//	to that argument's column, and the address ID and time tag to
+//	their own columns, so a consumer can run SIMD over the floats of
+//	every sensor without ever building an OscTree. Values are copied
+//	straight out of the packets, and when the peer's byte order is
+//	not ours the new rows of each column are swapped in one pass.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "cinder/Exception.h"
+#include "OscBatchDecoder.h"
+#include "OscTree.h"
+
+class OscColumnarSink
+{
+public:
+	enum ByteOrder : uint8_t
+	{
+		//! Values are in this machine's byte order, as OscTree encodes them
+		BYTE_ORDER_HOST,
+		//! Argument values and bundle time tags are swapped on the way in, for peers with the
+		//! other byte order. This only covers flat messages: OscBatchDecoder reads bundle element
+		//! sizes in this machine's byte order, so bundles from such a peer fail to decode.
+		BYTE_ORDER_SWAPPED
+	};
+
+	explicit OscColumnarSink( ByteOrder byteOrder = BYTE_ORDER_HOST );
+
+	//! Adds a signature for messages with \a address, or any address starting with it if it ends in '*',
+	//! and exactly the arguments in \a typeTags. Only fixed size arguments ( i f c r m h d t ) can be
+	//! collected, others throw ExcUnsupportedTypeTag. Returns the signature's index. An address
+	//! matching several signatures goes to the first one added.
+	size_t						addSignature( const std::string& address, const std::string& typeTags );
+	size_t						getNumSignatures() const { return mSignatures.size(); }
+
+	//! Appends a row for every message in \a batch that matches a signature. Rows refer to
+	//! addresses by ID, so messages for addresses that were never interned are skipped.
+	void						append( const OscMessageBatch& batch );
+	//! Removes every row, keeping the columns' capacity
+	void						clear();
+
+	size_t						getNumRows( size_t signature ) const { return mSignatures[ signature ].mAddressIds.size(); }
+	//! Returns the address ID of every row, see OscAddressTable
+	const std::vector<uint32_t>&	getAddressIds( size_t signature ) const { return mSignatures[ signature ].mAddressIds; }
+	//! Returns the time tag of every row as the batch has it, TimeTag() for messages that didn't come in a bundle
+	const std::vector<uint64_t>&	getTimeTags( size_t signature ) const { return mSignatures[ signature ].mTimeTags; }
+	//! Returns the values of argument \a column of every row, contiguous and aligned to 8 bytes.
+	//! \a T must match the size of the column's type tag.
+	template<typename T>
+	const T*					getColumn( size_t signature, size_t column ) const
+	{
+		return reinterpret_cast<const T*>( mSignatures[ signature ].mColumns[ column ].mValues.data() );
+	}
+
+	class ExcUnsupportedTypeTag : public OscTree::Exception
+	{
+	public:
+		ExcUnsupportedTypeTag( OscTree::TypeTag typeTag );
+
+		virtual const char* what() const throw()
+		{
+			return mMessage.c_str();
+		}
+	protected:
+		std::string			mMessage;
+	};
+
+protected:
+	struct Column
+	{
+		uint32_t			mSize;
+		// 64-bit words keep every column aligned for any of its types
+		std::vector<uint64_t>	mValues;
+		size_t				mNumValues;
+	};
+
+	struct Signature
+	{
+		std::string			mAddress;
+		bool				mIsPrefix;
+		std::string			mTypeTags;
+		std::vector<Column>	mColumns;
+		std::vector<uint32_t>	mAddressIds;
+		std::vector<uint64_t>	mTimeTags;
+	};
+
+	static const size_t		kNoSignature = static_cast<size_t>( -1 );
+
+	size_t					findSignature( uint32_t addressId );
+	static void				swapBytes( Column& column, size_t first );
+
+	ByteOrder				mByteOrder;
+	std::vector<Signature>	mSignatures;
+	// signature of every address ID seen so far, including kNoSignature
+	std::unordered_map<uint32_t, size_t>	mSignatureCache;
+	// rows of every signature before the batch being appended, for swapping only the new ones
+	std::vector<size_t>		mFirstRows;
+};
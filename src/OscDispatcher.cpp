@@ -0,0 +1,491 @@
+//
+//  OscDispatcher.cpp
+//
+
+#include "OscDispatcher.h"
+#include "cinder/Log.h"
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	const size_t		kCacheLineSize	= 64;
+	// yields before an idle shard goes to sleep
+	const size_t		kSpinCount		= 64;
+	// a sleeping shard wakes this often to look for work to steal
+	const chrono::microseconds	kStealInterval( 500 );
+
+	// critical is strict, normal gets 8 turns to every one of bulk
+	const uint32_t		kDefaultWeights[ OscDispatcher::PRIORITY_COUNT ]		= { 0, 8, 1 };
+	// meter data and the like is stale by the time it would wait
+	const OscDispatcher::DropPolicy	kDefaultDropPolicies[ OscDispatcher::PRIORITY_COUNT ]	=
+		{ OscDispatcher::BLOCK, OscDispatcher::BLOCK, OscDispatcher::DROP_OLDEST };
+}
+
+struct OscDispatcher::Lane
+{
+	Lane( size_t queueCapacity )
+		: mOrdered( queueCapacity ), mUnordered( queueCapacity ), mNumDispatched( 0 ), mNumDropped( 0 ),
+		mNumHandled( 0 )
+	{
+	}
+
+	bool tryPop( Task& task, bool& ordered )
+	{
+		ordered = true;
+		if ( mOrdered.tryPop( task ) ) {
+			return true;
+		}
+		ordered = false;
+		return mUnordered.tryPop( task );
+	}
+
+	size_t getSize() const
+	{
+		return mOrdered.getSize() + mUnordered.getSize();
+	}
+
+	OscRingBuffer<Task>		mOrdered;
+	OscRingBuffer<Task>		mUnordered;
+
+	// written by producers
+	char					mPaddingProducer[ kCacheLineSize ];
+	atomic<uint64_t>		mNumDispatched;
+	atomic<uint64_t>		mNumDropped;
+
+	// written by the worker that ran the task, the histogram
+	// only by the shard's own worker, under its stats lock
+	char					mPaddingWorker[ kCacheLineSize ];
+	atomic<uint64_t>		mNumHandled;
+	OscMetrics::Histogram	mQueueLatency;
+	char					mPaddingAfter[ kCacheLineSize ];
+};
+
+struct OscDispatcher::Shard
+{
+	Shard( size_t queueCapacity )
+		: mNumSubmitted( 0 ), mSleeping( false ), mNumCompleted( 0 ), mNumStolen( 0 ), mDepth( nullptr ),
+		mLane( 0 ), mCredit( 0 )
+	{
+		for ( size_t i = 0; i < PRIORITY_COUNT; ++i ) {
+			mLanes[ i ].reset( new Lane( queueCapacity ) );
+		}
+		mStatsLock.clear();
+	}
+
+	void lockStats()
+	{
+		while ( mStatsLock.test_and_set( memory_order_acquire ) ) {
+			this_thread::yield();
+		}
+	}
+
+	void unlockStats()
+	{
+		mStatsLock.clear( memory_order_release );
+	}
+
+	size_t getSize() const
+	{
+		size_t size = 0;
+		for ( size_t i = 0; i < PRIORITY_COUNT; ++i ) {
+			size += mLanes[ i ]->getSize();
+		}
+		return size;
+	}
+
+	unique_ptr<Lane>		mLanes[ PRIORITY_COUNT ];
+
+	// written by producers
+	char					mPaddingProducer[ kCacheLineSize ];
+	atomic<uint64_t>		mNumSubmitted;
+	atomic<bool>			mSleeping;
+
+	// written by the shard's worker
+	char					mPaddingWorker[ kCacheLineSize ];
+	atomic<uint64_t>		mNumCompleted;
+	atomic<uint64_t>		mNumStolen;
+	OscMetrics::Gauge*		mDepth;
+	// the weighted lane taking its turn and how many it has taken
+	size_t					mLane;
+	uint32_t				mCredit;
+	atomic_flag				mStatsLock;
+	char					mPaddingAfter[ kCacheLineSize ];
+
+	mutex					mMutex;
+	condition_variable		mWakeup;
+	thread					mThread;
+};
+
+OscDispatcherRef OscDispatcher::create( size_t numShards, size_t queueCapacity )
+{
+	return make_shared<OscDispatcher>( numShards, queueCapacity );
+}
+
+OscDispatcher::OscDispatcher( size_t numShards, size_t queueCapacity )
+	: mStopped( false ), mHandlers( make_shared<HandlerMap>() )
+{
+	if ( numShards == 0 ) {
+		numShards = max( thread::hardware_concurrency(), 1u );
+	}
+
+	for ( size_t i = 0; i < PRIORITY_COUNT; ++i ) {
+		mDropPolicies[ i ].store( kDefaultDropPolicies[ i ] );
+		mWeights[ i ].store( kDefaultWeights[ i ] );
+	}
+
+	for ( size_t i = 0; i < numShards; ++i ) {
+		mShards.emplace_back( new Shard( queueCapacity ) );
+		mShards.back()->mDepth = &OscMetrics::get().getGauge( "dispatcher shard " + to_string( i ) + " depth" );
+	}
+
+	// workers only start once every shard exists, they steal from each other
+	for ( size_t i = 0; i < numShards; ++i ) {
+		mShards[ i ]->mThread = thread( &OscDispatcher::run, this, i );
+	}
+}
+
+OscDispatcher::~OscDispatcher()
+{
+	mStopped = true;
+	for ( const auto& shard : mShards ) {
+		lock_guard<mutex> lock( shard->mMutex );
+		shard->mWakeup.notify_one();
+	}
+	for ( const auto& shard : mShards ) {
+		shard->mThread.join();
+	}
+}
+
+uint32_t OscDispatcher::hashAddress( const string& address )
+{
+	return OscAddressTable::hashAddress( address.data(), address.size() );
+}
+
+size_t OscDispatcher::getShardIndex( const string& address ) const
+{
+	return hashAddress( address ) % mShards.size();
+}
+
+uint64_t OscDispatcher::getNumStolen() const
+{
+	uint64_t numStolen = 0;
+	for ( const auto& shard : mShards ) {
+		numStolen += shard->mNumStolen.load( memory_order_relaxed );
+	}
+	return numStolen;
+}
+
+bool OscDispatcher::addHandler( const string& address, const Handler& handler, Ordering ordering )
+{
+	uint32_t addressId = OscAddressTable::get().intern( address );
+	if ( addressId == OscAddressTable::kInvalidId ) {
+		CI_LOG_E( "Can't add a handler for " << address << ", the address table is full" );
+		return false;
+	}
+
+	lock_guard<mutex> lock( mHandlersMutex );
+
+	shared_ptr<HandlerMap> handlerMap = make_shared<HandlerMap>( *mHandlers );
+
+	shared_ptr<Handlers> handlers = make_shared<Handlers>();
+	auto iter = handlerMap->find( addressId );
+	if ( iter != handlerMap->end() ) {
+		*handlers = *iter->second;
+	}
+
+	if ( ordering == ORDERED ) {
+		handlers->mOrdered.push_back( handler );
+	} else {
+		handlers->mUnordered.push_back( handler );
+	}
+
+	Priority priority = PRIORITY_NORMAL;
+	for ( auto pattern = mPriorities.rbegin(); pattern != mPriorities.rend(); ++pattern ) {
+		if ( OscAddressTable::matchPattern( pattern->first.c_str(), address.c_str() ) ) {
+			priority = pattern->second;
+			break;
+		}
+	}
+
+	// an address keeps its lane while it has handlers, ordered messages
+	// already queued in the old lane could run after ones in the new one
+	if ( iter == handlerMap->end() ) {
+		handlers->mPriority = priority;
+	} else if ( handlers->mPriority != priority ) {
+		CI_LOG_W( "Handlers for " << address << " stay in their lane until they are removed, a priority set since doesn't apply" );
+	}
+	( *handlerMap )[ addressId ] = handlers;
+
+	atomic_store( &mHandlers, shared_ptr<const HandlerMap>( handlerMap ) );
+	return true;
+}
+
+void OscDispatcher::removeHandlers( const string& address )
+{
+	lock_guard<mutex> lock( mHandlersMutex );
+
+	shared_ptr<HandlerMap> handlerMap = make_shared<HandlerMap>( *mHandlers );
+	handlerMap->erase( OscAddressTable::get().find( address ) );
+
+	atomic_store( &mHandlers, shared_ptr<const HandlerMap>( handlerMap ) );
+}
+
+void OscDispatcher::setPriority( const string& pattern, Priority priority )
+{
+	lock_guard<mutex> lock( mHandlersMutex );
+	mPriorities.push_back( make_pair( pattern, priority ) );
+}
+
+OscDispatcher::Priority OscDispatcher::getPriority( const string& address ) const
+{
+	shared_ptr<const HandlerMap> handlerMap = atomic_load( &mHandlers );
+	auto iter = handlerMap->find( OscAddressTable::get().find( address ) );
+	return iter != handlerMap->end() ? iter->second->mPriority : PRIORITY_NORMAL;
+}
+
+void OscDispatcher::setDropPolicy( Priority priority, DropPolicy dropPolicy )
+{
+	mDropPolicies[ priority ].store( dropPolicy, memory_order_relaxed );
+}
+
+void OscDispatcher::setWeight( Priority priority, uint32_t weight )
+{
+	mWeights[ priority ].store( weight, memory_order_relaxed );
+}
+
+OscDispatcher::LaneStats OscDispatcher::getLaneStats( Priority priority ) const
+{
+	LaneStats stats;
+	for ( const auto& shard : mShards ) {
+		Lane& lane = *shard->mLanes[ priority ];
+		stats.mNumDispatched	+= lane.mNumDispatched.load( memory_order_relaxed );
+		stats.mNumDropped		+= lane.mNumDropped.load( memory_order_relaxed );
+		stats.mNumHandled		+= lane.mNumHandled.load( memory_order_relaxed );
+		stats.mDepth			+= lane.getSize();
+
+		shard->lockStats();
+		stats.mQueueLatency.merge( lane.mQueueLatency );
+		shard->unlockStats();
+	}
+	return stats;
+}
+
+void OscDispatcher::dispatch( const OscTree& tree )
+{
+	if ( tree.isBundle() ) {
+		for ( const OscTree& child : tree.getChildren() ) {
+			dispatch( child );
+		}
+		return;
+	}
+
+	// only copy messages someone is listening to
+	shared_ptr<const HandlerMap> handlerMap = atomic_load( &mHandlers );
+	if ( handlerMap->find( tree.getAddressId() ) != handlerMap->end() ) {
+		dispatch( make_shared<OscTree>( tree ) );
+	}
+}
+
+void OscDispatcher::dispatch( const MessageRef& message )
+{
+	shared_ptr<const HandlerMap> handlerMap = atomic_load( &mHandlers );
+	uint32_t addressId = message->getAddressId();
+	auto iter = handlerMap->find( addressId );
+	if ( iter == handlerMap->end() ) {
+		return;
+	}
+
+	// the same shard getShardIndex() picks, without hashing the address again
+	const HandlersRef& handlers = iter->second;
+	Shard& shard = *mShards[ OscAddressTable::get().getHash( addressId ) % mShards.size() ];
+	Lane& lane = *shard.mLanes[ handlers->mPriority ];
+
+	OscTrace& trace		= OscTrace::get();
+	uint64_t packetId	= trace.isEnabled() ? OscTrace::getCurrentPacket() : 0;
+	uint64_t queueTime	= OscMetrics::get().isEnabled() ? OscTrace::now() : 0;
+	if ( !handlers->mOrdered.empty() ) {
+		Task task = { message, handlers, packetId, queueTime };
+		push( shard, handlers->mPriority, lane.mOrdered, move( task ) );
+	}
+	if ( !handlers->mUnordered.empty() ) {
+		Task task = { message, handlers, packetId, queueTime };
+		push( shard, handlers->mPriority, lane.mUnordered, move( task ) );
+	}
+}
+
+void OscDispatcher::push( Shard& shard, Priority priority, OscRingBuffer<Task>& queue, Task&& task )
+{
+	Lane& lane = *shard.mLanes[ priority ];
+	lane.mNumDispatched.fetch_add( 1, memory_order_relaxed );
+
+	// counted before it is queued, so completed never runs ahead of submitted
+	shard.mNumSubmitted.fetch_add( 1, memory_order_relaxed );
+	if ( task.mPacketId != 0 ) {
+		OscTrace::get().record( OscTrace::STAGE_ENQUEUE, task.mPacketId );
+	}
+
+	// a dropped task is taken back off submitted, it will never complete
+	DropPolicy dropPolicy = static_cast<DropPolicy>( mDropPolicies[ priority ].load( memory_order_relaxed ) );
+	while ( !queue.tryPush( move( task ) ) ) {
+		if ( dropPolicy == DROP_NEWEST ) {
+			shard.mNumSubmitted.fetch_sub( 1, memory_order_relaxed );
+			lane.mNumDropped.fetch_add( 1, memory_order_relaxed );
+			return;
+		}
+
+		Task oldest;
+		if ( dropPolicy == DROP_OLDEST && queue.tryPop( oldest ) ) {
+			shard.mNumSubmitted.fetch_sub( 1, memory_order_relaxed );
+			lane.mNumDropped.fetch_add( 1, memory_order_relaxed );
+			continue;
+		}
+
+		this_thread::yield();
+	}
+
+	// pairs with the fence in run(), either the worker sees the task
+	// before it sleeps or we see it sleeping and wake it
+	atomic_thread_fence( memory_order_seq_cst );
+	if ( shard.mSleeping.load( memory_order_relaxed ) ) {
+		lock_guard<mutex> lock( shard.mMutex );
+		shard.mWakeup.notify_one();
+	}
+}
+
+void OscDispatcher::waitUntilIdle() const
+{
+	for ( ;; ) {
+		// completed is summed first, it can only catch up with submitted
+		uint64_t numCompleted = 0;
+		for ( const auto& shard : mShards ) {
+			numCompleted += shard->mNumCompleted.load( memory_order_acquire );
+		}
+		uint64_t numSubmitted = 0;
+		for ( const auto& shard : mShards ) {
+			numSubmitted += shard->mNumSubmitted.load( memory_order_relaxed );
+		}
+		if ( numCompleted >= numSubmitted ) {
+			return;
+		}
+		this_thread::yield();
+	}
+}
+
+bool OscDispatcher::pop( Shard& shard, Task& task, Priority& priority, bool& ordered )
+{
+	for ( size_t i = 0; i < PRIORITY_COUNT; ++i ) {
+		if ( mWeights[ i ].load( memory_order_relaxed ) == 0 && shard.mLanes[ i ]->tryPop( task, ordered ) ) {
+			priority = static_cast<Priority>( i );
+			return true;
+		}
+	}
+
+	// a lane's turn ends once it has taken its weight or runs
+	// dry, one lap around brings the first lane back for another
+	for ( size_t i = 0; i <= PRIORITY_COUNT; ++i ) {
+		uint32_t weight = mWeights[ shard.mLane ].load( memory_order_relaxed );
+		if ( shard.mCredit < weight && shard.mLanes[ shard.mLane ]->tryPop( task, ordered ) ) {
+			++shard.mCredit;
+			priority = static_cast<Priority>( shard.mLane );
+			return true;
+		}
+		shard.mLane		= ( shard.mLane + 1 ) % PRIORITY_COUNT;
+		shard.mCredit	= 0;
+	}
+	return false;
+}
+
+bool OscDispatcher::steal( size_t index, Task& task, Priority& priority )
+{
+	// only unordered tasks are stolen, ordered tasks stay on their
+	// shard. Higher lanes are stolen from every shard first.
+	for ( size_t p = 0; p < PRIORITY_COUNT; ++p ) {
+		for ( size_t i = 1; i < mShards.size(); ++i ) {
+			Shard& victim = *mShards[ ( index + i ) % mShards.size() ];
+			if ( victim.mLanes[ p ]->mUnordered.tryPop( task ) ) {
+				priority = static_cast<Priority>( p );
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void OscDispatcher::execute( const vector<Handler>& handlers, const OscTree& message )
+{
+	for ( const Handler& handler : handlers ) {
+		try {
+			handler( message );
+		} catch ( const std::exception& exc ) {
+			CI_LOG_E( "Handler for " << message.getAddress() << " threw: " << exc.what() );
+		}
+	}
+}
+
+void OscDispatcher::run( size_t index )
+{
+	Shard& shard		= *mShards[ index ];
+	size_t numSpins		= 0;
+	Task task;
+
+	for ( ;; ) {
+		Priority priority	= PRIORITY_NORMAL;
+		bool ordered		= true;
+		bool found			= pop( shard, task, priority, ordered );
+		if ( !found && !mStopped && steal( index, task, priority ) ) {
+			found	= true;
+			ordered	= false;
+			shard.mNumStolen.fetch_add( 1, memory_order_relaxed );
+		}
+
+		if ( found ) {
+			numSpins = 0;
+			Lane& lane = *shard.mLanes[ priority ];
+			if ( OscMetrics::get().isEnabled() ) {
+				shard.mDepth->set( static_cast<int64_t>( shard.getSize() ) );
+			}
+			if ( task.mQueueTime != 0 ) {
+				uint64_t queueLatency = OscTrace::now() - task.mQueueTime;
+				shard.lockStats();
+				lane.mQueueLatency.record( queueLatency );
+				shard.unlockStats();
+			}
+
+			// the handlers run as part of the packet, so whatever they dispatch is traced with it
+			if ( task.mPacketId != 0 ) {
+				OscTrace& trace = OscTrace::get();
+				trace.record( OscTrace::STAGE_DEQUEUE, task.mPacketId );
+				OscTrace::setCurrentPacket( task.mPacketId );
+				execute( ordered ? task.mHandlers->mOrdered : task.mHandlers->mUnordered, *task.mMessage );
+				trace.record( OscTrace::STAGE_HANDLER_END, task.mPacketId );
+				OscTrace::setCurrentPacket( 0 );
+			} else {
+				execute( ordered ? task.mHandlers->mOrdered : task.mHandlers->mUnordered, *task.mMessage );
+			}
+			task = Task();
+			lane.mNumHandled.fetch_add( 1, memory_order_relaxed );
+			shard.mNumCompleted.fetch_add( 1, memory_order_release );
+			continue;
+		}
+
+		// queued tasks are drained before the worker stops
+		if ( mStopped ) {
+			break;
+		}
+
+		if ( ++numSpins < kSpinCount ) {
+			this_thread::yield();
+			continue;
+		}
+
+		unique_lock<mutex> lock( shard.mMutex );
+		shard.mSleeping.store( true, memory_order_relaxed );
+		atomic_thread_fence( memory_order_seq_cst );
+		if ( shard.getSize() == 0 && !mStopped ) {
+			shard.mWakeup.wait_for( lock, kStealInterval );
+		}
+		shard.mSleeping.store( false, memory_order_relaxed );
+	}
+}
@@ -0,0 +1,182 @@
+//
+//  OscDispatcher.h
+//
+//	Runs message handlers in parallel on a pool of worker shards
+//
+//	Every address hashes to one shard, and ordered handlers for an
+//	address only ever run on that shard's thread, in arrival order,
+//	so per-address state such as a fader position needs no locking
+//	and never sees messages out of order. Handlers registered as
+//	unordered can run on any shard, idle shards steal them from
+//	busy ones. Each shard has its own lock-free queues, producers
+//	and workers only share a cache line when a shard goes to sleep.
+//
+//	Addresses are assigned a priority lane when their handlers are
+//	registered, by the address patterns given to setPriority(), so a
+//	flood of meter data can't hold up a cue behind it. Every lane of
+//	a shard has queues of its own. A lane with a weight of zero is
+//	strict, it is always drained before the lanes below it, and the
+//	others take turns taking up to their weight in messages at a time.
+//	Each lane has its own policy for when its queues are full: wait
+//	for room, or drop the new message or the oldest queued one.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "OscMetrics.h"
+#include "OscRingBuffer.h"
+#include "OscTrace.h"
+#include "OscTree.h"
+
+class OscDispatcher;
+typedef std::shared_ptr<OscDispatcher>	OscDispatcherRef;
+
+class OscDispatcher
+{
+public:
+	typedef std::function<void( const OscTree& )>	Handler;
+	typedef std::shared_ptr<const OscTree>			MessageRef;
+
+	enum Ordering : uint8_t
+	{
+		//! Runs on the address's shard, in the order messages were dispatched
+		ORDERED,
+		//! Runs on any shard, in no particular order
+		UNORDERED
+	};
+
+	enum Priority : uint8_t
+	{
+		PRIORITY_CRITICAL,
+		PRIORITY_NORMAL,
+		PRIORITY_BULK,
+		PRIORITY_COUNT
+	};
+
+	//! What dispatch() does when a lane's queue is full
+	enum DropPolicy : uint8_t
+	{
+		//! Waits for the shard to catch up
+		BLOCK,
+		//! Drops the message being dispatched
+		DROP_NEWEST,
+		//! Drops the oldest message queued in the lane to make room
+		DROP_OLDEST
+	};
+
+	struct LaneStats
+	{
+		LaneStats() : mNumDispatched( 0 ), mNumDropped( 0 ), mNumHandled( 0 ), mDepth( 0 ) {}
+
+		//! Messages dispatched to the lane, dropped ones included
+		uint64_t				mNumDispatched;
+		uint64_t				mNumDropped;
+		uint64_t				mNumHandled;
+		//! Messages queued right now
+		size_t					mDepth;
+		//! Nanoseconds from dispatch to a worker taking the message, recorded while OscMetrics is enabled
+		OscMetrics::Histogram	mQueueLatency;
+	};
+
+	//! Creates a dispatcher with \a numShards worker threads, one per
+	//! hardware thread if zero. Each lane of a shard queues up to
+	//! \a queueCapacity messages before its drop policy applies.
+	static OscDispatcherRef	create( size_t numShards = 0, size_t queueCapacity = 4096 );
+	~OscDispatcher();
+
+	//! Registers \a handler for messages with \a address. Safe to call while dispatching.
+	//! Returns false, registering nothing, if \a address can't be interned as the table is full.
+	bool					addHandler( const std::string& address, const Handler& handler, Ordering ordering = ORDERED );
+	//! Removes every handler for \a address. Messages already queued still run the removed handlers.
+	void					removeHandlers( const std::string& address );
+
+	//! Puts addresses matching the OSC address \a pattern in lane \a priority, see OscAddressTable::matchPattern().
+	//! Applies to addresses given their first handler from here on, the last pattern set that matches wins.
+	//! An address keeps its lane while it has handlers, so its ordered messages are never overtaken, and
+	//! only moves once removeHandlers() was called for it. Addresses no pattern matches go in PRIORITY_NORMAL.
+	void					setPriority( const std::string& pattern, Priority priority );
+	//! Returns the lane messages for \a address are queued in
+	Priority				getPriority( const std::string& address ) const;
+	//! Sets what happens when a queue of lane \a priority is full. Every lane blocks by default,
+	//! except PRIORITY_BULK which drops the oldest message.
+	void					setDropPolicy( Priority priority, DropPolicy dropPolicy );
+	//! Sets how many messages lane \a priority takes in its turn, zero to drain it before any
+	//! lower lane. By default PRIORITY_CRITICAL is strict, PRIORITY_NORMAL takes 8 and PRIORITY_BULK 1.
+	void					setWeight( Priority priority, uint32_t weight );
+	//! Returns the counters of lane \a priority summed over every shard
+	LaneStats				getLaneStats( Priority priority ) const;
+
+	//! Queues a message, or every message in a bundle, for its handlers.
+	//! Blocks while the lane's queue is full, unless its drop policy drops.
+	void					dispatch( const OscTree& tree );
+	//! Queues a message without copying it. Blocks while the lane's queue is full, unless its drop policy drops.
+	void					dispatch( const MessageRef& message );
+	//! Blocks until every queued message has been handled
+	void					waitUntilIdle() const;
+
+	size_t					getNumShards() const { return mShards.size(); }
+	//! Returns the shard ordered handlers for \a address run on
+	size_t					getShardIndex( const std::string& address ) const;
+	//! Returns the number of unordered tasks run by a shard other than the one they were queued on
+	uint64_t				getNumStolen() const;
+
+	//! 32-bit FNV-1a hash of \a address, the same as OscPacket::getAddressHash()
+	static uint32_t			hashAddress( const std::string& address );
+
+	OscDispatcher( size_t numShards, size_t queueCapacity );
+protected:
+	OscDispatcher( const OscDispatcher& );
+	OscDispatcher&			operator=( const OscDispatcher& );
+
+	struct Handlers
+	{
+		std::vector<Handler>	mOrdered;
+		std::vector<Handler>	mUnordered;
+		Priority				mPriority;
+	};
+	typedef std::shared_ptr<const Handlers>							HandlersRef;
+	// keyed by interned address ID, see OscAddressTable
+	typedef std::unordered_map<uint32_t, HandlersRef>				HandlerMap;
+
+	struct Task
+	{
+		MessageRef			mMessage;
+		HandlersRef			mHandlers;
+		// the traced packet the message came in, zero if none, see OscTrace
+		uint64_t			mPacketId;
+		// when the message was dispatched, zero unless metrics are enabled
+		uint64_t			mQueueTime;
+	};
+
+	struct Lane;
+	struct Shard;
+
+	void					run( size_t index );
+	//! Takes the next task from \a shard's lanes, strict lanes first and then the weighted lanes in turn
+	bool					pop( Shard& shard, Task& task, Priority& priority, bool& ordered );
+	bool					steal( size_t index, Task& task, Priority& priority );
+	void					push( Shard& shard, Priority priority, OscRingBuffer<Task>& queue, Task&& task );
+	void					execute( const std::vector<Handler>& handlers, const OscTree& message );
+
+	std::vector<std::unique_ptr<Shard>>	mShards;
+	std::atomic<bool>					mStopped;
+
+	// handlers are copied on write and swapped in, dispatching only
+	// takes a reference to the current map
+	std::shared_ptr<const HandlerMap>	mHandlers;
+	std::mutex							mHandlersMutex;
+	std::vector<std::pair<std::string, Priority>>	mPriorities;
+
+	std::atomic<uint8_t>				mDropPolicies[ PRIORITY_COUNT ];
+	std::atomic<uint32_t>				mWeights[ PRIORITY_COUNT ];
+};
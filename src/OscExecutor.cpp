@@ -0,0 +1,66 @@
+//
+//  OscExecutor.cpp
+//
+
+#include "OscExecutor.h"
+
+using namespace std;
+
+OscExecutorRef OscExecutor::create( asio::io_service& io )
+{
+	return make_shared<OscExecutor>( io );
+}
+
+OscExecutor::OscExecutor( asio::io_service& io )
+	: mIo( io ), mScheduled( false ), mNumBatches( 0 ), mNumTasks( 0 )
+{
+}
+
+void OscExecutor::post( const Task& task )
+{
+	bool schedule = false;
+	{
+		lock_guard<mutex> lock( mMutex );
+		mPending.push_back( task );
+		++mNumTasks;
+
+		schedule	= !mScheduled;
+		mScheduled	= true;
+	}
+
+	if ( schedule ) {
+		OscExecutorRef self = shared_from_this();
+		mIo.post( [ self ]()
+		{
+			self->runBatch();
+		} );
+	}
+}
+
+void OscExecutor::runBatch()
+{
+	vector<Task> tasks;
+	{
+		lock_guard<mutex> lock( mMutex );
+		tasks.swap( mPending );
+		mScheduled = false;
+		++mNumBatches;
+	}
+
+	// anything posted from here on goes into the next batch
+	for ( const Task& task : tasks ) {
+		task();
+	}
+}
+
+size_t OscExecutor::getNumBatches() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumBatches;
+}
+
+size_t OscExecutor::getNumTasks() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumTasks;
+}
@@ -0,0 +1,52 @@
+//
+//  OscExecutor.h
+//
+//	Runs work on the thread of an asio::io_service, batching wakeups
+//
+//	Work posted while a batch is waiting to run joins that batch,
+//	so a burst of packets arriving on hundreds of endpoints costs
+//	one io_service wakeup instead of one per packet.
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "asio/asio.hpp"
+
+class OscExecutor;
+typedef std::shared_ptr<OscExecutor>	OscExecutorRef;
+
+class OscExecutor : public std::enable_shared_from_this<OscExecutor>
+{
+public:
+	typedef std::function<void()>	Task;
+
+	//! Creates an executor that runs work on whichever thread runs \a io
+	static OscExecutorRef	create( asio::io_service& io );
+
+	//! Queues \a task to run on the io_service thread. Safe to call from any thread.
+	void					post( const Task& task );
+
+	asio::io_service&		getIoService() const { return mIo; }
+	//! Returns the number of batches run, compare with the number of tasks posted to see the batching
+	size_t					getNumBatches() const;
+	//! Returns the number of tasks posted
+	size_t					getNumTasks() const;
+
+	OscExecutor( asio::io_service& io );
+protected:
+	OscExecutor( const OscExecutor& );
+	OscExecutor&			operator=( const OscExecutor& );
+
+	void					runBatch();
+
+	asio::io_service&		mIo;
+	mutable std::mutex		mMutex;
+	std::vector<Task>		mPending;
+	bool					mScheduled;
+	size_t					mNumBatches;
+	size_t					mNumTasks;
+};
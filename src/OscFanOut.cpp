@@ -0,0 +1,141 @@
+//
+//  OscFanOut.cpp
+//
+
+#include "OscFanOut.h"
+#include "cinder/Log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+using namespace ci;
+using namespace std;
+using asio::ip::udp;
+
+namespace
+{
+	// endpoints per sendmmsg call
+	const size_t	kMaxBatchSize	= 64;
+}
+
+OscFanOutSenderRef OscFanOutSender::create( asio::io_service& io )
+{
+	return make_shared<OscFanOutSender>( io );
+}
+
+OscFanOutSender::OscFanOutSender( asio::io_service& io )
+	: mIo( io ), mSocket( io, udp::v4() ), mCompressionEnabled( false ), mNumSyscalls( 0 )
+{
+}
+
+void OscFanOutSender::addEndpoint( const string& host, uint16_t port )
+{
+	udp::resolver resolver( mIo );
+	addEndpoint( *resolver.resolve( udp::resolver::query( udp::v4(), host, to_string( port ) ) ) );
+}
+
+void OscFanOutSender::addEndpoint( const udp::endpoint& endpoint )
+{
+	if ( find( mEndpoints.begin(), mEndpoints.end(), endpoint ) == mEndpoints.end() ) {
+		mEndpoints.push_back( endpoint );
+		updateMessages();
+	}
+}
+
+void OscFanOutSender::removeEndpoint( const udp::endpoint& endpoint )
+{
+	mEndpoints.erase( remove( mEndpoints.begin(), mEndpoints.end(), endpoint ), mEndpoints.end() );
+	updateMessages();
+}
+
+void OscFanOutSender::clearEndpoints()
+{
+	mEndpoints.clear();
+	updateMessages();
+}
+
+void OscFanOutSender::setMulticastTtl( int ttl )
+{
+	mSocket.set_option( asio::ip::multicast::hops( ttl ) );
+}
+
+void OscFanOutSender::setMulticastLoopback( bool enabled )
+{
+	mSocket.set_option( asio::ip::multicast::enable_loopback( enabled ) );
+}
+
+void OscFanOutSender::updateMessages()
+{
+#if defined( OSC_HAS_SENDMMSG )
+	// the headers point into mEndpoints, so they are rebuilt whenever it changes
+	mMessages.resize( mEndpoints.size() );
+	for ( size_t i = 0; i < mEndpoints.size(); ++i ) {
+		memset( &mMessages[ i ], 0, sizeof( mmsghdr ) );
+		mMessages[ i ].msg_hdr.msg_name		= mEndpoints[ i ].data();
+		mMessages[ i ].msg_hdr.msg_namelen	= static_cast<socklen_t>( mEndpoints[ i ].size() );
+	}
+#endif
+}
+
+BufferRef OscFanOutSender::encode( const OscTree& tree ) const
+{
+	BufferRef packet = tree.toBuffer();
+	if ( mCompressionEnabled ) {
+		packet = make_shared<Buffer>( compressBuffer( *packet ) );
+	}
+	return packet;
+}
+
+size_t OscFanOutSender::send( const OscTree& tree )
+{
+	return send( encode( tree ) );
+}
+
+size_t OscFanOutSender::send( const BufferRef& packet )
+{
+	size_t numSent = 0;
+
+#if defined( OSC_HAS_SENDMMSG )
+	iovec iov;
+	iov.iov_base	= packet->getData();
+	iov.iov_len		= packet->getSize();
+	for ( mmsghdr& message : mMessages ) {
+		message.msg_hdr.msg_iov		= &iov;
+		message.msg_hdr.msg_iovlen	= 1;
+	}
+
+	size_t index = 0;
+	while ( index < mMessages.size() ) {
+		unsigned int batchSize	= static_cast<unsigned int>( min( mMessages.size() - index, kMaxBatchSize ) );
+		int result				= ::sendmmsg( mSocket.native_handle(), &mMessages[ index ], batchSize, 0 );
+		++mNumSyscalls;
+
+		if ( result < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			// sendmmsg only fails outright when the first message of the
+			// batch fails, skip that endpoint and carry on with the rest
+			CI_LOG_W( "OSC fan out send to " << mEndpoints[ index ] << " failed: " << strerror( errno ) );
+			++index;
+		} else {
+			index	+= result;
+			numSent	+= result;
+		}
+	}
+#else
+	for ( const udp::endpoint& endpoint : mEndpoints ) {
+		asio::error_code error;
+		mSocket.send_to( asio::buffer( packet->getData(), packet->getSize() ), endpoint, 0, error );
+		++mNumSyscalls;
+
+		if ( error ) {
+			CI_LOG_W( "OSC fan out send to " << endpoint << " failed: " << error.message() );
+		} else {
+			++numSent;
+		}
+	}
+#endif
+
+	return numSent;
+}
@@ -0,0 +1,80 @@
+//
+//  OscFanOut.h
+//
+//	Sends the same packet to many endpoints
+//
+//	A tree is encoded, and optionally compressed, once into a
+//	packet that is shared by every send. On Linux the sends to all
+//	endpoints are batched into sendmmsg calls of up to 64 endpoints
+//	each, elsewhere each endpoint is a single send_to on the same
+//	packet. Endpoints can be unicast addresses or multicast groups.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "asio/asio.hpp"
+#include "cinder/Buffer.h"
+#include "OscTree.h"
+
+#if defined( __linux__ )
+	#include <sys/socket.h>
+	#define OSC_HAS_SENDMMSG
+#endif
+
+class OscFanOutSender;
+typedef std::shared_ptr<OscFanOutSender>	OscFanOutSenderRef;
+
+//! Not thread safe, send from one thread at a time
+class OscFanOutSender
+{
+public:
+	static OscFanOutSenderRef	create( asio::io_service& io );
+
+	//! Adds a unicast endpoint or a multicast group, resolving \a host synchronously
+	void						addEndpoint( const std::string& host, uint16_t port );
+	void						addEndpoint( const asio::ip::udp::endpoint& endpoint );
+	void						removeEndpoint( const asio::ip::udp::endpoint& endpoint );
+	void						clearEndpoints();
+	const std::vector<asio::ip::udp::endpoint>&	getEndpoints() const { return mEndpoints; }
+
+	//! Sets the number of router hops multicast packets live for
+	void						setMulticastTtl( int ttl );
+	//! Sets whether multicast packets are also delivered on this host
+	void						setMulticastLoopback( bool enabled );
+
+	//! Compresses packets with zlib when encoding, as OscDevApp does. Disabled by default.
+	void						setCompressionEnabled( bool enabled ) { mCompressionEnabled = enabled; }
+	bool						isCompressionEnabled() const { return mCompressionEnabled; }
+
+	//! Encodes, and compresses if enabled, \a tree into a packet that can be sent any number of times
+	ci::BufferRef				encode( const OscTree& tree ) const;
+
+	//! Encodes \a tree once and sends it to every endpoint. Returns the number of endpoints sent to.
+	size_t						send( const OscTree& tree );
+	//! Sends \a packet as is to every endpoint. Returns the number of endpoints sent to.
+	size_t						send( const ci::BufferRef& packet );
+
+	//! Returns the number of send system calls made so far
+	uint64_t					getNumSyscalls() const { return mNumSyscalls; }
+
+	OscFanOutSender( asio::io_service& io );
+protected:
+	OscFanOutSender( const OscFanOutSender& );
+	OscFanOutSender&			operator=( const OscFanOutSender& );
+
+	void						updateMessages();
+
+	asio::io_service&						mIo;
+	asio::ip::udp::socket					mSocket;
+	std::vector<asio::ip::udp::endpoint>	mEndpoints;
+	bool									mCompressionEnabled;
+	uint64_t								mNumSyscalls;
+#if defined( OSC_HAS_SENDMMSG )
+	// one header per endpoint, all pointing at the same packet
+	std::vector<mmsghdr>					mMessages;
+#endif
+};
@@ -0,0 +1,381 @@
+//
+//  OscLoadGenerator.cpp
+//
+
+#include "OscLoadGenerator.h"
+#include "OscExecutor.h"
+#include "OscTrace.h"
+#include "OscTransport.h"
+#include "cinder/Log.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	// the largest payload of an IPv4 datagram
+	const size_t	kMaxPacketSize	= 65507;
+	// after sending, how long the receiver may go without a packet before it is done
+	const chrono::milliseconds	kDrainTimeout( 200 );
+
+	// Parses "8" or "1-8" into a range
+	bool parseRange( const string& value, size_t& low, size_t& high )
+	{
+		char* end		= nullptr;
+		low				= strtoul( value.c_str(), &end, 10 );
+		if ( end == value.c_str() ) {
+			return false;
+		}
+		high = low;
+		if ( *end == '-' ) {
+			const char* begin = end + 1;
+			high = strtoul( begin, &end, 10 );
+			if ( end == begin ) {
+				return false;
+			}
+		}
+		return *end == '\0' && low <= high;
+	}
+
+	bool parseNumber( const string& value, double& number )
+	{
+		char* end	= nullptr;
+		number		= strtod( value.c_str(), &end );
+		return end != value.c_str() && *end == '\0' && number >= 0.0;
+	}
+}
+
+OscLoadGenerator::Options::Options()
+	: mRate( 10000.0 ), mDuration( 5.0 ), mNumAddresses( 100 ), mMinArguments( 1 ), mMaxArguments( 4 ),
+	mTypeTags( "ifs" ), mMinStringSize( 4 ), mMaxStringSize( 16 ), mMinBlobSize( 16 ), mMaxBlobSize( 256 ),
+	mBundleDepth( 0 ), mBundleSize( 4 ), mNumVariants( 64 ), mSeed( 1 )
+{
+}
+
+OscLoadGenerator::Options OscLoadGenerator::Options::parse( const vector<string>& args )
+{
+	Options options;
+	for ( const string& arg : args ) {
+		size_t equals = arg.find( '=' );
+		if ( arg.compare( 0, 2, "--" ) != 0 || equals == string::npos ) {
+			continue;
+		}
+		string name		= arg.substr( 2, equals - 2 );
+		string value	= arg.substr( equals + 1 );
+
+		double number	= 0.0;
+		size_t low		= 0;
+		size_t high		= 0;
+		bool valid		= true;
+		if ( name == "rate" ) {
+			valid = parseNumber( value, options.mRate );
+		} else if ( name == "duration" ) {
+			valid = parseNumber( value, options.mDuration );
+		} else if ( name == "addresses" ) {
+			valid = parseRange( value, low, high ) && low > 0 && low == high;
+			options.mNumAddresses = low;
+		} else if ( name == "arguments" ) {
+			valid = parseRange( value, options.mMinArguments, options.mMaxArguments );
+		} else if ( name == "types" ) {
+			valid = !value.empty() && value.find_first_not_of( "ifhdsbTFN" ) == string::npos;
+			options.mTypeTags = value;
+		} else if ( name == "strings" ) {
+			valid = parseRange( value, options.mMinStringSize, options.mMaxStringSize );
+		} else if ( name == "blobs" ) {
+			valid = parseRange( value, options.mMinBlobSize, options.mMaxBlobSize );
+		} else if ( name == "bundle-depth" ) {
+			valid = parseRange( value, low, high ) && low == high;
+			options.mBundleDepth = low;
+		} else if ( name == "bundle-size" ) {
+			valid = parseRange( value, low, high ) && low > 0 && low == high;
+			options.mBundleSize = low;
+		} else if ( name == "variants" ) {
+			valid = parseRange( value, low, high ) && low > 0 && low == high;
+			options.mNumVariants = low;
+		} else if ( name == "seed" ) {
+			valid = parseNumber( value, number );
+			options.mSeed = static_cast<uint32_t>( number );
+		} else {
+			valid = false;
+		}
+
+		if ( !valid ) {
+			throw ExcInvalidOption( arg );
+		}
+	}
+	return options;
+}
+
+string OscLoadGenerator::Options::toString() const
+{
+	stringstream ss;
+	ss << "rate: " << ( mRate > 0.0 ? to_string( static_cast<uint64_t>( mRate ) ) : string( "max" ) )
+		<< " duration: " << mDuration << "s"
+		<< " addresses: " << mNumAddresses
+		<< " arguments: " << mMinArguments << "-" << mMaxArguments
+		<< " types: " << mTypeTags
+		<< " strings: " << mMinStringSize << "-" << mMaxStringSize
+		<< " blobs: " << mMinBlobSize << "-" << mMaxBlobSize
+		<< " bundle depth: " << mBundleDepth
+		<< " bundle size: " << mBundleSize;
+	return ss.str();
+}
+
+OscLoadGenerator::Report::Report()
+	: mRate( 0.0 ), mSeconds( 0.0 ), mNumSent( 0 ), mNumReceived( 0 ), mNumInvalid( 0 ),
+	mNumBytesSent( 0 ), mNumBytesReceived( 0 )
+{
+}
+
+string OscLoadGenerator::Report::toString() const
+{
+	stringstream ss;
+	ss << "Load at " << ( mRate > 0.0 ? to_string( static_cast<uint64_t>( mRate ) ) : string( "max" ) ) << " packets/s:"
+		<< " sent: " << mNumSent
+		<< " received: " << mNumReceived
+		<< " lost: " << getNumLost() << " (" << getLossRate() * 100.0 << "%)"
+		<< " invalid: " << mNumInvalid
+		<< "\n\tthroughput: " << static_cast<uint64_t>( getThroughput() ) << " packets/s, " << getMegabitsPerSecond() << " Mbit/s"
+		<< "\n\tlatency (us): p50: " << mLatency.getPercentile( 50.0 ) / 1000.0
+		<< " p90: " << mLatency.getPercentile( 90.0 ) / 1000.0
+		<< " p99: " << mLatency.getPercentile( 99.0 ) / 1000.0
+		<< " p99.9: " << mLatency.getPercentile( 99.9 ) / 1000.0
+		<< " max: " << mLatency.getMax() / 1000.0;
+	return ss.str();
+}
+
+OscLoadGenerator::ExcInvalidOption::ExcInvalidOption( const string& option )
+{
+	mMessage = "Invalid load generator option: " + option;
+}
+
+OscLoadGeneratorRef OscLoadGenerator::create( const Options& options )
+{
+	return make_shared<OscLoadGenerator>( options );
+}
+
+OscLoadGenerator::OscLoadGenerator( const Options& options )
+	: mOptions( options ), mRandom( options.mSeed )
+{
+	mOptions.mNumAddresses	= max( mOptions.mNumAddresses, static_cast<size_t>( 1 ) );
+	mOptions.mBundleSize	= max( mOptions.mBundleSize, static_cast<size_t>( 1 ) );
+	if ( mOptions.mTypeTags.empty() ) {
+		mOptions.mTypeTags = "i";
+	}
+
+	// packets are drawn from a set made up front, so sending costs what encoding does
+	for ( size_t i = 0; i < max( mOptions.mNumVariants, static_cast<size_t>( 1 ) ); ++i ) {
+		mVariants.push_back( makeVariant() );
+	}
+}
+
+OscTree OscLoadGenerator::makeVariant()
+{
+	OscTree variant = makeElement( mOptions.mBundleDepth, true );
+	if ( variant.getEncodedSize() > kMaxPacketSize ) {
+		CI_LOG_W( "Load generator packet of " << variant.getEncodedSize() << " bytes is too large for UDP, sending a message instead" );
+		variant = makeMessage( true );
+	}
+	return variant;
+}
+
+OscTree OscLoadGenerator::makeElement( size_t depth, bool first )
+{
+	if ( depth == 0 ) {
+		return makeMessage( first );
+	}
+
+	OscTree bundle = OscTree::makeBundle();
+	for ( size_t i = 0; i < mOptions.mBundleSize; ++i ) {
+		bundle.pushBack( makeElement( depth - 1, first && i == 0 ) );
+	}
+	return bundle;
+}
+
+OscTree OscLoadGenerator::makeMessage( bool first )
+{
+	auto random = [ this ]( size_t low, size_t high ) -> size_t
+	{
+		return uniform_int_distribution<size_t>( low, high )( mRandom );
+	};
+
+	OscTree message = OscTree::makeMessage( "/load/" + to_string( random( 0, mOptions.mNumAddresses - 1 ) ) + "/value" );
+	if ( first ) {
+		// the sequence number and due time, filled in for each packet sent
+		message.pushBack( OscTree( static_cast<int64_t>( 0 ) ) );
+		message.pushBack( OscTree( static_cast<int64_t>( 0 ) ) );
+	}
+
+	size_t numArguments = random( mOptions.mMinArguments, mOptions.mMaxArguments );
+	for ( size_t i = 0; i < numArguments; ++i ) {
+		char typeTag = mOptions.mTypeTags[ random( 0, mOptions.mTypeTags.size() - 1 ) ];
+		switch ( typeTag ) {
+		case 'i':
+			message.pushBack( OscTree( static_cast<int32_t>( mRandom() ) ) );
+			break;
+		case 'f':
+			message.pushBack( OscTree( uniform_real_distribution<float>( 0.0f, 1.0f )( mRandom ) ) );
+			break;
+		case 'h':
+			message.pushBack( OscTree( static_cast<int64_t>( mRandom() ) << 16 ) );
+			break;
+		case 'd':
+			message.pushBack( OscTree( uniform_real_distribution<double>( 0.0, 1.0 )( mRandom ) ) );
+			break;
+		case 's': {
+			string value( random( mOptions.mMinStringSize, mOptions.mMaxStringSize ), ' ' );
+			for ( char& c : value ) {
+				c = static_cast<char>( 'a' + random( 0, 25 ) );
+			}
+			message.pushBack( OscTree( value ) );
+			break;
+		}
+		case 'b': {
+			vector<uint8_t> value( random( mOptions.mMinBlobSize, mOptions.mMaxBlobSize ) );
+			for ( uint8_t& byte : value ) {
+				byte = static_cast<uint8_t>( mRandom() );
+			}
+			message.pushBack( OscTree( value.data(), value.size() ) );
+			break;
+		}
+		default:
+			message.pushBack( OscTree( static_cast<OscTree::TypeTag>( typeTag ) ) );
+		}
+	}
+	return message;
+}
+
+OscTree& OscLoadGenerator::getFirstMessage( OscTree& tree )
+{
+	return tree.isBundle() && tree.hasChildren() ? getFirstMessage( tree.getChild( 0 ) ) : tree;
+}
+
+BufferRef OscLoadGenerator::makePacket( uint64_t sequence, uint64_t dueTime )
+{
+	// only the header changes, so the encoder patches it in place
+	OscTree& variant = mVariants[ sequence % mVariants.size() ];
+	OscTree& message = getFirstMessage( variant );
+	message.getChild( 0 ).setValue( static_cast<int64_t>( sequence ) );
+	message.getChild( 1 ).setValue( static_cast<int64_t>( dueTime ) );
+	return variant.toBuffer();
+}
+
+OscLoadGenerator::Report OscLoadGenerator::run()
+{
+	Report report;
+	report.mRate = mOptions.mRate;
+
+	// the receiver, on a thread of its own like a real one
+	asio::io_service receiverIo;
+	OscExecutorRef receiverExecutor		= OscExecutor::create( receiverIo );
+	OscUdpTransportRef receiver			= OscUdpTransport::create( receiverExecutor );
+	vector<bool> received;
+	atomic<uint64_t> lastReceived( OscTrace::now() );
+	receiver->setReceiveHandler( [ & ]( const BufferRef& packet )
+	{
+		uint64_t now = OscTrace::now();
+		lastReceived.store( now, memory_order_relaxed );
+
+		if ( !OscTree::validate( packet->getData(), packet->getSize() ).isValid() ) {
+			++report.mNumInvalid;
+			return;
+		}
+
+		// only the headers are read, as a receiver routing on the address would
+		OscTree tree( packet, OscTree::PARSE_LAZY | OscTree::PARSE_VALIDATED );
+		OscTree& message = getFirstMessage( tree );
+		if ( !message.isMessage() || message.getNumChildren() < 2 || message.getChild( 0 ).getTypeTag() != 'h' ) {
+			++report.mNumInvalid;
+			return;
+		}
+
+		uint64_t sequence	= static_cast<uint64_t>( message.getChild( 0 ).get<int64_t>() );
+		uint64_t dueTime	= static_cast<uint64_t>( message.getChild( 1 ).get<int64_t>() );
+		if ( sequence >= received.size() ) {
+			received.resize( max( static_cast<size_t>( sequence + 1 ), received.size() * 2 ) );
+		}
+		if ( received[ sequence ] ) {
+			++report.mNumInvalid;
+			return;
+		}
+		received[ sequence ] = true;
+
+		++report.mNumReceived;
+		report.mNumBytesReceived += packet->getSize();
+		report.mLatency.record( now > dueTime ? now - dueTime : 0 );
+	} );
+
+	unique_ptr<asio::io_service::work> work( new asio::io_service::work( receiverIo ) );
+	thread receiverThread( [ &receiverIo ]() { receiverIo.run(); } );
+
+	asio::io_service senderIo;
+	OscExecutorRef senderExecutor	= OscExecutor::create( senderIo );
+	OscUdpTransportRef sender		= OscUdpTransport::create( senderExecutor );
+	sender->connect( "127.0.0.1", receiver->getLocalPort() );
+
+	// packets are due on a fixed schedule, a sender that falls behind
+	// catches up rather than sliding the schedule and hiding the delay
+	uint64_t begin		= OscTrace::now();
+	uint64_t end		= begin + static_cast<uint64_t>( mOptions.mDuration * 1e9 );
+	double interval		= mOptions.mRate > 0.0 ? 1e9 / mOptions.mRate : 0.0;
+	for ( uint64_t sequence = 0; ; ++sequence ) {
+		uint64_t now		= OscTrace::now();
+		uint64_t dueTime	= interval > 0.0 ? begin + static_cast<uint64_t>( sequence * interval ) : now;
+		if ( dueTime >= end || now >= end ) {
+			break;
+		}
+		while ( now < dueTime ) {
+			if ( dueTime - now > 1000000 ) {
+				this_thread::sleep_for( chrono::nanoseconds( dueTime - now - 500000 ) );
+			} else {
+				this_thread::yield();
+			}
+			now = OscTrace::now();
+		}
+
+		BufferRef packet = makePacket( sequence, dueTime );
+		sender->send( packet );
+		senderIo.poll();
+		senderIo.reset();
+
+		++report.mNumSent;
+		report.mNumBytesSent += packet->getSize();
+	}
+	senderIo.run();
+	report.mSeconds = ( OscTrace::now() - begin ) / 1e9;
+
+	// done once the receiver goes quiet
+	uint64_t drainTimeout = static_cast<uint64_t>( chrono::duration_cast<chrono::nanoseconds>( kDrainTimeout ).count() );
+	while ( OscTrace::now() - lastReceived.load( memory_order_relaxed ) < drainTimeout ) {
+		this_thread::sleep_for( chrono::milliseconds( 10 ) );
+	}
+
+	receiverExecutor->post( [ receiver ]() { receiver->close(); } );
+	work.reset();
+	receiverThread.join();
+	sender->close();
+
+	return report;
+}
+
+vector<OscLoadGenerator::Report> OscLoadGenerator::sweep( double startRate, double maxLossRate )
+{
+	vector<Report> reports;
+	Options options = mOptions;
+	for ( double rate = startRate; ; rate *= 2.0 ) {
+		mOptions.mRate = rate;
+		reports.push_back( run() );
+		const Report& report = reports.back();
+		CI_LOG_I( report.toString() );
+		if ( report.getLossRate() > maxLossRate || report.mNumReceived < report.mRate * mOptions.mDuration * 0.9 ) {
+			break;
+		}
+	}
+	mOptions = options;
+	return reports;
+}
@@ -0,0 +1,141 @@
+//
+//  OscLoadGenerator.h
+//
+//	Stress and soak load for OscTree receivers over loopback
+//
+//	Packets are built with the OscTree encoder from a mix of address
+//	cardinality, argument counts and types, string and blob sizes and
+//	bundle nesting, and sent at a target rate or as fast as the socket
+//	takes them. A receiver on a thread of its own parses every packet
+//	and reports loss, throughput and latency percentiles. The first
+//	message of every packet starts with its sequence number and the
+//	time it was due, so at a target rate latency counts from when the
+//	packet should have gone out and a stalled sender shows up as
+//	latency rather than hiding it. sweep() raises the rate until the
+//	receiver falls behind, to find where it saturates.
+//
+//	OscDev runs it from the command line, for example
+//		OscDev --load --rate=50000 --duration=10 --addresses=1000
+//			--arguments=1-8 --types=ifsbhd --strings=4-32 --blobs=16-1024
+//			--bundle-depth=2 --bundle-size=4
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "cinder/Exception.h"
+#include "OscMetrics.h"
+#include "OscTree.h"
+
+class OscLoadGenerator;
+typedef std::shared_ptr<OscLoadGenerator>	OscLoadGeneratorRef;
+
+class OscLoadGenerator
+{
+public:
+	struct Options
+	{
+		Options();
+
+		//! Parses options like "--rate=1000" and "--arguments=1-8", ignoring arguments that
+		//! don't start with "--". Throws ExcInvalidOption for an unknown option or bad value.
+		static Options		parse( const std::vector<std::string>& args );
+		std::string			toString() const;
+
+		//! Packets per second, zero to send as fast as possible
+		double				mRate;
+		//! Seconds to send for
+		double				mDuration;
+		//! Number of distinct addresses messages are sent to
+		size_t				mNumAddresses;
+		//! Arguments per message, besides the sequence number and time of the first
+		size_t				mMinArguments;
+		size_t				mMaxArguments;
+		//! Type tags arguments are drawn from, any of i f h d s b T F N
+		std::string			mTypeTags;
+		size_t				mMinStringSize;
+		size_t				mMaxStringSize;
+		size_t				mMinBlobSize;
+		size_t				mMaxBlobSize;
+		//! Levels of bundles around the messages, zero to send single messages
+		size_t				mBundleDepth;
+		//! Elements in each bundle
+		size_t				mBundleSize;
+		//! Number of different packets sent in turn
+		size_t				mNumVariants;
+		uint32_t			mSeed;
+	};
+
+	struct Report
+	{
+		Report();
+
+		double				mRate;
+		double				mSeconds;
+		uint64_t			mNumSent;
+		uint64_t			mNumReceived;
+		//! Packets that arrived again, or that the receiver couldn't parse
+		uint64_t			mNumInvalid;
+		uint64_t			mNumBytesSent;
+		uint64_t			mNumBytesReceived;
+		//! Nanoseconds from when a packet was due to be sent to when it was parsed
+		OscMetrics::Histogram	mLatency;
+
+		uint64_t			getNumLost() const { return mNumSent > mNumReceived ? mNumSent - mNumReceived : 0; }
+		double				getLossRate() const { return mNumSent > 0 ? static_cast<double>( getNumLost() ) / mNumSent : 0.0; }
+		//! Returns the packets received per second
+		double				getThroughput() const { return mSeconds > 0.0 ? mNumReceived / mSeconds : 0.0; }
+		double				getMegabitsPerSecond() const { return mSeconds > 0.0 ? mNumBytesReceived * 8.0 / mSeconds / 1000000.0 : 0.0; }
+		std::string			toString() const;
+	};
+
+	static OscLoadGeneratorRef	create( const Options& options = Options() );
+
+	//! Builds the packet with \a sequence number, due at \a dueTime on the steady clock in nanoseconds
+	ci::BufferRef			makePacket( uint64_t sequence, uint64_t dueTime );
+
+	//! Sends to a receiver on a new loopback socket for the duration and rate of the options,
+	//! and returns once the receiver has had the chance to catch up
+	Report					run();
+	//! Runs at \a startRate, doubling it each run, until more than \a maxLossRate of the
+	//! packets are lost or the receiver handles less than 90% of the rate. Returns every run.
+	std::vector<Report>		sweep( double startRate = 1000.0, double maxLossRate = 0.001 );
+
+	const Options&			getOptions() const { return mOptions; }
+
+	//! Base class for load generator exceptions
+	class Exception : public ci::Exception
+	{
+	};
+
+	class ExcInvalidOption : public Exception
+	{
+	public:
+		ExcInvalidOption( const std::string& option );
+
+		virtual const char* what() const throw()
+		{
+			return mMessage.c_str();
+		}
+	protected:
+		std::string			mMessage;
+	};
+
+	OscLoadGenerator( const Options& options );
+protected:
+	OscLoadGenerator( const OscLoadGenerator& );
+	OscLoadGenerator&		operator=( const OscLoadGenerator& );
+
+	OscTree					makeVariant();
+	OscTree					makeElement( size_t depth, bool first );
+	OscTree					makeMessage( bool first );
+	static OscTree&			getFirstMessage( OscTree& tree );
+
+	Options					mOptions;
+	std::mt19937			mRandom;
+	std::vector<OscTree>	mVariants;
+};
@@ -0,0 +1,100 @@
+//
+//  OscMappedFile.cpp
+//
+
+#include "OscMappedFile.h"
+
+#if defined( _WIN32 )
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+using namespace ci;
+using namespace std;
+
+OscMappedFileRef OscMappedFile::create( const fs::path& path )
+{
+	return make_shared<OscMappedFile>( path );
+}
+
+OscMappedFile::OscMappedFile( const fs::path& path )
+	: mPath( path ), mData( nullptr ), mSize( 0 )
+{
+#if defined( _WIN32 )
+	mMapping	= nullptr;
+	mFile		= ::CreateFileW( path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( mFile == INVALID_HANDLE_VALUE ) {
+		throw ExcMapFailed( path );
+	}
+
+	LARGE_INTEGER size;
+	if ( !::GetFileSizeEx( mFile, &size ) ) {
+		::CloseHandle( mFile );
+		throw ExcMapFailed( path );
+	}
+	mSize = static_cast<size_t>( size.QuadPart );
+
+	// an empty file can't be mapped, but it is still a valid (empty) file
+	if ( mSize > 0 ) {
+		mMapping = ::CreateFileMappingW( mFile, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		if ( mMapping == nullptr ) {
+			::CloseHandle( mFile );
+			throw ExcMapFailed( path );
+		}
+		mData = reinterpret_cast<const uint8_t*>( ::MapViewOfFile( mMapping, FILE_MAP_READ, 0, 0, 0 ) );
+		if ( mData == nullptr ) {
+			::CloseHandle( mMapping );
+			::CloseHandle( mFile );
+			throw ExcMapFailed( path );
+		}
+	}
+#else
+	mFile = ::open( path.string().c_str(), O_RDONLY );
+	if ( mFile < 0 ) {
+		throw ExcMapFailed( path );
+	}
+
+	struct stat st;
+	if ( ::fstat( mFile, &st ) != 0 ) {
+		::close( mFile );
+		throw ExcMapFailed( path );
+	}
+	mSize = static_cast<size_t>( st.st_size );
+
+	if ( mSize > 0 ) {
+		void* data = ::mmap( nullptr, mSize, PROT_READ, MAP_SHARED, mFile, 0 );
+		if ( data == MAP_FAILED ) {
+			::close( mFile );
+			throw ExcMapFailed( path );
+		}
+		mData = reinterpret_cast<const uint8_t*>( data );
+	}
+#endif
+}
+
+OscMappedFile::~OscMappedFile()
+{
+#if defined( _WIN32 )
+	if ( mData != nullptr ) {
+		::UnmapViewOfFile( mData );
+	}
+	if ( mMapping != nullptr ) {
+		::CloseHandle( mMapping );
+	}
+	::CloseHandle( mFile );
+#else
+	if ( mData != nullptr ) {
+		::munmap( const_cast<uint8_t*>( mData ), mSize );
+	}
+	::close( mFile );
+#endif
+}
+
+OscMappedFile::ExcMapFailed::ExcMapFailed( const fs::path& path )
+{
+	mMessage = "Failed to map file: " + path.string();
+}
@@ -0,0 +1,61 @@
+//
+//  OscMappedFile.h
+//
+//	Read-only memory mapping of a file, used by the capture
+//	and archive readers to access packets without copying
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "cinder/Exception.h"
+#include "cinder/Filesystem.h"
+
+class OscMappedFile;
+typedef std::shared_ptr<OscMappedFile> OscMappedFileRef;
+
+class OscMappedFile
+{
+public:
+	//! Maps the entire file at \a path into memory, read-only
+	static OscMappedFileRef	create( const ci::fs::path& path );
+	~OscMappedFile();
+
+	//! Returns a pointer to the first byte of the file
+	const uint8_t*			getData() const { return mData; }
+	//! Returns the size of the file in bytes
+	size_t					getSize() const { return mSize; }
+	//! Returns the path the file was mapped from
+	const ci::fs::path&		getPath() const { return mPath; }
+
+	OscMappedFile( const ci::fs::path& path );
+protected:
+	OscMappedFile( const OscMappedFile& );
+	OscMappedFile&			operator=( const OscMappedFile& );
+
+	ci::fs::path			mPath;
+	const uint8_t*			mData;
+	size_t					mSize;
+#if defined( _WIN32 )
+	void*					mFile;
+	void*					mMapping;
+#else
+	int						mFile;
+#endif
+
+public:
+	class ExcMapFailed : public ci::Exception
+	{
+	public:
+		ExcMapFailed( const ci::fs::path& path );
+
+		virtual const char* what() const throw()
+		{
+			return mMessage.c_str();
+		}
+	protected:
+		std::string			mMessage;
+	};
+};
@@ -0,0 +1,465 @@
+//
+//  OscMetrics.cpp
+//
+
+#include "OscMetrics.h"
+#include "OscAddressTable.h"
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#if defined( _MSC_VER )
+	#include <intrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	const size_t	kCacheLineSize	= 64;
+	const size_t	kMaxAddresses	= 256;
+	const uint32_t	kSampleInterval	= 64;
+
+	// counters only ever written by their own thread need no atomic add
+	void add( atomic<uint64_t>& counter, uint64_t value )
+	{
+		counter.store( counter.load( memory_order_relaxed ) + value, memory_order_relaxed );
+	}
+
+	size_t findMostSignificantBit( uint64_t value )
+	{
+#if defined( _MSC_VER ) && defined( _WIN64 )
+		unsigned long index;
+		_BitScanReverse64( &index, value );
+		return index;
+#elif defined( _MSC_VER )
+		unsigned long index;
+		if ( _BitScanReverse( &index, static_cast<unsigned long>( value >> 32 ) ) ) {
+			return index + 32;
+		}
+		_BitScanReverse( &index, static_cast<unsigned long>( value ) );
+		return index;
+#else
+		return 63 - __builtin_clzll( value );
+#endif
+	}
+
+	const char* getParseErrorName( size_t error )
+	{
+		switch ( error ) {
+			case OscTree::PARSE_OK:						return "ok";
+			case OscTree::PARSE_MALFORMED_ADDRESS:		return "malformed address";
+			case OscTree::PARSE_MALFORMED_TYPE_TAGS:	return "malformed type tags";
+			case OscTree::PARSE_MALFORMED_BUNDLE:		return "malformed bundle";
+			case OscTree::PARSE_UNKNOWN_TYPE_TAG:		return "unknown type tag";
+			case OscTree::PARSE_TRUNCATED:				return "truncated";
+		}
+		return "unknown";
+	}
+}
+
+// Counters owned by a single recording thread. The padding keeps
+// blocks of different threads off each other's cache lines. Message
+// and byte counts are atomics written only by the owning thread, so
+// counting a message takes no lock. The spin lock guards everything
+// else, and is only ever contended while a snapshot is taken.
+struct OscMetrics::ThreadCounters
+{
+	struct Address
+	{
+		Address() : mNumMessages( 0 ), mNumBytes( 0 ) {}
+
+		atomic<uint64_t>			mNumMessages;
+		atomic<uint64_t>			mNumBytes;
+		OscMetrics::Histogram		mDecodeLatency;
+	};
+
+	ThreadCounters()
+		: mThreadId( this_thread::get_id() ), mResetPending( false )
+	{
+		mLock.clear();
+		fill( begin( mErrors ), end( mErrors ), 0 );
+	}
+
+	void lock()
+	{
+		while ( mLock.test_and_set( memory_order_acquire ) ) {
+			this_thread::yield();
+		}
+	}
+
+	void unlock()
+	{
+		mLock.clear( memory_order_release );
+	}
+
+	// Called by the owning thread only. Adding an address changes
+	// what a snapshot reads, so that alone takes the lock.
+	Address& getAddress( uint32_t addressId, const string& address, size_t maxAddresses )
+	{
+		if ( addressId == OscAddressTable::kInvalidId ) {
+			return getUninternedAddress( address, maxAddresses );
+		}
+		if ( addressId < mSlots.size() && mSlots[ addressId ] != nullptr ) {
+			return *mSlots[ addressId ];
+		}
+		if ( mAddresses.size() >= maxAddresses ) {
+			return mOtherAddresses;
+		}
+
+		lock();
+		if ( addressId >= mSlots.size() ) {
+			mSlots.resize( addressId + 1, nullptr );
+		}
+		mAddresses.emplace_back( new Address() );
+		mAddressIds.push_back( addressId );
+		mAddressNames.emplace_back();
+		mSlots[ addressId ] = mAddresses.back().get();
+		unlock();
+
+		return *mSlots[ addressId ];
+	}
+
+	// Called by the owning thread only. An address that collides with
+	// the hash of another counts as other, rather than being merged.
+	Address& getUninternedAddress( const string& address, size_t maxAddresses )
+	{
+		if ( address.empty() ) {
+			return mOtherAddresses;
+		}
+
+		uint32_t hash	= OscAddressTable::hashAddress( address.data(), address.size() );
+		auto it			= mHashedAddresses.find( hash );
+		if ( it != mHashedAddresses.end() ) {
+			return mAddressNames[ it->second ] == address ? *mAddresses[ it->second ] : mOtherAddresses;
+		}
+		if ( mAddresses.size() >= maxAddresses ) {
+			return mOtherAddresses;
+		}
+
+		lock();
+		mHashedAddresses[ hash ] = mAddresses.size();
+		mAddresses.emplace_back( new Address() );
+		mAddressIds.push_back( static_cast<uint32_t>( OscAddressTable::kInvalidId ) );
+		mAddressNames.push_back( address );
+		unlock();
+
+		return *mAddresses.back();
+	}
+
+	// Called by the owning thread only, with the lock held
+	void clear()
+	{
+		mSlots.clear();
+		mHashedAddresses.clear();
+		mAddressIds.clear();
+		mAddressNames.clear();
+		mAddresses.clear();
+		mOtherAddresses.mNumMessages.store( 0, memory_order_relaxed );
+		mOtherAddresses.mNumBytes.store( 0, memory_order_relaxed );
+		mOtherAddresses.mDecodeLatency.reset();
+		fill( begin( mErrors ), end( mErrors ), 0 );
+		mDecodeLatency.reset();
+	}
+
+	char											mPaddingBefore[ kCacheLineSize ];
+	atomic_flag										mLock;
+	thread::id										mThreadId;
+	// set by reset(), the owning thread clears its counters before it next records
+	atomic<bool>									mResetPending;
+	// the stats of every address ID, null until it's recorded
+	vector<Address*>								mSlots;
+	// the index in mAddresses of every address that was never interned, by its hash
+	unordered_map<uint32_t, size_t>					mHashedAddresses;
+	vector<uint32_t>								mAddressIds;
+	// empty for interned addresses
+	vector<string>									mAddressNames;
+	vector<unique_ptr<Address>>						mAddresses;
+	Address											mOtherAddresses;
+	uint64_t										mErrors[ OscTree::PARSE_ERROR_COUNT ];
+	OscMetrics::Histogram							mDecodeLatency;
+	char											mPaddingAfter[ kCacheLineSize ];
+};
+
+OscMetrics::Histogram::Histogram()
+{
+	reset();
+}
+
+size_t OscMetrics::Histogram::getBucketIndex( uint64_t value )
+{
+	if ( value < kSubBuckets ) {
+		return static_cast<size_t>( value );
+	}
+
+	size_t exponent = findMostSignificantBit( value );
+	if ( exponent > kMaxExponent ) {
+		return kNumBuckets - 1;
+	}
+
+	size_t shift = exponent - kSubBucketBits;
+	return ( shift + 1 ) * kSubBuckets + static_cast<size_t>( ( value >> shift ) & ( kSubBuckets - 1 ) );
+}
+
+uint64_t OscMetrics::Histogram::getBucketValue( size_t index )
+{
+	if ( index < kSubBuckets ) {
+		return index;
+	}
+
+	// report the middle of the bucket
+	size_t shift		= index / kSubBuckets - 1;
+	uint64_t subBucket	= index % kSubBuckets;
+	uint64_t lower		= ( kSubBuckets + subBucket ) << shift;
+
+	return lower + ( ( static_cast<uint64_t>( 1 ) << shift ) >> 1 );
+}
+
+void OscMetrics::Histogram::record( uint64_t value )
+{
+	++mBuckets[ getBucketIndex( value ) ];
+	++mCount;
+	mSum += value;
+	mMin = min( mMin, value );
+	mMax = max( mMax, value );
+}
+
+void OscMetrics::Histogram::merge( const Histogram& other )
+{
+	for ( size_t i = 0; i < kNumBuckets; ++i ) {
+		mBuckets[ i ] += other.mBuckets[ i ];
+	}
+	mCount	+= other.mCount;
+	mSum	+= other.mSum;
+	mMin	= min( mMin, other.mMin );
+	mMax	= max( mMax, other.mMax );
+}
+
+void OscMetrics::Histogram::reset()
+{
+	fill( begin( mBuckets ), end( mBuckets ), 0 );
+	mCount	= 0;
+	mSum	= 0;
+	mMin	= numeric_limits<uint64_t>::max();
+	mMax	= 0;
+}
+
+double OscMetrics::Histogram::getMean() const
+{
+	return mCount > 0 ? static_cast<double>( mSum ) / static_cast<double>( mCount ) : 0.0;
+}
+
+uint64_t OscMetrics::Histogram::getPercentile( double percentile ) const
+{
+	if ( mCount == 0 ) {
+		return 0;
+	}
+
+	percentile		= min( max( percentile, 0.0 ), 100.0 );
+	uint64_t target	= max( static_cast<uint64_t>( 1 ), static_cast<uint64_t>( percentile / 100.0 * mCount + 0.5 ) );
+
+	uint64_t count = 0;
+	for ( size_t i = 0; i < kNumBuckets; ++i ) {
+		count += mBuckets[ i ];
+		if ( count >= target ) {
+			return min( max( getBucketValue( i ), getMin() ), mMax );
+		}
+	}
+
+	return mMax;
+}
+
+OscMetrics::Snapshot::Snapshot()
+{
+	fill( begin( mErrors ), end( mErrors ), 0 );
+}
+
+string OscMetrics::Snapshot::toString() const
+{
+	stringstream ss;
+
+	ss << "Decode latency (ns):"
+		<< " timed: " << mDecodeLatency.getCount()
+		<< " mean: " << static_cast<uint64_t>( mDecodeLatency.getMean() )
+		<< " p50: " << mDecodeLatency.getPercentile( 50.0 )
+		<< " p99: " << mDecodeLatency.getPercentile( 99.0 )
+		<< " max: " << mDecodeLatency.getMax();
+
+	for ( size_t i = OscTree::PARSE_OK + 1; i < OscTree::PARSE_ERROR_COUNT; ++i ) {
+		if ( mErrors[ i ] > 0 ) {
+			ss << "\n\t" << getParseErrorName( i ) << ": " << mErrors[ i ];
+		}
+	}
+
+	auto printAddress = [ &ss ]( const string& name, const AddressStats& stats ) -> void
+	{
+		ss << "\n\t" << name
+			<< " messages: " << stats.mNumMessages
+			<< " bytes: " << stats.mNumBytes
+			<< " p50: " << stats.mDecodeLatency.getPercentile( 50.0 )
+			<< " p99: " << stats.mDecodeLatency.getPercentile( 99.0 );
+	};
+	for ( const auto& address : mAddresses ) {
+		printAddress( address.first, address.second );
+	}
+	if ( mOtherAddresses.mNumMessages > 0 ) {
+		printAddress( "other addresses", mOtherAddresses );
+	}
+
+	for ( const auto& gauge : mGauges ) {
+		ss << "\n\t" << gauge.first << ": " << gauge.second;
+	}
+
+	return ss.str();
+}
+
+OscMetrics& OscMetrics::get()
+{
+	static OscMetrics metrics;
+	return metrics;
+}
+
+OscMetrics::OscMetrics()
+	: mEnabled( false ), mMaxAddresses( kMaxAddresses ), mSampleInterval( kSampleInterval )
+{
+}
+
+OscMetrics::ThreadCounters* OscMetrics::getThreadCounters()
+{
+	// cache the lookup for the most recently used metrics
+	// instance, in practice there is only OscMetrics::get()
+	static thread_local const OscMetrics*	sOwner		= nullptr;
+	static thread_local ThreadCounters*		sCounters	= nullptr;
+
+	if ( sOwner != this ) {
+		lock_guard<mutex> lock( mMutex );
+
+		ThreadCounters* counters	= nullptr;
+		thread::id threadId			= this_thread::get_id();
+		for ( const auto& threadCounters : mThreadCounters ) {
+			if ( threadCounters->mThreadId == threadId ) {
+				counters = threadCounters.get();
+				break;
+			}
+		}
+
+		if ( counters == nullptr ) {
+			mThreadCounters.emplace_back( new ThreadCounters() );
+			counters = mThreadCounters.back().get();
+		}
+
+		sOwner		= this;
+		sCounters	= counters;
+	}
+
+	if ( sCounters->mResetPending.load( memory_order_acquire ) ) {
+		sCounters->lock();
+		sCounters->clear();
+		sCounters->mResetPending.store( false, memory_order_relaxed );
+		sCounters->unlock();
+	}
+
+	return sCounters;
+}
+
+void OscMetrics::recordDecode( uint32_t addressId, const string& address, size_t numBytes )
+{
+	ThreadCounters* counters			= getThreadCounters();
+	ThreadCounters::Address& stats		= counters->getAddress( addressId, address, mMaxAddresses.load( memory_order_relaxed ) );
+	add( stats.mNumMessages, 1 );
+	add( stats.mNumBytes, numBytes );
+}
+
+void OscMetrics::recordDecode( uint32_t addressId, const string& address, size_t numBytes, uint64_t nanoseconds )
+{
+	ThreadCounters* counters			= getThreadCounters();
+	ThreadCounters::Address& stats		= counters->getAddress( addressId, address, mMaxAddresses.load( memory_order_relaxed ) );
+	add( stats.mNumMessages, 1 );
+	add( stats.mNumBytes, numBytes );
+
+	counters->lock();
+	stats.mDecodeLatency.record( nanoseconds );
+	counters->mDecodeLatency.record( nanoseconds );
+	counters->unlock();
+}
+
+void OscMetrics::recordError( OscTree::ParseError error )
+{
+	ThreadCounters* counters = getThreadCounters();
+	counters->lock();
+	++counters->mErrors[ error ];
+	counters->unlock();
+}
+
+OscMetrics::Gauge& OscMetrics::getGauge( const string& name )
+{
+	lock_guard<mutex> lock( mMutex );
+
+	unique_ptr<Gauge>& gauge = mGauges[ name ];
+	if ( !gauge ) {
+		gauge.reset( new Gauge() );
+	}
+
+	return *gauge;
+}
+
+OscMetrics::Snapshot OscMetrics::snapshot() const
+{
+	Snapshot snapshot;
+
+	auto merge = []( AddressStats& stats, const ThreadCounters::Address& other ) -> void
+	{
+		stats.mNumMessages	+= other.mNumMessages.load( memory_order_relaxed );
+		stats.mNumBytes		+= other.mNumBytes.load( memory_order_relaxed );
+		stats.mDecodeLatency.merge( other.mDecodeLatency );
+	};
+
+	lock_guard<mutex> lock( mMutex );
+
+	for ( const auto& counters : mThreadCounters ) {
+		counters->lock();
+
+		// counters reset since their thread last recorded are as good as zero
+		if ( counters->mResetPending.load( memory_order_relaxed ) ) {
+			counters->unlock();
+			continue;
+		}
+
+		for ( size_t i = 0; i < counters->mAddresses.size(); ++i ) {
+			uint32_t addressId		= counters->mAddressIds[ i ];
+			const string& address	= addressId != OscAddressTable::kInvalidId ? OscAddressTable::get().getAddress( addressId ) : counters->mAddressNames[ i ];
+			merge( snapshot.mAddresses[ address ], *counters->mAddresses[ i ] );
+		}
+		merge( snapshot.mOtherAddresses, counters->mOtherAddresses );
+
+		for ( size_t i = 0; i < OscTree::PARSE_ERROR_COUNT; ++i ) {
+			snapshot.mErrors[ i ] += counters->mErrors[ i ];
+		}
+
+		snapshot.mDecodeLatency.merge( counters->mDecodeLatency );
+
+		counters->unlock();
+	}
+
+	for ( const auto& gauge : mGauges ) {
+		snapshot.mGauges[ gauge.first ] = gauge.second->get();
+	}
+
+	return snapshot;
+}
+
+void OscMetrics::reset()
+{
+	lock_guard<mutex> lock( mMutex );
+
+	// a thread may be counting at this very moment, so it clears its own
+	for ( const auto& counters : mThreadCounters ) {
+		counters->mResetPending.store( true, memory_order_release );
+	}
+
+	for ( const auto& gauge : mGauges ) {
+		gauge.second->set( 0 );
+	}
+}
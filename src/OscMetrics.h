@@ -0,0 +1,168 @@
+//
+//  OscMetrics.h
+//
+//	Low overhead receive and decode metrics
+//
+//	Every thread that records gets its own cache line padded
+//	block of counters, so recording never contends with other
+//	threads. Aggregation across threads only happens when a
+//	snapshot is taken, off the hot path.
+//
+//	Messages are counted by their interned address ID, so
+//	counting one costs an array lookup rather than hashing its
+//	address. Each thread keeps its own stats for at most
+//	getMaxAddresses() addresses. An address that was never interned
+//	is keyed by its hash instead, within the same limit. Messages
+//	for any address past the limit share a single overflow entry,
+//	so a flood of made up addresses can't grow the metrics.
+//	Every message is counted, but only one in getSampleInterval()
+//	is timed, as reading the clock costs more than the rest.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "OscTree.h"
+
+class OscMetrics
+{
+public:
+	//! Log-linear latency histogram in the spirit of HdrHistogram.
+	//! Each power of two is split into 8 linear sub-buckets, so any
+	//! recorded value is reported within 12.5% of its true value.
+	class Histogram
+	{
+	public:
+		Histogram();
+
+		void					record( uint64_t value );
+		void					merge( const Histogram& other );
+		void					reset();
+
+		uint64_t				getCount() const { return mCount; }
+		uint64_t				getMin() const { return mCount > 0 ? mMin : 0; }
+		uint64_t				getMax() const { return mMax; }
+		double					getMean() const;
+		//! Returns the value at \a percentile ( 0 - 100 )
+		uint64_t				getPercentile( double percentile ) const;
+
+	protected:
+		static const size_t		kSubBucketBits	= 3;
+		static const size_t		kSubBuckets		= 1 << kSubBucketBits;
+		// values are clamped at 2^40, about 18 minutes in nanoseconds
+		static const size_t		kMaxExponent	= 40;
+		static const size_t		kNumBuckets		= ( kMaxExponent - kSubBucketBits + 2 ) * kSubBuckets;
+
+		static size_t			getBucketIndex( uint64_t value );
+		static uint64_t			getBucketValue( size_t index );
+
+		uint64_t				mBuckets[ kNumBuckets ];
+		uint64_t				mCount;
+		uint64_t				mSum;
+		uint64_t				mMin;
+		uint64_t				mMax;
+	};
+
+	//! A named value, such as a queue depth. Look a gauge up once
+	//! and keep the pointer, setting it is a relaxed atomic store.
+	class Gauge
+	{
+	public:
+		Gauge() : mValue( 0 ) {}
+
+		void					set( int64_t value ) { mValue.store( value, std::memory_order_relaxed ); }
+		void					add( int64_t delta ) { mValue.fetch_add( delta, std::memory_order_relaxed ); }
+		int64_t					get() const { return mValue.load( std::memory_order_relaxed ); }
+	protected:
+		std::atomic<int64_t>	mValue;
+	};
+
+	struct AddressStats
+	{
+		AddressStats() : mNumMessages( 0 ), mNumBytes( 0 ) {}
+
+		uint64_t				mNumMessages;
+		uint64_t				mNumBytes;
+		Histogram				mDecodeLatency;
+	};
+
+	struct Snapshot
+	{
+		Snapshot();
+
+		std::map<std::string, AddressStats>	mAddresses;
+		//! Messages for addresses past the limit, or never interned
+		AddressStats						mOtherAddresses;
+		uint64_t							mErrors[ OscTree::PARSE_ERROR_COUNT ];
+		Histogram							mDecodeLatency;
+		std::map<std::string, int64_t>		mGauges;
+
+		//! Returns a human readable summary of the snapshot
+		std::string							toString() const;
+	};
+
+	//! Returns the metrics the OscTree parser records to
+	static OscMetrics&			get();
+
+	//! Enables or disables recording, metrics are disabled by default
+	void						setEnabled( bool enabled ) { mEnabled.store( enabled, std::memory_order_relaxed ); }
+	bool						isEnabled() const { return mEnabled.load( std::memory_order_relaxed ); }
+
+	//! Returns true if the calling thread's next decode is one to time
+	bool						isTimingDecode()
+	{
+		// asked for every message, so it's inline and keeps its own count
+		static thread_local uint32_t sUntilTimed = 1;
+		if ( --sUntilTimed > 0 ) {
+			return false;
+		}
+		sUntilTimed = std::max( getSampleInterval(), static_cast<uint32_t>( 1 ) );
+		return true;
+	}
+	//! Records a decoded message on the calling thread's counters. \a addressId
+	//! is the message's interned address, or OscAddressTable::kInvalidId.
+	//! \a address is only read for the latter, and may be empty otherwise.
+	void						recordDecode( uint32_t addressId, const std::string& address, size_t numBytes );
+	//! Records a decoded message that was timed, see isTimingDecode()
+	void						recordDecode( uint32_t addressId, const std::string& address, size_t numBytes, uint64_t nanoseconds );
+	//! Records a malformed packet on the calling thread's counters
+	void						recordError( OscTree::ParseError error );
+
+	//! Limits the number of addresses each thread keeps stats for,
+	//! 256 by default. Each costs a histogram of about 2.5KB.
+	void						setMaxAddresses( size_t maxAddresses ) { mMaxAddresses.store( maxAddresses, std::memory_order_relaxed ); }
+	size_t						getMaxAddresses() const { return mMaxAddresses.load( std::memory_order_relaxed ); }
+	//! Times one decode in every \a interval on each thread, 64 by default.
+	//! The latency histograms only hold the decodes that were timed.
+	void						setSampleInterval( uint32_t interval ) { mSampleInterval.store( interval, std::memory_order_relaxed ); }
+	uint32_t					getSampleInterval() const { return mSampleInterval.load( std::memory_order_relaxed ); }
+
+	//! Returns the gauge named \a name, creating it if needed. The
+	//! returned reference stays valid for the lifetime of the metrics.
+	Gauge&						getGauge( const std::string& name );
+
+	//! Aggregates the counters of every thread
+	Snapshot					snapshot() const;
+	//! Clears the counters of every thread and every gauge
+	void						reset();
+
+	OscMetrics();
+protected:
+	struct ThreadCounters;
+
+	ThreadCounters*				getThreadCounters();
+
+	std::atomic<bool>									mEnabled;
+	std::atomic<size_t>									mMaxAddresses;
+	std::atomic<uint32_t>								mSampleInterval;
+	mutable std::mutex									mMutex;
+	std::vector<std::unique_ptr<ThreadCounters>>		mThreadCounters;
+	std::map<std::string, std::unique_ptr<Gauge>>		mGauges;
+};
@@ -0,0 +1,54 @@
+//
+//  OscPacket.cpp
+//
+
+#include "OscPacket.h"
+#include <cstring>
+
+using namespace ci;
+using namespace std;
+
+OscPacketRef OscPacket::create( const OscTree& tree )
+{
+	// the tree copies its encoding before patching it while anyone else holds it,
+	// so the packet can share it rather than copy it
+	return make_shared<OscPacket>( tree.toBuffer() );
+}
+
+OscPacketRef OscPacket::create( const BufferRef& buffer )
+{
+	return make_shared<OscPacket>( buffer );
+}
+
+OscPacket::OscPacket( const BufferRef& buffer )
+	: mBuffer( buffer ), mAddressHash( hashAddress( "", 0 ) ), mAddressId( OscAddressTable::kInvalidId ), mIsBundle( false ), mIsMessage( false )
+{
+	const char* data	= static_cast<const char*>( mBuffer->getData() );
+	size_t size			= mBuffer->getSize();
+
+	if ( size >= 16 && memcmp( data, "#bundle", 8 ) == 0 ) {
+		mIsBundle = true;
+		return;
+	}
+	if ( size == 0 || data[ 0 ] != '/' ) {
+		return;
+	}
+
+	const char* addressEnd = static_cast<const char*>( memchr( data, 0, size ) );
+	if ( addressEnd == nullptr ) {
+		return;
+	}
+	mIsMessage		= true;
+	mAddress		= OscTree::StringView( data, addressEnd - data );
+	mAddressHash	= hashAddress( mAddress.data(), mAddress.size() );
+	mAddressId		= OscAddressTable::get().find( mAddress.data(), mAddress.size(), mAddressHash );
+
+	// the type tags start at the next multiple of four after the address' terminator
+	size_t offset = ( mAddress.size() + 4 ) & ~static_cast<size_t>( 3 );
+	if ( offset < size && data[ offset ] == ',' ) {
+		const char* typeTagsEnd = static_cast<const char*>( memchr( data + offset, 0, size - offset ) );
+		if ( typeTagsEnd != nullptr ) {
+			mTypeTags = OscTree::StringView( data + offset + 1, typeTagsEnd - data - offset - 1 );
+		}
+	}
+}
@@ -0,0 +1,69 @@
+//
+//  OscPacket.h
+//
+//	An encoded OSC packet that can be shared but not modified
+//
+//	Encoding a tree into a packet happens once, after that the
+//	packet can be handed to any number of threads, a logger, a
+//	recorder and several transports, without copying: shared_ptr
+//	counts its references atomically and nothing can write to the
+//	data. The header is read when the packet is created, so later
+//	stages can route on the address, its hash, its interned ID or
+//	the type tags without parsing the packet again.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "cinder/Buffer.h"
+#include "OscTree.h"
+
+class OscPacket;
+typedef std::shared_ptr<const OscPacket>	OscPacketRef;
+
+class OscPacket
+{
+public:
+	//! Encodes \a tree into a packet
+	static OscPacketRef		create( const OscTree& tree );
+	//! Wraps encoded data in a packet without copying it, \a buffer must not be modified afterwards
+	static OscPacketRef		create( const ci::BufferRef& buffer );
+
+	const void*				getData() const { return mBuffer->getData(); }
+	size_t					getSize() const { return mBuffer->getSize(); }
+	//! Returns the encoded data to hand to a transport. Read only, other threads may be sending it.
+	const ci::BufferRef&	getBuffer() const { return mBuffer; }
+
+	bool					isBundle() const { return mIsBundle; }
+	bool					isMessage() const { return mIsMessage; }
+
+	//! Returns the address of a message, empty for a bundle or malformed data
+	const OscTree::StringView&	getAddress() const { return mAddress; }
+	//! Returns the hash of the address, as hashAddress() computes it
+	uint32_t				getAddressHash() const { return mAddressHash; }
+	//! Returns the ID the address is interned as, the same as OscTree::getAddressId(). The
+	//! address is only looked up, kInvalidId if it was never interned.
+	uint32_t				getAddressId() const { return mAddressId; }
+	//! Returns the type tags of a message without the leading comma, one per argument
+	const OscTree::StringView&	getTypeTags() const { return mTypeTags; }
+
+	//! Parses the packet into a tree
+	OscTree					toTree() const { return OscTree( mBuffer ); }
+
+	//! 32-bit FNV-1a hash of the \a length characters at \a address
+	static uint32_t			hashAddress( const char* address, size_t length ) { return OscAddressTable::hashAddress( address, length ); }
+
+	explicit OscPacket( const ci::BufferRef& buffer );
+protected:
+	OscPacket( const OscPacket& );
+	OscPacket&				operator=( const OscPacket& );
+
+	ci::BufferRef			mBuffer;
+	OscTree::StringView		mAddress;
+	OscTree::StringView		mTypeTags;
+	uint32_t				mAddressHash;
+	uint32_t				mAddressId;
+	bool					mIsBundle;
+	bool					mIsMessage;
+};
@@ -0,0 +1,880 @@
+//
+//  OscQuery.cpp
+//
+
+#include "OscQuery.h"
+#include "cinder/Log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	const char*		kWebSocketGuid		= "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	// WebSocket frames larger than this are refused, commands are a line of JSON
+	const size_t	kMaxFrameSize		= 1 << 20;
+	const size_t	kMaxRequestSize		= 1 << 16;
+	// a client with this many writes queued isn't reading and is disconnected,
+	// values pushed are coalesced by address so only many listened addresses get here
+	const size_t	kMaxQueuedWrites	= 4096;
+
+	const uint8_t	kOpcodeText			= 0x1;
+	const uint8_t	kOpcodeBinary		= 0x2;
+	const uint8_t	kOpcodeClose		= 0x8;
+	const uint8_t	kOpcodePing			= 0x9;
+	const uint8_t	kOpcodePong			= 0xA;
+
+	string toBase64( const uint8_t* data, size_t size )
+	{
+		static const char* kAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		string out;
+		out.reserve( ( size + 2 ) / 3 * 4 );
+		for ( size_t i = 0; i < size; i += 3 ) {
+			uint32_t n = static_cast<uint32_t>( data[ i ] ) << 16;
+			if ( i + 1 < size ) {
+				n |= static_cast<uint32_t>( data[ i + 1 ] ) << 8;
+			}
+			if ( i + 2 < size ) {
+				n |= data[ i + 2 ];
+			}
+			out += kAlphabet[ ( n >> 18 ) & 63 ];
+			out += kAlphabet[ ( n >> 12 ) & 63 ];
+			out += i + 1 < size ? kAlphabet[ ( n >> 6 ) & 63 ] : '=';
+			out += i + 2 < size ? kAlphabet[ n & 63 ] : '=';
+		}
+		return out;
+	}
+
+	// Only for the WebSocket handshake, SHA-1 is not used for anything that needs to be secure
+	void sha1( const string& message, uint8_t digest[ 20 ] )
+	{
+		uint32_t h[ 5 ] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+		vector<uint8_t> data( message.begin(), message.end() );
+		uint64_t numBits = static_cast<uint64_t>( message.size() ) * 8;
+		data.push_back( 0x80 );
+		while ( data.size() % 64 != 56 ) {
+			data.push_back( 0 );
+		}
+		for ( int i = 7; i >= 0; --i ) {
+			data.push_back( static_cast<uint8_t>( numBits >> ( i * 8 ) ) );
+		}
+
+		auto rotate = []( uint32_t x, int n ) { return ( x << n ) | ( x >> ( 32 - n ) ); };
+		for ( size_t chunk = 0; chunk < data.size(); chunk += 64 ) {
+			uint32_t w[ 80 ];
+			for ( int i = 0; i < 16; ++i ) {
+				const uint8_t* p = &data[ chunk + i * 4 ];
+				w[ i ] = ( static_cast<uint32_t>( p[ 0 ] ) << 24 ) | ( static_cast<uint32_t>( p[ 1 ] ) << 16 ) |
+					( static_cast<uint32_t>( p[ 2 ] ) << 8 ) | p[ 3 ];
+			}
+			for ( int i = 16; i < 80; ++i ) {
+				w[ i ] = rotate( w[ i - 3 ] ^ w[ i - 8 ] ^ w[ i - 14 ] ^ w[ i - 16 ], 1 );
+			}
+
+			uint32_t a = h[ 0 ], b = h[ 1 ], c = h[ 2 ], d = h[ 3 ], e = h[ 4 ];
+			for ( int i = 0; i < 80; ++i ) {
+				uint32_t f, k;
+				if ( i < 20 ) {
+					f = ( b & c ) | ( ~b & d );
+					k = 0x5A827999;
+				} else if ( i < 40 ) {
+					f = b ^ c ^ d;
+					k = 0x6ED9EBA1;
+				} else if ( i < 60 ) {
+					f = ( b & c ) | ( b & d ) | ( c & d );
+					k = 0x8F1BBCDC;
+				} else {
+					f = b ^ c ^ d;
+					k = 0xCA62C1D6;
+				}
+				uint32_t t = rotate( a, 5 ) + f + e + k + w[ i ];
+				e = d;
+				d = c;
+				c = rotate( b, 30 );
+				b = a;
+				a = t;
+			}
+			h[ 0 ] += a;
+			h[ 1 ] += b;
+			h[ 2 ] += c;
+			h[ 3 ] += d;
+			h[ 4 ] += e;
+		}
+
+		for ( int i = 0; i < 20; ++i ) {
+			digest[ i ] = static_cast<uint8_t>( h[ i / 4 ] >> ( 24 - ( i % 4 ) * 8 ) );
+		}
+	}
+
+	void appendJsonString( string& out, const char* data, size_t size )
+	{
+		out += '"';
+		for ( size_t i = 0; i < size; ++i ) {
+			char c = data[ i ];
+			switch ( c ) {
+			case '"':	out += "\\\"";	break;
+			case '\\':	out += "\\\\";	break;
+			case '\n':	out += "\\n";	break;
+			case '\r':	out += "\\r";	break;
+			case '\t':	out += "\\t";	break;
+			default:
+				if ( static_cast<uint8_t>( c ) < 0x20 ) {
+					char escaped[ 8 ];
+					snprintf( escaped, sizeof( escaped ), "\\u%04x", c );
+					out += escaped;
+				} else {
+					out += c;
+				}
+			}
+		}
+		out += '"';
+	}
+
+	void appendJsonString( string& out, const string& value )
+	{
+		appendJsonString( out, value.data(), value.size() );
+	}
+
+	void appendJsonNumber( string& out, double value, const char* format )
+	{
+		// JSON has no infinity or NaN
+		if ( std::isnan( value ) || std::isinf( value ) ) {
+			out += "null";
+			return;
+		}
+		char text[ 32 ];
+		snprintf( text, sizeof( text ), format, value );
+		out += text;
+	}
+
+	void appendJsonValue( string& out, const OscTree& argument )
+	{
+		char text[ 32 ];
+		switch ( argument.getTypeTag() ) {
+		case 'i':
+		case 'm':
+			snprintf( text, sizeof( text ), "%d", argument.get<int32_t>() );
+			out += text;
+			break;
+		case 'c':
+			text[ 0 ] = static_cast<char>( argument.get<int32_t>() );
+			appendJsonString( out, text, 1 );
+			break;
+		case 'r':
+			snprintf( text, sizeof( text ), "\"#%08x\"", static_cast<uint32_t>( argument.get<int32_t>() ) );
+			out += text;
+			break;
+		case 'h':
+			snprintf( text, sizeof( text ), "%lld", static_cast<long long>( argument.get<int64_t>() ) );
+			out += text;
+			break;
+		case 't':
+			snprintf( text, sizeof( text ), "%llu", static_cast<unsigned long long>( argument.get<OscTree::TimeTag>().mTimeTag ) );
+			out += text;
+			break;
+		case 'f':
+			appendJsonNumber( out, argument.get<float>(), "%.9g" );
+			break;
+		case 'd':
+			appendJsonNumber( out, argument.get<double>(), "%.17g" );
+			break;
+		case 's':
+		case 'S': {
+			OscTree::StringView value = argument.get<OscTree::StringView>();
+			appendJsonString( out, value.data(), value.size() );
+			break;
+		}
+		case 'b': {
+			OscTree::BlobSpan value = argument.get<OscTree::BlobSpan>();
+			out += '"' + toBase64( value.data(), value.size() ) + '"';
+			break;
+		}
+		case 'T':
+			out += "true";
+			break;
+		case 'F':
+			out += "false";
+			break;
+		default:
+			out += "null";
+		}
+	}
+
+	// Returns the string value of \a key in a flat JSON object, enough for WebSocket commands
+	string getJsonString( const string& json, const string& key )
+	{
+		size_t pos = json.find( '"' + key + '"' );
+		if ( pos == string::npos ) {
+			return "";
+		}
+		pos = json.find( ':', pos + key.size() + 2 );
+		if ( pos == string::npos ) {
+			return "";
+		}
+		pos = json.find( '"', pos );
+		if ( pos == string::npos ) {
+			return "";
+		}
+		string value;
+		for ( ++pos; pos < json.size() && json[ pos ] != '"'; ++pos ) {
+			if ( json[ pos ] == '\\' && pos + 1 < json.size() ) {
+				++pos;
+			}
+			value += json[ pos ];
+		}
+		return value;
+	}
+
+	string decodeUrl( const string& url )
+	{
+		string out;
+		for ( size_t i = 0; i < url.size(); ++i ) {
+			if ( url[ i ] == '%' && i + 2 < url.size() && isxdigit( url[ i + 1 ] ) && isxdigit( url[ i + 2 ] ) ) {
+				out += static_cast<char>( strtol( url.substr( i + 1, 2 ).c_str(), nullptr, 16 ) );
+				i += 2;
+			} else {
+				out += url[ i ];
+			}
+		}
+		return out;
+	}
+
+	// Returns the value of header \a name in \a request, names are not case sensitive
+	string getHeader( const string& request, const string& name )
+	{
+		size_t lineBegin = request.find( "\r\n" );
+		while ( lineBegin != string::npos ) {
+			lineBegin += 2;
+			size_t lineEnd	= request.find( "\r\n", lineBegin );
+			size_t colon	= request.find( ':', lineBegin );
+			if ( lineEnd == string::npos || colon == string::npos || colon > lineEnd ) {
+				break;
+			}
+			if ( colon - lineBegin == name.size() &&
+				equal( name.begin(), name.end(), request.begin() + lineBegin, []( char a, char b ) { return tolower( a ) == tolower( b ); } ) ) {
+				size_t valueBegin = request.find_first_not_of( " \t", colon + 1 );
+				return valueBegin < lineEnd ? request.substr( valueBegin, lineEnd - valueBegin ) : "";
+			}
+			lineBegin = lineEnd;
+		}
+		return "";
+	}
+
+	bool containsToken( string value, const char* token )
+	{
+		transform( value.begin(), value.end(), value.begin(), ::tolower );
+		return value.find( token ) != string::npos;
+	}
+
+	// Paths are handled without the trailing slash, except for the root
+	string normalizePath( const string& path )
+	{
+		if ( path.size() > 1 && path.back() == '/' ) {
+			return path.substr( 0, path.size() - 1 );
+		}
+		return path.empty() ? "/" : path;
+	}
+
+	string makeFrameHeader( uint8_t opcode, size_t size )
+	{
+		string header( 1, static_cast<char>( 0x80 | opcode ) );
+		if ( size < 126 ) {
+			header += static_cast<char>( size );
+		} else if ( size < 65536 ) {
+			header += static_cast<char>( 126 );
+			header += static_cast<char>( size >> 8 );
+			header += static_cast<char>( size );
+		} else {
+			header += static_cast<char>( 127 );
+			for ( int i = 7; i >= 0; --i ) {
+				header += static_cast<char>( static_cast<uint64_t>( size ) >> ( i * 8 ) );
+			}
+		}
+		return header;
+	}
+}
+
+OscQueryNamespaceRef OscQueryNamespace::create()
+{
+	return make_shared<OscQueryNamespace>();
+}
+
+OscQueryNamespace::OscQueryNamespace()
+	: mRoot( new Node ), mNumSerialized( 0 )
+{
+	mRoot->mPath		= "/";
+	mRoot->mAccess		= ACCESS_NONE;
+	mRoot->mIsAddress	= false;
+	mRoot->mParent		= nullptr;
+}
+
+void OscQueryNamespace::addAddress( const string& address, const string& typeTags, Access access, const string& description )
+{
+	lock_guard<mutex> lock( mMutex );
+
+	Node* node = mRoot.get();
+	for ( size_t begin = 1; begin < address.size(); ) {
+		size_t end = address.find( '/', begin );
+		if ( end == string::npos ) {
+			end = address.size();
+		}
+		if ( end > begin ) {
+			string name = address.substr( begin, end - begin );
+			unique_ptr<Node>& child = node->mChildren[ name ];
+			if ( !child ) {
+				child.reset( new Node );
+				child->mPath		= address.substr( 0, end );
+				child->mAccess		= ACCESS_NONE;
+				child->mIsAddress	= false;
+				child->mParent		= node;
+			}
+			node = child.get();
+		}
+		begin = end + 1;
+	}
+
+	node->mTypeTags		= typeTags;
+	node->mAccess		= access;
+	node->mDescription	= description;
+	node->mIsAddress	= true;
+	invalidate( node );
+}
+
+void OscQueryNamespace::removeAddress( const string& address )
+{
+	lock_guard<mutex> lock( mMutex );
+
+	Node* node = findNode( address );
+	if ( node == nullptr || node == mRoot.get() ) {
+		return;
+	}
+	Node* parent = node->mParent;
+	parent->mChildren.erase( node->mPath.substr( node->mPath.rfind( '/' ) + 1 ) );
+	invalidate( parent );
+}
+
+bool OscQueryNamespace::setValue( const OscTree& message )
+{
+	ValueHandler handler;
+	{
+		lock_guard<mutex> lock( mMutex );
+
+		Node* node = findNode( message.getAddress() );
+		if ( node == nullptr || !node->mIsAddress ) {
+			return false;
+		}
+
+		string value = "[";
+		for ( const OscTree& argument : message.getChildren() ) {
+			if ( value.size() > 1 ) {
+				value += ',';
+			}
+			appendJsonValue( value, argument );
+		}
+		value += ']';
+		node->mValue.swap( value );
+		invalidate( node );
+
+		handler = mValueHandler;
+	}
+
+	// outside the lock, the handler may well query the namespace
+	if ( handler ) {
+		handler( message );
+	}
+	return true;
+}
+
+void OscQueryNamespace::setValueHandler( const ValueHandler& handler )
+{
+	lock_guard<mutex> lock( mMutex );
+	mValueHandler = handler;
+}
+
+OscQueryNamespace::JsonRef OscQueryNamespace::getJson( const string& path ) const
+{
+	lock_guard<mutex> lock( mMutex );
+
+	const Node* node = findNode( path );
+	return node != nullptr ? serialize( *node ) : nullptr;
+}
+
+OscQueryNamespace::JsonRef OscQueryNamespace::getAttributeJson( const string& path, const string& attribute ) const
+{
+	lock_guard<mutex> lock( mMutex );
+
+	const Node* node = findNode( path );
+	if ( node == nullptr ) {
+		return nullptr;
+	}
+
+	string json = "{\"" + attribute + "\":";
+	if ( attribute == "FULL_PATH" ) {
+		appendJsonString( json, node->mPath );
+	} else if ( node->mIsAddress && attribute == "TYPE" ) {
+		appendJsonString( json, node->mTypeTags );
+	} else if ( attribute == "ACCESS" ) {
+		json += static_cast<char>( '0' + node->mAccess );
+	} else if ( node->mIsAddress && attribute == "VALUE" && !node->mValue.empty() ) {
+		json += node->mValue;
+	} else if ( !node->mDescription.empty() && attribute == "DESCRIPTION" ) {
+		appendJsonString( json, node->mDescription );
+	} else {
+		return nullptr;
+	}
+	json += '}';
+
+	return make_shared<const string>( move( json ) );
+}
+
+size_t OscQueryNamespace::getNumSerialized() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumSerialized;
+}
+
+OscQueryNamespace::Node* OscQueryNamespace::findNode( const string& path ) const
+{
+	Node* node = mRoot.get();
+	for ( size_t begin = 1; begin < path.size() && node != nullptr; ) {
+		size_t end = path.find( '/', begin );
+		if ( end == string::npos ) {
+			end = path.size();
+		}
+		if ( end > begin ) {
+			auto iter = node->mChildren.find( path.substr( begin, end - begin ) );
+			node = iter != node->mChildren.end() ? iter->second.get() : nullptr;
+		}
+		begin = end + 1;
+	}
+	return node;
+}
+
+void OscQueryNamespace::invalidate( Node* node )
+{
+	// a node's JSON holds its children's, so everything above goes too
+	for ( ; node != nullptr; node = node->mParent ) {
+		node->mJson.reset();
+	}
+}
+
+const OscQueryNamespace::JsonRef& OscQueryNamespace::serialize( const Node& node ) const
+{
+	if ( node.mJson ) {
+		return node.mJson;
+	}
+
+	string json = "{\"FULL_PATH\":";
+	appendJsonString( json, node.mPath );
+	json += ",\"ACCESS\":";
+	json += static_cast<char>( '0' + node.mAccess );
+	if ( node.mIsAddress ) {
+		json += ",\"TYPE\":";
+		appendJsonString( json, node.mTypeTags );
+		if ( !node.mValue.empty() ) {
+			json += ",\"VALUE\":" + node.mValue;
+		}
+	}
+	if ( !node.mDescription.empty() ) {
+		json += ",\"DESCRIPTION\":";
+		appendJsonString( json, node.mDescription );
+	}
+	if ( !node.mChildren.empty() ) {
+		json += ",\"CONTENTS\":{";
+		for ( auto iter = node.mChildren.begin(); iter != node.mChildren.end(); ++iter ) {
+			if ( iter != node.mChildren.begin() ) {
+				json += ',';
+			}
+			appendJsonString( json, iter->first );
+			json += ':';
+			json += *serialize( *iter->second );
+		}
+		json += '}';
+	}
+	json += '}';
+
+	// a new string rather than the old one changed, responses still being sent hold the old one
+	node.mJson = make_shared<const string>( move( json ) );
+	++mNumSerialized;
+	return node.mJson;
+}
+
+OscQueryServerRef OscQueryServer::create( const OscExecutorRef& executor, const OscQueryNamespaceRef& space, uint16_t port,
+										 const string& name, uint16_t oscPort )
+{
+	OscQueryServerRef server = make_shared<OscQueryServer>( executor, space, port, name, oscPort );
+
+	// values are encoded once on the thread that set them, then sent to every listener
+	weak_ptr<OscQueryServer> weakServer = server;
+	space->setValueHandler( [ weakServer ]( const OscTree& message )
+	{
+		OscQueryServerRef server = weakServer.lock();
+		if ( !server ) {
+			return;
+		}
+		BufferRef packet	= message.toBuffer();
+		string address		= message.getAddress();
+		server->mExecutor->post( [ weakServer, packet, address ]()
+		{
+			OscQueryServerRef server = weakServer.lock();
+			if ( server ) {
+				server->push( packet, address );
+			}
+		} );
+	} );
+
+	server->accept();
+	return server;
+}
+
+OscQueryServer::OscQueryServer( const OscExecutorRef& executor, const OscQueryNamespaceRef& space, uint16_t port, const string& name, uint16_t oscPort )
+	: mExecutor( executor ), mNamespace( space ),
+	mAcceptor( executor->getIoService(), asio::ip::tcp::endpoint( asio::ip::tcp::v4(), port ) ),
+	mNumRequests( 0 ), mNumPushed( 0 )
+{
+	string hostInfo = "{\"NAME\":";
+	appendJsonString( hostInfo, name );
+	hostInfo += ",\"OSC_PORT\":" + to_string( oscPort );
+	hostInfo += ",\"OSC_TRANSPORT\":\"UDP\"";
+	hostInfo += ",\"EXTENSIONS\":{\"ACCESS\":true,\"VALUE\":true,\"DESCRIPTION\":true,\"LISTEN\":true}}";
+	mHostInfo = make_shared<const string>( move( hostInfo ) );
+}
+
+OscQueryServer::~OscQueryServer()
+{
+	// the handlers still pending find the server gone and return
+	asio::error_code error;
+	mAcceptor.close( error );
+	for ( const ConnectionRef& connection : mConnections ) {
+		connection->mSocket.close( error );
+	}
+}
+
+void OscQueryServer::close()
+{
+	OscQueryServerRef self = shared_from_this();
+	mExecutor->post( [ self ]()
+	{
+		asio::error_code error;
+		self->mAcceptor.close( error );
+		vector<ConnectionRef> connections;
+		connections.swap( self->mConnections );
+		for ( const ConnectionRef& connection : connections ) {
+			connection->mSocket.close( error );
+		}
+	} );
+}
+
+uint16_t OscQueryServer::getPort() const
+{
+	asio::error_code error;
+	return mAcceptor.local_endpoint( error ).port();
+}
+
+void OscQueryServer::accept()
+{
+	weak_ptr<OscQueryServer> weakSelf	= shared_from_this();
+	ConnectionRef connection			= make_shared<Connection>( mExecutor->getIoService(), kMaxRequestSize );
+	mAcceptor.async_accept( connection->mSocket, [ weakSelf, connection ]( const asio::error_code& error )
+	{
+		OscQueryServerRef self = weakSelf.lock();
+		if ( error || !self ) {
+			return;
+		}
+		asio::error_code ignored;
+		connection->mSocket.set_option( asio::ip::tcp::no_delay( true ), ignored );
+		self->mConnections.push_back( connection );
+		self->readRequest( connection );
+		self->accept();
+	} );
+}
+
+void OscQueryServer::readRequest( const ConnectionRef& connection )
+{
+	weak_ptr<OscQueryServer> weakSelf = shared_from_this();
+	asio::async_read_until( connection->mSocket, connection->mRequest, "\r\n\r\n", [ weakSelf, connection ]( const asio::error_code& error, size_t size )
+	{
+		OscQueryServerRef self = weakSelf.lock();
+		if ( !self ) {
+			return;
+		}
+		// not_found when the headers outgrow the streambuf without ending
+		if ( error ) {
+			self->disconnect( connection );
+			return;
+		}
+		// the streambuf may hold more than this request, the rest stays for the next read
+		string request( size, '\0' );
+		connection->mRequest.sgetn( &request[ 0 ], size );
+		self->handleRequest( connection, request );
+	} );
+}
+
+void OscQueryServer::handleRequest( const ConnectionRef& connection, const string& request )
+{
+	size_t methodEnd	= request.find( ' ' );
+	size_t targetEnd	= methodEnd != string::npos ? request.find( ' ', methodEnd + 1 ) : string::npos;
+	if ( targetEnd == string::npos || request.compare( 0, methodEnd, "GET" ) != 0 ) {
+		Connection::Write response;
+		response.mHeader = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		write( connection, move( response ) );
+		connection->mClosing = true;
+		return;
+	}
+
+	string target		= request.substr( methodEnd + 1, targetEnd - methodEnd - 1 );
+	size_t queryBegin	= target.find( '?' );
+	string path			= normalizePath( decodeUrl( target.substr( 0, queryBegin ) ) );
+	string attribute	= queryBegin != string::npos ? target.substr( queryBegin + 1 ) : "";
+
+	string key = getHeader( request, "Sec-WebSocket-Key" );
+	if ( containsToken( getHeader( request, "Upgrade" ), "websocket" ) && !key.empty() ) {
+		uint8_t digest[ 20 ];
+		sha1( key + kWebSocketGuid, digest );
+
+		Connection::Write response;
+		response.mHeader = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " +
+			toBase64( digest, sizeof( digest ) ) + "\r\n\r\n";
+		write( connection, move( response ) );
+
+		// bytes that came in behind the handshake are the first frames
+		connection->mIsWebSocket = true;
+		const uint8_t* pending = asio::buffer_cast<const uint8_t*>( connection->mRequest.data() );
+		connection->mFrames.assign( pending, pending + connection->mRequest.size() );
+		connection->mRequest.consume( connection->mRequest.size() );
+		while ( handleFrame( connection ) ) {
+		}
+		readFrames( connection );
+		return;
+	}
+
+	OscQueryNamespace::JsonRef json;
+	if ( attribute == "HOST_INFO" ) {
+		json = mHostInfo;
+	} else if ( attribute.empty() ) {
+		json = mNamespace->getJson( path );
+	} else {
+		json = mNamespace->getAttributeJson( path, attribute );
+	}
+
+	Connection::Write response;
+	if ( json ) {
+		response.mHeader	= "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + to_string( json->size() ) + "\r\n\r\n";
+		response.mText		= json;
+	} else {
+		response.mHeader	= "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	}
+	++mNumRequests;
+
+	bool close = containsToken( getHeader( request, "Connection" ), "close" );
+	write( connection, move( response ) );
+	if ( close ) {
+		connection->mClosing = true;
+	} else {
+		readRequest( connection );
+	}
+}
+
+void OscQueryServer::readFrames( const ConnectionRef& connection )
+{
+	weak_ptr<OscQueryServer> weakSelf = shared_from_this();
+	connection->mSocket.async_read_some( asio::buffer( connection->mReadBuffer ), [ weakSelf, connection ]( const asio::error_code& error, size_t size )
+	{
+		OscQueryServerRef self = weakSelf.lock();
+		if ( !self ) {
+			return;
+		}
+		if ( error ) {
+			self->disconnect( connection );
+			return;
+		}
+		connection->mFrames.insert( connection->mFrames.end(), connection->mReadBuffer, connection->mReadBuffer + size );
+		while ( self->handleFrame( connection ) ) {
+		}
+		if ( connection->mFrames.size() > kMaxFrameSize + 14 ) {
+			self->disconnect( connection );
+			return;
+		}
+		if ( !connection->mClosing ) {
+			self->readFrames( connection );
+		}
+	} );
+}
+
+bool OscQueryServer::handleFrame( const ConnectionRef& connection )
+{
+	vector<uint8_t>& frames = connection->mFrames;
+	if ( connection->mClosing || frames.size() < 2 ) {
+		return false;
+	}
+
+	uint8_t opcode		= frames[ 0 ] & 0x0F;
+	bool masked			= ( frames[ 1 ] & 0x80 ) != 0;
+	uint64_t size		= frames[ 1 ] & 0x7F;
+	size_t headerSize	= 2;
+	if ( size == 126 ) {
+		if ( frames.size() < 4 ) {
+			return false;
+		}
+		size		= ( static_cast<uint64_t>( frames[ 2 ] ) << 8 ) | frames[ 3 ];
+		headerSize	= 4;
+	} else if ( size == 127 ) {
+		if ( frames.size() < 10 ) {
+			return false;
+		}
+		size = 0;
+		for ( size_t i = 2; i < 10; ++i ) {
+			size = ( size << 8 ) | frames[ i ];
+		}
+		headerSize = 10;
+	}
+
+	// clients always mask their frames
+	if ( !masked || size > kMaxFrameSize ) {
+		disconnect( connection );
+		return false;
+	}
+	if ( frames.size() < headerSize + 4 + size ) {
+		return false;
+	}
+
+	const uint8_t* mask = &frames[ headerSize ];
+	string payload( static_cast<size_t>( size ), '\0' );
+	for ( size_t i = 0; i < payload.size(); ++i ) {
+		payload[ i ] = static_cast<char>( frames[ headerSize + 4 + i ] ^ mask[ i % 4 ] );
+	}
+	frames.erase( frames.begin(), frames.begin() + headerSize + 4 + static_cast<size_t>( size ) );
+
+	if ( opcode == kOpcodeText ) {
+		handleCommand( connection, payload );
+	} else if ( opcode == kOpcodeBinary ) {
+		// a client sets a value by sending the message
+		BufferRef buffer = Buffer::create( payload.size() );
+		memcpy( buffer->getData(), payload.data(), payload.size() );
+		OscTree message( buffer );
+		if ( message.isMessage() && message.getParseError() == OscTree::PARSE_OK ) {
+			mNamespace->setValue( message );
+		}
+	} else if ( opcode == kOpcodePing ) {
+		Connection::Write pong;
+		pong.mHeader = makeFrameHeader( kOpcodePong, payload.size() ) + payload;
+		write( connection, move( pong ) );
+	} else if ( opcode == kOpcodeClose ) {
+		Connection::Write close;
+		close.mHeader = makeFrameHeader( kOpcodeClose, 0 );
+		write( connection, move( close ) );
+		connection->mClosing = true;
+		return false;
+	}
+	return true;
+}
+
+void OscQueryServer::handleCommand( const ConnectionRef& connection, const string& command )
+{
+	string name = getJsonString( command, "COMMAND" );
+	string path = normalizePath( getJsonString( command, "DATA" ) );
+	if ( name == "LISTEN" ) {
+		connection->mListening.insert( path );
+	} else if ( name == "IGNORE" ) {
+		connection->mListening.erase( path );
+	}
+}
+
+void OscQueryServer::push( const BufferRef& packet, const string& address )
+{
+	// the frame header is the only part made for each listener
+	for ( const ConnectionRef& connection : mConnections ) {
+		if ( !connection->mIsWebSocket || connection->mClosing || connection->mListening.count( address ) == 0 ) {
+			continue;
+		}
+		// a client that hasn't been sent the last value yet only gets the newest one
+		auto queued = connection->mQueuedPushes.find( address );
+		if ( queued != connection->mQueuedPushes.end() ) {
+			queued->second->mHeader = makeFrameHeader( kOpcodeBinary, packet->getSize() );
+			queued->second->mBinary = packet;
+			continue;
+		}
+		Connection::Write frame;
+		frame.mHeader	= makeFrameHeader( kOpcodeBinary, packet->getSize() );
+		frame.mBinary	= packet;
+		frame.mAddress	= address;
+		write( connection, move( frame ) );
+		if ( connection->mClosing ) {
+			continue;
+		}
+		// the deque keeps its elements in place while pushing at the back and popping at the front
+		if ( connection->mWrites.size() > 1 ) {
+			connection->mQueuedPushes[ address ] = &connection->mWrites.back();
+		}
+		++mNumPushed;
+	}
+}
+
+void OscQueryServer::write( const ConnectionRef& connection, Connection::Write&& write )
+{
+	// closing the socket fails the write in flight, which disconnects
+	if ( connection->mWrites.size() >= kMaxQueuedWrites ) {
+		CI_LOG_W( "OSCQuery client has " << kMaxQueuedWrites << " writes queued, disconnecting" );
+		asio::error_code error;
+		connection->mSocket.close( error );
+		connection->mClosing = true;
+		return;
+	}
+	connection->mWrites.push_back( move( write ) );
+	if ( !connection->mWriting ) {
+		writeNext( connection );
+	}
+}
+
+void OscQueryServer::writeNext( const ConnectionRef& connection )
+{
+	if ( connection->mWrites.empty() ) {
+		connection->mWriting = false;
+		if ( connection->mClosing ) {
+			disconnect( connection );
+		}
+		return;
+	}
+	connection->mWriting = true;
+
+	const Connection::Write& next = connection->mWrites.front();
+	if ( !next.mAddress.empty() ) {
+		connection->mQueuedPushes.erase( next.mAddress );
+	}
+	vector<asio::const_buffer> buffers;
+	buffers.push_back( asio::buffer( next.mHeader ) );
+	if ( next.mText ) {
+		buffers.push_back( asio::buffer( *next.mText ) );
+	}
+	if ( next.mBinary ) {
+		buffers.push_back( asio::buffer( next.mBinary->getData(), next.mBinary->getSize() ) );
+	}
+
+	weak_ptr<OscQueryServer> weakSelf = shared_from_this();
+	asio::async_write( connection->mSocket, buffers, [ weakSelf, connection ]( const asio::error_code& error, size_t )
+	{
+		connection->mWrites.pop_front();
+		OscQueryServerRef self = weakSelf.lock();
+		if ( !self ) {
+			return;
+		}
+		if ( error ) {
+			self->disconnect( connection );
+			return;
+		}
+		self->writeNext( connection );
+	} );
+}
+
+void OscQueryServer::disconnect( const ConnectionRef& connection )
+{
+	asio::error_code error;
+	connection->mSocket.close( error );
+	connection->mClosing = true;
+	mConnections.erase( remove( mConnections.begin(), mConnections.end(), connection ), mConnections.end() );
+}
@@ -0,0 +1,187 @@
+//
+//  OscQuery.h
+//
+//	OSCQuery introspection: the address space and its current values
+//	as JSON over HTTP, and value updates over WebSocket
+//
+//	OscQueryNamespace is a tree of the registered addresses, each
+//	with its type tags, access and current value. Every node keeps
+//	its JSON serialized, and a change only re-serializes the node it
+//	happened at and the nodes above it, pasting in the cached JSON
+//	of everything else, so a query is answered with bytes that are
+//	already there. OscQueryServer answers
+//
+//		GET /mixer				the node and everything below it
+//		GET /mixer/ch/1?VALUE	one attribute of a node
+//		GET /?HOST_INFO			the server's name, OSC port and extensions
+//
+//	and upgrades to a WebSocket on request, where a client sends
+//	{ "COMMAND": "LISTEN", "DATA": "/mixer/ch/1" } to have every new
+//	value of that address pushed to it as an encoded OSC message in
+//	a binary frame, and IGNORE to stop.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "asio/asio.hpp"
+#include "cinder/Buffer.h"
+#include "OscExecutor.h"
+#include "OscTree.h"
+
+class OscQueryNamespace;
+class OscQueryServer;
+typedef std::shared_ptr<OscQueryNamespace>	OscQueryNamespaceRef;
+typedef std::shared_ptr<OscQueryServer>		OscQueryServerRef;
+
+//! Thread safe, values can be set from any thread while the server reads
+class OscQueryNamespace
+{
+public:
+	typedef std::shared_ptr<const std::string>		JsonRef;
+	typedef std::function<void( const OscTree& )>	ValueHandler;
+
+	enum Access : uint8_t
+	{
+		ACCESS_NONE			= 0,
+		ACCESS_READ			= 1,
+		ACCESS_WRITE		= 2,
+		ACCESS_READ_WRITE	= 3
+	};
+
+	static OscQueryNamespaceRef	create();
+
+	//! Adds \a address, taking arguments with \a typeTags, creating the containers above it.
+	//! Adding an address again replaces its type tags, access and description.
+	void					addAddress( const std::string& address, const std::string& typeTags, Access access = ACCESS_READ_WRITE, const std::string& description = "" );
+	//! Removes \a address and everything below it
+	void					removeAddress( const std::string& address );
+
+	//! Sets the current value of the address of \a message to its arguments and passes
+	//! it to the value handler. Returns false if the address was never added.
+	bool					setValue( const OscTree& message );
+	//! Called with every message passed to setValue(), on the thread that set it
+	void					setValueHandler( const ValueHandler& handler );
+
+	//! Returns the JSON of the node at \a path and everything below it, or nullptr if there is none
+	JsonRef					getJson( const std::string& path ) const;
+	//! Returns the JSON of one attribute of the node at \a path, like VALUE or TYPE, or nullptr
+	JsonRef					getAttributeJson( const std::string& path, const std::string& attribute ) const;
+
+	//! Returns the number of nodes serialized since creation, to see the cache at work
+	size_t					getNumSerialized() const;
+
+	OscQueryNamespace();
+protected:
+	OscQueryNamespace( const OscQueryNamespace& );
+	OscQueryNamespace&		operator=( const OscQueryNamespace& );
+
+	struct Node
+	{
+		std::string				mPath;
+		std::string				mTypeTags;
+		std::string				mDescription;
+		Access					mAccess;
+		bool					mIsAddress;
+		// the arguments of the last message set, serialized
+		std::string				mValue;
+		std::map<std::string, std::unique_ptr<Node>>	mChildren;
+		Node*					mParent;
+		// cleared on every change to the node or below it
+		mutable JsonRef			mJson;
+	};
+
+	Node*					findNode( const std::string& path ) const;
+	void					invalidate( Node* node );
+	const JsonRef&			serialize( const Node& node ) const;
+
+	mutable std::mutex		mMutex;
+	std::unique_ptr<Node>	mRoot;
+	ValueHandler			mValueHandler;
+	mutable size_t			mNumSerialized;
+};
+
+//! Serves a namespace to OSCQuery clients on the thread of the executor's io_service.
+//! Pending reads and writes don't keep it alive, releasing the last reference closes it like close().
+class OscQueryServer : public std::enable_shared_from_this<OscQueryServer>
+{
+public:
+	//! Creates a server on \a port, an ephemeral port if zero. \a name and \a oscPort
+	//! are reported to clients asking for HOST_INFO. The server becomes the namespace's value handler.
+	static OscQueryServerRef	create( const OscExecutorRef& executor, const OscQueryNamespaceRef& space, uint16_t port = 0,
+									const std::string& name = "OscTree", uint16_t oscPort = 0 );
+	~OscQueryServer();
+
+	//! Stops accepting and closes every connection
+	void					close();
+
+	uint16_t				getPort() const;
+	//! Returns the number of HTTP requests answered
+	size_t					getNumRequests() const { return mNumRequests; }
+	//! Returns the number of values pushed to WebSocket clients
+	size_t					getNumPushed() const { return mNumPushed; }
+
+	OscQueryServer( const OscExecutorRef& executor, const OscQueryNamespaceRef& space, uint16_t port, const std::string& name, uint16_t oscPort );
+protected:
+	OscQueryServer( const OscQueryServer& );
+	OscQueryServer&			operator=( const OscQueryServer& );
+
+	struct Connection
+	{
+		Connection( asio::io_service& io, size_t maxRequestSize )
+			: mSocket( io ), mRequest( maxRequestSize ), mIsWebSocket( false ), mWriting( false ), mClosing( false ) {}
+
+		struct Write
+		{
+			std::string					mHeader;
+			OscQueryNamespace::JsonRef	mText;
+			ci::BufferRef				mBinary;
+			// the address of a pushed value, empty for everything else
+			std::string					mAddress;
+		};
+
+		asio::ip::tcp::socket			mSocket;
+		// bounded, a request that doesn't end within it fails the read
+		asio::streambuf					mRequest;
+		// received WebSocket bytes not yet parsed into frames
+		std::vector<uint8_t>			mFrames;
+		uint8_t							mReadBuffer[ 4096 ];
+		std::deque<Write>				mWrites;
+		// pushes not yet being written by address, a newer value of one replaces it in place
+		std::unordered_map<std::string, Write*>	mQueuedPushes;
+		std::set<std::string>			mListening;
+		bool							mIsWebSocket;
+		bool							mWriting;
+		// closed once the writes queued have been sent
+		bool							mClosing;
+	};
+	typedef std::shared_ptr<Connection>	ConnectionRef;
+
+	void					accept();
+	void					readRequest( const ConnectionRef& connection );
+	void					handleRequest( const ConnectionRef& connection, const std::string& request );
+	void					readFrames( const ConnectionRef& connection );
+	bool					handleFrame( const ConnectionRef& connection );
+	void					handleCommand( const ConnectionRef& connection, const std::string& command );
+	void					push( const ci::BufferRef& packet, const std::string& address );
+	void					write( const ConnectionRef& connection, Connection::Write&& write );
+	void					writeNext( const ConnectionRef& connection );
+	void					disconnect( const ConnectionRef& connection );
+
+	OscExecutorRef			mExecutor;
+	OscQueryNamespaceRef	mNamespace;
+	asio::ip::tcp::acceptor	mAcceptor;
+	OscQueryNamespace::JsonRef	mHostInfo;
+	std::vector<ConnectionRef>	mConnections;
+	size_t					mNumRequests;
+	size_t					mNumPushed;
+};
@@ -0,0 +1,445 @@
+//
+//  OscReliable.cpp
+//
+
+#include "OscReliable.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	// OSC packets start with '/' or '#'
+	const char		kMagic[ 4 ]			= { '!', 'r', 'e', 'l' };
+	const uint8_t	kTypeData			= 'D';
+	const uint8_t	kTypeAck			= 'A';
+
+	// magic, type, channel, two bytes of padding and the sequence number
+	const size_t	kDataHeaderSize		= 12;
+	// magic, type, channel, padding and the cumulative ack, followed by
+	// a bit for each packet received past the first missing one
+	const size_t	kAckHeaderSize		= 12;
+
+	// packets further ahead of the next expected one are dropped unacknowledged
+	const uint32_t	kMaxOutOfOrder		= 4096;
+
+	const chrono::microseconds	kMinRetransmitTimeout( 10000 );
+	const chrono::microseconds	kMaxRetransmitTimeout( 2000000 );
+	// how often unacknowledged packets are checked against their deadline
+	const chrono::microseconds	kTimerInterval( 5000 );
+
+	// sequence numbers wrap around, compare them by their distance
+	int32_t sequenceDistance( uint32_t from, uint32_t to )
+	{
+		return static_cast<int32_t>( to - from );
+	}
+
+	void writeUint32( uint8_t* data, uint32_t value )
+	{
+		data[ 0 ] = static_cast<uint8_t>( value >> 24 );
+		data[ 1 ] = static_cast<uint8_t>( value >> 16 );
+		data[ 2 ] = static_cast<uint8_t>( value >> 8 );
+		data[ 3 ] = static_cast<uint8_t>( value );
+	}
+
+	uint32_t readUint32( const uint8_t* data )
+	{
+		return ( static_cast<uint32_t>( data[ 0 ] ) << 24 ) | ( static_cast<uint32_t>( data[ 1 ] ) << 16 ) |
+			( static_cast<uint32_t>( data[ 2 ] ) << 8 ) | static_cast<uint32_t>( data[ 3 ] );
+	}
+
+	void writeHeader( uint8_t* data, uint8_t type, uint8_t channel )
+	{
+		memcpy( data, kMagic, sizeof( kMagic ) );
+		data[ 4 ] = type;
+		data[ 5 ] = channel;
+		data[ 6 ] = 0;
+		data[ 7 ] = 0;
+	}
+}
+
+OscReliableTransportRef OscReliableTransport::create( const OscTransportRef& transport )
+{
+	OscReliableTransportRef reliable = make_shared<OscReliableTransport>( transport );
+
+	weak_ptr<OscReliableTransport> weakReliable = reliable;
+	transport->setReceiveHandler( [ weakReliable ]( const BufferRef& packet )
+	{
+		OscReliableTransportRef reliable = weakReliable.lock();
+		if ( reliable ) {
+			reliable->receive( packet );
+		}
+	} );
+
+	return reliable;
+}
+
+OscReliableTransport::OscReliableTransport( const OscTransportRef& transport )
+	: OscTransport( transport->getExecutor() ), mTransport( transport ), mTimer( transport->getExecutor()->getIoService() ),
+	mTimerScheduled( false ), mClosed( false ), mWindowSize( 256 ), mSmoothedRtt( 0 ), mRttVariance( 0 ),
+	mRetransmitTimeout( 200000 ), mNumRetransmits( 0 ), mNumDuplicates( 0 )
+{
+}
+
+OscReliableTransport::~OscReliableTransport()
+{
+	asio::error_code error;
+	mTimer.cancel( error );
+}
+
+bool OscReliableTransport::isReliablePacket( const BufferRef& packet )
+{
+	return packet->getSize() >= sizeof( kMagic ) && memcmp( packet->getData(), kMagic, sizeof( kMagic ) ) == 0;
+}
+
+OscReliableTransport::Channel& OscReliableTransport::getChannel( uint8_t channel )
+{
+	if ( !mChannels[ channel ] ) {
+		mChannels[ channel ].reset( new Channel() );
+	}
+	return *mChannels[ channel ];
+}
+
+void OscReliableTransport::send( const BufferRef& packet, const SendHandler& handler )
+{
+	mTransport->send( packet, handler );
+}
+
+void OscReliableTransport::sendReliable( const BufferRef& packet, uint8_t channel, const SendHandler& handler )
+{
+	if ( mClosed ) {
+		if ( handler ) {
+			handler( false );
+		}
+		return;
+	}
+
+	Channel& state = getChannel( channel );
+
+	Outgoing outgoing;
+	outgoing.mSequence		= state.mNextSequence++;
+	outgoing.mPacket		= Buffer::create( kDataHeaderSize + packet->getSize() );
+	outgoing.mHandler		= handler;
+	outgoing.mNumSends		= 0;
+	outgoing.mAcknowledged	= false;
+
+	uint8_t* data = static_cast<uint8_t*>( outgoing.mPacket->getData() );
+	writeHeader( data, kTypeData, channel );
+	writeUint32( data + 8, outgoing.mSequence );
+	memcpy( data + kDataHeaderSize, packet->getData(), packet->getSize() );
+
+	state.mWaiting.push_back( outgoing );
+	fillWindow( state );
+}
+
+void OscReliableTransport::fillWindow( Channel& channel )
+{
+	Clock::time_point now = Clock::now();
+	while ( !channel.mWaiting.empty() && channel.mInFlight.size() < mWindowSize ) {
+		channel.mInFlight.push_back( channel.mWaiting.front() );
+		channel.mWaiting.pop_front();
+		transmit( channel.mInFlight.back(), now );
+	}
+	scheduleTimer();
+}
+
+void OscReliableTransport::transmit( Outgoing& outgoing, Clock::time_point now )
+{
+	// every retransmit doubles the timeout
+	chrono::microseconds timeout = mRetransmitTimeout;
+	for ( uint32_t i = 0; i < outgoing.mNumSends && timeout < kMaxRetransmitTimeout; ++i ) {
+		timeout *= 2;
+	}
+
+	if ( outgoing.mNumSends > 0 ) {
+		++mNumRetransmits;
+	}
+	++outgoing.mNumSends;
+	outgoing.mSentTime	= now;
+	outgoing.mDeadline	= now + min( timeout, kMaxRetransmitTimeout );
+
+	mTransport->send( outgoing.mPacket );
+}
+
+void OscReliableTransport::setReceiveHandler( const ReceiveHandler& handler )
+{
+	mReceiveHandler = handler;
+}
+
+void OscReliableTransport::close()
+{
+	if ( mClosed ) {
+		return;
+	}
+	mClosed = true;
+
+	asio::error_code error;
+	mTimer.cancel( error );
+	mTransport->close();
+
+	for ( unique_ptr<Channel>& channel : mChannels ) {
+		if ( !channel ) {
+			continue;
+		}
+		for ( deque<Outgoing>* outgoing : { &channel->mInFlight, &channel->mWaiting } ) {
+			for ( const Outgoing& packet : *outgoing ) {
+				if ( packet.mHandler && !packet.mAcknowledged ) {
+					packet.mHandler( false );
+				}
+			}
+			outgoing->clear();
+		}
+	}
+}
+
+void OscReliableTransport::setInitialRetransmitTimeout( const chrono::milliseconds& timeout )
+{
+	if ( mSmoothedRtt.count() == 0 ) {
+		mRetransmitTimeout = timeout;
+	}
+}
+
+size_t OscReliableTransport::getNumUnacknowledged() const
+{
+	size_t numUnacknowledged = 0;
+	for ( const unique_ptr<Channel>& channel : mChannels ) {
+		if ( channel ) {
+			numUnacknowledged += channel->mWaiting.size();
+			for ( const Outgoing& outgoing : channel->mInFlight ) {
+				numUnacknowledged += outgoing.mAcknowledged ? 0 : 1;
+			}
+		}
+	}
+	return numUnacknowledged;
+}
+
+void OscReliableTransport::receive( const BufferRef& packet )
+{
+	if ( mClosed ) {
+		return;
+	}
+
+	if ( !isReliablePacket( packet ) ) {
+		if ( mReceiveHandler ) {
+			mReceiveHandler( packet );
+		}
+		return;
+	}
+
+	const uint8_t* data	= static_cast<const uint8_t*>( packet->getData() );
+	size_t size			= packet->getSize();
+	if ( size >= kDataHeaderSize && data[ 4 ] == kTypeData ) {
+		BufferRef payload = Buffer::create( size - kDataHeaderSize );
+		payload->copyFrom( data + kDataHeaderSize, size - kDataHeaderSize );
+		receiveData( data[ 5 ], readUint32( data + 8 ), payload );
+	} else if ( size >= kAckHeaderSize && data[ 4 ] == kTypeAck ) {
+		receiveAck( data[ 5 ], readUint32( data + 8 ), data + kAckHeaderSize, size - kAckHeaderSize );
+	}
+}
+
+void OscReliableTransport::receiveData( uint8_t channel, uint32_t sequence, const BufferRef& packet )
+{
+	Channel& state = getChannel( channel );
+
+	// acknowledged even when it is a duplicate, the previous ack may have been lost
+	if ( !state.mAckPending ) {
+		state.mAckPending = true;
+		if ( mAckChannels.empty() ) {
+			// one ack per channel for everything received in this batch
+			weak_ptr<OscReliableTransport> weakReliable = shared_from_this();
+			mExecutor->post( [ weakReliable ]()
+			{
+				OscReliableTransportRef reliable = weakReliable.lock();
+				if ( reliable ) {
+					reliable->sendAcks();
+				}
+			} );
+		}
+		mAckChannels.push_back( channel );
+	}
+
+	int32_t distance = sequenceDistance( state.mExpectedSequence, sequence );
+	if ( distance < 0 || ( distance > 0 && state.mOutOfOrder.count( sequence ) > 0 ) ) {
+		++mNumDuplicates;
+		return;
+	}
+	if ( distance > 0 ) {
+		if ( static_cast<uint32_t>( distance ) < kMaxOutOfOrder ) {
+			state.mOutOfOrder[ sequence ] = packet;
+		}
+		return;
+	}
+
+	++state.mExpectedSequence;
+	if ( mReceiveHandler ) {
+		mReceiveHandler( packet );
+	}
+
+	// whatever was held back waiting for this packet follows it
+	for ( auto iter = state.mOutOfOrder.find( state.mExpectedSequence ); iter != state.mOutOfOrder.end(); iter = state.mOutOfOrder.find( state.mExpectedSequence ) ) {
+		BufferRef next = iter->second;
+		state.mOutOfOrder.erase( iter );
+		++state.mExpectedSequence;
+		if ( mReceiveHandler && !mClosed ) {
+			mReceiveHandler( next );
+		}
+	}
+}
+
+void OscReliableTransport::sendAcks()
+{
+	vector<uint8_t> channels;
+	channels.swap( mAckChannels );
+	if ( mClosed ) {
+		return;
+	}
+
+	for ( uint8_t channel : channels ) {
+		Channel& state		= getChannel( channel );
+		state.mAckPending	= false;
+
+		// bit i acknowledges the packet i + 1 after the next expected one,
+		// covering everything held back so none of it is sent again
+		size_t numBits = 0;
+		for ( const auto& received : state.mOutOfOrder ) {
+			numBits = max( numBits, static_cast<size_t>( sequenceDistance( state.mExpectedSequence, received.first ) ) );
+		}
+
+		size_t maskSize	= ( numBits + 7 ) / 8;
+		BufferRef ack	= Buffer::create( kAckHeaderSize + maskSize );
+		uint8_t* data	= static_cast<uint8_t*>( ack->getData() );
+		writeHeader( data, kTypeAck, channel );
+		writeUint32( data + 8, state.mExpectedSequence );
+
+		uint8_t* mask = data + kAckHeaderSize;
+		memset( mask, 0, maskSize );
+		for ( const auto& received : state.mOutOfOrder ) {
+			size_t bit = sequenceDistance( state.mExpectedSequence, received.first ) - 1;
+			mask[ bit / 8 ] |= static_cast<uint8_t>( 1 << ( bit % 8 ) );
+		}
+		mTransport->send( ack );
+	}
+}
+
+void OscReliableTransport::receiveAck( uint8_t channel, uint32_t cumulative, const uint8_t* mask, size_t maskSize )
+{
+	Channel& state			= getChannel( channel );
+	Clock::time_point now	= Clock::now();
+
+	bool measured = false;
+	Clock::duration sample;
+	for ( Outgoing& outgoing : state.mInFlight ) {
+		if ( outgoing.mAcknowledged ) {
+			continue;
+		}
+
+		int32_t distance = sequenceDistance( cumulative, outgoing.mSequence );
+		size_t bit = static_cast<size_t>( distance - 1 );
+		bool acknowledged = distance < 0 || ( distance >= 1 && bit / 8 < maskSize && ( mask[ bit / 8 ] & ( 1 << ( bit % 8 ) ) ) != 0 );
+		if ( !acknowledged ) {
+			continue;
+		}
+
+		outgoing.mAcknowledged = true;
+		// a packet sent more than once can't tell which send the ack is for
+		if ( outgoing.mNumSends == 1 ) {
+			measured	= true;
+			sample		= now - outgoing.mSentTime;
+		}
+	}
+	if ( measured ) {
+		updateRoundTripTime( sample );
+	}
+
+	retransmitLost( state, now );
+
+	while ( !state.mInFlight.empty() && state.mInFlight.front().mAcknowledged ) {
+		SendHandler handler = state.mInFlight.front().mHandler;
+		state.mInFlight.pop_front();
+		if ( handler ) {
+			handler( true );
+		}
+	}
+
+	fillWindow( state );
+}
+
+void OscReliableTransport::retransmitLost( Channel& channel, Clock::time_point now )
+{
+	// a packet still missing while later ones arrived is most likely lost, it is
+	// resent without waiting for its timeout once it is older than a round trip
+	// plus the usual variation, so packets merely reordered are left alone
+	Clock::duration reorderWindow = mSmoothedRtt + mRttVariance * 2;
+	bool laterAcknowledged = false;
+	for ( auto iter = channel.mInFlight.rbegin(); iter != channel.mInFlight.rend(); ++iter ) {
+		if ( iter->mAcknowledged ) {
+			laterAcknowledged = true;
+		} else if ( laterAcknowledged && iter->mNumSends == 1 && now - iter->mSentTime > reorderWindow ) {
+			transmit( *iter, now );
+		}
+	}
+}
+
+void OscReliableTransport::updateRoundTripTime( Clock::duration sample )
+{
+	chrono::microseconds rtt = chrono::duration_cast<chrono::microseconds>( sample );
+	if ( mSmoothedRtt.count() == 0 ) {
+		mSmoothedRtt	= rtt;
+		mRttVariance	= rtt / 2;
+	} else {
+		chrono::microseconds error = mSmoothedRtt > rtt ? mSmoothedRtt - rtt : rtt - mSmoothedRtt;
+		mRttVariance	= ( mRttVariance * 3 + error ) / 4;
+		mSmoothedRtt	= ( mSmoothedRtt * 7 + rtt ) / 8;
+	}
+	mRetransmitTimeout = min( max( mSmoothedRtt + max( kTimerInterval, mRttVariance * 4 ), kMinRetransmitTimeout ), kMaxRetransmitTimeout );
+}
+
+void OscReliableTransport::scheduleTimer()
+{
+	if ( mTimerScheduled || mClosed ) {
+		return;
+	}
+	mTimerScheduled = true;
+
+	weak_ptr<OscReliableTransport> weakReliable = shared_from_this();
+	mTimer.expires_from_now( kTimerInterval );
+	mTimer.async_wait( [ weakReliable ]( const asio::error_code& error )
+	{
+		OscReliableTransportRef reliable = weakReliable.lock();
+		if ( reliable ) {
+			reliable->mTimerScheduled = false;
+			if ( !error ) {
+				reliable->onTimer();
+			}
+		}
+	} );
+}
+
+void OscReliableTransport::onTimer()
+{
+	if ( mClosed ) {
+		return;
+	}
+
+	Clock::time_point now	= Clock::now();
+	bool inFlight			= false;
+	for ( unique_ptr<Channel>& channel : mChannels ) {
+		if ( !channel ) {
+			continue;
+		}
+		retransmitLost( *channel, now );
+		for ( Outgoing& outgoing : channel->mInFlight ) {
+			if ( !outgoing.mAcknowledged && outgoing.mDeadline <= now ) {
+				transmit( outgoing, now );
+			}
+		}
+		inFlight = inFlight || !channel->mInFlight.empty();
+	}
+
+	// the timer only runs while something waits for an ack
+	if ( inFlight ) {
+		scheduleTimer();
+	}
+}
@@ -0,0 +1,134 @@
+//
+//  OscReliable.h
+//
+//	Optional reliable, ordered delivery on top of a datagram transport
+//
+//	Reliable packets are framed with a small header carrying a
+//	channel and a sequence number, and are sent again until the peer
+//	acknowledges them. Acknowledgements are cumulative plus a bitmask
+//	of the packets received past the first missing one, so a single
+//	loss only costs the lost packet. Each channel is ordered on its own: a
+//	lost cue on one channel never holds back another channel, nor
+//	the unreliable packets, which pass through untouched on the same
+//	socket. The header starts with bytes no OSC packet starts with,
+//	so a peer without the reliability layer can still read the
+//	unreliable traffic.
+//
+//	The retransmit timeout follows the measured round trip time
+//	( RFC 6298 ), packets sent more than once are not measured. A
+//	packet missing while later ones were acknowledged is resent
+//	after a round trip, without waiting for its timeout.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include "asio/asio.hpp"
+#include "cinder/Buffer.h"
+#include "OscTransport.h"
+
+class OscReliableTransport;
+typedef std::shared_ptr<OscReliableTransport>	OscReliableTransportRef;
+
+//! Not thread safe, use it on the executor's thread like the transport it wraps
+class OscReliableTransport : public OscTransport, public std::enable_shared_from_this<OscReliableTransport>
+{
+public:
+	//! Adds reliable delivery to \a transport, both peers need one
+	static OscReliableTransportRef	create( const OscTransportRef& transport );
+	~OscReliableTransport();
+
+	//! Sends \a packet unreliably, it may be lost or arrive out of order
+	void						send( const ci::BufferRef& packet, const SendHandler& handler = SendHandler() ) override;
+	//! Sends \a packet on \a channel until the peer acknowledges it. Packets on one channel
+	//! are received in the order they were sent. \a handler is called with true once the packet
+	//! is acknowledged, or with false if the transport is closed first.
+	void						sendReliable( const ci::BufferRef& packet, uint8_t channel = 0, const SendHandler& handler = SendHandler() );
+	//! Reliable packets are passed to \a handler in order, without their header, unreliable ones as they arrive
+	void						setReceiveHandler( const ReceiveHandler& handler ) override;
+	//! Closes the wrapped transport, unacknowledged packets are given up
+	void						close() override;
+
+	//! Sets the retransmit timeout used until a round trip has been measured, 200ms by default
+	void						setInitialRetransmitTimeout( const std::chrono::milliseconds& timeout );
+	//! Sets the number of unacknowledged packets per channel, later packets wait their turn. 256 by default.
+	void						setWindowSize( size_t windowSize ) { mWindowSize = windowSize; }
+
+	//! Returns the smoothed round trip time, zero until one has been measured
+	std::chrono::microseconds	getRoundTripTime() const { return mSmoothedRtt; }
+	std::chrono::microseconds	getRetransmitTimeout() const { return mRetransmitTimeout; }
+	//! Returns the number of packets sent but not yet acknowledged, including those waiting for the window
+	size_t						getNumUnacknowledged() const;
+	uint64_t					getNumRetransmits() const { return mNumRetransmits; }
+	//! Returns the number of reliable packets received more than once
+	uint64_t					getNumDuplicates() const { return mNumDuplicates; }
+
+	//! Returns true if \a packet is framed by the reliability layer rather than plain OSC
+	static bool					isReliablePacket( const ci::BufferRef& packet );
+
+	OscReliableTransport( const OscTransportRef& transport );
+protected:
+	OscReliableTransport( const OscReliableTransport& );
+	OscReliableTransport&		operator=( const OscReliableTransport& );
+
+	typedef std::chrono::steady_clock	Clock;
+
+	struct Outgoing
+	{
+		uint32_t				mSequence;
+		ci::BufferRef			mPacket;
+		SendHandler				mHandler;
+		Clock::time_point		mSentTime;
+		Clock::time_point		mDeadline;
+		uint32_t				mNumSends;
+		bool					mAcknowledged;
+	};
+
+	struct Channel
+	{
+		Channel() : mNextSequence( 0 ), mExpectedSequence( 0 ), mAckPending( false ) {}
+
+		// sending, in flight packets are in sequence order
+		uint32_t				mNextSequence;
+		std::deque<Outgoing>	mInFlight;
+		std::deque<Outgoing>	mWaiting;
+
+		// receiving
+		uint32_t				mExpectedSequence;
+		std::map<uint32_t, ci::BufferRef>	mOutOfOrder;
+		bool					mAckPending;
+	};
+
+	Channel&					getChannel( uint8_t channel );
+	void						receive( const ci::BufferRef& packet );
+	void						receiveData( uint8_t channel, uint32_t sequence, const ci::BufferRef& packet );
+	void						receiveAck( uint8_t channel, uint32_t cumulative, const uint8_t* mask, size_t maskSize );
+	void						sendAcks();
+	void						transmit( Outgoing& outgoing, Clock::time_point now );
+	void						fillWindow( Channel& channel );
+	void						retransmitLost( Channel& channel, Clock::time_point now );
+	void						updateRoundTripTime( Clock::duration sample );
+	void						scheduleTimer();
+	void						onTimer();
+
+	OscTransportRef				mTransport;
+	ReceiveHandler				mReceiveHandler;
+	std::unique_ptr<Channel>	mChannels[ 256 ];
+	std::vector<uint8_t>		mAckChannels;
+	asio::steady_timer			mTimer;
+	bool						mTimerScheduled;
+	bool						mClosed;
+	size_t						mWindowSize;
+
+	std::chrono::microseconds	mSmoothedRtt;
+	std::chrono::microseconds	mRttVariance;
+	std::chrono::microseconds	mRetransmitTimeout;
+
+	uint64_t					mNumRetransmits;
+	uint64_t					mNumDuplicates;
+};
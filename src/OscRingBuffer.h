@@ -0,0 +1,130 @@
+//
+//  OscRingBuffer.h
+//
+//	Bounded lock-free multi-producer multi-consumer queue
+//
+//	Each cell carries a sequence number that tells producers and
+//	consumers whether it is free or full for the current lap around
+//	the ring, so pushing and popping is a single compare-and-swap on
+//	the head or tail in the uncontended case ( after Dmitry Vyukov's
+//	bounded MPMC queue ). Head and tail live on separate cache lines.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+template<typename T>
+class OscRingBuffer
+{
+public:
+	//! Creates a queue holding at least \a capacity items, rounded up to a power of two
+	explicit OscRingBuffer( size_t capacity )
+		: mEnqueuePos( 0 ), mDequeuePos( 0 )
+	{
+		size_t size = 2;
+		while ( size < capacity ) {
+			size <<= 1;
+		}
+
+		mMask	= size - 1;
+		mCells	= std::unique_ptr<Cell[]>( new Cell[ size ] );
+		for ( size_t i = 0; i < size; ++i ) {
+			mCells[ i ].mSequence.store( i, std::memory_order_relaxed );
+		}
+	}
+
+	//! Appends \a value, returns false if the queue is full
+	bool			tryPush( const T& value )
+	{
+		T copy( value );
+		return tryPush( std::move( copy ) );
+	}
+
+	//! Appends \a value, returns false if the queue is full. \a value is left untouched on failure.
+	bool			tryPush( T&& value )
+	{
+		Cell* cell;
+		size_t pos = mEnqueuePos.load( std::memory_order_relaxed );
+		for ( ;; ) {
+			cell				= &mCells[ pos & mMask ];
+			size_t sequence		= cell->mSequence.load( std::memory_order_acquire );
+			intptr_t diff		= static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos );
+			if ( diff == 0 ) {
+				if ( mEnqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+					break;
+				}
+			} else if ( diff < 0 ) {
+				return false;
+			} else {
+				pos = mEnqueuePos.load( std::memory_order_relaxed );
+			}
+		}
+
+		cell->mValue = std::move( value );
+		cell->mSequence.store( pos + 1, std::memory_order_release );
+
+		return true;
+	}
+
+	//! Removes the oldest item into \a value, returns false if the queue is empty
+	bool			tryPop( T& value )
+	{
+		Cell* cell;
+		size_t pos = mDequeuePos.load( std::memory_order_relaxed );
+		for ( ;; ) {
+			cell				= &mCells[ pos & mMask ];
+			size_t sequence		= cell->mSequence.load( std::memory_order_acquire );
+			intptr_t diff		= static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos + 1 );
+			if ( diff == 0 ) {
+				if ( mDequeuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+					break;
+				}
+			} else if ( diff < 0 ) {
+				return false;
+			} else {
+				pos = mDequeuePos.load( std::memory_order_relaxed );
+			}
+		}
+
+		value = std::move( cell->mValue );
+		cell->mValue = T();
+		cell->mSequence.store( pos + mMask + 1, std::memory_order_release );
+
+		return true;
+	}
+
+	//! Returns the number of items in the queue, only a snapshot while other threads push or pop
+	size_t			getSize() const
+	{
+		size_t enqueuePos = mEnqueuePos.load( std::memory_order_relaxed );
+		size_t dequeuePos = mDequeuePos.load( std::memory_order_relaxed );
+		return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+	}
+
+	bool			isEmpty() const { return getSize() == 0; }
+	size_t			getCapacity() const { return mMask + 1; }
+
+protected:
+	OscRingBuffer( const OscRingBuffer& );
+	OscRingBuffer&	operator=( const OscRingBuffer& );
+
+	struct Cell
+	{
+		std::atomic<size_t>	mSequence;
+		T					mValue;
+	};
+
+	static const size_t		kCacheLineSize = 64;
+
+	std::unique_ptr<Cell[]>	mCells;
+	size_t					mMask;
+	char					mPadding0[ kCacheLineSize ];
+	std::atomic<size_t>		mEnqueuePos;
+	char					mPadding1[ kCacheLineSize ];
+	std::atomic<size_t>		mDequeuePos;
+	char					mPadding2[ kCacheLineSize ];
+};
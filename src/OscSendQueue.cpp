@@ -0,0 +1,314 @@
+//
+//  OscSendQueue.cpp
+//
+
+#include "OscSendQueue.h"
+#include <algorithm>
+
+using namespace ci;
+using namespace std;
+
+namespace
+{
+	// "#bundle" and the time tag
+	const size_t	kBundleHeaderSize	= 16;
+	// each bundle element is prefixed with its size
+	const size_t	kElementHeaderSize	= 4;
+
+	// a message parsed before its address was interned is looked up again, it may be there by now
+	uint32_t getIndexId( const OscTree& message )
+	{
+		uint32_t id = message.getAddressId();
+		return id != OscAddressTable::kInvalidId ? id : OscAddressTable::get().find( message.getAddress() );
+	}
+}
+
+OscSendQueueRef OscSendQueue::create( const OscTransportRef& transport, const chrono::milliseconds& flushInterval, size_t maxBundleSize )
+{
+	OscSendQueueRef sendQueue = make_shared<OscSendQueue>( transport, flushInterval, maxBundleSize );
+
+	// the timer is only ever touched on the executor's thread
+	weak_ptr<OscSendQueue> weakQueue = sendQueue;
+	transport->getExecutor()->post( [ weakQueue ]()
+	{
+		OscSendQueueRef sendQueue = weakQueue.lock();
+		if ( sendQueue ) {
+			sendQueue->scheduleTick();
+		}
+	} );
+
+	return sendQueue;
+}
+
+OscSendQueue::OscSendQueue( const OscTransportRef& transport, const chrono::milliseconds& flushInterval, size_t maxBundleSize )
+	: mTransport( transport ), mTimer( transport->getExecutor()->getIoService() ), mFlushInterval( flushInterval ),
+	mClosed( false ), mPendingSize( 0 ), mMaxBundleSize( maxBundleSize ), mFlushScheduled( false ),
+	mBytesPerSecond( 0 ), mBurstSize( 0 ), mTokens( 0.0 ), mLastRefill( Clock::now() ),
+	mNumQueued( 0 ), mNumCoalesced( 0 ), mNumBundles( 0 ), mNumThrottled( 0 )
+{
+}
+
+OscSendQueue::~OscSendQueue()
+{
+	asio::error_code error;
+	mTimer.cancel( error );
+}
+
+void OscSendQueue::send( const OscTree& tree )
+{
+	lock_guard<mutex> lock( mMutex );
+	if ( !mClosed ) {
+		queue( tree );
+	}
+}
+
+void OscSendQueue::queue( const OscTree& message )
+{
+	// an immediate bundle only groups its messages, a bundle scheduled
+	// for later goes out whole, inside the tick's bundle or on its own
+	bool scheduled = message.isBundle() && message.getTimeTag().mTimeTag != OscTree::TimeTag().mTimeTag;
+	if ( message.isBundle() && !scheduled ) {
+		for ( const OscTree& child : message.getChildren() ) {
+			queue( child );
+		}
+		return;
+	}
+
+	++mNumQueued;
+	size_t size = message.getEncodedSize() + kElementHeaderSize;
+
+	size_t index = scheduled ? string::npos : findPending( message );
+	if ( index != string::npos ) {
+		// latest wins, but keeps the place of the message it replaces
+		Pending& pending	= mPending[ index ];
+		mPendingSize		-= pending.mSize;
+		pending.mMessage	= message;
+		pending.mSize		= size;
+		++mNumCoalesced;
+	} else {
+		if ( !scheduled ) {
+			indexPending( message, mPending.size() );
+		}
+		Pending pending = { message, size };
+		mPending.push_back( pending );
+	}
+	mPendingSize += size;
+
+	if ( kBundleHeaderSize + mPendingSize >= mMaxBundleSize ) {
+		scheduleFlush();
+	}
+}
+
+size_t OscSendQueue::findPending( const OscTree& message ) const
+{
+	uint32_t id = getIndexId( message );
+	if ( id != OscAddressTable::kInvalidId ) {
+		auto iter = mIndex.find( id );
+		if ( iter != mIndex.end() ) {
+			return iter->second;
+		}
+		// the address may have been interned after a message for it was queued
+		if ( mUninternedIndex.empty() ) {
+			return string::npos;
+		}
+	}
+	auto iter = mUninternedIndex.find( message.getAddress() );
+	return iter != mUninternedIndex.end() ? iter->second : string::npos;
+}
+
+void OscSendQueue::indexPending( const OscTree& message, size_t index )
+{
+	uint32_t id = getIndexId( message );
+	if ( id != OscAddressTable::kInvalidId ) {
+		mIndex[ id ] = index;
+	} else {
+		mUninternedIndex[ message.getAddress() ] = index;
+	}
+}
+
+void OscSendQueue::scheduleFlush()
+{
+	if ( mFlushScheduled ) {
+		return;
+	}
+	mFlushScheduled = true;
+
+	weak_ptr<OscSendQueue> weakQueue = shared_from_this();
+	mTransport->getExecutor()->post( [ weakQueue ]()
+	{
+		OscSendQueueRef sendQueue = weakQueue.lock();
+		if ( sendQueue ) {
+			sendQueue->flush();
+		}
+	} );
+}
+
+void OscSendQueue::scheduleTick()
+{
+	weak_ptr<OscSendQueue> weakQueue = shared_from_this();
+	mTimer.expires_from_now( mFlushInterval );
+	mTimer.async_wait( [ weakQueue ]( const asio::error_code& error )
+	{
+		OscSendQueueRef sendQueue = weakQueue.lock();
+		if ( error || !sendQueue ) {
+			return;
+		}
+
+		sendQueue->flush();
+
+		bool closed;
+		{
+			lock_guard<mutex> lock( sendQueue->mMutex );
+			closed = sendQueue->mClosed;
+		}
+		if ( !closed ) {
+			sendQueue->scheduleTick();
+		}
+	} );
+}
+
+void OscSendQueue::refill()
+{
+	Clock::time_point now	= Clock::now();
+	double elapsed			= chrono::duration<double>( now - mLastRefill ).count();
+	mLastRefill				= now;
+	mTokens					= min( static_cast<double>( mBurstSize ), mTokens + elapsed * mBytesPerSecond );
+}
+
+void OscSendQueue::flush()
+{
+	vector<BufferRef> packets;
+	{
+		lock_guard<mutex> lock( mMutex );
+		mFlushScheduled = false;
+		if ( mClosed || mPending.empty() ) {
+			return;
+		}
+		if ( mBytesPerSecond > 0 ) {
+			refill();
+		}
+
+		size_t numSent = 0;
+		while ( numSent < mPending.size() ) {
+			// as many messages as fit the budget, and at least one
+			size_t end	= numSent;
+			size_t size	= kBundleHeaderSize;
+			while ( end < mPending.size() && ( end == numSent || size + mPending[ end ].mSize <= mMaxBundleSize ) ) {
+				size += mPending[ end ].mSize;
+				++end;
+			}
+
+			// a lone message goes out as is, it doesn't need a bundle
+			bool single = end - numSent == 1;
+			if ( single ) {
+				size = mPending[ numSent ].mSize - kElementHeaderSize;
+			}
+
+			if ( mBytesPerSecond > 0 ) {
+				// a packet larger than the burst goes out once the bucket is full
+				double cost = static_cast<double>( min( size, mBurstSize ) );
+				if ( mTokens < cost ) {
+					++mNumThrottled;
+					break;
+				}
+				mTokens -= cost;
+			}
+
+			if ( single ) {
+				packets.push_back( mPending[ numSent ].mMessage.toBuffer() );
+			} else {
+				OscTree bundle = OscTree::makeBundle();
+				for ( size_t i = numSent; i < end; ++i ) {
+					bundle.pushBack( move( mPending[ i ].mMessage ) );
+				}
+				packets.push_back( bundle.toBuffer() );
+			}
+			++mNumBundles;
+			numSent = end;
+		}
+
+		// whatever the rate limit held back stays queued, in order
+		mPending.erase( mPending.begin(), mPending.begin() + numSent );
+		mIndex.clear();
+		mUninternedIndex.clear();
+		mPendingSize = 0;
+		for ( size_t i = 0; i < mPending.size(); ++i ) {
+			if ( !mPending[ i ].mMessage.isBundle() ) {
+				indexPending( mPending[ i ].mMessage, i );
+			}
+			mPendingSize += mPending[ i ].mSize;
+		}
+	}
+
+	// sent outside the lock, senders can keep queueing meanwhile
+	for ( const BufferRef& packet : packets ) {
+		mTransport->send( packet );
+	}
+}
+
+void OscSendQueue::close()
+{
+	{
+		lock_guard<mutex> lock( mMutex );
+		mClosed = true;
+		mPending.clear();
+		mIndex.clear();
+		mUninternedIndex.clear();
+		mPendingSize = 0;
+	}
+
+	weak_ptr<OscSendQueue> weakQueue = shared_from_this();
+	mTransport->getExecutor()->post( [ weakQueue ]()
+	{
+		OscSendQueueRef sendQueue = weakQueue.lock();
+		if ( sendQueue ) {
+			asio::error_code error;
+			sendQueue->mTimer.cancel( error );
+		}
+	} );
+}
+
+void OscSendQueue::setRateLimit( size_t bytesPerSecond, size_t burstSize )
+{
+	lock_guard<mutex> lock( mMutex );
+	mBytesPerSecond	= bytesPerSecond;
+	mBurstSize		= burstSize;
+	mTokens			= static_cast<double>( burstSize );
+	mLastRefill		= Clock::now();
+}
+
+void OscSendQueue::setMaxBundleSize( size_t maxBundleSize )
+{
+	lock_guard<mutex> lock( mMutex );
+	mMaxBundleSize = maxBundleSize;
+}
+
+size_t OscSendQueue::getNumPending() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mPending.size();
+}
+
+uint64_t OscSendQueue::getNumQueued() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumQueued;
+}
+
+uint64_t OscSendQueue::getNumCoalesced() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumCoalesced;
+}
+
+uint64_t OscSendQueue::getNumBundles() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumBundles;
+}
+
+uint64_t OscSendQueue::getNumThrottled() const
+{
+	lock_guard<mutex> lock( mMutex );
+	return mNumThrottled;
+}
@@ -0,0 +1,127 @@
+//
+//  OscSendQueue.h
+//
+//	Coalesces and rate limits messages on their way to a transport
+//
+//	Messages sent to the queue wait until the next tick. A message
+//	for an address that is already waiting replaces it, so a fader
+//	dragged across a hundred positions between ticks goes out once,
+//	at its latest position. On each tick the waiting messages are
+//	packed into bundles of up to the size budget, and the bundles are
+//	sent as long as the destination's token bucket allows. Whatever
+//	does not fit stays queued and keeps coalescing until the next
+//	tick. Queueing enough messages to fill a bundle flushes right
+//	away instead of waiting for the tick.
+//
+//	Messages for different addresses can go out in a different
+//	order than they were sent, messages for one address never do.
+//	A bundle with a time tag is never taken apart or replaced, it
+//	goes out as it was sent, so its messages still take effect
+//	together at the time it was scheduled for.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "asio/asio.hpp"
+#include "OscTransport.h"
+#include "OscTree.h"
+
+class OscSendQueue;
+typedef std::shared_ptr<OscSendQueue>	OscSendQueueRef;
+
+//! Sends to a single destination, create one queue per transport
+class OscSendQueue : public std::enable_shared_from_this<OscSendQueue>
+{
+public:
+	//! Creates a queue that flushes to \a transport every \a flushInterval,
+	//! in bundles of at most \a maxBundleSize bytes
+	static OscSendQueueRef	create( const OscTransportRef& transport,
+								const std::chrono::milliseconds& flushInterval = std::chrono::milliseconds( 16 ),
+								size_t maxBundleSize = 1432 );
+	~OscSendQueue();
+
+	//! Queues \a tree, replacing any queued message with the same address.
+	//! Immediate bundles are queued message by message, a bundle with a time
+	//! tag is queued whole and never replaced. Safe to call from any thread.
+	void					send( const OscTree& tree );
+	//! Sends everything queued that the rate limit allows now, on the executor's thread
+	void					flush();
+	//! Stops the ticks, messages still queued are dropped
+	void					close();
+
+	//! Limits sending to \a bytesPerSecond, allowing bursts of up
+	//! to \a burstSize bytes. Zero bytes per second disables the limit,
+	//! which is the default.
+	void					setRateLimit( size_t bytesPerSecond, size_t burstSize );
+	size_t					getRateLimit() const { return mBytesPerSecond; }
+
+	void					setMaxBundleSize( size_t maxBundleSize );
+	size_t					getMaxBundleSize() const { return mMaxBundleSize; }
+
+	//! Returns the number of messages waiting for the next flush
+	size_t					getNumPending() const;
+	//! Returns the number of messages sent to the queue, a bundle with a time tag counts as one
+	uint64_t				getNumQueued() const;
+	//! Returns the number of queued messages replaced by a newer one before they were sent
+	uint64_t				getNumCoalesced() const;
+	//! Returns the number of bundles handed to the transport
+	uint64_t				getNumBundles() const;
+	//! Returns the number of flushes that left messages queued because of the rate limit
+	uint64_t				getNumThrottled() const;
+
+	const OscTransportRef&	getTransport() const { return mTransport; }
+
+	OscSendQueue( const OscTransportRef& transport, const std::chrono::milliseconds& flushInterval, size_t maxBundleSize );
+protected:
+	OscSendQueue( const OscSendQueue& );
+	OscSendQueue&			operator=( const OscSendQueue& );
+
+	struct Pending
+	{
+		OscTree				mMessage;
+		// size of the message as a bundle element, including its size prefix
+		size_t				mSize;
+	};
+
+	typedef std::chrono::steady_clock	Clock;
+
+	void					queue( const OscTree& message );
+	//! Returns the position of the message waiting for the address of \a message, or npos
+	size_t					findPending( const OscTree& message ) const;
+	void					indexPending( const OscTree& message, size_t index );
+	void					scheduleFlush();
+	void					scheduleTick();
+	void					refill();
+
+	OscTransportRef			mTransport;
+	asio::steady_timer		mTimer;
+	std::chrono::milliseconds	mFlushInterval;
+	bool					mClosed;
+
+	mutable std::mutex		mMutex;
+	std::vector<Pending>	mPending;
+	// index into mPending by address ID, and by address for messages whose address isn't interned
+	std::unordered_map<uint32_t, size_t>	mIndex;
+	std::unordered_map<std::string, size_t>	mUninternedIndex;
+	size_t					mPendingSize;
+	size_t					mMaxBundleSize;
+	bool					mFlushScheduled;
+
+	// token bucket, in bytes
+	size_t					mBytesPerSecond;
+	size_t					mBurstSize;
+	double					mTokens;
+	Clock::time_point		mLastRefill;
+
+	uint64_t				mNumQueued;
+	uint64_t				mNumCoalesced;
+	uint64_t				mNumBundles;
+	uint64_t				mNumThrottled;
+};
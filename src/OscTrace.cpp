@@ -0,0 +1,333 @@
+//
+//  OscTrace.cpp
+//
+
+#include "OscTrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+	const size_t	kCacheLineSize	= 64;
+	// the stage shares a word with the packet ID, so an event is two atomic stores
+	const size_t	kStageShift		= 56;
+	const uint64_t	kPacketIdMask	= ( static_cast<uint64_t>( 1 ) << kStageShift ) - 1;
+
+	thread_local uint64_t sCurrentPacket = 0;
+
+	// The stages a packet went through, the first time of each and the
+	// last end of its handlers, with the threads they happened on
+	struct PacketStages
+	{
+		PacketStages() : mStages( 0 )
+		{
+			fill( begin( mTimes ), end( mTimes ), 0 );
+			fill( begin( mThreads ), end( mThreads ), 0 );
+		}
+
+		bool has( OscTrace::Stage stage ) const { return ( mStages & ( 1 << stage ) ) != 0; }
+
+		uint32_t	mStages;
+		uint64_t	mTimes[ OscTrace::STAGE_COUNT ];
+		uint32_t	mThreads[ OscTrace::STAGE_COUNT ];
+	};
+
+	map<uint64_t, PacketStages> getPacketStages( const vector<OscTrace::Event>& events )
+	{
+		map<uint64_t, PacketStages> packets;
+		for ( const OscTrace::Event& event : events ) {
+			PacketStages& packet = packets[ event.mPacketId ];
+			bool first = !packet.has( event.mStage );
+			bool later = event.mTime > packet.mTimes[ event.mStage ];
+			if ( first || ( event.mStage == OscTrace::STAGE_HANDLER_END ? later : !later ) ) {
+				packet.mTimes[ event.mStage ]	= event.mTime;
+				packet.mThreads[ event.mStage ]	= event.mThreadIndex;
+				packet.mStages					|= 1 << event.mStage;
+			}
+		}
+		return packets;
+	}
+
+	// Returns the stage the handlers are timed from
+	OscTrace::Stage getHandlerBegin( const PacketStages& packet )
+	{
+		if ( packet.has( OscTrace::STAGE_DEQUEUE ) ) {
+			return OscTrace::STAGE_DEQUEUE;
+		}
+		return packet.has( OscTrace::STAGE_PARSE_END ) ? OscTrace::STAGE_PARSE_END : OscTrace::STAGE_RECEIVE;
+	}
+
+	void writeSpan( stringstream& ss, bool& first, const char* name, uint64_t packetId, uint64_t begin, uint64_t end, uint32_t thread )
+	{
+		char text[ 256 ];
+		snprintf( text, sizeof( text ), "%s\n{\"name\":\"%s\",\"cat\":\"osc\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"packet\":%llu}}",
+			first ? "" : ",", name, begin / 1000.0, ( end - begin ) / 1000.0, thread, static_cast<unsigned long long>( packetId ) );
+		ss << text;
+		first = false;
+	}
+
+	void writeHistogram( stringstream& ss, const char* name, const OscMetrics::Histogram& histogram )
+	{
+		ss << "\n\t" << name << ":"
+			<< " count: " << histogram.getCount()
+			<< " p50: " << histogram.getPercentile( 50.0 )
+			<< " p90: " << histogram.getPercentile( 90.0 )
+			<< " p99: " << histogram.getPercentile( 99.0 )
+			<< " p99.9: " << histogram.getPercentile( 99.9 )
+			<< " max: " << histogram.getMax();
+	}
+}
+
+// Events of a single recording thread. Only the owning thread writes,
+// a slot is written before the head is released past it, and readers
+// check the head again after copying to drop slots overwritten meanwhile.
+struct OscTrace::ThreadRing
+{
+	struct Slot
+	{
+		atomic<uint64_t>	mPacket;
+		atomic<uint64_t>	mTime;
+	};
+
+	ThreadRing( size_t capacity, uint32_t threadIndex )
+		: mSlots( new Slot[ capacity ] ), mCapacity( capacity ), mThreadIndex( threadIndex ),
+		mThreadId( this_thread::get_id() ), mHead( 0 ), mBegin( 0 )
+	{
+	}
+
+	void record( Stage stage, uint64_t packetId, uint64_t time )
+	{
+		uint64_t head	= mHead.load( memory_order_relaxed );
+		Slot& slot		= mSlots[ head % mCapacity ];
+		slot.mPacket.store( ( static_cast<uint64_t>( stage ) << kStageShift ) | ( packetId & kPacketIdMask ), memory_order_relaxed );
+		slot.mTime.store( time, memory_order_relaxed );
+		mHead.store( head + 1, memory_order_release );
+	}
+
+	void collect( vector<Event>& events ) const
+	{
+		uint64_t head	= mHead.load( memory_order_acquire );
+		uint64_t begin	= max( mBegin.load( memory_order_relaxed ), head > mCapacity ? head - mCapacity : 0 );
+		size_t offset	= events.size();
+		for ( uint64_t i = begin; i < head; ++i ) {
+			const Slot& slot	= mSlots[ i % mCapacity ];
+			uint64_t packet		= slot.mPacket.load( memory_order_relaxed );
+			Event event			= { packet & kPacketIdMask, slot.mTime.load( memory_order_relaxed ), mThreadIndex, static_cast<Stage>( packet >> kStageShift ) };
+			events.push_back( event );
+		}
+
+		// the owner may have lapped the copy, drop what it wrote over
+		atomic_thread_fence( memory_order_acquire );
+		uint64_t newHead = mHead.load( memory_order_relaxed );
+		if ( newHead > mCapacity && newHead - mCapacity > begin ) {
+			size_t numOverwritten = static_cast<size_t>( min( newHead - mCapacity, head ) - begin );
+			events.erase( events.begin() + offset, events.begin() + offset + numOverwritten );
+		}
+	}
+
+	char					mPaddingBefore[ kCacheLineSize ];
+	unique_ptr<Slot[]>		mSlots;
+	size_t					mCapacity;
+	uint32_t				mThreadIndex;
+	thread::id				mThreadId;
+	atomic<uint64_t>		mHead;
+	// events before this were reset
+	atomic<uint64_t>		mBegin;
+	char					mPaddingAfter[ kCacheLineSize ];
+};
+
+string OscTrace::Summary::toString() const
+{
+	stringstream ss;
+	ss << "Packet latency (ns): packets: " << mNumPackets;
+	writeHistogram( ss, "socket", mSocket );
+	writeHistogram( ss, "parse", mParse );
+	writeHistogram( ss, "queue", mQueue );
+	writeHistogram( ss, "handler", mHandler );
+	writeHistogram( ss, "total", mTotal );
+	return ss.str();
+}
+
+OscTrace& OscTrace::get()
+{
+	static OscTrace trace;
+	return trace;
+}
+
+OscTrace::OscTrace()
+	: mEnabled( false ), mNextPacketId( 1 ), mRingCapacity( 32768 )
+{
+}
+
+void OscTrace::setRingCapacity( size_t capacity )
+{
+	lock_guard<mutex> lock( mMutex );
+	mRingCapacity = max( capacity, static_cast<size_t>( 1 ) );
+}
+
+uint64_t OscTrace::now()
+{
+	return static_cast<uint64_t>( chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+uint64_t OscTrace::getCurrentPacket()
+{
+	return sCurrentPacket;
+}
+
+void OscTrace::setCurrentPacket( uint64_t packetId )
+{
+	sCurrentPacket = packetId;
+}
+
+OscTrace::ThreadRing* OscTrace::getThreadRing()
+{
+	// as in OscMetrics, cache the lookup for the most recently used trace
+	static thread_local const OscTrace*	sOwner	= nullptr;
+	static thread_local ThreadRing*		sRing	= nullptr;
+
+	if ( sOwner == this ) {
+		return sRing;
+	}
+
+	lock_guard<mutex> lock( mMutex );
+
+	ThreadRing* ring	= nullptr;
+	thread::id threadId	= this_thread::get_id();
+	for ( const auto& threadRing : mRings ) {
+		if ( threadRing->mThreadId == threadId ) {
+			ring = threadRing.get();
+			break;
+		}
+	}
+
+	if ( ring == nullptr ) {
+		mRings.emplace_back( new ThreadRing( mRingCapacity, static_cast<uint32_t>( mRings.size() ) ) );
+		ring = mRings.back().get();
+	}
+
+	sOwner	= this;
+	sRing	= ring;
+
+	return ring;
+}
+
+uint64_t OscTrace::beginPacket( uint64_t arrivalTime )
+{
+	uint64_t packetId	= mNextPacketId.fetch_add( 1, memory_order_relaxed ) & kPacketIdMask;
+	ThreadRing* ring	= getThreadRing();
+	ring->record( STAGE_ARRIVAL, packetId, arrivalTime );
+	ring->record( STAGE_RECEIVE, packetId, now() );
+	sCurrentPacket = packetId;
+	return packetId;
+}
+
+void OscTrace::record( Stage stage )
+{
+	if ( sCurrentPacket != 0 ) {
+		getThreadRing()->record( stage, sCurrentPacket, now() );
+	}
+}
+
+void OscTrace::record( Stage stage, uint64_t packetId )
+{
+	getThreadRing()->record( stage, packetId, now() );
+}
+
+vector<OscTrace::Event> OscTrace::collect() const
+{
+	vector<Event> events;
+
+	lock_guard<mutex> lock( mMutex );
+	for ( const auto& ring : mRings ) {
+		ring->collect( events );
+	}
+
+	return events;
+}
+
+void OscTrace::reset()
+{
+	lock_guard<mutex> lock( mMutex );
+	for ( const auto& ring : mRings ) {
+		ring->mBegin.store( ring->mHead.load( memory_order_acquire ), memory_order_relaxed );
+	}
+}
+
+string OscTrace::toChromeTrace() const
+{
+	vector<Event> events = collect();
+	map<uint64_t, PacketStages> packets = getPacketStages( events );
+
+	stringstream ss;
+	ss << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first = true;
+	for ( const auto& iter : packets ) {
+		const PacketStages& packet = iter.second;
+		if ( packet.has( STAGE_ARRIVAL ) && packet.has( STAGE_RECEIVE ) ) {
+			writeSpan( ss, first, "socket", iter.first, packet.mTimes[ STAGE_ARRIVAL ], packet.mTimes[ STAGE_RECEIVE ], packet.mThreads[ STAGE_RECEIVE ] );
+		}
+		if ( packet.has( STAGE_PARSE_BEGIN ) && packet.has( STAGE_PARSE_END ) ) {
+			writeSpan( ss, first, "parse", iter.first, packet.mTimes[ STAGE_PARSE_BEGIN ], packet.mTimes[ STAGE_PARSE_END ], packet.mThreads[ STAGE_PARSE_BEGIN ] );
+		}
+		if ( packet.has( STAGE_ENQUEUE ) && packet.has( STAGE_DEQUEUE ) ) {
+			writeSpan( ss, first, "queue", iter.first, packet.mTimes[ STAGE_ENQUEUE ], packet.mTimes[ STAGE_DEQUEUE ], packet.mThreads[ STAGE_DEQUEUE ] );
+		}
+		Stage handlerBegin = getHandlerBegin( packet );
+		if ( packet.has( handlerBegin ) && packet.has( STAGE_HANDLER_END ) ) {
+			writeSpan( ss, first, "handler", iter.first, packet.mTimes[ handlerBegin ], packet.mTimes[ STAGE_HANDLER_END ], packet.mThreads[ STAGE_HANDLER_END ] );
+		}
+	}
+
+	// names the rows of the threads events came from
+	vector<uint32_t> threads;
+	for ( const Event& event : events ) {
+		threads.push_back( event.mThreadIndex );
+	}
+	sort( threads.begin(), threads.end() );
+	threads.erase( unique( threads.begin(), threads.end() ), threads.end() );
+	for ( uint32_t thread : threads ) {
+		ss << ( first ? "" : "," ) << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+			<< ",\"args\":{\"name\":\"OSC thread " << thread << "\"}}";
+		first = false;
+	}
+	ss << "\n]}";
+
+	return ss.str();
+}
+
+OscTrace::Summary OscTrace::summarize() const
+{
+	Summary summary;
+
+	map<uint64_t, PacketStages> packets = getPacketStages( collect() );
+	for ( const auto& iter : packets ) {
+		const PacketStages& packet = iter.second;
+		// packets whose start was overwritten would only skew the numbers
+		if ( !packet.has( STAGE_ARRIVAL ) || !packet.has( STAGE_RECEIVE ) ) {
+			continue;
+		}
+		++summary.mNumPackets;
+
+		const uint64_t* times = packet.mTimes;
+		summary.mSocket.record( times[ STAGE_RECEIVE ] - min( times[ STAGE_ARRIVAL ], times[ STAGE_RECEIVE ] ) );
+		if ( packet.has( STAGE_PARSE_BEGIN ) && packet.has( STAGE_PARSE_END ) ) {
+			summary.mParse.record( times[ STAGE_PARSE_END ] - times[ STAGE_PARSE_BEGIN ] );
+		}
+		if ( packet.has( STAGE_ENQUEUE ) && packet.has( STAGE_DEQUEUE ) ) {
+			summary.mQueue.record( times[ STAGE_DEQUEUE ] - times[ STAGE_ENQUEUE ] );
+		}
+		if ( packet.has( STAGE_HANDLER_END ) ) {
+			summary.mHandler.record( times[ STAGE_HANDLER_END ] - times[ getHandlerBegin( packet ) ] );
+			summary.mTotal.record( times[ STAGE_HANDLER_END ] - min( times[ STAGE_ARRIVAL ], times[ STAGE_HANDLER_END ] ) );
+		}
+	}
+
+	return summary;
+}
@@ -0,0 +1,131 @@
+//
+//  OscTrace.h
+//
+//	Per-packet latency tracing, from the socket to the handler
+//
+//	When tracing is enabled every received packet gets an ID, and
+//	each stage it passes through records a timestamp against it:
+//	arrival at the socket ( the kernel's receive timestamp where the
+//	platform has one ), the read by the transport, the start and end
+//	of parsing, the dispatcher queue and the end of its handlers.
+//	The packet's ID follows it through the receiving thread and the
+//	dispatcher's tasks, so no API has to carry it.
+//
+//	Each thread records into a ring of its own with a plain store
+//	and a release of the ring's head, so recording never locks or
+//	contends. Readers copy the rings and drop whatever was overwritten
+//	while they copied. The oldest events are overwritten once a ring
+//	is full. collect() gathers the rings for a Chrome trace, which
+//	chrome://tracing and ui.perfetto.dev open, or a summary of where
+//	the time went.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "OscMetrics.h"
+
+class OscTrace
+{
+public:
+	enum Stage : uint8_t
+	{
+		//! The packet arrived at the socket
+		STAGE_ARRIVAL,
+		//! The transport read the packet
+		STAGE_RECEIVE,
+		STAGE_PARSE_BEGIN,
+		STAGE_PARSE_END,
+		//! A message of the packet was queued for the dispatcher
+		STAGE_ENQUEUE,
+		//! A dispatcher worker took the message
+		STAGE_DEQUEUE,
+		//! The handlers of a message, or the transport's receive handler, returned
+		STAGE_HANDLER_END,
+		STAGE_COUNT
+	};
+
+	struct Event
+	{
+		uint64_t				mPacketId;
+		//! Nanoseconds on the steady clock, see now()
+		uint64_t				mTime;
+		uint32_t				mThreadIndex;
+		Stage					mStage;
+	};
+
+	//! Latencies between stages in nanoseconds, each packet counted once.
+	//! The messages of a bundle are taken together, from the first one
+	//! queued to the last one handled.
+	struct Summary
+	{
+		Summary() : mNumPackets( 0 ) {}
+
+		uint64_t				mNumPackets;
+		//! Arrival to the transport reading it, time spent in the kernel
+		OscMetrics::Histogram	mSocket;
+		OscMetrics::Histogram	mParse;
+		//! Queued to taken by a dispatcher worker
+		OscMetrics::Histogram	mQueue;
+		//! Taken, or parsed without a dispatcher, to the end of the handlers
+		OscMetrics::Histogram	mHandler;
+		//! Arrival to the end of the handlers
+		OscMetrics::Histogram	mTotal;
+
+		//! Returns a human readable summary with percentiles
+		std::string				toString() const;
+	};
+
+	//! Returns the trace the transports, parser and dispatcher record to
+	static OscTrace&		get();
+
+	//! Enables or disables tracing, disabled by default. Enable it before
+	//! receiving starts for transports to ask the kernel for timestamps.
+	void					setEnabled( bool enabled ) { mEnabled.store( enabled, std::memory_order_relaxed ); }
+	bool					isEnabled() const { return mEnabled.load( std::memory_order_relaxed ); }
+	//! Sets the number of events each thread keeps, for threads that record from here on. 32768 by default.
+	void					setRingCapacity( size_t capacity );
+
+	//! Starts a packet that arrived at \a arrivalTime, recording its arrival and receive
+	//! and making it the calling thread's current packet. Returns its ID.
+	uint64_t				beginPacket( uint64_t arrivalTime );
+	//! Records \a stage for the calling thread's current packet, if there is one
+	void					record( Stage stage );
+	//! Records \a stage for \a packetId
+	void					record( Stage stage, uint64_t packetId );
+
+	//! Returns the packet the calling thread is working on, zero if none
+	static uint64_t			getCurrentPacket();
+	static void				setCurrentPacket( uint64_t packetId );
+
+	//! Returns the time in nanoseconds on the clock events are recorded with
+	static uint64_t			now();
+
+	//! Copies the events of every thread, oldest first within each thread
+	std::vector<Event>		collect() const;
+	//! Returns the events as Chrome trace event JSON, a span for each stage of each packet
+	std::string				toChromeTrace() const;
+	Summary					summarize() const;
+	//! Forgets the events recorded so far
+	void					reset();
+
+	OscTrace();
+protected:
+	OscTrace( const OscTrace& );
+	OscTrace&				operator=( const OscTrace& );
+
+	struct ThreadRing;
+
+	ThreadRing*				getThreadRing();
+
+	std::atomic<bool>						mEnabled;
+	std::atomic<uint64_t>					mNextPacketId;
+	size_t									mRingCapacity;
+	mutable std::mutex						mMutex;
+	std::vector<std::unique_ptr<ThreadRing>>	mRings;
+};
@@ -0,0 +1,353 @@
+//
+//  OscTransport.cpp
+//
+
+#include "OscTransport.h"
+#include "OscTrace.h"
+#include "cinder/Log.h"
+
+#if defined( __linux__ )
+	#include <linux/sockios.h>
+	#include <sys/ioctl.h>
+	#include <sys/socket.h>
+	#include <time.h>
+#endif
+
+using namespace ci;
+using namespace std;
+using asio::ip::udp;
+
+namespace
+{
+	// datagrams read in one go before going back to the io_service,
+	// so a busy socket can't starve the other endpoints
+	const size_t	kMaxReadsPerWakeup	= 64;
+
+	// the largest UDP payload
+	const size_t	kMaxDatagramSize	= 65507;
+
+	// asio hands at most this many buffers to one sendmsg() or WSASendTo()
+	const size_t	kMaxGatherBuffers	= 64;
+
+	// Asks the kernel to timestamp the datagrams it receives on \a socket
+	void enableTimestamps( udp::socket& socket )
+	{
+#if defined( __linux__ )
+		int enabled = 1;
+		setsockopt( socket.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &enabled, sizeof( enabled ) );
+#endif
+	}
+
+	// Returns when the datagram last read from \a socket arrived, on the
+	// clock OscTrace records with, or now where the kernel can't tell
+	uint64_t getArrivalTime( udp::socket& socket )
+	{
+		uint64_t now = OscTrace::now();
+#if defined( __linux__ )
+		// the kernel's timestamp is wall clock time, moved over by how long ago it was
+		timespec arrival, realtime;
+		if ( ioctl( socket.native_handle(), SIOCGSTAMPNS, &arrival ) == 0 && clock_gettime( CLOCK_REALTIME, &realtime ) == 0 ) {
+			int64_t age = ( static_cast<int64_t>( realtime.tv_sec ) - arrival.tv_sec ) * 1000000000 + ( realtime.tv_nsec - arrival.tv_nsec );
+			if ( age > 0 && static_cast<uint64_t>( age ) < now ) {
+				return now - static_cast<uint64_t>( age );
+			}
+		}
+#endif
+		return now;
+	}
+}
+
+OscUdpTransportRef OscUdpTransport::create( const OscExecutorRef& executor, uint16_t localPort )
+{
+	return make_shared<OscUdpTransport>( executor, localPort );
+}
+
+OscUdpTransport::OscUdpTransport( const OscExecutorRef& executor, uint16_t localPort )
+	: OscTransport( executor ), mSocket( executor->getIoService(), udp::endpoint( udp::v4(), localPort ) ), 
+	mReceiving( false )
+{
+}
+
+OscUdpTransport::~OscUdpTransport()
+{
+	close();
+}
+
+void OscUdpTransport::connect( const string& host, uint16_t port )
+{
+	udp::resolver resolver( mExecutor->getIoService() );
+	mRemoteEndpoint = *resolver.resolve( udp::resolver::query( udp::v4(), host, to_string( port ) ) );
+}
+
+uint16_t OscUdpTransport::getLocalPort() const
+{
+	return mSocket.local_endpoint().port();
+}
+
+void OscUdpTransport::send( const BufferRef& packet, const SendHandler& handler )
+{
+	// the packet is held by the completion handler until it is sent
+	OscUdpTransportRef self = shared_from_this();
+	mSocket.async_send_to( asio::buffer( packet->getData(), packet->getSize() ), mRemoteEndpoint, 
+		[ self, packet, handler ]( const asio::error_code& error, size_t )
+	{
+		if ( error ) {
+			CI_LOG_W( "OSC send failed: " << error.message() );
+		}
+		if ( handler ) {
+			handler( !error );
+		}
+	} );
+}
+
+void OscUdpTransport::send( const OscTree& tree, const SendHandler& handler, size_t minReferencedSize )
+{
+	// the copy shares the tree's values, keeping referenced blobs alive until the send completes
+	shared_ptr<OscTree> held = make_shared<OscTree>( tree );
+	vector<OscTree::GatherBuffer> gather;
+	BufferRef encoded = held->toBuffers( gather, minReferencedSize );
+
+	// the buffers past the limit would be left out of the datagram
+	if ( gather.size() > kMaxGatherBuffers ) {
+		send( held->toBuffer(), handler );
+		return;
+	}
+
+	// asio copies the list of buffers, but not what they point to
+	vector<asio::const_buffer> buffers;
+	buffers.reserve( gather.size() );
+	for ( const OscTree::GatherBuffer& buffer : gather ) {
+		buffers.push_back( asio::buffer( buffer.mData, buffer.mSize ) );
+	}
+
+	OscUdpTransportRef self = shared_from_this();
+	mSocket.async_send_to( buffers, mRemoteEndpoint, 
+		[ self, held, encoded, handler ]( const asio::error_code& error, size_t )
+	{
+		if ( error ) {
+			CI_LOG_W( "OSC send failed: " << error.message() );
+		}
+		if ( handler ) {
+			handler( !error );
+		}
+	} );
+}
+
+void OscUdpTransport::setReceiveHandler( const ReceiveHandler& handler )
+{
+	mReceiveHandler = handler;
+	if ( !mReceiving && mSocket.is_open() ) {
+		mReceiving = true;
+		if ( OscTrace::get().isEnabled() ) {
+			enableTimestamps( mSocket );
+		}
+		// reads stop at an empty socket rather than wait on it
+		asio::error_code error;
+		mSocket.non_blocking( true, error );
+		receive();
+	}
+}
+
+void OscUdpTransport::close()
+{
+	if ( mSocket.is_open() ) {
+		asio::error_code error;
+		mSocket.close( error );
+	}
+	mReceiving = false;
+}
+
+void OscUdpTransport::receive()
+{
+	// waits for a datagram without reading it, so it can be read
+	// straight into a buffer of its size instead of copied into one
+	OscUdpTransportRef self = shared_from_this();
+	mSocket.async_receive_from( asio::null_buffers(), mSenderEndpoint, 
+		[ self ]( const asio::error_code& error, size_t )
+	{
+		if ( !self->mSocket.is_open() ) {
+			return;
+		}
+		if ( error ) {
+			CI_LOG_W( "OSC receive failed: " << error.message() );
+			self->receive();
+			return;
+		}
+
+		// drain whatever else already arrived without another round trip through the io_service
+		size_t numReads = 0;
+		while ( numReads < kMaxReadsPerWakeup && self->mSocket.is_open() && self->readPacket() ) {
+			++numReads;
+		}
+
+		if ( self->mSocket.is_open() ) {
+			self->receive();
+		}
+	} );
+}
+
+bool OscUdpTransport::readPacket()
+{
+	// the size of the next datagram on Linux and macOS, of everything
+	// queued on Windows, which is why it is capped
+	asio::error_code error;
+	size_t size = min( mSocket.available( error ), kMaxDatagramSize );
+	if ( error ) {
+		return false;
+	}
+
+	BufferRef packet	= mBufferPool ? mBufferPool->acquire( size ) : Buffer::create( size );
+	size_t numBytes		= mSocket.receive_from( asio::buffer( packet->getData(), packet->getAllocatedSize() ), mSenderEndpoint, 0, error );
+	if ( error ) {
+		if ( error != asio::error::would_block ) {
+			CI_LOG_W( "OSC receive failed: " << error.message() );
+		}
+		return false;
+	}
+	packet->setSize( numBytes );
+
+	dispatchPacket( packet );
+	return true;
+}
+
+void OscUdpTransport::dispatchPacket( const BufferRef& packet )
+{
+	if ( !mReceiveHandler ) {
+		return;
+	}
+
+	OscTrace& trace = OscTrace::get();
+	if ( !trace.isEnabled() ) {
+		mReceiveHandler( packet );
+		return;
+	}
+	trace.beginPacket( getArrivalTime( mSocket ) );
+	mReceiveHandler( packet );
+	trace.record( OscTrace::STAGE_HANDLER_END );
+	OscTrace::setCurrentPacket( 0 );
+}
+
+pair<OscLoopbackTransportRef, OscLoopbackTransportRef> OscLoopbackTransport::createPair( const OscExecutorRef& executor )
+{
+	OscLoopbackTransportRef a = make_shared<OscLoopbackTransport>( executor );
+	OscLoopbackTransportRef b = make_shared<OscLoopbackTransport>( executor );
+	a->mPeer = b;
+	b->mPeer = a;
+
+	return make_pair( a, b );
+}
+
+OscLoopbackTransport::OscLoopbackTransport( const OscExecutorRef& executor )
+	: OscTransport( executor ), mClosed( false )
+{
+}
+
+void OscLoopbackTransport::send( const BufferRef& packet, const SendHandler& handler )
+{
+	OscLoopbackTransportRef peer = mClosed ? OscLoopbackTransportRef() : mPeer.lock();
+	mExecutor->post( [ peer, packet, handler ]()
+	{
+		if ( peer ) {
+			peer->deliver( packet );
+		}
+		if ( handler ) {
+			handler( static_cast<bool>( peer ) );
+		}
+	} );
+}
+
+void OscLoopbackTransport::setReceiveHandler( const ReceiveHandler& handler )
+{
+	mReceiveHandler = handler;
+}
+
+void OscLoopbackTransport::close()
+{
+	mClosed = true;
+	mReceiveHandler = nullptr;
+}
+
+void OscLoopbackTransport::deliver( const BufferRef& packet )
+{
+	if ( mClosed || !mReceiveHandler ) {
+		return;
+	}
+
+	OscTrace& trace = OscTrace::get();
+	if ( !trace.isEnabled() ) {
+		mReceiveHandler( packet );
+		return;
+	}
+	trace.beginPacket( OscTrace::now() );
+	mReceiveHandler( packet );
+	trace.record( OscTrace::STAGE_HANDLER_END );
+	OscTrace::setCurrentPacket( 0 );
+}
+
+OscLossyTransportRef OscLossyTransport::create( const OscTransportRef& transport, uint32_t seed )
+{
+	return make_shared<OscLossyTransport>( transport, seed );
+}
+
+OscLossyTransport::OscLossyTransport( const OscTransportRef& transport, uint32_t seed )
+	: OscTransport( transport->getExecutor() ), mTransport( transport ), mRandom( seed ), mLossProbability( 0.0 ), 
+	mLatency( 0 ), mJitter( 0 ), mClosed( false ), mNumSent( 0 ), mNumDropped( 0 )
+{
+}
+
+void OscLossyTransport::setLatency( const chrono::microseconds& latency, const chrono::microseconds& jitter )
+{
+	mLatency	= latency;
+	mJitter		= jitter;
+}
+
+void OscLossyTransport::send( const BufferRef& packet, const SendHandler& handler )
+{
+	// a dropped packet still counts as sent, the network lost it
+	bool dropped = !mClosed && uniform_real_distribution<double>( 0.0, 1.0 )( mRandom ) < mLossProbability;
+	if ( mClosed || dropped ) {
+		if ( dropped ) {
+			++mNumDropped;
+		}
+		mExecutor->post( [ handler, dropped ]()
+		{
+			if ( handler ) {
+				handler( dropped );
+			}
+		} );
+		return;
+	}
+
+	++mNumSent;
+	chrono::microseconds delay = mLatency;
+	if ( mJitter.count() > 0 ) {
+		delay += chrono::microseconds( uniform_int_distribution<int64_t>( 0, mJitter.count() )( mRandom ) );
+	}
+	if ( delay.count() == 0 ) {
+		mTransport->send( packet, handler );
+		return;
+	}
+
+	OscLossyTransportRef self = shared_from_this();
+	shared_ptr<asio::steady_timer> timer = make_shared<asio::steady_timer>( mExecutor->getIoService() );
+	timer->expires_from_now( delay );
+	timer->async_wait( [ self, timer, packet, handler ]( const asio::error_code& error )
+	{
+		if ( !error && !self->mClosed ) {
+			self->mTransport->send( packet, handler );
+		} else if ( handler ) {
+			handler( false );
+		}
+	} );
+}
+
+void OscLossyTransport::setReceiveHandler( const ReceiveHandler& handler )
+{
+	mTransport->setReceiveHandler( handler );
+}
+
+void OscLossyTransport::close()
+{
+	mClosed = true;
+	mTransport->close();
+}
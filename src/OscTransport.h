@@ -0,0 +1,156 @@
+//
+//  OscTransport.h
+//
+//	Datagram transports that carry encoded OSC packets
+//
+//	A transport sends and receives whole packets. Receive and send
+//	handlers always run on the thread of the executor's io_service,
+//	so code built on top of a transport, like the coroutines in
+//	OscAsync.h, never needs to lock. OscUdpTransport talks to the network through asio,
+//	OscLoopbackTransport connects two transports in the same process, and
+//	OscLossyTransport wraps either to simulate a bad network.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "asio/asio.hpp"
+#include "cinder/Buffer.h"
+#include "OscBufferPool.h"
+#include "OscExecutor.h"
+#include "OscTree.h"
+
+class OscTransport;
+class OscUdpTransport;
+class OscLoopbackTransport;
+class OscLossyTransport;
+typedef std::shared_ptr<OscTransport>			OscTransportRef;
+typedef std::shared_ptr<OscUdpTransport>		OscUdpTransportRef;
+typedef std::shared_ptr<OscLoopbackTransport>	OscLoopbackTransportRef;
+typedef std::shared_ptr<OscLossyTransport>		OscLossyTransportRef;
+
+class OscTransport
+{
+public:
+	typedef std::function<void( const ci::BufferRef& packet )>	ReceiveHandler;
+	typedef std::function<void( bool sent )>						SendHandler;
+
+	virtual ~OscTransport() {}
+
+	//! Sends \a packet, \a handler is called once it has been handed to the network.
+	//! \a packet must not be modified until then.
+	virtual void				send( const ci::BufferRef& packet, const SendHandler& handler = SendHandler() ) = 0;
+	//! Calls \a handler for every packet received from here on
+	virtual void				setReceiveHandler( const ReceiveHandler& handler ) = 0;
+	//! Stops receiving, pending handlers are not called
+	virtual void				close() = 0;
+
+	const OscExecutorRef&		getExecutor() const { return mExecutor; }
+
+protected:
+	OscTransport( const OscExecutorRef& executor ) : mExecutor( executor ) {}
+
+	OscExecutorRef				mExecutor;
+};
+
+//! UDP transport bound to a local port, sending to a single remote endpoint
+class OscUdpTransport : public OscTransport, public std::enable_shared_from_this<OscUdpTransport>
+{
+public:
+	//! Creates a transport bound to \a localPort, an ephemeral port if zero
+	static OscUdpTransportRef	create( const OscExecutorRef& executor, uint16_t localPort = 0 );
+	~OscUdpTransport();
+
+	//! Sets where packets are sent, resolving \a host synchronously
+	void						connect( const std::string& host, uint16_t port );
+	//! Receives packets straight into buffers from \a pool rather than the heap
+	void						setBufferPool( const OscBufferPoolRef& pool ) { mBufferPool = pool; }
+
+	void						send( const ci::BufferRef& packet, const SendHandler& handler = SendHandler() ) override;
+	//! Sends \a tree with a single gathering write, blob values of at least \a minReferencedSize
+	//! bytes go to the socket from where they are without being copied, see OscTree::toBuffers()
+	void						send( const OscTree& tree, const SendHandler& handler = SendHandler(), size_t minReferencedSize = 1024 );
+	void						setReceiveHandler( const ReceiveHandler& handler ) override;
+	void						close() override;
+
+	uint16_t					getLocalPort() const;
+	const asio::ip::udp::endpoint&	getRemoteEndpoint() const { return mRemoteEndpoint; }
+	//! Returns the endpoint the last packet was received from
+	const asio::ip::udp::endpoint&	getSenderEndpoint() const { return mSenderEndpoint; }
+
+	OscUdpTransport( const OscExecutorRef& executor, uint16_t localPort );
+protected:
+	void						receive();
+	//! Reads the next datagram into a buffer of its own, false once there is none
+	bool						readPacket();
+	void						dispatchPacket( const ci::BufferRef& packet );
+
+	asio::ip::udp::socket		mSocket;
+	asio::ip::udp::endpoint		mRemoteEndpoint;
+	asio::ip::udp::endpoint		mSenderEndpoint;
+	ReceiveHandler				mReceiveHandler;
+	OscBufferPoolRef			mBufferPool;
+	bool						mReceiving;
+};
+
+//! In-process transport. Packets sent on one transport of a pair
+//! are received by the other, without copying.
+class OscLoopbackTransport : public OscTransport, public std::enable_shared_from_this<OscLoopbackTransport>
+{
+public:
+	//! Creates two transports connected to each other
+	static std::pair<OscLoopbackTransportRef, OscLoopbackTransportRef>	createPair( const OscExecutorRef& executor );
+
+	void						send( const ci::BufferRef& packet, const SendHandler& handler = SendHandler() ) override;
+	void						setReceiveHandler( const ReceiveHandler& handler ) override;
+	void						close() override;
+
+	OscLoopbackTransport( const OscExecutorRef& executor );
+protected:
+	void						deliver( const ci::BufferRef& packet );
+
+	std::weak_ptr<OscLoopbackTransport>	mPeer;
+	ReceiveHandler				mReceiveHandler;
+	bool						mClosed;
+};
+
+//! Wraps another transport and drops and delays the packets it sends,
+//! for testing code against loss, latency and reordering over loopback.
+//! Received packets are passed through untouched.
+class OscLossyTransport : public OscTransport, public std::enable_shared_from_this<OscLossyTransport>
+{
+public:
+	//! Wraps \a transport, \a seed makes the simulated losses repeatable
+	static OscLossyTransportRef	create( const OscTransportRef& transport, uint32_t seed = 1 );
+
+	//! Drops each packet sent with \a probability ( 0 - 1 )
+	void						setLossProbability( double probability ) { mLossProbability = probability; }
+	//! Delays each packet sent by \a latency plus up to \a jitter, chosen at random.
+	//! Packets sent closer together than the jitter can arrive out of order.
+	void						setLatency( const std::chrono::microseconds& latency, const std::chrono::microseconds& jitter = std::chrono::microseconds( 0 ) );
+
+	void						send( const ci::BufferRef& packet, const SendHandler& handler = SendHandler() ) override;
+	void						setReceiveHandler( const ReceiveHandler& handler ) override;
+	void						close() override;
+
+	uint64_t					getNumSent() const { return mNumSent; }
+	uint64_t					getNumDropped() const { return mNumDropped; }
+
+	OscLossyTransport( const OscTransportRef& transport, uint32_t seed );
+protected:
+	OscTransportRef				mTransport;
+	std::mt19937				mRandom;
+	double						mLossProbability;
+	std::chrono::microseconds	mLatency;
+	std::chrono::microseconds	mJitter;
+	bool						mClosed;
+	uint64_t					mNumSent;
+	uint64_t					mNumDropped;
+};
@@ -6,8 +6,12 @@
 //
 
 #include "OscTree.h"
+#include "OscMetrics.h"
+#include "OscTrace.h"
 #include "cinder/Utilities.h"
+#include <algorithm>
 #include <limits>
+#include <thread>
 
 using namespace ci;
 using namespace std;
@@ -22,36 +26,343 @@ size_t ceil4( size_t size )
 	return size + 4 - remainder;
 }
 
-void padWithZeroes( BufferRef& buffer, size_t offset, size_t length )
+// Masks of the last 0 to 3 bytes of a 32-bit word, in memory order
+const uint8_t kPaddingMasks[ 4 ][ 4 ] = {
+	{ 0x00, 0x00, 0x00, 0x00 }, 
+	{ 0x00, 0x00, 0x00, 0xFF }, 
+	{ 0x00, 0x00, 0xFF, 0xFF }, 
+	{ 0x00, 0xFF, 0xFF, 0xFF }
+};
+
+// Returns the padding from p up to the next multiple of 4 bytes
+// from the start of the block, or null if it doesn't fit in the block
+const char* getPaddingEnd( const char* pBlockBegin, const char* p, const char* pBlockEnd )
 {
-	uint8_t* data	= reinterpret_cast<uint8_t*>( buffer->getData() );
-	data			+= offset;
-	
-	memset( data, 0, length );
+	const char* q = pBlockBegin + ceil4( p - pBlockBegin );
+	return q <= pBlockEnd ? q : nullptr;
 }
 
-void padWithZeroes( BufferRef& buffer )
+// Checks the padding from p up to q, at most 3 bytes ending on a
+// multiple of 4 from the start of the block, is zero. The padding
+// is checked as a whole word, q is always at least 4 bytes in.
+bool isZeroPadding( const char* p, const char* q )
 {
-	size_t oldSize		= buffer->getAllocatedSize();
-	size_t newSize		= ceil4( oldSize );
-	size_t diff			= newSize - oldSize;
-	
-	if ( diff > 0 ) {
-		buffer->resize( newSize );
-		padWithZeroes( buffer, oldSize, diff );
+	uint32_t word;
+	uint32_t mask;
+	memcpy( &word, q - 4, 4 );
+	memcpy( &mask, kPaddingMasks[ q - p ], 4 );
+	return ( word & mask ) == 0;
+}
+
+// Checks the bytes from p up to the next multiple of 4 bytes from
+// the start of the block are zero, and that they fit in the block
+bool isZeroPadded( const char* pBlockBegin, const char* p, const char* pBlockEnd )
+{
+	const char* q = getPaddingEnd( pBlockBegin, p, pBlockEnd );
+	return q != nullptr && isZeroPadding( p, q );
+}
+
+// Type tag codecs. Sizes include padding, a negative size is the
+// ParseError that stops the parse.
+
+template <size_t N>
+ptrdiff_t getFixedSize( const char*, size_t available )
+{
+	return available >= N ? static_cast<ptrdiff_t>( N ) : -OscTree::PARSE_TRUNCATED;
+}
+
+ptrdiff_t getStringSize( const char* data, size_t available )
+{
+	const char* pEnd = available > 0 ? static_cast<const char*>( memchr( data, 0, available ) ) : nullptr;
+	if ( pEnd == nullptr ) {
+		return -OscTree::PARSE_TRUNCATED;
+	}
+	return static_cast<ptrdiff_t>( min( ceil4( pEnd - data + 1 ), available ) );
+}
+
+ptrdiff_t getBlobSize( const char* data, size_t available )
+{
+	// the first 4 bytes of a blob are a 32-bit integer
+	// representing the number of 8-bit bytes in the blob
+	int32_t blobSize = -1;
+	if ( available >= 4 ) {
+		memcpy( &blobSize, data, 4 );
+	}
+	if ( blobSize < 0 || static_cast<size_t>( blobSize ) + 4 > available ) {
+		return -OscTree::PARSE_TRUNCATED;
 	}
+	return static_cast<ptrdiff_t>( min( ceil4( blobSize + 4 ), available ) );
+}
+
+ptrdiff_t getUnknownSize( const char*, size_t )
+{
+	return -OscTree::PARSE_UNKNOWN_TYPE_TAG;
+}
+
+BufferRef decodeString( const char* data, size_t size )
+{
+	// strings are stored with their terminator, not their padding
+	size_t length		= static_cast<const char*>( memchr( data, 0, size ) ) - data;
+	BufferRef value		= Buffer::create( length + 1 );
+	value->copyFrom( data, length + 1 );
+	return value;
 }
 
-bool isZeroPadded( const char* p )
+BufferRef decodeBlob( const char* data, size_t )
 {
-	const char* q = (const char*)ceil4( (size_t)p );
-	for ( ; p < q; ++p ) {
-		if ( *p != 0 ) {
-			return false;
+	int32_t blobSize;
+	memcpy( &blobSize, data, 4 );
+	BufferRef value		= Buffer::create( blobSize );
+	value->copyFrom( data + 4, blobSize );
+	return value;
+}
+
+BufferRef decodeNone( const char*, size_t )
+{
+	return BufferRef();
+}
+
+// A value that refers to the packet it was parsed from, and keeps it alive
+struct ValueView
+{
+	ValueView( const BufferRef& source, const char* data, size_t size )
+		: mSource( source ), mView( const_cast<char*>( data ), size )
+	{
+	}
+
+	BufferRef	mSource;
+	Buffer		mView;
+};
+
+// Returns the value of an argument with a built in codec as a view of
+// source instead of a copy, or nothing if the codec is a custom one
+BufferRef decodeView( const BufferRef& source, OscTree::TypeTagCodec::DecodeFn decode, const char* data, size_t size )
+{
+	if ( decode == &decodeString ) {
+		size = static_cast<const char*>( memchr( data, 0, size ) ) - data + 1;
+	} else if ( decode == &decodeBlob ) {
+		int32_t blobSize;
+		memcpy( &blobSize, data, 4 );
+		data	+= 4;
+		size	= blobSize;
+	} else if ( decode != &OscTree::decodeValue ) {
+		return BufferRef();
+	}
+
+	shared_ptr<ValueView> view = make_shared<ValueView>( source, data, size );
+	return BufferRef( view, &view->mView );
+}
+
+// Holds a tree's encode lock for as long as it is in scope
+class ScopedEncodeLock
+{
+public:
+	ScopedEncodeLock( atomic_flag& lock )
+		: mLock( lock )
+	{
+		while ( mLock.test_and_set( memory_order_acquire ) ) {
+			this_thread::yield();
+		}
+	}
+
+	~ScopedEncodeLock()
+	{
+		mLock.clear( memory_order_release );
+	}
+
+protected:
+	atomic_flag&	mLock;
+};
+
+struct CodecTable
+{
+	CodecTable()
+	{
+		OscTree::TypeTagCodec unknown	= { &getUnknownSize, &decodeNone, 0 };
+		OscTree::TypeTagCodec int32		= { &getFixedSize<4>, &OscTree::decodeValue, 0 };
+		OscTree::TypeTagCodec int64		= { &getFixedSize<8>, &OscTree::decodeValue, 0 };
+		OscTree::TypeTagCodec text		= { &getStringSize, &decodeString, 0 };
+		OscTree::TypeTagCodec blob		= { &getBlobSize, &decodeBlob, 4 };
+		OscTree::TypeTagCodec none		= { &getFixedSize<0>, &decodeNone, 0 };
+
+		fill( begin( mCodecs ), end( mCodecs ), unknown );
+
+		// 32-bit int, float, ascii character, rgba color, midi message
+		mCodecs[ 'i' ] = mCodecs[ 'f' ] = mCodecs[ 'c' ] = mCodecs[ 'r' ] = mCodecs[ 'm' ] = int32;
+		// 64-bit int, double, time tag
+		mCodecs[ 'h' ] = mCodecs[ 'd' ] = mCodecs[ 't' ] = int64;
+		// string, alternate string ( symbol )
+		mCodecs[ 's' ] = mCodecs[ 'S' ] = text;
+		mCodecs[ 'b' ] = blob;
+		// true, false, nil, infinitum
+		mCodecs[ 'T' ] = mCodecs[ 'F' ] = mCodecs[ 'N' ] = mCodecs[ 'I' ] = none;
+	}
+
+	OscTree::TypeTagCodec	mCodecs[ 256 ];
+};
+
+CodecTable sCodecTable;
+
+void OscTree::registerTypeTag( TypeTag typeTag, const TypeTagCodec& codec )
+{
+	sCodecTable.mCodecs[ typeTag ] = codec;
+}
+
+const OscTree::TypeTagCodec& OscTree::getTypeTagCodec( TypeTag typeTag )
+{
+	return sCodecTable.mCodecs[ typeTag ];
+}
+
+BufferRef OscTree::decodeValue( const char* data, size_t size )
+{
+	BufferRef value = Buffer::create( size );
+	value->copyFrom( data, size );
+	return value;
+}
+
+// Walks a packet the way the parser does, checking it without building
+// anything, and zeroing its padding on the way when canonicalizing
+class PacketValidator
+{
+public:
+	PacketValidator( const char* data, bool canonicalize )
+		: mPacket( data ), mCanonicalize( canonicalize )
+	{
+	}
+
+	OscTree::Validation		validate( size_t size )
+	{
+		validateElement( mPacket, size );
+		return mValidation;
+	}
+
+protected:
+	bool					fail( OscTree::ParseError error, const char* p )
+	{
+		mValidation.mError			= error;
+		mValidation.mErrorOffset	= static_cast<uint32_t>( p - mPacket );
+		return false;
+	}
+
+	// Returns true if the padding from p to q is zero, or has been zeroed
+	bool					checkPadding( const char* p, const char* q )
+	{
+		if ( isZeroPadding( p, q ) ) {
+			return true;
+		}
+		if ( mCanonicalize ) {
+			memset( const_cast<char*>( p ), 0, q - p );
+			return true;
+		}
+		mValidation.mHasNonZeroPadding = true;
+		return false;
+	}
+
+	bool					validateElement( const char* data, size_t size )
+	{
+		if ( size % 4 != 0 ) {
+			mValidation.mHasStrayBytes = true;
+		}
+		if ( size == 0 ) {
+			return fail( OscTree::PARSE_TRUNCATED, data );
+		}
+		return *data == '#' ? validateBundle( data, size ) : validateMessage( data, size );
+	}
+
+	bool					validateBundle( const char* data, size_t size )
+	{
+		if ( size < 16 || memcmp( data, "#bundle", 8 ) != 0 ) {
+			return fail( OscTree::PARSE_MALFORMED_BUNDLE, data );
+		}
+
+		const char* pBlockEnd = data + size;
+		for ( const char* pBegin = data + 16; pBegin < pBlockEnd; ) {
+			int32_t elementSize = -1;
+			if ( pBlockEnd - pBegin >= 4 ) {
+				memcpy( &elementSize, pBegin, 4 );
+			}
+			if ( elementSize < 0 || elementSize > pBlockEnd - pBegin - 4 ) {
+				return fail( OscTree::PARSE_TRUNCATED, pBegin );
+			}
+			if ( !validateElement( pBegin + 4, static_cast<size_t>( elementSize ) ) ) {
+				return false;
+			}
+			pBegin += 4 + elementSize;
 		}
+
+		return true;
 	}
 
-	return true;
+	bool					validateMessage( const char* data, size_t size )
+	{
+		const char* pBlockEnd	= data + size;
+		const char* pEnd		= static_cast<const char*>( memchr( data, 0, size ) );
+		const char* pPaddingEnd	= pEnd != nullptr ? getPaddingEnd( data, pEnd + 1, pBlockEnd ) : nullptr;
+		if ( pPaddingEnd == nullptr || *data != '/' ) {
+			return fail( OscTree::PARSE_MALFORMED_ADDRESS, data );
+		}
+		if ( !checkPadding( pEnd + 1, pPaddingEnd ) ) {
+			return fail( OscTree::PARSE_MALFORMED_ADDRESS, pEnd + 1 );
+		}
+
+		const char* pTypeTags	= pPaddingEnd;
+		pEnd					= pTypeTags < pBlockEnd ? static_cast<const char*>( memchr( pTypeTags, 0, pBlockEnd - pTypeTags ) ) : nullptr;
+		pPaddingEnd				= pEnd != nullptr ? getPaddingEnd( data, pEnd + 1, pBlockEnd ) : nullptr;
+		if ( pPaddingEnd == nullptr || *pTypeTags != ',' ) {
+			return fail( OscTree::PARSE_MALFORMED_TYPE_TAGS, pTypeTags );
+		}
+		if ( !checkPadding( pEnd + 1, pPaddingEnd ) ) {
+			return fail( OscTree::PARSE_MALFORMED_TYPE_TAGS, pEnd + 1 );
+		}
+
+		const char* pBegin = pPaddingEnd;
+		for ( const char* pTypeTag = pTypeTags + 1; pTypeTag < pEnd; ++pTypeTag ) {
+			const OscTree::TypeTagCodec& codec	= sCodecTable.mCodecs[ static_cast<uint8_t>( *pTypeTag ) ];
+			size_t available					= pBegin < pBlockEnd ? pBlockEnd - pBegin : 0;
+
+			ptrdiff_t sz = codec.mSize( pBegin, available );
+			if ( sz < 0 ) {
+				return fail( static_cast<OscTree::ParseError>( -sz ), pBegin );
+			}
+
+			// strings and blobs are padded, the parser doesn't mind
+			// what with, a custom type's padding is its own business
+			const char* pValueEnd = nullptr;
+			if ( codec.mDecode == &decodeString ) {
+				pValueEnd = static_cast<const char*>( memchr( pBegin, 0, sz ) ) + 1;
+			} else if ( codec.mDecode == &decodeBlob ) {
+				int32_t blobSize;
+				memcpy( &blobSize, pBegin, 4 );
+				pValueEnd = pBegin + 4 + blobSize;
+			}
+
+			pBegin += sz;
+			if ( pValueEnd != nullptr ) {
+				checkPadding( pValueEnd, pBegin );
+			}
+		}
+
+		if ( pBegin != pBlockEnd ) {
+			mValidation.mHasStrayBytes = true;
+		}
+		++mValidation.mNumMessages;
+
+		return true;
+	}
+
+	const char*				mPacket;
+	bool					mCanonicalize;
+	OscTree::Validation		mValidation;
+};
+
+OscTree::Validation OscTree::validate( const void* data, size_t size )
+{
+	return PacketValidator( static_cast<const char*>( data ), false ).validate( size );
+}
+
+OscTree::Validation OscTree::canonicalize( void* data, size_t size )
+{
+	return PacketValidator( static_cast<const char*>( data ), true ).validate( size );
 }
 
 OscTree::OscTree()
@@ -59,146 +370,310 @@ OscTree::OscTree()
 	init();
 }
 
-OscTree::OscTree( const BufferRef& buffer )
+OscTree::OscTree( const BufferRef& buffer, uint8_t options )
 {
 	init();
+	mParseOptions = options;
+	if ( ( options & PARSE_LAZY ) != 0 ) {
+		// the children are built from the packet when they're asked for
+		mSource = buffer;
+	}
+
+	OscTrace& trace = OscTrace::get();
+	if ( trace.isEnabled() ) {
+		trace.record( OscTrace::STAGE_PARSE_BEGIN );
+		parse( reinterpret_cast<const char*>( buffer->getData() ), buffer->getSize() );
+		trace.record( OscTrace::STAGE_PARSE_END );
+	} else {
+		parse( reinterpret_cast<const char*>( buffer->getData() ), buffer->getSize() );
+	}
+	finishLazyParse();
+
+	OscMetrics& metrics = OscMetrics::get();
+	if ( mParseError != PARSE_OK && metrics.isEnabled() ) {
+		metrics.recordError( mParseError );
+	}
+}
+
+void OscTree::parse( const char* data, size_t size )
+{
+	// bundles aren't timed, the messages in them are
+	OscMetrics& metrics = OscMetrics::get();
+	if ( size == 0 || *data == '#' || !metrics.isEnabled() ) {
+		parseElement( data, size );
+		return;
+	}
+
+	if ( !metrics.isTimingDecode() ) {
+		parseMessage( data, size );
+		if ( isMessage() ) {
+			metrics.recordDecode( mAddressId, mAddress, size );
+		}
+		return;
+	}
+
+	auto start = chrono::steady_clock::now();
+	parseMessage( data, size );
+	auto elapsed = chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - start ).count();
+
+	if ( isMessage() ) {
+		metrics.recordDecode( mAddressId, mAddress, size, static_cast<uint64_t>( elapsed ) );
+	}
+}
+
+void OscTree::parseElement( const char* data, size_t size )
+{
 	// create OscTree from binary data assuming
 	// binary data is structed based on the OSC spec
-	const char* data = reinterpret_cast<const char*>( buffer->getData() );
+	if ( size == 0 ) {
+		mParseError = PARSE_TRUNCATED;
+		return;
+	}
 
 	// check if the first byte denotes an OSC Bundle
 	// by looking for #bundle at the beginning
 	if ( *data == '#' ) {
-		// parse OSC Bundle
+		parseBundle( data, size );
 	} else {
-		// parse OSC Message
-		// parse out the address pattern
-		const char* pBlockEnd	= data + buffer->getSize();
-		const char* pBegin		= data;
-		const char* pEnd		= (const char*)memchr( pBegin, 0, pBlockEnd - pBegin );
-
-		if ( pEnd == nullptr || *pBegin != '/' || *pEnd != '\0' || !isZeroPadded( pEnd + 1 ) ) {
-			// the address data is malformed
-			// throw an exception?
-			// just return an empty OscTree?
-		} else {
-			setAddress( pBegin );
+		parseMessage( data, size );
+	}
+}
+
+void OscTree::parseBundle( const char* data, size_t size )
+{
+	// an OSC Bundle is the string "#bundle", an OSC Time Tag and
+	// zero or more bundle elements, each an int32 size followed by
+	// the contents of an OSC Message or another OSC Bundle
+	if ( size < 16 || memcmp( data, "#bundle", 8 ) != 0 ) {
+		mParseError = PARSE_MALFORMED_BUNDLE;
+		return;
+	}
+
+	mIsBundle = true;
+	memcpy( &mTimeTag.mTimeTag, data + 8, 8 );
+
+	size_t numChildren = 0;
+	if ( mSource ) {
+		// only check the elements, they are built on first access
+		mParseError = parseElements( data + 16, size - 16, mSource, mParseOptions, nullptr, numChildren );
+		mLazyData			= data + 16;
+		mLazySize			= static_cast<uint32_t>( size - 16 );
+		mLazyNumChildren	= static_cast<uint32_t>( numChildren );
+	} else {
+		mParseError = parseElements( data + 16, size - 16, BufferRef(), mParseOptions, &mChildren, numChildren );
+		if ( numChildren > 0 ) {
+			reparentChildren();
+			markDirty( DIRTY_STRUCTURE );
 		}
+	}
+}
+
+OscTree::ParseError OscTree::parseElements( const char* data, size_t size, const BufferRef& source, uint8_t options, vector<OscTree>* children, size_t& numChildren )
+{
+	const char* pBlockEnd	= data + size;
+	const char* pBegin		= data;
+	bool validated			= ( options & PARSE_VALIDATED ) != 0;
 
-		// parse the type string
-		// TODO:
-		// Old OSC implementations are not guaranteed
-		// to have a type string. Should we care?
-		// For now, I am going to only support
-		// OSC implementations that include a
-		// type tag string
-		pBegin		= (const char*)ceil4( (size_t)pEnd + 1 );
-		pEnd		= (const char*)memchr( pBegin, 0, pBlockEnd - pBegin );
+	while ( pBegin < pBlockEnd ) {
+		int32_t elementSize = -1;
+		if ( pBlockEnd - pBegin >= 4 ) {
+			memcpy( &elementSize, pBegin, 4 );
+		}
+		if ( elementSize < 0 || elementSize > pBlockEnd - pBegin - 4 ) {
+			return PARSE_TRUNCATED;
+		}
 
-		vector<char> typeTags;
+		if ( validated && children == nullptr ) {
+			// nothing to check, only count the elements
+			++numChildren;
+			pBegin += 4 + elementSize;
+			continue;
+		}
 
-		if ( pEnd == nullptr || *pBegin != ',' || !isZeroPadded( pEnd + 1 ) ) {
-			// malformed type tag string
+		OscTree element;
+		element.mSource			= source;
+		element.mParseOptions	= options;
+		if ( source && children != nullptr ) {
+			// the packet was timed when it was first scanned
+			element.parseElement( pBegin + 4, static_cast<size_t>( elementSize ) );
 		} else {
-			// increment pBegin by 1 to exclude comma
-			typeTags.assign( pBegin + 1, pEnd );
-		}
-
-		// TODO:
-		// How do you read data from a buffer
-		// if you aren't sure exactly what the
-		// data in the buffer is meant to be?
-		// We give the user the ability to create
-		// custom type tags for all arguments
-		// so how can we know what the data
-		// in the buffer is?
-		// For now, in the spirit of getting this
-		// working, I'm going to assume type tags
-		// specify argument type, and therefore size
-		if ( !typeTags.empty() ) {
-			// read arguments
-			pBegin	= (const char*)ceil4( (size_t)pEnd + 1 );
-
-			for ( char typeTag : typeTags ) {
-				size_t sz = 0;
-				if ( pBegin < pBlockEnd ) {
-					if ( typeTag == 'i' ) {
-						// 32-bit int is 4 bytes
-						const int32_t* const pValue	= reinterpret_cast<const int32_t*>( pBegin );
-						int32_t value				= *pValue;
-						sz							= 4;
-
-						pushBack( OscTree( value, typeTag ) );
-					} else if ( typeTag == 'f' ) {
-						// float is 4 bytes
-						const float* const pValue	= reinterpret_cast<const float*>( pBegin );
-						float value					= *pValue;
-						sz							= 4;
-
-						pushBack( OscTree( value, typeTag ) );
-					} else if ( typeTag == 's' ) {
-						pEnd						= reinterpret_cast<const char*>( memchr( pBegin, 0, pBlockEnd - pBegin ) );
-						string s					= string( pBegin, pEnd - pBegin );
-						sz							= ceil4( s.size() + 1 );
-
-						pushBack( OscTree( s, typeTag ) );
-					} else if ( typeTag == 'b' ) {
-						// the first 4 bytes of a blob are a 32-bit integer
-						// representing the number of 8-bit bytes in the blob
-						const int32_t* const pValue	= reinterpret_cast<const int32_t*>( pBegin );
-						int32_t blobSize			= *pValue;
-						uint8_t* blobData			= new uint8_t[ blobSize ]();
-						sz							= ceil4( blobSize + 4 );
-
-						memcpy( blobData, pBegin + 4, blobSize );
-						pushBack( OscTree( blobData, blobSize ) );
-					} else if ( typeTag == 'h' ) {
-						// 64-bit int is 8 bytes
-						const int64_t* const pValue	= reinterpret_cast<const int64_t*>( pBegin );
-						int64_t value				= *pValue;
-						sz							= 8;
-
-						pushBack( OscTree( value, typeTag ) );
-					} else if ( typeTag == 'd' ) {
-						// double is 8 bytes
-						const double* const pValue	= reinterpret_cast<const double*>( pBegin );
-						double value				= *pValue;
-						sz							= 8;
-
-						pushBack( OscTree( value, typeTag ) );
-					} else if ( typeTag == 'T' ) {
-						// true value, no bytes allocated,
-						// so no need to move pointer
-						sz = 0;
-
-						pushBack( OscTree( typeTag ) );
-					} else if ( typeTag == 'F' ) {
-						// false value, no bytes allocated,
-						// so no need to move pointer
-						sz = 0;
-
-						pushBack( OscTree( typeTag ) );
-					} else if ( typeTag == 'N' ) {
-						// nil value, no bytes allocated,
-						// so no need to move pointer
-						sz = 0;
-
-						pushBack( OscTree( typeTag ) );
-					} else if ( typeTag == 'I' ) {
-						// infinitum value, no bytes allocated,
-						// so no need to move pointer
-						sz = 0;
-
-						pushBack( OscTree( typeTag ) );
-					} else {
-						// unknown type tag
-						// should throw error?
-					}
-
-					pBegin += sz;
-				}
+			element.parse( pBegin + 4, static_cast<size_t>( elementSize ) );
+		}
+		element.finishLazyParse();
+
+		ParseError error = element.mParseError;
+		if ( children != nullptr ) {
+			children->push_back( move( element ) );
+		}
+		++numChildren;
+
+		if ( error != PARSE_OK ) {
+			return error;
+		}
+
+		pBegin += 4 + elementSize;
+	}
+
+	return PARSE_OK;
+}
+
+void OscTree::parseMessage( const char* data, size_t size )
+{
+	// parse OSC Message
+	// parse out the address pattern
+	const char* pBlockEnd	= data + size;
+	const char* pBegin		= data;
+
+	// the address is hashed while looking for its terminator, so
+	// interning it doesn't take a second pass over the characters
+	uint32_t hash		= OscAddressTable::kHashOffset;
+	const char* pEnd	= pBegin;
+	while ( pEnd < pBlockEnd && *pEnd != 0 ) {
+		hash = ( hash ^ static_cast<uint8_t>( *pEnd ) ) * OscAddressTable::kHashPrime;
+		++pEnd;
+	}
+
+	bool validated = ( mParseOptions & PARSE_VALIDATED ) != 0;
+	if ( !validated && ( pEnd == pBlockEnd || *pBegin != '/' || !isZeroPadded( data, pEnd + 1, pBlockEnd ) ) ) {
+		// the address data is malformed, leave
+		// the OscTree empty and report the error
+		mParseError = PARSE_MALFORMED_ADDRESS;
+		return;
+	}
+
+	// received addresses are only looked up, so untrusted
+	// traffic can't fill the address table
+	assignAddress( pBegin, pEnd - pBegin, hash, false );
+
+	// the type tag string starts at a multiple of 4 bytes from the
+	// message, so the arguments can be parsed as a block of their own
+	pBegin = data + ceil4( pEnd + 1 - data );
+
+	size_t numChildren = 0;
+	if ( mSource ) {
+		// only check the arguments, they are built on first access
+		mParseError = parseArguments( pBegin, pBlockEnd - pBegin, mSource, mParseOptions, nullptr, numChildren );
+		mLazyData			= pBegin;
+		mLazySize			= static_cast<uint32_t>( pBlockEnd - pBegin );
+		mLazyNumChildren	= static_cast<uint32_t>( numChildren );
+	} else {
+		mParseError = parseArguments( pBegin, pBlockEnd - pBegin, BufferRef(), mParseOptions, &mChildren, numChildren );
+		if ( numChildren > 0 ) {
+			reparentChildren();
+			markDirty( DIRTY_STRUCTURE );
+		}
+	}
+}
+
+OscTree::ParseError OscTree::parseArguments( const char* data, size_t size, const BufferRef& source, uint8_t options, vector<OscTree>* children, size_t& numChildren )
+{
+	// parse the type string
+	// TODO:
+	// Old OSC implementations are not guaranteed
+	// to have a type string. Should we care?
+	// For now, I am going to only support
+	// OSC implementations that include a
+	// type tag string
+	const char* pBlockEnd	= data + size;
+	const char* pBegin		= data;
+	const char* pEnd		= size > 0 ? (const char*)memchr( pBegin, 0, size ) : nullptr;
+
+	bool validated			= ( options & PARSE_VALIDATED ) != 0;
+	if ( !validated && ( pEnd == nullptr || *pBegin != ',' || !isZeroPadded( data, pEnd + 1, pBlockEnd ) ) ) {
+		return PARSE_MALFORMED_TYPE_TAGS;
+	}
+
+	// increment pBegin by 1 to exclude comma
+	const char* pTypeTag	= pBegin + 1;
+	const char* pTypeTagEnd	= pEnd;
+
+	if ( validated && children == nullptr ) {
+		// the arguments were checked, only count them
+		numChildren += pTypeTagEnd - pTypeTag;
+		return PARSE_OK;
+	}
+
+	// read arguments
+	pBegin = data + ceil4( pEnd + 1 - data );
+
+	// every type tag has a codec in the table, the size of an
+	// unknown tag is an error too, so there is a single branch
+	// per argument whatever its type
+	for ( ; pTypeTag < pTypeTagEnd; ++pTypeTag ) {
+		const TypeTag typeTag		= static_cast<TypeTag>( *pTypeTag );
+		const TypeTagCodec& codec	= sCodecTable.mCodecs[ typeTag ];
+		size_t available			= pBegin < pBlockEnd ? pBlockEnd - pBegin : 0;
+
+		ptrdiff_t sz = codec.mSize( pBegin, available );
+		if ( sz < 0 ) {
+			// without a size the rest of the message can't be found
+			return static_cast<ParseError>( -sz );
+		}
+
+		if ( children != nullptr ) {
+			OscTree argument( typeTag );
+			if ( source ) {
+				argument.mValue			= decodeView( source, codec.mDecode, pBegin, static_cast<size_t>( sz ) );
+				argument.mIsValueRef	= static_cast<bool>( argument.mValue );
+			}
+			if ( !argument.mIsValueRef ) {
+				argument.mValue = codec.mDecode( pBegin, static_cast<size_t>( sz ) );
 			}
+			if ( argument.mValue && codec.mValueOffset > 0 ) {
+				argument.mBlobSize = static_cast<int32_t>( argument.mValue->getSize() );
+			}
+			children->push_back( move( argument ) );
 		}
+		++numChildren;
+
+		pBegin += sz;
+	}
+
+	return PARSE_OK;
+}
+
+void OscTree::finishLazyParse()
+{
+	if ( mSource && mLazyNumChildren > 0 ) {
+		mLazyState.store( LAZY_PENDING, memory_order_relaxed );
+	} else {
+		// nothing to build later
+		mSource.reset();
+	}
+}
+
+void OscTree::buildLazyChildren() const
+{
+	// a message shared between threads, such as by the dispatcher's
+	// handlers, is built by whichever gets there first
+	uint8_t state = LAZY_PENDING;
+	if ( !mLazyState.compare_exchange_strong( state, LAZY_BUILDING, memory_order_acquire ) ) {
+		while ( mLazyState.load( memory_order_acquire ) != LAZY_NONE ) {
+			this_thread::yield();
+		}
+		return;
+	}
+
+	size_t numChildren = 0;
+	mChildren.reserve( mLazyNumChildren );
+	if ( mIsBundle ) {
+		parseElements( mLazyData, mLazySize, mSource, mParseOptions, &mChildren, numChildren );
+	} else {
+		parseArguments( mLazyData, mLazySize, mSource, mParseOptions, &mChildren, numChildren );
+	}
+
+	for ( auto& child : mChildren ) {
+		child.mParent = const_cast<OscTree*>( this );
+	}
+
+	mLazyState.store( LAZY_NONE, memory_order_release );
+}
+
+void OscTree::materialize() const
+{
+	buildChildren();
+	for ( const auto& child : mChildren ) {
+		child.materialize();
 	}
 }
 
@@ -313,6 +788,9 @@ OscTree::OscTree( TimeTag value, TypeTag typeTag )
 {
 	init();
 	
+	mValue = Buffer::create( sizeof( uint64_t ) );
+	mValue->copyFrom( &value.mTimeTag, sizeof( uint64_t ) );
+
 	mTypeTag = typeTag;
 }
 
@@ -332,18 +810,206 @@ OscTree OscTree::makeBundle( const TimeTag& timeTag )
 	return bundle;
 }
 
+OscTree OscTree::makeBlobRef( const BufferRef& value, TypeTag typeTag )
+{
+	if ( value->getSize() >= static_cast<size_t>( numeric_limits< int32_t >::max() ) ) {
+		throw ExcExceededMaxSize( value->getSize() );
+	}
+
+	OscTree blob;
+	blob.mValue			= value;
+	blob.mTypeTag		= typeTag;
+	blob.mBlobSize		= static_cast<int32_t>( value->getSize() );
+	blob.mIsValueRef	= true;
+
+	return blob;
+}
+
+OscTree OscTree::makeBlobRef( const void* value, size_t numBytes, TypeTag typeTag )
+{
+	// wrapped in a Buffer that neither owns nor frees the memory
+	return makeBlobRef( Buffer::create( const_cast<void*>( value ), numBytes ), typeTag );
+}
+
+OscTree::OscTree( const OscTree& other )
+{
+	init();
+	copyFrom( other );
+}
+
+OscTree::OscTree( OscTree&& other ) OSC_NOEXCEPT
+{
+	init();
+	moveFrom( other );
+}
+
+OscTree& OscTree::operator=( const OscTree& other )
+{
+	if ( this != &other ) {
+		bool registered			= isDirty();
+		size_t encodedOffset	= mEncodedOffset;
+		size_t encodedSize		= mEncodedSize;
+		copyFrom( other );
+		replaced( registered, encodedOffset, encodedSize );
+	}
+
+	return *this;
+}
+
+OscTree& OscTree::operator=( OscTree&& other ) OSC_NOEXCEPT
+{
+	if ( this != &other ) {
+		bool registered			= isDirty();
+		size_t encodedOffset	= mEncodedOffset;
+		size_t encodedSize		= mEncodedSize;
+		moveFrom( other );
+		replaced( registered, encodedOffset, encodedSize );
+	}
+
+	return *this;
+}
+
+void OscTree::copyFrom( const OscTree& other )
+{
+	// other may be read, built or encoded by other threads meanwhile. Its
+	// children are only copied once built, and the copy is encoded afresh.
+	uint8_t lazyState	= other.mLazyState.load( memory_order_acquire );
+	if ( lazyState == LAZY_NONE ) {
+		mChildren = other.mChildren;
+	} else {
+		mChildren.clear();
+	}
+	mValue				= other.mValue;
+	mAddress			= other.mAddress;
+	mAddressId			= other.mAddressId;
+	mTimeTag			= other.mTimeTag;
+	mTypeTag			= other.mTypeTag;
+	mBlobSize			= other.mBlobSize;
+	mParseError			= other.mParseError;
+	mIsBundle			= other.mIsBundle;
+	mIsValueRef			= other.mIsValueRef;
+	mParseOptions		= other.mParseOptions;
+	mSource				= other.mSource;
+	mLazyData			= other.mLazyData;
+	mLazySize			= other.mLazySize;
+	mLazyNumChildren	= other.mLazyNumChildren;
+	mLazyState.store( lazyState == LAZY_NONE ? LAZY_NONE : LAZY_PENDING, memory_order_relaxed );
+	mEncoded.reset();
+	mEncodedOffset		= 0;
+	mEncodedSize		= 0;
+	mEncodedNumChildren	= 0;
+	mEncodedChildren	= nullptr;
+	mChildrenExposed	= false;
+	mDirty				= DIRTY_NONE;
+	mDescendantsDirty	= false;
+	mDirtyChildren.clear();
+
+	reparentChildren();
+}
+
+void OscTree::moveFrom( OscTree& other )
+{
+	mChildren			= move( other.mChildren );
+	mValue				= move( other.mValue );
+	mAddress			= move( other.mAddress );
+	mAddressId			= other.mAddressId;
+	mTimeTag			= other.mTimeTag;
+	mTypeTag			= other.mTypeTag;
+	mBlobSize			= other.mBlobSize;
+	mParseError			= other.mParseError;
+	mIsBundle			= other.mIsBundle;
+	mIsValueRef			= other.mIsValueRef;
+	mParseOptions		= other.mParseOptions;
+	mSource				= move( other.mSource );
+	mLazyData			= other.mLazyData;
+	mLazySize			= other.mLazySize;
+	mLazyNumChildren	= other.mLazyNumChildren;
+	mLazyState.store( other.mLazyState.load( memory_order_relaxed ), memory_order_relaxed );
+	mEncoded			= move( other.mEncoded );
+	mEncodedOffset		= other.mEncodedOffset;
+	mEncodedSize		= other.mEncodedSize;
+	mEncodedNumChildren	= other.mEncodedNumChildren;
+	mEncodedChildren	= other.mEncodedChildren;
+	mChildrenExposed	= other.mChildrenExposed;
+	mDirty				= other.mDirty;
+	mDescendantsDirty	= other.mDescendantsDirty;
+	mDirtyChildren		= move( other.mDirtyChildren );
+
+	reparentChildren();
+}
+
+void OscTree::replaced( bool registered, size_t encodedOffset, size_t encodedSize )
+{
+	// a tree assigned over a child keeps its place in the parent's
+	// encoding, but none of the encoding of what was there before applies
+	if ( mParent != nullptr ) {
+		mEncodedOffset		= encodedOffset;
+		mEncodedSize		= encodedSize;
+		mChildrenExposed	= false;
+		mDirty				= DIRTY_NONE;
+		mDescendantsDirty	= false;
+		mDirtyChildren.clear();
+		mEncoded.reset();
+
+		// the type tag string lives in the parent message
+		if ( mParent->isMessage() ) {
+			mParent->markDirty( DIRTY_STRUCTURE );
+		}
+		if ( registered ) {
+			mDirty = DIRTY_STRUCTURE;
+		} else {
+			markDirty( DIRTY_STRUCTURE );
+		}
+	}
+}
+
 bool OscTree::hasChildren() const
 {
-	return !mChildren.empty();
+	return getNumChildren() > 0;
+}
+
+size_t OscTree::getNumChildren() const
+{
+	return mLazyState.load( memory_order_acquire ) != LAZY_NONE ? mLazyNumChildren : mChildren.size();
 }
 
 vector<OscTree>& OscTree::getChildren()
 {
+	buildChildren();
+
+	// the vector may have been changed through a previous call, so
+	// the layout is only kept if every child is where it was encoded
+	if ( childrenMoved() ) {
+		markDirty( DIRTY_STRUCTURE );
+		reparentChildren();
+	}
+
+	// nothing tracks what is done to the vector itself, children
+	// pushed, erased or swapped, so the next encoding checks
+	if ( !isDirty() && mParent != nullptr ) {
+		mParent->markChildDirty( this );
+	}
+	mChildrenExposed = true;
+
 	return mChildren;
 }
 
+OscTree& OscTree::getChild( size_t index )
+{
+	buildChildren();
+
+	if ( mChildren[ index ].mParent != this ) {
+		// the vector was changed through getChildren()
+		markDirty( DIRTY_STRUCTURE );
+		reparentChildren();
+	}
+
+	return mChildren[ index ];
+}
+
 const vector<OscTree>& OscTree::getChildren() const
 {
+	buildChildren();
 	return mChildren;
 }
 
@@ -352,201 +1018,622 @@ bool OscTree::hasParent() const
 	return mParent != nullptr;
 }
 
+OscTree& OscTree::getParent()
+{
+	return *mParent;
+}
+
+const OscTree& OscTree::getParent() const
+{
+	return *mParent;
+}
+
+bool OscTree::isBundle() const
+{
+	return mIsBundle;
+}
+
+bool OscTree::isMessage() const
+{
+	return !mIsBundle && ( mAddressId != OscAddressTable::kInvalidId || !mAddress.empty() || getNumChildren() > 0 );
+}
+
 void OscTree::pushBack( const OscTree& child )
 {
+	buildChildren();
+
+	const OscTree* data = mChildren.data();
 	mChildren.push_back( child );
-	mChildren.back().mParent = this;
+	if ( mChildren.data() != data ) {
+		reparentChildren();
+	} else {
+		mChildren.back().mParent = this;
+	}
+
+	markDirty( DIRTY_STRUCTURE );
+}
+
+void OscTree::pushBack( OscTree&& child )
+{
+	buildChildren();
+
+	const OscTree* data = mChildren.data();
+	mChildren.push_back( move( child ) );
+	if ( mChildren.data() != data ) {
+		reparentChildren();
+	} else {
+		mChildren.back().mParent = this;
+	}
+
+	markDirty( DIRTY_STRUCTURE );
+}
+
+void OscTree::reparentChildren()
+{
+	for ( auto& child : mChildren ) {
+		child.mParent = this;
+	}
+}
+
+void OscTree::setValue( int32_t value, TypeTag typeTag )
+{
+	setFixedValue( &value, sizeof( int32_t ), typeTag );
+}
+
+void OscTree::setValue( float value, TypeTag typeTag )
+{
+	setFixedValue( &value, sizeof( float ), typeTag );
+}
+
+void OscTree::setValue( int64_t value, TypeTag typeTag )
+{
+	setFixedValue( &value, sizeof( int64_t ), typeTag );
+}
+
+void OscTree::setValue( double value, TypeTag typeTag )
+{
+	setFixedValue( &value, sizeof( double ), typeTag );
+}
+
+void OscTree::setValue( const string& value, TypeTag typeTag )
+{
+	// strings are stored with their null terminator
+	setFixedValue( value.c_str(), value.length() + 1, typeTag );
+}
+
+void OscTree::setValue( const void* value, size_t numBytes, TypeTag typeTag )
+{
+	if ( numBytes >= numeric_limits< int32_t >::max() ) {
+		throw ExcExceededMaxSize( numBytes );
+	}
+
+	mBlobSize = static_cast<int32_t>( numBytes );
+	setFixedValue( value, numBytes, typeTag );
+}
+
+OscTree::StringView OscTree::getStringView() const
+{
+	checkTypeTag( "sS", 0 );
+	if ( !mValue ) {
+		return StringView();
+	}
+
+	// stop at the terminator, or at the end of a value that has none
+	const char* data	= static_cast<const char*>( mValue->getData() );
+	const void* end		= memchr( data, '\0', mValue->getSize() );
+	size_t size			= end != nullptr ? static_cast<const char*>( end ) - data : mValue->getSize();
+
+	return StringView( data, size );
+}
+
+OscTree::BlobSpan OscTree::getBlobSpan() const
+{
+	checkTypeTag( "b", 0 );
+	if ( !mValue ) {
+		return BlobSpan();
+	}
+
+	return BlobSpan( static_cast<const uint8_t*>( mValue->getData() ), mValue->getSize() );
+}
+
+void OscTree::checkTypeTag( const char* typeTags, size_t numBytes ) const
+{
+	bool matches = mTypeTag != 0 && strchr( typeTags, mTypeTag ) != nullptr;
+	if ( !matches || ( numBytes > 0 && ( !mValue || mValue->getSize() < numBytes ) ) ) {
+		throw ExcTypeMismatch( typeTags, mTypeTag );
+	}
+}
+
+void OscTree::setFixedValue( const void* value, size_t numBytes, TypeTag typeTag )
+{
+	bool sameSize = mValue && mValue->getSize() == numBytes;
+
+	// the value buffer is shared between copies of an OscTree,
+	// so only write into it if nothing else refers to it
+	if ( !sameSize || !mValue.unique() || mIsValueRef ) {
+		mValue		= Buffer::create( numBytes );
+		mIsValueRef	= false;
+	}
+	mValue->copyFrom( value, numBytes );
+
+	if ( typeTag != mTypeTag ) {
+		// the type tag string lives in the parent message
+		mTypeTag = typeTag;
+		if ( mParent != nullptr ) {
+			mParent->markDirty( DIRTY_STRUCTURE );
+		}
+		markDirty( DIRTY_STRUCTURE );
+	} else {
+		markDirty( sameSize ? DIRTY_VALUE : DIRTY_STRUCTURE );
+	}
+}
+
+bool OscTree::isDirty() const
+{
+	return mDirty != DIRTY_NONE || mDescendantsDirty || mChildrenExposed;
+}
+
+bool OscTree::childrenMoved() const
+{
+	// a child put in the vector doesn't point back to this until reparented
+	if ( mChildren.size() != mEncodedNumChildren || mChildren.data() != mEncodedChildren ) {
+		return true;
+	}
+	for ( const auto& child : mChildren ) {
+		if ( child.mParent != this ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void OscTree::markDirty( DirtyState state )
+{
+	bool registered = isDirty();
+	if ( state > mDirty ) {
+		mDirty = state;
+	}
+
+	if ( !registered && mParent != nullptr ) {
+		mParent->markChildDirty( this );
+	}
+}
+
+void OscTree::markChildDirty( const OscTree* child )
+{
+	size_t index = child - mChildren.data();
+	if ( index >= mChildren.size() ) {
+		// the child isn't where it should be, so the
+		// layout of the children can't be trusted
+		markDirty( DIRTY_STRUCTURE );
+		return;
+	}
+
+	bool registered		= isDirty();
+	mDescendantsDirty	= true;
+	mDirtyChildren.push_back( static_cast<uint32_t>( index ) );
+
+	if ( !registered && mParent != nullptr ) {
+		mParent->markChildDirty( this );
+	}
+}
+
+void OscTree::clearDirty() const
+{
+	mDirty				= DIRTY_NONE;
+	mDescendantsDirty	= false;
+	mChildrenExposed	= false;
+	mDirtyChildren.clear();
+
+	for ( const auto& child : mChildren ) {
+		child.clearDirty();
+	}
 }
 
 BufferRef OscTree::toBuffer() const
 {
-	// Turn the entire OscTree data structure into binary data
-	// if this contains children, it is either an OSC Message or an OSC Bundle
-	// if this's children contain children, it is an OSC Bundle
+	if ( mParent != nullptr ) {
+		return encodeRoot();
+	}
 
-	// if this is an OSC Bundle, write #bundle as the first byte in the buffer
+	ScopedEncodeLock lock( mEncodeLock );
+	return encodeRoot();
+}
+
+BufferRef OscTree::encodeRoot() const
+{
+	// Turn the entire OscTree data structure into binary data
+	// if this is an OSC Bundle, write #bundle as the first bytes in the buffer
 	// followed by an OSC time tag
 	// then write each bundle element into the buffer by specifying the
 	// element size in 8-bit bytes followed by the element data
-	
-	BufferRef buffer = Buffer::create( 4 );
-	size_t dataSize = 0;
-	
-	// if this node doesn't have children, it represents
-	// an argument. return the binary representation of
-	// the argument, and pad it so it is a multiple of 4
-	if ( !hasChildren() ) {
-		appendValue( buffer, dataSize );
-	} else {
-		bool isBundle = false;
-		
+
+	// A subtree is laid out as part of its root's encoding, so
+	// only a tree without a parent keeps its encoding around
+	if ( mParent != nullptr ) {
+		BufferRef buffer = Buffer::create( getEncodedSize() );
+		encode( reinterpret_cast<uint8_t*>( buffer->getData() ), false );
+
+		return buffer;
+	}
+
+	bool reencode = !mEncoded || mDirty == DIRTY_STRUCTURE || mEncodedNumChildren != mChildren.size() || ( mChildrenExposed && childrenMoved() ) || 
+		( !isBundle() && !isMessage() );
+	if ( reencode ) {
+		mEncodedOffset	= 0;
+		mEncodedSize	= getEncodedSize();
+		mEncoded		= Buffer::create( mEncodedSize );
+		encode( reinterpret_cast<uint8_t*>( mEncoded->getData() ), true );
+		clearDirty();
+
+		return mEncoded;
+	}
+
+	// the children were handed out, but left where they were
+	mChildrenExposed = false;
+
+	if ( isDirty() ) {
+		// someone may still be sending the previous encoding,
+		// copy it rather than patching it under their feet
+		if ( !mEncoded.unique() ) {
+			BufferRef buffer = Buffer::create( mEncoded->getSize() );
+			buffer->copyFrom( mEncoded->getData(), mEncoded->getSize() );
+			mEncoded = buffer;
+		}
+
+		updateEncoding( mEncoded, 0 );
+	}
+
+	return mEncoded;
+}
+
+size_t OscTree::getEncodedSize() const
+{
+	buildChildren();
+
+	size_t size = 0;
+
+	if ( isBundle() ) {
+		// #bundle, time tag, then a 32-bit size for each element
+		size = 8 + 8;
 		for ( const auto& child : mChildren ) {
-			if ( child.hasChildren() ) {
-				isBundle = true;
-				break;
-			}
+			size += 4 + child.getEncodedSize();
 		}
-		
-		if ( isBundle ) {
-			// TODO: implement bundles
-		} else {
-			// write address pattern into buffer
-			appendAddress( buffer, dataSize );
-			
-			// write type tag string into buffer
-			appendTypeTagString( buffer, dataSize );
+	} else if ( isMessage() ) {
+		// address and type tag string, both null terminated and padded
+		size = ceil4( getAddress().size() + 1 ) + ceil4( ( mChildren.size() + 1 + 1 ) * sizeof( TypeTag ) );
+		for ( const auto& child : mChildren ) {
+			size += child.getEncodedSize();
 		}
-		
+	} else if ( mValue ) {
+		size = ceil4( mValue->getSize() + getValueOffset() );
+	}
+
+	return size;
+}
+
+size_t OscTree::getValueOffset() const
+{
+	// a blob is prefixed with its size as a 32-bit int
+	return sCodecTable.mCodecs[ mTypeTag ].mValueOffset;
+}
+
+uint8_t* OscTree::encode( uint8_t* pBuffer, bool recordLayout ) const
+{
+	buildChildren();
+
+	if ( isBundle() ) {
+		memcpy( pBuffer, "#bundle", 8 );
+		pBuffer += 8;
+		memcpy( pBuffer, &mTimeTag.mTimeTag, 8 );
+		pBuffer += 8;
+
+		uint8_t* pBegin = pBuffer - 16;
 		for ( const auto& child : mChildren ) {
-			if ( child.hasChildren() ) {
-				// TODO: implement bundles
-				// this is a bundle
-				// child is a bundle or a message
-			} else {
-				// an OSC Message contains an OSC Address Pattern
-				// followed by an OSC Type String
-				// followed by zero or more OSC Arguments
-				
-				// this OscTree is a message
-				// each child is an argument
-				// and these come back zero padded
-//				Buffer childBuffer		= child.toBuffer();
-				appendValue( buffer, dataSize, child.toBuffer() );
+			uint8_t* pSize	= pBuffer;
+			uint8_t* pChild	= pBuffer + 4;
+			pBuffer			= child.encode( pChild, recordLayout );
+
+			int32_t size	= static_cast<int32_t>( pBuffer - pChild );
+			memcpy( pSize, &size, 4 );
+
+			if ( recordLayout ) {
+				child.mEncodedOffset	= pChild - pBegin;
+				child.mEncodedSize		= size;
+				const_cast<OscTree&>( child ).mParent = const_cast<OscTree*>( this );
 			}
 		}
+	} else if ( isMessage() ) {
+		// an OSC Message contains an OSC Address Pattern
+		// followed by an OSC Type String
+		// followed by zero or more OSC Arguments
+		uint8_t* pBegin = pBuffer;
+		pBuffer = encodeAddress( pBuffer );
+		pBuffer = encodeTypeTagString( pBuffer );
+
+		for ( const auto& child : mChildren ) {
+			uint8_t* pChild	= pBuffer;
+			pBuffer			= child.encode( pChild, recordLayout );
+
+			if ( recordLayout ) {
+				child.mEncodedOffset	= pChild - pBegin;
+				child.mEncodedSize		= pBuffer - pChild;
+				const_cast<OscTree&>( child ).mParent = const_cast<OscTree*>( this );
+			}
+		}
+	} else {
+		// this node represents an argument, write the
+		// binary representation padded to a multiple of 4
+		pBuffer = encodeValue( pBuffer );
 	}
-	
-	return buffer;
+
+	if ( recordLayout ) {
+		mEncodedNumChildren	= mChildren.size();
+		mEncodedChildren	= mChildren.data();
+	}
+
+	return pBuffer;
 }
 
-void OscTree::appendAddress( BufferRef& buffer, size_t& dataSize ) const
+uint8_t* OscTree::encodeAddress( uint8_t* pBuffer ) const
 {
-	size_t newDataSize			= mAddress.size() + 1; // add 1 for null terminator not included in string::size()
-	size_t newDataSizePadded	= ceil4( newDataSize );
-	size_t oldDataSize			= dataSize;
-	size_t newBufferDataSize	= oldDataSize + newDataSizePadded;
-	dataSize					= newBufferDataSize;
-	
-	buffer->resize( newBufferDataSize );
-	
-	uint8_t* pBuffer			= reinterpret_cast<uint8_t*>( buffer->getData() );
-	pBuffer						+= oldDataSize;
-	
-	memcpy( pBuffer, mAddress.data(), newDataSize );
-	
-	size_t diff					= newDataSizePadded - newDataSize;
-	
-	if ( diff > 0 ) {
-		size_t offset	= oldDataSize + newDataSize;
-		padWithZeroes( buffer, offset, diff );
-	}
+	const string& address	= getAddress();
+	size_t dataSize			= address.size() + 1; // add 1 for null terminator not included in string::size()
+	size_t dataSizePadded	= ceil4( dataSize );
+
+	memcpy( pBuffer, address.c_str(), dataSize );
+	memset( pBuffer + dataSize, 0, dataSizePadded - dataSize );
+
+	return pBuffer + dataSizePadded;
 }
 
-void OscTree::appendTypeTagString( BufferRef& buffer, size_t& dataSize ) const
+uint8_t* OscTree::encodeTypeTagString( uint8_t* pBuffer ) const
 {
-	size_t typeTagSize			= sizeof( TypeTag );
-	size_t newDataSize			= ( mChildren.size() + 1 + 1 ) * typeTagSize; // need to add 1 for the ',' and 1 for a '\0'
-	size_t newDataSizePadded	= ceil4( newDataSize );
-	size_t oldDataSize			= dataSize;
-	size_t newBufferDataSize	= oldDataSize + newDataSizePadded;
-	dataSize					= newBufferDataSize;
-	
-	buffer->resize( newBufferDataSize );
-	
-	uint8_t* pBuffer	= reinterpret_cast<uint8_t*>( buffer->getData() );
-	pBuffer				+= oldDataSize;
-	
-	memcpy( pBuffer, ",", typeTagSize );
-	pBuffer				+= typeTagSize;
-	
+	size_t typeTagSize		= sizeof( TypeTag );
+	size_t dataSize			= ( mChildren.size() + 1 + 1 ) * typeTagSize; // need to add 1 for the ',' and 1 for a '\0'
+	size_t dataSizePadded	= ceil4( dataSize );
+	uint8_t* pBegin			= pBuffer;
+
+	*pBuffer++ = ',';
 	for ( const auto& child : mChildren ) {
-		TypeTag typeTag		= child.getTypeTag();
-		memcpy( pBuffer, &typeTag, typeTagSize );
-		pBuffer				+= typeTagSize;
+		*pBuffer++ = child.getTypeTag();
 	}
 
-	*pBuffer = '\0';
-	
-	size_t diff			= newDataSizePadded - newDataSize;
-	
-	if ( diff > 0 ) {
-		size_t offset	= oldDataSize + newDataSize;
-		padWithZeroes( buffer, offset, diff );
-	}
+	memset( pBuffer, 0, dataSizePadded - ( pBuffer - pBegin ) );
+
+	return pBegin + dataSizePadded;
 }
 
-void OscTree::appendValue( BufferRef& buffer, size_t& dataSize ) const
+uint8_t* OscTree::encodeValue( uint8_t* pBuffer ) const
 {
-	size_t extraByteSize = 0;
-	if ( getTypeTag() == 'b' ) {
-		extraByteSize = 4;
+	// an argument without a value, like T or F, takes no space
+	if ( !mValue ) {
+		return pBuffer;
 	}
 
-	BufferRef valueBuffer		= getValue();
-	size_t newDataSize			= valueBuffer->getSize() + extraByteSize;
-	size_t newDataSizePadded	= ceil4( newDataSize );
-	size_t oldDataSize			= dataSize;
-	size_t newBufferSize		= oldDataSize + newDataSizePadded;
-	
-	buffer->resize( newBufferSize );
-	
-	uint8_t* pBuffer	= reinterpret_cast<uint8_t*>( buffer->getData() );
-	pBuffer				+= oldDataSize;
+	size_t valueOffset		= getValueOffset();
+	size_t dataSize			= mValue->getSize() + valueOffset;
+	size_t dataSizePadded	= ceil4( dataSize );
 
 	// if this is a blob, a 32-bit int size
 	// count needs to be prepended to the data
-	if ( getTypeTag() == 'b' ) {
-		memcpy( pBuffer, &mBlobSize, extraByteSize );
-		pBuffer			+= extraByteSize;
-		memcpy( pBuffer, valueBuffer->getData(), mBlobSize );
-	} else {
-		memcpy( pBuffer, valueBuffer->getData(), newDataSize );
+	if ( valueOffset > 0 ) {
+		memcpy( pBuffer, &mBlobSize, valueOffset );
 	}
-	
-	size_t diff			= newDataSizePadded - newDataSize;
-	
-	if ( diff > 0 ) {
-		size_t offset	= oldDataSize + newDataSize;
-		padWithZeroes( buffer, offset, diff );
+	memcpy( pBuffer + valueOffset, mValue->getData(), mValue->getSize() );
+	memset( pBuffer + dataSize, 0, dataSizePadded - dataSize );
+
+	return pBuffer + dataSizePadded;
+}
+
+BufferRef OscTree::toBuffers( vector<GatherBuffer>& buffers, size_t minReferencedSize ) const
+{
+	buffers.clear();
+
+	// everything but the referenced blob values goes in one buffer
+	BufferRef encoded	= Buffer::create( getEncodedSize() - getReferencedSize( minReferencedSize ) );
+	uint8_t* pRun		= reinterpret_cast<uint8_t*>( encoded->getData() );
+	uint8_t* pEnd		= encodeGather( pRun, pRun, buffers, minReferencedSize );
+	if ( pEnd > pRun ) {
+		GatherBuffer run = { pRun, static_cast<size_t>( pEnd - pRun ) };
+		buffers.push_back( run );
 	}
+
+	return encoded;
 }
 
-// Appends the data from a buffer holding argument/value data to a buffer
-// The value data should already be zero padded
-void OscTree::appendValue( ci::BufferRef& buffer, size_t& dataSize, const ci::BufferRef& valueBuffer ) const
+bool OscTree::isReferenced( size_t minReferencedSize ) const
 {
-	size_t newDataSize		= valueBuffer->getSize();
-	size_t oldDataSize		= dataSize;
-	size_t newBufferSize	= dataSize + newDataSize;
-	dataSize				= newBufferSize;
-	
-	buffer->resize( newBufferSize );
-	
-	uint8_t* pBuffer		= reinterpret_cast<uint8_t*>( buffer->getData() );
-	pBuffer					+= oldDataSize;
-	
-	memcpy( pBuffer, valueBuffer->getData(), newDataSize );
+	return mValue && getValueOffset() > 0 && mValue->getSize() >= minReferencedSize;
+}
+
+size_t OscTree::getReferencedSize( size_t minReferencedSize ) const
+{
+	buildChildren();
+
+	size_t size = isReferenced( minReferencedSize ) ? mValue->getSize() : 0;
+	for ( const auto& child : mChildren ) {
+		size += child.getReferencedSize( minReferencedSize );
+	}
+	return size;
+}
+
+uint8_t* OscTree::encodeGather( uint8_t* pBuffer, uint8_t*& pRun, vector<GatherBuffer>& buffers, size_t minReferencedSize ) const
+{
+	// laid out as encode() does, pRun is where the bytes not yet listed in buffers start
+	buildChildren();
+
+	if ( isBundle() ) {
+		memcpy( pBuffer, "#bundle", 8 );
+		memcpy( pBuffer + 8, &mTimeTag.mTimeTag, 8 );
+		pBuffer += 16;
+
+		for ( const auto& child : mChildren ) {
+			int32_t size = static_cast<int32_t>( child.getEncodedSize() );
+			memcpy( pBuffer, &size, 4 );
+			pBuffer = child.encodeGather( pBuffer + 4, pRun, buffers, minReferencedSize );
+		}
+	} else if ( isMessage() ) {
+		pBuffer = encodeAddress( pBuffer );
+		pBuffer = encodeTypeTagString( pBuffer );
+
+		for ( const auto& child : mChildren ) {
+			pBuffer = child.encodeGather( pBuffer, pRun, buffers, minReferencedSize );
+		}
+	} else if ( isReferenced( minReferencedSize ) ) {
+		// the size goes in the run before the value, the padding in the one after it
+		size_t valueOffset	= getValueOffset();
+		memcpy( pBuffer, &mBlobSize, valueOffset );
+		pBuffer += valueOffset;
+
+		GatherBuffer run	= { pRun, static_cast<size_t>( pBuffer - pRun ) };
+		GatherBuffer value	= { mValue->getData(), mValue->getSize() };
+		buffers.push_back( run );
+		buffers.push_back( value );
+
+		size_t padding = ceil4( mValue->getSize() + valueOffset ) - mValue->getSize() - valueOffset;
+		memset( pBuffer, 0, padding );
+		pRun	= pBuffer;
+		pBuffer	+= padding;
+	} else {
+		pBuffer = encodeValue( pBuffer );
+	}
+
+	return pBuffer;
+}
+
+ptrdiff_t OscTree::updateEncoding( BufferRef& buffer, size_t offset ) const
+{
+	// offset is where this node's encoding starts in buffer
+	if ( mDirty == DIRTY_STRUCTURE || mEncodedNumChildren != mChildren.size() || ( mChildrenExposed && childrenMoved() ) ) {
+		// re-encode this subtree, moving everything after it
+		// if its size changed
+		size_t oldSize	= mEncodedSize;
+		size_t newSize	= getEncodedSize();
+		size_t tailSize	= buffer->getSize() - offset - oldSize;
+
+		if ( newSize > oldSize ) {
+			buffer->resize( buffer->getSize() + newSize - oldSize );
+		}
+
+		uint8_t* pBuffer = reinterpret_cast<uint8_t*>( buffer->getData() ) + offset;
+		if ( newSize != oldSize ) {
+			memmove( pBuffer + newSize, pBuffer + oldSize, tailSize );
+		}
+		if ( newSize < oldSize ) {
+			buffer->resize( buffer->getSize() - ( oldSize - newSize ) );
+			pBuffer = reinterpret_cast<uint8_t*>( buffer->getData() ) + offset;
+		}
+
+		encode( pBuffer, true );
+		mEncodedSize = newSize;
+		clearDirty();
+
+		return static_cast<ptrdiff_t>( newSize ) - static_cast<ptrdiff_t>( oldSize );
+	}
+
+	if ( mDirty == DIRTY_VALUE ) {
+		// same sized value, patch the bytes in place
+		uint8_t* pBuffer = reinterpret_cast<uint8_t*>( buffer->getData() ) + offset;
+		if ( isBundle() ) {
+			memcpy( pBuffer + 8, &mTimeTag.mTimeTag, 8 );
+		} else if ( mValue ) {
+			memcpy( pBuffer + getValueOffset(), mValue->getData(), mValue->getSize() );
+		}
+		mDirty = DIRTY_NONE;
+	}
+
+	ptrdiff_t total = 0;
+	for ( uint32_t index : mDirtyChildren ) {
+		const OscTree& child	= mChildren[ index ];
+		ptrdiff_t delta			= child.updateEncoding( buffer, offset + child.mEncodedOffset );
+		if ( delta == 0 ) {
+			continue;
+		}
+
+		if ( isBundle() ) {
+			int32_t size		= static_cast<int32_t>( child.mEncodedSize );
+			uint8_t* pSize		= reinterpret_cast<uint8_t*>( buffer->getData() ) + offset + child.mEncodedOffset - 4;
+			memcpy( pSize, &size, 4 );
+		}
+
+		for ( size_t i = index + 1; i < mChildren.size(); ++i ) {
+			mChildren[ i ].mEncodedOffset += delta;
+		}
+
+		total += delta;
+	}
+
+	mDirtyChildren.clear();
+	mDescendantsDirty	= false;
+	mChildrenExposed	= false;
+	mEncodedSize		+= total;
+
+	return total;
 }
 
 void OscTree::setAddress( const string& address )
 {
-	mAddress	= address;
+	assignAddress( address.data(), address.size(), OscAddressTable::hashAddress( address.data(), address.size() ), true );
+	markDirty( DIRTY_STRUCTURE );
+}
+
+void OscTree::assignAddress( const char* address, size_t length, uint32_t hash, bool intern )
+{
+	OscAddressTable& table = OscAddressTable::get();
+	if ( length == 0 ) {
+		mAddressId = OscAddressTable::kInvalidId;
+	} else {
+		mAddressId = intern ? table.intern( address, length, hash ) : table.find( address, length, hash );
+	}
+	if ( mAddressId == OscAddressTable::kInvalidId ) {
+		mAddress.assign( address, length );
+	} else {
+		mAddress.clear();
+	}
 }
 
 void OscTree::setTimeTag( const TimeTag& timeTag )
 {
+	// setting a time tag makes this an OSC Bundle
 	mTimeTag	= timeTag;
+	markDirty( mIsBundle ? DIRTY_VALUE : DIRTY_STRUCTURE );
+	mIsBundle	= true;
 }
 
 void OscTree::init()
 {
-	mParent		= nullptr;
-	mTypeTag	= 0;
-	mBlobSize	= 0;
+	mParent				= nullptr;
+	mAddressId			= OscAddressTable::kInvalidId;
+	mTypeTag			= 0;
+	mBlobSize			= 0;
+	mParseError			= PARSE_OK;
+	mIsBundle			= false;
+	mIsValueRef			= false;
+	mParseOptions		= PARSE_EAGER;
+	mLazyData			= nullptr;
+	mLazySize			= 0;
+	mLazyNumChildren	= 0;
+	mLazyState.store( LAZY_NONE, memory_order_relaxed );
+	mEncodedOffset		= 0;
+	mEncodedSize		= 0;
+	mEncodedNumChildren	= 0;
+	mEncodedChildren	= nullptr;
+	mChildrenExposed	= false;
+	mDirty				= DIRTY_NONE;
+	mDescendantsDirty	= false;
+	mEncodeLock.clear();
 }
 
 OscTree::ExcExceededMaxSize::ExcExceededMaxSize( size_t size )
 {
     mMessage    = "Exceeded the maximum size limit. Size: " + toString( size );
 }
+
+OscTree::ExcTypeMismatch::ExcTypeMismatch( const char* expectedTypeTags, TypeTag typeTag )
+{
+	mMessage = string( "Type tag mismatch. Expected: " ) + expectedTypeTags + " Found: " + 
+		( typeTag != 0 ? string( 1, static_cast<char>( typeTag ) ) : string( "none" ) );
+}
 	
\ No newline at end of file
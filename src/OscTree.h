@@ -8,18 +8,78 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstring>
 #include <typeinfo>
 #include <string>
 #include <vector>
 #include "cinder/Buffer.h"
 #include "cinder/Exception.h"
+#include "OscAddressTable.h"
+
+#if defined( _MSC_VER ) && _MSC_VER < 1900
+	#define OSC_NOEXCEPT
+#else
+	#define OSC_NOEXCEPT noexcept
+#endif
 
 class OscTree
 {
 public:
 	typedef uint8_t		TypeTag;
 
+	//! Result of parsing binary data in OscTree( const ci::BufferRef& )
+	enum ParseError : uint8_t
+	{
+		PARSE_OK, 
+		PARSE_MALFORMED_ADDRESS, 
+		PARSE_MALFORMED_TYPE_TAGS, 
+		PARSE_MALFORMED_BUNDLE, 
+		PARSE_UNKNOWN_TYPE_TAG, 
+		PARSE_TRUNCATED, 
+		PARSE_ERROR_COUNT
+	};
+
+	//! Options for parsing binary data in OscTree( const ci::BufferRef&, uint8_t )
+	enum ParseOption : uint8_t
+	{
+		//! Builds the whole tree up front, copying every argument value
+		PARSE_EAGER		= 0, 
+		//! Only scans the packet, checking it and reading the addresses. The children
+		//! of a message or bundle are built the first time they are asked for, and
+		//! argument values refer to the packet rather than copy it. The tree and its
+		//! arguments keep the packet alive, and it must not change while they use it.
+		PARSE_LAZY		= 1 << 0, 
+		//! The packet passed validate(), so the parser skips its checks, and a lazy
+		//! parse only reads the headers. Undefined for a packet that didn't pass.
+		PARSE_VALIDATED	= 1 << 1
+	};
+
+	//! Verdict of validate() on a whole packet
+	struct Validation
+	{
+		Validation()
+			: mError( PARSE_OK ), mHasNonZeroPadding( false ), mHasStrayBytes( false ), mErrorOffset( 0 ), mNumMessages( 0 )
+		{
+		}
+
+		//! The error parsing the packet would report
+		ParseError			mError;
+		//! A padding byte isn't zero, see canonicalize()
+		bool				mHasNonZeroPadding;
+		//! A message or bundle element isn't a multiple of 4 bytes long, or has bytes after its arguments
+		bool				mHasStrayBytes;
+		//! Where in the packet the error was found
+		uint32_t			mErrorOffset;
+		//! Messages in the packet, counting those in bundles, up to the error
+		uint32_t			mNumMessages;
+
+		bool				isValid() const { return mError == PARSE_OK; }
+		//! Returns true if the packet is valid and encoded as toBuffer() would encode it
+		bool				isCanonical() const { return isValid() && !mHasNonZeroPadding && !mHasStrayBytes; }
+	};
+
 	struct TimeTag
 	{
 		uint64_t mTimeTag;
@@ -35,11 +95,107 @@ public:
 		}
 	};
 
+	//! Tells the parser how to read the data of arguments with a type tag.
+	//! Encoding needs no codec, the value buffer already holds the data
+	//! as it appears in a packet, after mValueOffset bytes of prefix.
+	struct TypeTagCodec
+	{
+		//! Returns the number of bytes the argument at \a data occupies, padding
+		//! included, or the negated ParseError if \a available bytes don't hold it
+		typedef ptrdiff_t		( *SizeFn )( const char* data, size_t available );
+		//! Returns the value buffer of the argument whose \a size bytes are at \a data
+		typedef ci::BufferRef	( *DecodeFn )( const char* data, size_t size );
+
+		SizeFn				mSize;
+		DecodeFn			mDecode;
+		//! Bytes in front of the value in a packet, 4 for a blob's size
+		uint8_t				mValueOffset;
+	};
+
+	//! Non-owning view of the characters of a string argument, without
+	//! the null terminator. Valid until the argument's value is replaced.
+	struct StringView
+	{
+		const char*			mData;
+		size_t				mSize;
+
+		StringView()
+			: mData( "" ), mSize( 0 )
+		{
+		}
+
+		StringView( const char* data, size_t size )
+			: mData( data ), mSize( size )
+		{
+		}
+
+		const char*			data() const { return mData; }
+		//! The view is always followed by a null terminator
+		const char*			c_str() const { return mData; }
+		size_t				size() const { return mSize; }
+		bool				empty() const { return mSize == 0; }
+		const char*			begin() const { return mData; }
+		const char*			end() const { return mData + mSize; }
+
+		//! Copies the characters into a new std::string
+		std::string			str() const { return std::string( mData, mSize ); }
+
+		bool operator==( const StringView& other ) const
+		{
+			return mSize == other.mSize && memcmp( mData, other.mData, mSize ) == 0;
+		}
+		bool operator!=( const StringView& other ) const { return !( *this == other ); }
+		bool operator==( const std::string& other ) const { return *this == StringView( other.data(), other.size() ); }
+		bool operator!=( const std::string& other ) const { return !( *this == other ); }
+		bool operator==( const char* other ) const { return *this == StringView( other, strlen( other ) ); }
+		bool operator!=( const char* other ) const { return !( *this == other ); }
+	};
+
+	//! Non-owning view of the bytes of a blob argument. Valid until
+	//! the argument's value is replaced.
+	struct BlobSpan
+	{
+		const uint8_t*		mData;
+		size_t				mSize;
+
+		BlobSpan()
+			: mData( nullptr ), mSize( 0 )
+		{
+		}
+
+		BlobSpan( const uint8_t* data, size_t size )
+			: mData( data ), mSize( size )
+		{
+		}
+
+		const uint8_t*		data() const { return mData; }
+		size_t				size() const { return mSize; }
+		bool				empty() const { return mSize == 0; }
+		const uint8_t*		begin() const { return mData; }
+		const uint8_t*		end() const { return mData + mSize; }
+		uint8_t				operator[]( size_t index ) const { return mData[ index ]; }
+	};
+
+	//! A run of bytes of an encoding split by toBuffers(), like an iovec
+	struct GatherBuffer
+	{
+		const void*			mData;
+		size_t				mSize;
+	};
+
 	//! Creates an empty OscTree
 	explicit OscTree();
 	
-	//! Creates an OscTree from binary data that is structred based on the OSC spec
-	explicit OscTree( const ci::BufferRef& buffer );
+	//! Creates an OscTree from binary data that is structred based on the OSC spec.
+	//! \a options are ParseOption flags.
+	explicit OscTree( const ci::BufferRef& buffer, uint8_t options = PARSE_EAGER );
+
+	//! Copies an OscTree, the copy has no parent
+	OscTree( const OscTree& other );
+	OscTree( OscTree&& other ) OSC_NOEXCEPT;
+	//! Replaces the contents of an OscTree, an OscTree that is a child keeps its place in its parent
+	OscTree&			operator=( const OscTree& other );
+	OscTree&			operator=( OscTree&& other ) OSC_NOEXCEPT;
 	
 	//! Creates an OscTree that represents an OSC Message
 	//explicit OscTree( const std::string& address );
@@ -86,6 +242,12 @@ public:
 	//! Creates an OscTree that represents an OSC Bundle
 	static OscTree      makeBundle( const TimeTag& timeTag = TimeTag() );
 
+	//! Creates a blob argument that shares \a value instead of copying it
+	static OscTree		makeBlobRef( const ci::BufferRef& value, TypeTag typeTag = 'b' );
+	//! Creates a blob argument that refers to the \a numBytes bytes at \a value without
+	//! copying them. The memory must outlive the argument and every copy of it.
+	static OscTree		makeBlobRef( const void* value, size_t numBytes, TypeTag typeTag = 'b' );
+
 	//! Attempt to retrieve the argument value as the requested type
 	// this does not work for a string or any object type because
 	// the data stored in the buffer will only be the data needed
@@ -98,55 +260,243 @@ public:
 	// needed from that object type is copied into the buffer. string
 	// and TimeTag definitely will be affected.
 	// My solution is to use template specialization
+	// The value is copied out rather than dereferenced in place, the
+	// buffer may hold parsed data with no alignment guarantees.
 	template <typename T>
 	inline T			getValue() const
 	{
-		return *static_cast<T*>( const_cast<void*>( mValue->getData() ) );
+		T value;
+		memcpy( &value, mValue->getData(), sizeof( T ) );
+		return value;
 	}
+
+	//! Returns the value of an argument as \a T, copied out of the value buffer.
+	//! Supported types and the type tags they accept are int32_t ( i, c, r, m ), float ( f ),
+	//! int64_t ( h ), double ( d ), TimeTag ( t ), bool ( T, F ), StringView ( s, S )
+	//! and BlobSpan ( b ). Throws ExcTypeMismatch if the type tag does not match \a T.
+	//! Never allocates.
+	template <typename T>
+	T					get() const;
+
+	//! Registers the codec the parser uses for arguments tagged \a typeTag,
+	//! replacing any previous one. Built in are i f s S b h d t c r m T F N I.
+	//! Not thread safe, register custom type tags before parsing starts.
+	static void			registerTypeTag( TypeTag typeTag, const TypeTagCodec& codec );
+	//! Returns the codec for \a typeTag, unknown type tags have a codec that fails to parse
+	static const TypeTagCodec&	getTypeTagCodec( TypeTag typeTag );
+	//! A TypeTagCodec::DecodeFn that copies all \a size bytes into the value
+	static ci::BufferRef	decodeValue( const char* data, size_t size );
+
+	//! Checks the \a size bytes of a packet at \a data, nested bundles included, in one pass without
+	//! allocating. Packets that pass can be parsed with PARSE_VALIDATED. Padding isn't required to
+	//! be zero after string and blob arguments, only after addresses and type tags, as when parsing.
+	static Validation	validate( const void* data, size_t size );
+	//! Zeroes every padding byte of the packet at \a data in place, which makes a packet whose
+	//! addresses or type tags were only rejected for their padding valid. Returns the validation
+	//! of the result.
+	static Validation	canonicalize( void* data, size_t size );
+
+	//! Returns a view of a string argument without copying it, throws ExcTypeMismatch if the argument is not a string
+	StringView			getStringView() const;
+	//! Returns a view of a blob argument without copying it, throws ExcTypeMismatch if the argument is not a blob
+	BlobSpan			getBlobSpan() const;
 	
 	//! Returns the raw binary representation of the value, only valid for an OscTree that represents an argument
 	ci::BufferRef		getValue() const { return mValue; }
 	
 	//! Returns the type tag, only valid for an OscTree that represents argument
 	TypeTag				getTypeTag() const { return mTypeTag; }
+	//! Returns true if the value refers to memory the argument was made with, see makeBlobRef(),
+	//! or to the packet it was parsed from with PARSE_LAZY
+	bool				isValueRef() const { return mIsValueRef; }
+
+	//! Replaces the value of an argument. A value with the same type tag and size
+	//! as the previous one is patched into the last encoding by toBuffer()
+	void				setValue( int32_t value, TypeTag typeTag = 'i' );
+	void				setValue( float value, TypeTag typeTag = 'f' );
+	void				setValue( const std::string& value, TypeTag typeTag = 's' );
+	void				setValue( const void* value, size_t numBytes, TypeTag typeTag = 'b' );
+	void				setValue( int64_t value, TypeTag typeTag = 'h' );
+	void				setValue( double value, TypeTag typeTag = 'd' );
+
+	//! Returns the first error found while parsing, only valid for an OscTree created from binary data.
+	//! Parsing stops at the first error, so children up to the error are still available.
+	ParseError			getParseError() const { return mParseError; }
 	
 	bool							hasChildren() const;
+	//! Returns the number of children, without building the children of a lazily parsed tree
+	size_t							getNumChildren() const;
+	//! Returns the children, building them first if the tree was parsed with PARSE_LAZY.
+	//! Any number of threads may build them at once, one builds and the others wait for it.
+	//! The children may be inserted, erased or reordered through the vector. The next toBuffer()
+	//! checks whether they were, and only encodes this node from scratch if so.
 	std::vector<OscTree>&			getChildren();
 	const std::vector<OscTree>&		getChildren() const;
+	//! Returns the child at \a index, changes to it through setValue() and the like are patched
+	//! into the last encoding by toBuffer()
+	OscTree&						getChild( size_t index );
+	const OscTree&					getChild( size_t index ) const { return getChildren()[ index ]; }
+	//! Builds every child and descendant of a tree parsed with PARSE_LAZY that hasn't been built yet
+	void							materialize() const;
 	
 	bool				hasParent() const;
 	OscTree&			getParent();
 	const OscTree&		getParent() const;
 	
+	//! Returns true if this OscTree represents an OSC Bundle
+	bool				isBundle() const;
+	//! Returns true if this OscTree represents an OSC Message
+	bool				isMessage() const;
+
 	//! Appends a child
 	void				pushBack( const OscTree& child );
+	void				pushBack( OscTree&& child );
 	
-	//! Converts entire OscTree structure to binary data based on OSC spec
+	//! Converts entire OscTree structure to binary data based on OSC spec.
+	//! An OscTree without a parent keeps its encoding, so the next call only
+	//! patches values changed through setValue() and re-encodes the subtrees
+	//! whose structure or size changed. The returned buffer is that encoding,
+	//! so it must not be written to, copy it first to change the packet. It
+	//! is copied rather than patched if anything else still holds on to it.
+	//! Several threads may encode the same tree at once, as long as none changes it.
 	ci::BufferRef		toBuffer() const;
 
+	//! Encodes the tree as a list of buffers to send with one gathering write, such as
+	//! sendmsg() or writev(). Blob values of at least \a minReferencedSize bytes are
+	//! listed where they are rather than copied, everything else is encoded into the
+	//! returned buffer, which \a buffers points into. The values and the returned
+	//! buffer must be kept until the write completes.
+	ci::BufferRef		toBuffers( std::vector<GatherBuffer>& buffers, size_t minReferencedSize = 1024 ) const;
+
+	//! Returns the size in bytes of the binary data toBuffer() produces
+	size_t				getEncodedSize() const;
+
 	//! Returns the address, applies to OscTrees that represent OSC Messages
-	const std::string&	getAddress() const { return mAddress; };
+	const std::string&	getAddress() const { return mAddressId != OscAddressTable::kInvalidId ? OscAddressTable::get().getAddress( mAddressId ) : mAddress; };
+	//! Returns the ID the address is interned as in OscAddressTable::get(), for routing and
+	//! caching on an integer. OscAddressTable::kInvalidId if there is no address, the table is full,
+	//! or the message was parsed with an address that was never interned, as parsing only looks it up.
+	uint32_t			getAddressId() const { return mAddressId; }
 
 	//! Sets the address, applies to OscTrees that represent OSC Messages
 	void				setAddress( const std::string& address );
 
 	//! Sets the time tag, applies to OscTress that represent OSC Bundles
 	void				setTimeTag( const TimeTag& timeTag );
+
+	//! Returns the time tag, applies to OscTrees that represent OSC Bundles
+	const TimeTag&		getTimeTag() const { return mTimeTag; }
     
 protected:
-	std::vector<OscTree>	mChildren;
+	enum DirtyState : uint8_t
+	{
+		DIRTY_NONE, 
+		DIRTY_VALUE, 
+		DIRTY_STRUCTURE
+	};
+
+	enum LazyState : uint8_t
+	{
+		//! The children are built, or there are none to build
+		LAZY_NONE, 
+		LAZY_PENDING, 
+		//! A thread is building the children
+		LAZY_BUILDING
+	};
+
+
+	// built on first access, const or not, when parsed with PARSE_LAZY
+	mutable std::vector<OscTree>	mChildren;
 	OscTree*				mParent;
 	ci::BufferRef			mValue;
+	// only holds the address when it could not be interned
 	std::string				mAddress;
+	uint32_t				mAddressId;
 	TimeTag					mTimeTag;
 	TypeTag					mTypeTag;
 	int32_t					mBlobSize;
+	ParseError				mParseError;
+	bool					mIsBundle;
+	// the value must not be written to, it belongs to the caller
+	bool					mIsValueRef;
+	// ParseOption flags the tree was parsed with, for children built later
+	uint8_t					mParseOptions;
+
+	// The packet a lazily parsed message or bundle builds its children
+	// from, kept while anything may be reading it. mLazyData is the type
+	// tag string of a message or the first element of a bundle. None of
+	// these change once parsed, only mLazyState and the children do.
+	ci::BufferRef			mSource;
+	const char*				mLazyData;
+	uint32_t				mLazySize;
+	uint32_t				mLazyNumChildren;
+	mutable std::atomic<uint8_t>	mLazyState;
+
+	// Layout of the last encoding. Offsets are relative to the start
+	// of the parent's encoding, the buffer itself is only kept by
+	// the root. Dirty children are listed by index so toBuffer()
+	// only visits the parts of the tree that changed.
+	mutable ci::BufferRef			mEncoded;
+	mutable size_t					mEncodedOffset;
+	mutable size_t					mEncodedSize;
+	mutable size_t					mEncodedNumChildren;
+	mutable const OscTree*			mEncodedChildren;
+	// set when the children vector was handed out to be changed,
+	// the next encoding checks whether it was
+	mutable bool					mChildrenExposed;
+	mutable DirtyState				mDirty;
+	mutable bool					mDescendantsDirty;
+	mutable std::vector<uint32_t>	mDirtyChildren;
+	// held while a root updates its encoding and layout
+	mutable std::atomic_flag		mEncodeLock;
 	
 	void					init();
-	void					appendTypeTagString( ci::BufferRef& buffer, size_t& dataSize ) const;
-	void					appendAddress( ci::BufferRef& buffer, size_t& dataSize ) const;
-	void					appendValue( ci::BufferRef& buffer, size_t& dataSize ) const;
-	void					appendValue( ci::BufferRef& buffer, size_t& dataSize, const ci::BufferRef& valueBuffer ) const;
+	void					assignAddress( const char* address, size_t length, uint32_t hash, bool intern );
+	void					copyFrom( const OscTree& other );
+	void					moveFrom( OscTree& other );
+	void					replaced( bool registered, size_t encodedOffset, size_t encodedSize );
+	void					reparentChildren();
+
+	void					parse( const char* data, size_t size );
+	void					parseElement( const char* data, size_t size );
+	void					parseBundle( const char* data, size_t size );
+	void					parseMessage( const char* data, size_t size );
+	//! Reads the type tag string at \a data and the arguments that follow it, or the bundle elements
+	//! at \a data. Each is counted in \a numChildren and appended to \a children if it isn't null.
+	//! With a \a source, values refer to it and elements are parsed lazily. Returns the first error.
+	static ParseError		parseArguments( const char* data, size_t size, const ci::BufferRef& source, uint8_t options, std::vector<OscTree>* children, size_t& numChildren );
+	static ParseError		parseElements( const char* data, size_t size, const ci::BufferRef& source, uint8_t options, std::vector<OscTree>* children, size_t& numChildren );
+	//! Builds the children of a lazily parsed tree, if they haven't been
+	void					buildChildren() const { if ( mLazyState.load( std::memory_order_acquire ) != LAZY_NONE ) { buildLazyChildren(); } }
+	void					buildLazyChildren() const;
+	//! Keeps the packet of a lazily parsed tree if there are children to build from it
+	void					finishLazyParse();
+
+	void					setFixedValue( const void* value, size_t numBytes, TypeTag typeTag );
+	bool					isDirty() const;
+	//! Returns true if the children were inserted, erased or moved since the last encoding
+	bool					childrenMoved() const;
+	void					markDirty( DirtyState state );
+	void					markChildDirty( const OscTree* child );
+	void					clearDirty() const;
+
+	ci::BufferRef			encodeRoot() const;
+	uint8_t*				encode( uint8_t* pBuffer, bool recordLayout ) const;
+	uint8_t*				encodeAddress( uint8_t* pBuffer ) const;
+	uint8_t*				encodeTypeTagString( uint8_t* pBuffer ) const;
+	uint8_t*				encodeValue( uint8_t* pBuffer ) const;
+	uint8_t*				encodeGather( uint8_t* pBuffer, uint8_t*& pRun, std::vector<GatherBuffer>& buffers, size_t minReferencedSize ) const;
+	size_t					getReferencedSize( size_t minReferencedSize ) const;
+	bool					isReferenced( size_t minReferencedSize ) const;
+	size_t					getValueOffset() const;
+	ptrdiff_t				updateEncoding( ci::BufferRef& buffer, size_t offset ) const;
+
+	//! Lists the type tags get<T>() accepts for \a T
+	template <typename T>
+	struct ArgumentTraits;
+
+	//! Throws ExcTypeMismatch unless the type tag is one of \a typeTags and the value holds at least \a numBytes
+	void					checkTypeTag( const char* typeTags, size_t numBytes ) const;
     
 public:
 	//! Base class for OscTree Exceptions
@@ -166,8 +516,56 @@ public:
     protected:
         std::string         mMessage;
     };
+
+	class ExcTypeMismatch : public Exception
+	{
+	public:
+		ExcTypeMismatch( const char* expectedTypeTags, TypeTag typeTag );
+
+		virtual const char* what() const throw()
+		{
+			return mMessage.c_str();
+		}
+	protected:
+		std::string			mMessage;
+	};
 };
 
+template<> struct OscTree::ArgumentTraits<int32_t>			{ static const char* getTypeTags() { return "icrm"; } };
+template<> struct OscTree::ArgumentTraits<float>			{ static const char* getTypeTags() { return "f"; } };
+template<> struct OscTree::ArgumentTraits<int64_t>			{ static const char* getTypeTags() { return "h"; } };
+template<> struct OscTree::ArgumentTraits<double>			{ static const char* getTypeTags() { return "d"; } };
+template<> struct OscTree::ArgumentTraits<OscTree::TimeTag>	{ static const char* getTypeTags() { return "t"; } };
+
+template <typename T>
+inline T OscTree::get() const
+{
+	checkTypeTag( ArgumentTraits<T>::getTypeTags(), sizeof( T ) );
+
+	T value;
+	memcpy( &value, mValue->getData(), sizeof( T ) );
+	return value;
+}
+
+template<>
+inline bool OscTree::get<bool>() const
+{
+	checkTypeTag( "TF", 0 );
+	return mTypeTag == 'T';
+}
+
+template<>
+inline OscTree::StringView OscTree::get<OscTree::StringView>() const
+{
+	return getStringView();
+}
+
+template<>
+inline OscTree::BlobSpan OscTree::get<OscTree::BlobSpan>() const
+{
+	return getBlobSpan();
+}
+
 template<>
 inline std::string OscTree::getValue<std::string>() const
 {
@@ -177,7 +575,11 @@ inline std::string OscTree::getValue<std::string>() const
 template<>
 inline OscTree::TimeTag OscTree::getValue<OscTree::TimeTag>() const
 {
-    return TimeTag();
+	TimeTag timeTag;
+	if ( mValue && mValue->getSize() >= sizeof( uint64_t ) ) {
+		memcpy( &timeTag.mTimeTag, mValue->getData(), sizeof( uint64_t ) );
+	}
+	return timeTag;
 }
 
 // TODO:
@@ -185,4 +587,4 @@ inline OscTree::TimeTag OscTree::getValue<OscTree::TimeTag>() const
 // getValue() == nullptr
 // Empty Exception - if data is empty
 // Non convertible exception
-// dynamic_cast
\ No newline at end of file
+// dynamic_cast
\ No newline at end of file
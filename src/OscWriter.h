@@ -0,0 +1,242 @@
+//
+//  OscWriter.h
+//
+//	Builds a message or bundle in a fixed buffer, for threads that
+//	must not allocate, lock or throw, like an audio callback
+//
+//		OscWriter<256> writer;
+//		writer.address( "/synth/1" ).i( 60 ).f( 0.8f ).s( "saw" );
+//		if ( writer.finish() ) {
+//			sendRaw( writer.getData(), writer.getSize() );
+//		}
+//
+//	Arguments are written straight after the address as they come,
+//	while their type tags are collected from the far end of the
+//	buffer. When the message is finished the arguments are moved up
+//	and the type tag string written in front of them, so the number
+//	of arguments needn't be known up front. Anything that doesn't
+//	fit, or an argument without an address, fails the writer: every
+//	later call does nothing and finish() returns false. The encoding
+//	is the same as OscTree::toBuffer(), values in host byte order.
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "OscTree.h"
+
+template<size_t N>
+class OscWriter
+{
+public:
+	OscWriter()
+	{
+		clear();
+	}
+
+	//! Starts over with an empty buffer
+	void			clear()
+	{
+		mSize			= 0;
+		mMessageBegin	= 0;
+		mArgumentsBegin	= 0;
+		mNumTypeTags	= 0;
+		mIsBundle		= false;
+		mIsOpen			= false;
+		mIsFinished		= false;
+		mHasFailed		= false;
+	}
+
+	//! Starts a bundle, every address() after this starts a message in it. Only valid on an empty writer.
+	OscWriter&		bundle( const OscTree::TimeTag& timeTag = OscTree::TimeTag() )
+	{
+		if ( mHasFailed || mSize != 0 || !reserve( 16 ) ) {
+			return fail();
+		}
+		memcpy( mData.data(), "#bundle", 8 );
+		memcpy( mData.data() + 8, &timeTag.mTimeTag, 8 );
+		mSize		= 16;
+		mIsBundle	= true;
+		return *this;
+	}
+
+	//! Starts a message to \a address. Outside a bundle this starts over, discarding what was written.
+	OscWriter&		address( const char* address )
+	{
+		if ( !mIsBundle ) {
+			clear();
+		} else {
+			closeMessage();
+		}
+		if ( mHasFailed || mIsFinished ) {
+			return fail();
+		}
+
+		size_t length	= strlen( address );
+		size_t padded	= ceil4( length + 1 );
+		size_t element	= mIsBundle ? 4 : 0;
+		if ( !reserve( element + padded ) ) {
+			return fail();
+		}
+
+		mMessageBegin = mSize + element;
+		memcpy( mData.data() + mMessageBegin, address, length );
+		memset( mData.data() + mMessageBegin + length, 0, padded - length );
+		mSize			= mMessageBegin + padded;
+		mArgumentsBegin	= mSize;
+		mNumTypeTags	= 0;
+		mIsOpen			= true;
+		return *this;
+	}
+
+	OscWriter&		address( const std::string& address ) { return this->address( address.c_str() ); }
+
+	OscWriter&		i( int32_t value )							{ return write( 'i', &value, sizeof( value ) ); }
+	OscWriter&		f( float value )							{ return write( 'f', &value, sizeof( value ) ); }
+	OscWriter&		h( int64_t value )							{ return write( 'h', &value, sizeof( value ) ); }
+	OscWriter&		d( double value )							{ return write( 'd', &value, sizeof( value ) ); }
+	OscWriter&		t( const OscTree::TimeTag& value )			{ return write( 't', &value.mTimeTag, sizeof( value.mTimeTag ) ); }
+	OscWriter&		c( char value )
+	{
+		int32_t character = value;
+		return write( 'c', &character, sizeof( character ) );
+	}
+	OscWriter&		boolean( bool value )						{ return write( value ? 'T' : 'F', nullptr, 0 ); }
+	OscWriter&		nil()										{ return write( 'N', nullptr, 0 ); }
+
+	OscWriter&		s( const char* value )						{ return writeString( 's', value, strlen( value ) ); }
+	OscWriter&		s( const std::string& value )				{ return writeString( 's', value.c_str(), value.size() ); }
+
+	//! Appends a blob of \a numBytes from \a data, tagged \a typeTag
+	OscWriter&		b( const void* data, size_t numBytes, OscTree::TypeTag typeTag = 'b' )
+	{
+		if ( !mIsOpen || !reserve( 4 + ceil4( numBytes ), 1 ) ) {
+			return fail();
+		}
+		int32_t size = static_cast<int32_t>( numBytes );
+		memcpy( mData.data() + mSize, &size, 4 );
+		writeValue( typeTag, data, numBytes, 4 );
+		return *this;
+	}
+
+	//! Closes the message and bundle being written. Returns false if the writer failed or
+	//! is empty, in which case there is nothing to send. Arguments written after this fail.
+	bool			finish()
+	{
+		if ( mSize == 0 ) {
+			fail();
+		}
+		if ( !mHasFailed && !mIsFinished ) {
+			closeMessage();
+			mIsFinished = true;
+		}
+		return !mHasFailed;
+	}
+
+	//! Returns the encoded packet, only valid after finish() returned true
+	const uint8_t*	getData() const { return mData.data(); }
+	//! Returns the size of the encoded packet, or zero if the writer failed
+	size_t			getSize() const { return mHasFailed ? 0 : mSize; }
+
+	//! Returns true if something didn't fit, or was written out of order
+	bool			hasFailed() const { return mHasFailed; }
+	static size_t	getCapacity() { return N; }
+
+protected:
+	static size_t	ceil4( size_t size ) { return ( size + 3 ) & ~static_cast<size_t>( 3 ); }
+
+	//! Returns the size of the type tag string with \a numTypeTags tags
+	static size_t	getTypeTagStringSize( size_t numTypeTags ) { return ceil4( numTypeTags + 2 ); }
+
+	//! Returns true if \a numBytes more bytes and \a numTypeTags more type tags fit,
+	//! both while the tags are held at the end and once they are moved into place
+	bool			reserve( size_t numBytes, size_t numTypeTags = 0 ) const
+	{
+		size_t typeTags = mIsOpen ? mNumTypeTags + numTypeTags : 0;
+		return mSize + numBytes <= N && N - mSize - numBytes >= typeTags + getTypeTagStringSize( typeTags );
+	}
+
+	OscWriter&		fail()
+	{
+		mHasFailed = true;
+		return *this;
+	}
+
+	OscWriter&		write( OscTree::TypeTag typeTag, const void* value, size_t numBytes )
+	{
+		if ( !mIsOpen || !reserve( numBytes, 1 ) ) {
+			return fail();
+		}
+		writeValue( typeTag, value, numBytes, 0 );
+		return *this;
+	}
+
+	OscWriter&		writeString( OscTree::TypeTag typeTag, const char* value, size_t length )
+	{
+		size_t padded = ceil4( length + 1 );
+		if ( !mIsOpen || !reserve( padded, 1 ) ) {
+			return fail();
+		}
+		writeValue( typeTag, value, length, 0 );
+		memset( mData.data() + mSize, 0, padded - length );
+		mSize += padded - length;
+		return *this;
+	}
+
+	//! Writes \a numBytes of \a value after a prefix of \a offset bytes already written, padded
+	//! with zeros if it isn't a string, and the type tag at the end of the buffer
+	void			writeValue( OscTree::TypeTag typeTag, const void* value, size_t numBytes, size_t offset )
+	{
+		mSize += offset;
+		if ( numBytes > 0 ) {
+			memcpy( mData.data() + mSize, value, numBytes );
+		}
+		mSize += numBytes;
+		if ( typeTag != 's' && typeTag != 'S' ) {
+			size_t padding = ceil4( offset + numBytes ) - offset - numBytes;
+			memset( mData.data() + mSize, 0, padding );
+			mSize += padding;
+		}
+		mData[ N - 1 - mNumTypeTags ] = typeTag;
+		++mNumTypeTags;
+	}
+
+	//! Moves the arguments up to make room for the type tag string, and writes it
+	void			closeMessage()
+	{
+		if ( !mIsOpen || mHasFailed ) {
+			return;
+		}
+		mIsOpen = false;
+
+		size_t typeTagSize		= getTypeTagStringSize( mNumTypeTags );
+		size_t argumentsSize	= mSize - mArgumentsBegin;
+		memmove( mData.data() + mArgumentsBegin + typeTagSize, mData.data() + mArgumentsBegin, argumentsSize );
+
+		uint8_t* pTypeTags = mData.data() + mArgumentsBegin;
+		*pTypeTags++ = ',';
+		for ( size_t i = 0; i < mNumTypeTags; ++i ) {
+			*pTypeTags++ = mData[ N - 1 - i ];
+		}
+		memset( pTypeTags, 0, typeTagSize - 1 - mNumTypeTags );
+		mSize += typeTagSize;
+
+		if ( mIsBundle ) {
+			int32_t size = static_cast<int32_t>( mSize - mMessageBegin );
+			memcpy( mData.data() + mMessageBegin - 4, &size, 4 );
+		}
+	}
+
+	std::array<uint8_t, N>	mData;
+	size_t					mSize;
+	size_t					mMessageBegin;
+	size_t					mArgumentsBegin;
+	size_t					mNumTypeTags;
+	bool					mIsBundle;
+	bool					mIsOpen;
+	bool					mIsFinished;
+	bool					mHasFailed;
+};
@@ -3,7 +3,26 @@
 #include "cinder/params/Params.h"
 
 #include "UdpClient.h"
+#include "OscAddressTable.h"
+#include "OscArchive.h"
+#include "OscAsync.h"
+#include "OscBatchDecoder.h"
+#include "OscBlobDelta.h"
+#include "OscBufferPool.h"
+#include "OscCapture.h"
+#include "OscColumnarSink.h"
+#include "OscDispatcher.h"
+#include "OscFanOut.h"
+#include "OscLoadGenerator.h"
+#include "OscMetrics.h"
+#include "OscPacket.h"
+#include "OscQuery.h"
+#include "OscReliable.h"
+#include "OscSendQueue.h"
+#include "OscTrace.h"
+#include "OscTransport.h"
 #include "OscTree.h"
+#include "OscWriter.h"
 
 class OscDevApp : public ci::app::App
 {
@@ -32,6 +51,31 @@ private:
 	void	testDouble();
 	void	testMessage();
 	void	testFromBuffer();
+	void	testIncrementalEncode();
+	void	testDispatcher();
+	void	testAccessors();
+	void	testTypeTagCodecs();
+	void	testTransport();
+	void	testFanOut();
+	void	testBufferPool();
+	void	testSendQueue();
+	void	testReliable();
+	void	testPacket();
+	void	testAddressTable();
+	void	testBatchDecoder();
+	void	testColumnarSink();
+	void	testArchive();
+	void	testBlobRef();
+	void	testBlobDelta();
+	void	testOscQuery();
+	void	testWriter();
+	void	testTrace();
+	void	testLoadGenerator();
+	void	testLazyParse();
+	void	testValidate();
+	void	testPriorityLanes();
+	void	testCapture();
+	void	testMetrics();
 	
 private:
 	UdpClientRef				mUdpClient;
@@ -67,7 +111,10 @@ private:
 #include "cinder/Perlin.h"
 #include "cinder/Rand.h"
 #include "cinder/Utilities.h"
+#include <algorithm>
+#include <chrono>
 #include <limits>
+#include <random>
 
 using namespace ci;
 using namespace ci::app;
@@ -244,7 +291,32 @@ void OscDevApp::setup()
 		"int64", 
 		"float", 
 		"double", 
-		"buffer"
+		"buffer", 
+		"incremental encode", 
+		"dispatcher", 
+		"accessors", 
+		"type tag codecs", 
+		"transport", 
+		"fan out", 
+		"buffer pool", 
+		"send queue", 
+		"reliable", 
+		"packet", 
+		"address table", 
+		"batch decoder", 
+		"columnar sink", 
+		"archive", 
+		"blob ref", 
+		"blob delta", 
+		"osc query", 
+		"writer", 
+		"trace", 
+		"load generator", 
+		"lazy parse", 
+		"validate", 
+		"priority lanes", 
+		"capture", 
+		"metrics"
 	};
 
 	auto runTest = [ & ]() -> void
@@ -277,6 +349,81 @@ void OscDevApp::setup()
 			case 8:
 				testFromBuffer();
 				break;
+			case 9:
+				testIncrementalEncode();
+				break;
+			case 10:
+				testDispatcher();
+				break;
+			case 11:
+				testAccessors();
+				break;
+			case 12:
+				testTypeTagCodecs();
+				break;
+			case 13:
+				testTransport();
+				break;
+			case 14:
+				testFanOut();
+				break;
+			case 15:
+				testBufferPool();
+				break;
+			case 16:
+				testSendQueue();
+				break;
+			case 17:
+				testReliable();
+				break;
+			case 18:
+				testPacket();
+				break;
+			case 19:
+				testAddressTable();
+				break;
+			case 20:
+				testBatchDecoder();
+				break;
+			case 21:
+				testColumnarSink();
+				break;
+			case 22:
+				testArchive();
+				break;
+			case 23:
+				testBlobRef();
+				break;
+			case 24:
+				testBlobDelta();
+				break;
+			case 25:
+				testOscQuery();
+				break;
+			case 26:
+				testWriter();
+				break;
+			case 27:
+				testTrace();
+				break;
+			case 28:
+				testLoadGenerator();
+				break;
+			case 29:
+				testLazyParse();
+				break;
+			case 30:
+				testValidate();
+				break;
+			case 31:
+				testPriorityLanes();
+				break;
+			case 32:
+				testCapture();
+				break;
+			case 33:
+				testMetrics();
+				break;
 		};
 	};
 
@@ -290,6 +437,31 @@ void OscDevApp::setup()
 		testDouble();
 		testBlobArray();
 		testBlobImage();
+		testIncrementalEncode();
+		testDispatcher();
+		testAccessors();
+		testTypeTagCodecs();
+		testTransport();
+		testFanOut();
+		testBufferPool();
+		testSendQueue();
+		testReliable();
+		testPacket();
+		testAddressTable();
+		testBatchDecoder();
+		testColumnarSink();
+		testArchive();
+		testBlobRef();
+		testBlobDelta();
+		testOscQuery();
+		testWriter();
+		testTrace();
+		testLoadGenerator();
+		testLazyParse();
+		testValidate();
+		testPriorityLanes();
+		testCapture();
+		testMetrics();
 	};
 
 	mParams = params::InterfaceGl::create( "Params", ivec2( 240, 120 ) );
@@ -302,6 +474,20 @@ void OscDevApp::setup()
 	mParams->addButton( "Run all test", runAllTests,	"key=R" );
 	mParams->addButton( "Write", bind( &OscDevApp::write, this ), "key=w" );
 
+	// "--load" runs the load generator with the options that follow, then quits
+	const vector<string>& args = getCommandLineArgs();
+	if ( find( args.begin(), args.end(), "--load" ) != args.end() ) {
+		try {
+			OscLoadGenerator::Options options = OscLoadGenerator::Options::parse( args );
+			CI_LOG_I( "Load generator " << options.toString() );
+			OscLoadGenerator::Report report = OscLoadGenerator::create( options )->run();
+			CI_LOG_I( report.toString() );
+		} catch ( const OscLoadGenerator::Exception& exc ) {
+			CI_LOG_E( exc.what() );
+		}
+		quit();
+	}
+
 	gl::enableAlphaBlending();
 }
 
@@ -727,6 +913,2516 @@ void OscDevApp::testFromBuffer()
 	}
 }
 
+void OscDevApp::testIncrementalEncode()
+{
+	// a state bundle where a few values change every frame
+	OscTree bundle = OscTree::makeBundle();
+	for ( int32_t i = 0; i < 500; ++i ) {
+		OscTree message = OscTree::makeMessage( "/state/" + to_string( i ) );
+		message.pushBack( OscTree( i ) );
+		message.pushBack( OscTree( static_cast<float>( i ) ) );
+		message.pushBack( OscTree( string( "label" ) ) );
+		bundle.pushBack( message );
+	}
+	bundle.toBuffer();
+
+	bool passed = true;
+	for ( size_t frame = 0; frame < 100 && passed; ++frame ) {
+		for ( size_t i = 0; i < 5; ++i ) {
+			OscTree& message = bundle.getChild( randInt( 500 ) );
+			message.getChild( 1 ).setValue( randFloat() );
+			if ( i == 0 ) {
+				// a string of a different length re-encodes the argument
+				message.getChild( 2 ).setValue( string( randInt( 1, 16 ), 'x' ) );
+			}
+		}
+
+		// a copy is encoded from scratch, it has to match the patched encoding
+		BufferRef patched	= bundle.toBuffer();
+		OscTree copy		= OscTree::makeBundle();
+		copy.pushBack( bundle );
+		BufferRef full		= copy.getChild( 0 ).toBuffer();
+
+		passed = ( patched->getSize() == full->getSize() && 
+			memcmp( patched->getData(), full->getData(), full->getSize() ) == 0 );
+	}
+
+	OscTree fromBuffer( bundle.toBuffer() );
+	passed = passed && fromBuffer.isBundle() && fromBuffer.getChildren().size() == 500 && 
+		fromBuffer.getChildren()[ 7 ].getChildren()[ 0 ].getValue<int32_t>() == 7;
+
+	// a subtree's own toBuffer() always encodes from scratch
+	auto isUpToDate = []( const OscTree& tree ) -> bool
+	{
+		OscTree parent = OscTree::makeBundle();
+		parent.pushBack( tree );
+		BufferRef patched	= tree.toBuffer();
+		BufferRef full		= parent.getChild( 0 ).toBuffer();
+		return patched->getSize() == full->getSize() && memcmp( patched->getData(), full->getData(), full->getSize() ) == 0;
+	};
+
+	// children pushed, swapped or erased through the vector re-encode the tree
+	OscTree nested = OscTree::makeBundle();
+	nested.pushBack( OscTree::makeMessage( "/a" ) );
+	nested.getChild( 0 ).pushBack( OscTree( 1 ) );
+	passed = passed && nested.toBuffer()->getSize() == 32;
+	nested.getChildren()[ 0 ].getChildren().push_back( OscTree( 2 ) );
+	passed = passed && nested.toBuffer()->getSize() == 36 && isUpToDate( nested );
+
+	OscTree reordered = OscTree::makeMessage( "/reordered" );
+	reordered.pushBack( OscTree( 1 ) );
+	reordered.pushBack( OscTree( string( "two" ) ) );
+	reordered.toBuffer();
+	std::swap( reordered.getChildren()[ 0 ], reordered.getChildren()[ 1 ] );
+	passed = passed && isUpToDate( reordered ) && OscTree( reordered.toBuffer() ).getChild( 0 ).getTypeTag() == 's';
+	reordered.getChildren().erase( reordered.getChildren().begin() );
+	passed = passed && isUpToDate( reordered ) && OscTree( reordered.toBuffer() ).getNumChildren() == 1;
+
+	// children pushed through a vector that is held on to still tell the tree when they change
+	vector<OscTree>& arguments = reordered.getChildren();
+	arguments.push_back( OscTree( 3 ) );
+	arguments.push_back( OscTree( 4 ) );
+	reordered.toBuffer();
+	arguments.back().setValue( 5 );
+	nested.getChild( 0 ).getChild( 1 ).setValue( 6 );
+	passed = passed && isUpToDate( reordered ) && OscTree( reordered.toBuffer() ).getChild( 2 ).get<int32_t>() == 5 && 
+		isUpToDate( nested ) && OscTree( nested.toBuffer() ).getChild( 0 ).getChild( 1 ).get<int32_t>() == 6;
+
+	// handing out the children without changing them keeps the encoding
+	BufferRef kept = reordered.toBuffer();
+	reordered.getChildren();
+	passed = passed && reordered.toBuffer() == kept;
+
+	// an argument assigned over another, or children moved over separate calls, are still found
+	reordered.getChild( 0 ) = OscTree( 7 );
+	passed = passed && isUpToDate( reordered ) && OscTree( reordered.toBuffer() ).getChild( 0 ).get<int32_t>() == 7;
+	reordered.getChildren().erase( reordered.getChildren().begin() );
+	reordered.getChildren().insert( reordered.getChildren().begin() + 1, OscTree( string( "inserted" ) ) );
+	passed = passed && isUpToDate( reordered ) && OscTree( reordered.toBuffer() ).getChild( 1 ).getTypeTag() == 's';
+
+	// any number of threads can encode the same tree, as the dispatcher's handlers may
+	bundle.getChild( 3 ).getChild( 1 ).setValue( 0.5f );
+	vector<thread> threads;
+	atomic<size_t> numMatching( 0 );
+	BufferRef expected = OscTree( bundle ).toBuffer();
+	for ( size_t i = 0; i < 4; ++i ) {
+		threads.push_back( thread( [ & ]()
+		{
+			const OscTree& shared = bundle;
+			for ( size_t j = 0; j < 100; ++j ) {
+				BufferRef buffer = shared.toBuffer();
+				numMatching += buffer->getSize() == expected->getSize() && memcmp( buffer->getData(), expected->getData(), expected->getSize() ) == 0 ? 1 : 0;
+			}
+		} ) );
+	}
+	for ( auto& thread : threads ) {
+		thread.join();
+	}
+	passed = passed && numMatching == 400;
+
+	string result = "Test incremental encode ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testDispatcher()
+{
+	// synthetic many-address traffic, every message carries its
+	// sequence number for its address so reordering is detected
+	const int32_t numAddresses	= 1024;
+	const int32_t numMessages	= 100000;
+
+	vector<string> addresses;
+	for ( int32_t i = 0; i < numAddresses; ++i ) {
+		addresses.push_back( "/fader/" + to_string( i ) );
+	}
+
+	vector<OscDispatcher::MessageRef> messages;
+	for ( int32_t i = 0; i < numMessages; ++i ) {
+		OscTree message = OscTree::makeMessage( addresses[ i % numAddresses ] );
+		message.pushBack( OscTree( i / numAddresses ) );
+		messages.push_back( make_shared<OscTree>( message ) );
+	}
+
+	// stands in for a few microseconds of handler work
+	auto work = []( int32_t value ) -> uint32_t
+	{
+		uint32_t hash = static_cast<uint32_t>( value );
+		for ( size_t i = 0; i < 2000; ++i ) {
+			hash = hash * 16777619u ^ static_cast<uint32_t>( i );
+		}
+		return hash;
+	};
+
+	// ordering is checked at every shard count, but a speedup only means
+	// something up to the number of hardware threads, so it is only logged
+	// that far. How it scales past a few cores hasn't been measured.
+	bool passed			= true;
+	double baseSeconds	= 0.0;
+	size_t maxShards	= max<size_t>( thread::hardware_concurrency(), 1 );
+	for ( size_t numShards = 1; numShards <= 16; numShards *= 2 ) {
+		OscDispatcherRef dispatcher = OscDispatcher::create( numShards );
+
+		vector<int32_t> lastSequence( numAddresses, -1 );
+		vector<uint32_t> results( numAddresses, 0 );
+		atomic<size_t> numOutOfOrder( 0 );
+		for ( int32_t i = 0; i < numAddresses; ++i ) {
+			dispatcher->addHandler( addresses[ i ], [ &, i ]( const OscTree& message )
+			{
+				int32_t sequence = message.getChildren()[ 0 ].getValue<int32_t>();
+				if ( sequence != lastSequence[ i ] + 1 ) {
+					++numOutOfOrder;
+				}
+				lastSequence[ i ]	= sequence;
+				results[ i ]		+= work( sequence );
+			} );
+		}
+
+		auto start = chrono::steady_clock::now();
+		for ( const auto& message : messages ) {
+			dispatcher->dispatch( message );
+		}
+		dispatcher->waitUntilIdle();
+		double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+		if ( numShards == 1 ) {
+			baseSeconds = seconds;
+		}
+		passed = passed && numOutOfOrder == 0 && lastSequence[ 0 ] == ( numMessages - 1 ) / numAddresses;
+
+		if ( numShards <= maxShards ) {
+			CI_LOG_V( "Dispatcher " << numShards << " shards: " 
+				<< static_cast<size_t>( numMessages / seconds ) << " messages/s, speedup " 
+				<< baseSeconds / seconds << "x" );
+		}
+	}
+
+	// producers dispatching at once: each producer's messages for an
+	// address run in the order it dispatched them, one at a time
+	{
+		const int32_t numProducers			= 4;
+		const int32_t numPerProducer		= 20000;
+		const int32_t numProducerAddresses	= 64;
+		OscDispatcherRef dispatcher = OscDispatcher::create( 4 );
+
+		vector<vector<int32_t>> lastSequences( numProducerAddresses, vector<int32_t>( numProducers, -1 ) );
+		unique_ptr<atomic<int32_t>[]> numRunning( new atomic<int32_t>[ numProducerAddresses ] );
+		vector<uint32_t> results( numProducerAddresses, 0 );
+		atomic<size_t> numOutOfOrder( 0 );
+		atomic<size_t> numOverlapping( 0 );
+		atomic<size_t> numHandled( 0 );
+		for ( int32_t i = 0; i < numProducerAddresses; ++i ) {
+			numRunning[ i ] = 0;
+			dispatcher->addHandler( addresses[ i ], [ &, i ]( const OscTree& message )
+			{
+				if ( numRunning[ i ].fetch_add( 1 ) != 0 ) {
+					++numOverlapping;
+				}
+				int32_t producer = message.getChildren()[ 0 ].getValue<int32_t>();
+				int32_t sequence = message.getChildren()[ 1 ].getValue<int32_t>();
+				if ( sequence != lastSequences[ i ][ producer ] + 1 ) {
+					++numOutOfOrder;
+				}
+				lastSequences[ i ][ producer ]	= sequence;
+				results[ i ]					+= work( sequence );
+				numRunning[ i ].fetch_sub( 1 );
+				++numHandled;
+			} );
+		}
+
+		vector<thread> producers;
+		for ( int32_t i = 0; i < numProducers; ++i ) {
+			producers.push_back( thread( [ &, i ]()
+			{
+				for ( int32_t j = 0; j < numPerProducer; ++j ) {
+					OscTree message = OscTree::makeMessage( addresses[ j % numProducerAddresses ] );
+					message.pushBack( OscTree( i ) );
+					message.pushBack( OscTree( j / numProducerAddresses ) );
+					dispatcher->dispatch( make_shared<OscTree>( message ) );
+				}
+			} ) );
+		}
+		for ( thread& t : producers ) {
+			t.join();
+		}
+		dispatcher->waitUntilIdle();
+
+		passed = passed && numOutOfOrder == 0 && numOverlapping == 0 && 
+			numHandled == static_cast<size_t>( numProducers * numPerProducer );
+	}
+
+	string result = "Test dispatcher ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testAccessors()
+{
+	int32_t valueInt32				= 42;
+	string valueString				= "accessor";
+	array<int32_t, 4> valueBlob		= { 1, 2, 3, 4 };
+
+	OscTree message = OscTree::makeMessage( "/accessors" );
+	message.pushBack( OscTree( valueInt32 ) );
+	message.pushBack( OscTree( valueString ) );
+	message.pushBack( OscTree( valueBlob.data(), sizeof( valueBlob ) ) );
+	message.pushBack( OscTree( 2.5 ) );
+	message.pushBack( OscTree( static_cast<OscTree::TypeTag>( 'T' ) ) );
+
+	// parsed values are read in place from the received packet's layout
+	OscTree fromBuffer( message.toBuffer() );
+	const vector<OscTree>& args = fromBuffer.getChildren();
+
+	OscTree::StringView view	= args[ 1 ].getStringView();
+	OscTree::BlobSpan blob		= args[ 2 ].getBlobSpan();
+
+	bool passed = args.size() == 5 && 
+		args[ 0 ].get<int32_t>() == valueInt32 && 
+		view == valueString && view.size() == valueString.size() && 
+		blob.size() == sizeof( valueBlob ) && memcmp( blob.data(), valueBlob.data(), blob.size() ) == 0 && 
+		args[ 3 ].get<double>() == 2.5 && 
+		args[ 4 ].get<bool>();
+
+	// reading an argument as the wrong type throws rather than reinterpreting its bytes
+	bool threw = false;
+	try {
+		args[ 0 ].get<float>();
+	} catch ( const OscTree::ExcTypeMismatch& exc ) {
+		CI_LOG_V( exc.what() );
+		threw = true;
+	}
+	passed = passed && threw;
+
+	string result = "Test accessors ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testTypeTagCodecs()
+{
+	// vendor type tags parse with their size, so the arguments after them survive
+	OscTree message = OscTree::makeMessage( "/vendor" );
+	message.pushBack( OscTree( static_cast<int32_t>( 'A' ), 'c' ) );
+	message.pushBack( OscTree( static_cast<int32_t>( 0xff8000ff ), 'r' ) );
+	message.pushBack( OscTree( static_cast<int32_t>( 0x00903c7f ), 'm' ) );
+	message.pushBack( OscTree( OscTree::TimeTag( 42 ) ) );
+	message.pushBack( OscTree( static_cast<int32_t>( 'Z' ), 'z' ) );
+	message.pushBack( OscTree( 7 ) );
+
+	// 'z' is unknown, parsing has to stop there
+	OscTree unknown( message.toBuffer() );
+	bool passed = unknown.getParseError() == OscTree::PARSE_UNKNOWN_TYPE_TAG && 
+		unknown.getChildren().size() == 4 && 
+		unknown.getChildren()[ 3 ].get<OscTree::TimeTag>().mTimeTag == 42;
+
+	OscTree::TypeTagCodec unknownCodec	= OscTree::getTypeTagCodec( 'z' );
+	OscTree::TypeTagCodec codec			= { OscTree::getTypeTagCodec( 'i' ).mSize, &OscTree::decodeValue, 0 };
+	OscTree::registerTypeTag( 'z', codec );
+
+	OscTree fromBuffer( message.toBuffer() );
+	passed = passed && fromBuffer.getParseError() == OscTree::PARSE_OK && 
+		fromBuffer.getChildren().size() == 6 && 
+		fromBuffer.getChildren()[ 0 ].get<int32_t>() == 'A' && 
+		fromBuffer.getChildren()[ 4 ].getValue<int32_t>() == 'Z' && 
+		fromBuffer.getChildren()[ 5 ].get<int32_t>() == 7;
+
+	// leave 'z' unknown for the next run
+	OscTree::registerTypeTag( 'z', unknownCodec );
+
+	string result = "Test type tag codecs ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+#if defined( OSC_HAS_COROUTINES )
+OscTask receiveSequenceAsync( OscReceiver& receiver, int32_t numPackets, int32_t& numReceived )
+{
+	for ( int32_t i = 0; i < numPackets; ++i ) {
+		OscTree message = co_await receiver.next();
+		if ( message.getChildren().empty() || message.getChildren()[ 0 ].get<int32_t>() != i ) {
+			co_return;
+		}
+		++numReceived;
+	}
+}
+
+OscTask sendSequenceAsync( OscSender& sender, int32_t numPackets, int32_t& numSent )
+{
+	for ( int32_t i = 0; i < numPackets; ++i ) {
+		OscTree message = OscTree::makeMessage( "/sequence" );
+		message.pushBack( OscTree( i ) );
+		if ( co_await sender.send( message ) ) {
+			++numSent;
+		}
+	}
+}
+#endif
+
+void OscDevApp::testTransport()
+{
+	// a private io_service, polled here until the packets are through
+	asio::io_service io;
+	OscExecutorRef executor = OscExecutor::create( io );
+
+	auto poll = [ & ]( const function<bool()>& isDone )
+	{
+		auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+		while ( !isDone() && chrono::steady_clock::now() < deadline ) {
+			io.poll();
+			io.reset();
+		}
+	};
+
+	const int32_t numPackets = 100;
+	auto sendAll = [ & ]( const OscTransportRef& sender, const OscTransportRef& receiver ) -> bool
+	{
+		int32_t numReceived = 0;
+		receiver->setReceiveHandler( [ & ]( const BufferRef& packet )
+		{
+			OscTree message( packet );
+			if ( !message.getChildren().empty() && message.getChildren()[ 0 ].get<int32_t>() == numReceived ) {
+				++numReceived;
+			}
+		} );
+
+		for ( int32_t i = 0; i < numPackets; ++i ) {
+			OscTree message = OscTree::makeMessage( "/sequence" );
+			message.pushBack( OscTree( i ) );
+			sender->send( message.toBuffer() );
+		}
+
+		poll( [ & ]() { return numReceived == numPackets; } );
+		receiver->setReceiveHandler( nullptr );
+
+		return numReceived == numPackets;
+	};
+
+	auto loopback = OscLoopbackTransport::createPair( executor );
+	bool passed = sendAll( loopback.first, loopback.second );
+
+	OscUdpTransportRef udpSender	= OscUdpTransport::create( executor );
+	OscUdpTransportRef udpReceiver	= OscUdpTransport::create( executor );
+	udpSender->connect( "127.0.0.1", udpReceiver->getLocalPort() );
+	passed = passed && sendAll( udpSender, udpReceiver );
+
+#if defined( OSC_HAS_COROUTINES )
+	{
+		int32_t numSent		= 0;
+		int32_t numReceived	= 0;
+		OscReceiver receiver( udpReceiver );
+		OscSender sender( udpSender );
+		receiveSequenceAsync( receiver, numPackets, numReceived );
+		sendSequenceAsync( sender, numPackets, numSent );
+		poll( [ & ]() { return numReceived == numPackets && numSent == numPackets; } );
+		passed = passed && numReceived == numPackets && numSent == numPackets;
+		receiver.close();
+		io.poll();
+		io.reset();
+	}
+#endif
+
+	udpSender->close();
+	udpReceiver->close();
+	io.poll();
+
+	CI_LOG_V( "Transport: " << executor->getNumTasks() << " tasks in " << executor->getNumBatches() << " batches" );
+
+	string result = "Test transport ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testFanOut()
+{
+	asio::io_service io;
+	OscExecutorRef executor = OscExecutor::create( io );
+
+	// stands in for a wall of display nodes
+	const size_t numReceivers = 40;
+	vector<OscUdpTransportRef> receivers;
+	vector<int32_t> received( numReceivers, -1 );
+	OscFanOutSenderRef sender = OscFanOutSender::create( io );
+	for ( size_t i = 0; i < numReceivers; ++i ) {
+		receivers.push_back( OscUdpTransport::create( executor ) );
+		receivers.back()->setReceiveHandler( [ &received, i ]( const BufferRef& packet )
+		{
+			OscTree message( packet );
+			if ( !message.getChildren().empty() ) {
+				received[ i ] = message.getChildren()[ 0 ].get<int32_t>();
+			}
+		} );
+		sender->addEndpoint( "127.0.0.1", receivers.back()->getLocalPort() );
+	}
+
+	OscTree message = OscTree::makeMessage( "/state" );
+	message.pushBack( OscTree( 42 ) );
+	size_t numSent = sender->send( message );
+
+	auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+	while ( count( received.begin(), received.end(), 42 ) < static_cast<ptrdiff_t>( numReceivers ) && chrono::steady_clock::now() < deadline ) {
+		io.poll();
+		io.reset();
+	}
+
+	bool passed = numSent == numReceivers && count( received.begin(), received.end(), 42 ) == static_cast<ptrdiff_t>( numReceivers );
+	CI_LOG_V( "Fan out: " << numSent << " endpoints in " << sender->getNumSyscalls() << " send calls" );
+
+	for ( const auto& receiver : receivers ) {
+		receiver->close();
+	}
+	io.poll();
+
+	string result = "Test fan out ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testBufferPool()
+{
+	OscBufferPoolRef pool = OscBufferPool::create( 4, 2, 1 );
+
+	// a slot is handed out again once every view of it is gone
+	bool passed = true;
+	{
+		BufferRef first		= pool->acquire( 100 );
+		BufferRef jumbo		= pool->acquire( 4000 );
+		passed = first->getSize() == 100 && jumbo->getSize() == 4000 &&
+			jumbo->getAllocatedSize() == OscBufferPool::kJumboSlotSize &&
+			pool->getNumAvailable() == pool->getNumSlots() - 2;
+	}
+	passed = passed && pool->getNumAvailable() == pool->getNumSlots();
+
+	// a full class spills into the next larger one, then the heap
+	{
+		vector<BufferRef> held;
+		for ( size_t i = 0; i < pool->getNumSlots(); ++i ) {
+			held.push_back( pool->acquire( 100 ) );
+		}
+		passed = passed && held[ 3 ]->getAllocatedSize() == OscBufferPool::kMtuSlotSize && 
+			held[ 4 ]->getAllocatedSize() == OscBufferPool::kJumboSlotSize && 
+			held[ 6 ]->getAllocatedSize() == OscBufferPool::kDatagramSlotSize && 
+			pool->getNumAvailable() == 0 && pool->acquire( 100 )->getSize() == 100 && pool->getNumFallbacks() == 1;
+	}
+	passed = passed && pool->getNumAvailable() == pool->getNumSlots();
+
+	// threads acquiring and releasing at once return every slot
+	{
+		OscBufferPoolRef shared = OscBufferPool::create( 8, 2, 0 );
+		vector<thread> threads;
+		for ( size_t i = 0; i < 4; ++i ) {
+			threads.push_back( thread( [ i, &shared ]()
+			{
+				for ( size_t j = 0; j < 10000; ++j ) {
+					BufferRef buffer = shared->acquire( ( j % 3 ) * 1000 + 1 );
+					static_cast<uint8_t*>( buffer->getData() )[ 0 ] = static_cast<uint8_t>( i );
+				}
+			} ) );
+		}
+		for ( thread& t : threads ) {
+			t.join();
+		}
+		passed = passed && shared->getNumAvailable() == shared->getNumSlots();
+	}
+
+	// a buffer keeps the slabs alive after its pool is gone
+	{
+		BufferRef orphan = OscBufferPool::create( 1, 0, 0 )->acquire( 64 );
+		memset( orphan->getData(), 0xAB, orphan->getSize() );
+		passed = passed && orphan->getAllocatedSize() == OscBufferPool::kMtuSlotSize && 
+			static_cast<const uint8_t*>( orphan->getData() )[ 63 ] == 0xAB;
+	}
+
+	// received packets come from the pool, and go back to it once parsed
+	asio::io_service io;
+	OscExecutorRef executor			= OscExecutor::create( io );
+	OscUdpTransportRef sender		= OscUdpTransport::create( executor );
+	OscUdpTransportRef receiver		= OscUdpTransport::create( executor );
+	receiver->setBufferPool( pool );
+	sender->connect( "127.0.0.1", receiver->getLocalPort() );
+
+	const int32_t numPackets	= 200;
+	int32_t numReceived			= 0;
+	size_t numDirect = 0;
+	receiver->setReceiveHandler( [ & ]( const BufferRef& packet )
+	{
+		// read straight into a slot sized for the datagram, not copied into one
+		if ( packet->getAllocatedSize() == OscBufferPool::kMtuSlotSize ) {
+			++numDirect;
+		}
+		OscTree message( packet );
+		if ( !message.getChildren().empty() && message.getChildren()[ 0 ].get<int32_t>() == numReceived ) {
+			++numReceived;
+		}
+	} );
+
+	for ( int32_t i = 0; i < numPackets; ++i ) {
+		OscTree message = OscTree::makeMessage( "/pooled" );
+		message.pushBack( OscTree( i ) );
+		sender->send( message.toBuffer() );
+
+		// keep the sender no more than a few packets ahead
+		io.poll();
+		io.reset();
+	}
+
+	auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+	while ( numReceived < numPackets && chrono::steady_clock::now() < deadline ) {
+		io.poll();
+		io.reset();
+	}
+
+	sender->close();
+	receiver->close();
+	io.poll();
+
+	passed = passed && numReceived == numPackets && numDirect == static_cast<size_t>( numPackets ) && pool->getNumFallbacks() == 1 &&
+		pool->getNumAvailable() == pool->getNumSlots();
+
+	// only the packet is recycled: an eager parse copies the arguments
+	// into the tree, a lazy one refers to the slot and keeps it out
+	OscTree message = OscTree::makeMessage( "/pooled" );
+	message.pushBack( OscTree( 7 ) );
+	BufferRef encoded	= message.toBuffer();
+	BufferRef packet	= pool->acquire( encoded->getSize() );
+	packet->copyFrom( encoded->getData(), encoded->getSize() );
+	OscTree eager( packet );
+	OscTree lazy( packet, OscTree::PARSE_LAZY );
+	packet.reset();
+	passed = passed && pool->getNumAvailable() == pool->getNumSlots() - 1 && 
+		eager.getChildren()[ 0 ].get<int32_t>() == 7 && lazy.getChildren()[ 0 ].get<int32_t>() == 7;
+	lazy = OscTree();
+	passed = passed && pool->getNumAvailable() == pool->getNumSlots() && eager.getChildren()[ 0 ].get<int32_t>() == 7;
+
+	string result = "Test buffer pool ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testSendQueue()
+{
+	asio::io_service io;
+	OscExecutorRef executor = OscExecutor::create( io );
+	auto transports			= OscLoopbackTransport::createPair( executor );
+	OscSendQueueRef sendQueue = OscSendQueue::create( transports.first, chrono::milliseconds( 5 ) );
+
+	const int32_t numFaders		= 32;
+	const int32_t numUpdates	= 100;
+	size_t numPackets			= 0;
+	vector<int32_t> positions( numFaders, -1 );
+	vector<OscTree> scheduled;
+	transports.second->setReceiveHandler( [ & ]( const BufferRef& packet )
+	{
+		++numPackets;
+		OscTree tree( packet );
+		vector<OscTree> messages;
+		if ( tree.isBundle() ) {
+			messages = tree.getChildren();
+		} else {
+			messages.push_back( tree );
+		}
+		if ( tree.isBundle() && tree.getTimeTag().mTimeTag != OscTree::TimeTag().mTimeTag ) {
+			messages.clear();
+			scheduled.push_back( tree );
+		}
+		for ( const OscTree& message : messages ) {
+			// bundles with a time tag arrive whole, they are checked below
+			if ( message.isBundle() ) {
+				scheduled.push_back( message );
+				continue;
+			}
+			int32_t fader = atoi( message.getAddress().c_str() + string( "/fader/" ).size() );
+			positions[ fader ] = message.getChildren()[ 0 ].get<int32_t>();
+		}
+	} );
+
+	auto run = [ & ]()
+	{
+		auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+		while ( sendQueue->getNumPending() > 0 && chrono::steady_clock::now() < deadline ) {
+			io.run_one();
+		}
+		io.poll();
+		io.reset();
+	};
+
+	// every fader dragged through a hundred positions between two ticks
+	for ( int32_t update = 0; update < numUpdates; ++update ) {
+		for ( int32_t fader = 0; fader < numFaders; ++fader ) {
+			OscTree message = OscTree::makeMessage( "/fader/" + to_string( fader ) );
+			message.pushBack( OscTree( update ) );
+			sendQueue->send( message );
+		}
+	}
+	run();
+
+	bool passed = sendQueue->getNumQueued() == static_cast<uint64_t>( numFaders * numUpdates ) && 
+		sendQueue->getNumCoalesced() == static_cast<uint64_t>( numFaders * ( numUpdates - 1 ) ) && 
+		numPackets > 0 && numPackets < static_cast<size_t>( numFaders );
+	for ( int32_t position : positions ) {
+		passed = passed && position == numUpdates - 1;
+	}
+
+	// parsing doesn't intern, a message for an address that isn't in the table coalesces
+	// by its address, also with a message sent after the address has been interned
+	OscTree fader = OscTree::makeMessage( "/fader/1" );
+	fader.pushBack( OscTree( 7 ) );
+	BufferRef packet = fader.toBuffer();
+	BufferRef renamed = Buffer::create( packet->getSize() );
+	memcpy( renamed->getData(), packet->getData(), packet->getSize() );
+	static_cast<char*>( renamed->getData() )[ 5 ] = 'x';
+	OscTree uninterned( renamed );
+	uint64_t numCoalesced = sendQueue->getNumCoalesced();
+	sendQueue->send( uninterned );
+	sendQueue->send( uninterned );
+	OscAddressTable::get().intern( "/fadex/1" );
+	OscTree interned = OscTree::makeMessage( "/fadex/1" );
+	interned.pushBack( OscTree( 8 ) );
+	sendQueue->send( interned );
+	passed = passed && uninterned.getAddressId() == OscAddressTable::kInvalidId && 
+		sendQueue->getNumPending() == 1 && sendQueue->getNumCoalesced() == numCoalesced + 2;
+	run();
+	passed = passed && positions[ 1 ] == 8;
+
+	// a budget of one bundle holds the rest back to a later flush
+	sendQueue->setMaxBundleSize( 256 );
+	sendQueue->setRateLimit( 4000, 256 );
+	for ( int32_t fader = 0; fader < numFaders; ++fader ) {
+		OscTree message = OscTree::makeMessage( "/fader/" + to_string( fader ) );
+		message.pushBack( OscTree( numUpdates ) );
+		sendQueue->send( message );
+	}
+	sendQueue->flush();
+	passed = passed && sendQueue->getNumPending() > 0 && sendQueue->getNumThrottled() > 0;
+	run();
+	passed = passed && sendQueue->getNumPending() == 0 && positions.back() == numUpdates;
+
+	// a bundle with a time tag goes out whole, neither replacing
+	// nor replaced by messages for the addresses in it
+	sendQueue->setRateLimit( 0, 0 );
+	sendQueue->setMaxBundleSize( 1432 );
+	OscTree scene = OscTree::makeBundle( OscTree::TimeTag( 42 ) );
+	for ( int32_t fader = 0; fader < 2; ++fader ) {
+		OscTree message = OscTree::makeMessage( "/fader/" + to_string( fader ) );
+		message.pushBack( OscTree( -fader - 1 ) );
+		scene.pushBack( message );
+	}
+	OscTree latest = OscTree::makeMessage( "/fader/0" );
+	latest.pushBack( OscTree( numUpdates + 1 ) );
+	sendQueue->send( scene );
+	sendQueue->send( latest );
+	sendQueue->send( scene );
+	passed = passed && sendQueue->getNumPending() == 3;
+	run();
+	passed = passed && scheduled.size() == 2 && positions[ 0 ] == numUpdates + 1;
+	for ( const OscTree& bundle : scheduled ) {
+		passed = passed && bundle.getTimeTag().mTimeTag == 42 && bundle.getChildren().size() == 2 && 
+			bundle.getChildren()[ 1 ].getAddress() == "/fader/1" && bundle.getChildren()[ 1 ].getChildren()[ 0 ].get<int32_t>() == -2;
+	}
+
+	// a scheduled bundle too large to share a packet goes out on its own
+	scheduled.clear();
+	sendQueue->setMaxBundleSize( 64 );
+	sendQueue->send( scene );
+	run();
+	passed = passed && scheduled.size() == 1 && scheduled[ 0 ].getTimeTag().mTimeTag == 42 && scheduled[ 0 ].getChildren().size() == 2;
+
+	sendQueue->close();
+	io.poll();
+
+	string result = "Test send queue ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testReliable()
+{
+	// both directions lose 10% of packets and reorder within 2ms,
+	// acks are lost as often as cues
+	asio::io_service io;
+	OscExecutorRef executor				= OscExecutor::create( io );
+	auto loopback						= OscLoopbackTransport::createPair( executor );
+	OscLossyTransportRef lossySender	= OscLossyTransport::create( loopback.first, 1 );
+	OscLossyTransportRef lossyReceiver	= OscLossyTransport::create( loopback.second, 2 );
+	for ( const OscLossyTransportRef& lossy : { lossySender, lossyReceiver } ) {
+		lossy->setLossProbability( 0.1 );
+		lossy->setLatency( chrono::microseconds( 1000 ), chrono::microseconds( 2000 ) );
+	}
+	OscReliableTransportRef sender		= OscReliableTransport::create( lossySender );
+	OscReliableTransportRef receiver	= OscReliableTransport::create( lossyReceiver );
+
+	const uint8_t numChannels	= 2;
+	const int32_t numCues		= 1000;
+	vector<int32_t> numReceived( numChannels, 0 );
+	size_t numUnreliable		= 0;
+	bool ordered				= true;
+	OscMetrics::Histogram latency;
+	receiver->setReceiveHandler( [ & ]( const BufferRef& packet )
+	{
+		OscTree message( packet );
+		if ( message.getAddress() == "/meter" ) {
+			++numUnreliable;
+			return;
+		}
+
+		uint8_t channel = message.getAddress() == "/cue/0" ? 0 : 1;
+		ordered = ordered && message.getChildren()[ 0 ].get<int32_t>() == numReceived[ channel ];
+		++numReceived[ channel ];
+
+		int64_t sentTime = message.getChildren()[ 1 ].get<int64_t>();
+		latency.record( chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count() - sentTime );
+	} );
+
+	size_t numAcknowledged = 0;
+	auto start = chrono::steady_clock::now();
+	for ( int32_t cue = 0; cue < numCues; ++cue ) {
+		for ( uint8_t channel = 0; channel < numChannels; ++channel ) {
+			OscTree message = OscTree::makeMessage( "/cue/" + to_string( channel ) );
+			message.pushBack( OscTree( cue ) );
+			message.pushBack( OscTree( static_cast<int64_t>( chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count() ) ) );
+			sender->sendReliable( message.toBuffer(), channel, [ & ]( bool acknowledged )
+			{
+				numAcknowledged += acknowledged ? 1 : 0;
+			} );
+		}
+
+		// unreliable traffic shares the socket
+		OscTree meter = OscTree::makeMessage( "/meter" );
+		meter.pushBack( OscTree( 0.5f ) );
+		sender->send( meter.toBuffer() );
+	}
+
+	auto deadline = chrono::steady_clock::now() + chrono::seconds( 10 );
+	while ( numAcknowledged < numChannels * numCues && chrono::steady_clock::now() < deadline ) {
+		io.run_one();
+	}
+	double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+	CI_LOG_I( "Reliable: " << numChannels * numCues / seconds << " cues/s, latency p50 " << latency.getPercentile( 50 ) / 1000 << "us p99 " << 
+		latency.getPercentile( 99 ) / 1000 << "us max " << latency.getMax() / 1000 << "us, " << sender->getNumRetransmits() << " retransmits, " << 
+		lossySender->getNumDropped() + lossyReceiver->getNumDropped() << " dropped, " << receiver->getNumDuplicates() << " duplicates" );
+
+	bool passed = ordered && numAcknowledged == numChannels * numCues && numReceived[ 0 ] == numCues && numReceived[ 1 ] == numCues &&
+		numUnreliable > 0 && numUnreliable < static_cast<size_t>( numCues ) && sender->getNumRetransmits() > 0 && sender->getNumUnacknowledged() == 0;
+
+	sender->close();
+	receiver->close();
+	io.poll();
+
+	string result = "Test reliable ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testPacket()
+{
+	OscTree message = OscTree::makeMessage( "/mixer/fader" );
+	message.pushBack( OscTree( 7 ) );
+	message.pushBack( OscTree( 0.5f ) );
+	message.pushBack( OscTree( string( "master" ) ) );
+
+	// the packet shares the tree's encoding instead of copying it
+	OscPacketRef packet = OscPacket::create( message );
+	bool passed = packet->isMessage() && !packet->isBundle() && packet->getAddress() == "/mixer/fader" && 
+		packet->getTypeTags() == "ifs" && packet->getAddressHash() == OscDispatcher::hashAddress( "/mixer/fader" ) && 
+		packet->getBuffer() == message.toBuffer();
+
+	// changing the tree afterwards leaves the packet as it was
+	message.getChild( 0 ).setValue( 8 );
+	passed = passed && packet->getBuffer() != message.toBuffer() && packet->toTree().getChildren()[ 0 ].get<int32_t>() == 7;
+
+	// any number of threads can hold and read the same packet
+	vector<thread> threads;
+	atomic<int32_t> numValid( 0 );
+	for ( size_t i = 0; i < 4; ++i ) {
+		threads.push_back( thread( [ packet, &numValid ]()
+		{
+			for ( size_t j = 0; j < 1000; ++j ) {
+				OscPacketRef copy = packet;
+				OscTree tree = copy->toTree();
+				if ( tree.getAddress() == "/mixer/fader" && tree.getChildren()[ 2 ].getStringView() == "master" ) {
+					++numValid;
+				}
+			}
+		} ) );
+	}
+	for ( thread& t : threads ) {
+		t.join();
+	}
+	passed = passed && numValid == 4000;
+
+	OscPacketRef bundle = OscPacket::create( OscTree::makeBundle() );
+	passed = passed && bundle->isBundle() && !bundle->isMessage() && bundle->getAddress().empty();
+
+	string result = "Test packet ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testAddressTable()
+{
+	OscAddressTable& table = OscAddressTable::get();
+
+	// parsed and built messages for one address share an ID
+	OscTree message = OscTree::makeMessage( "/light/12/intensity" );
+	message.pushBack( OscTree( 0.75f ) );
+	OscTree parsed( message.toBuffer() );
+	uint32_t id = parsed.getAddressId();
+	bool passed = id != OscAddressTable::kInvalidId && id == message.getAddressId() && 
+		table.getAddress( id ) == "/light/12/intensity" && parsed.getAddress() == "/light/12/intensity" && 
+		table.getHash( id ) == OscDispatcher::hashAddress( "/light/12/intensity" ) && 
+		table.find( "/light/12/intensity" ) == id && table.find( "/light/12/never/sent" ) == OscAddressTable::kInvalidId;
+
+	// threads interning the same addresses at once agree on their IDs,
+	// while the table grows under them
+	const size_t numThreads		= 4;
+	const size_t numAddresses	= 2000;
+	vector<vector<uint32_t>> ids( numThreads, vector<uint32_t>( numAddresses ) );
+	vector<thread> threads;
+	for ( size_t i = 0; i < numThreads; ++i ) {
+		threads.push_back( thread( [ i, &ids ]()
+		{
+			for ( size_t j = 0; j < numAddresses; ++j ) {
+				ids[ i ][ j ] = OscTree::makeMessage( "/grid/" + to_string( ( j * ( i + 1 ) ) % numAddresses ) ).getAddressId();
+			}
+		} ) );
+	}
+	for ( thread& t : threads ) {
+		t.join();
+	}
+	for ( size_t i = 0; i < numThreads; ++i ) {
+		for ( size_t j = 0; j < numAddresses; ++j ) {
+			string address = "/grid/" + to_string( ( j * ( i + 1 ) ) % numAddresses );
+			passed = passed && ids[ i ][ j ] != OscAddressTable::kInvalidId && table.getAddress( ids[ i ][ j ] ) == address && 
+				table.find( address ) == ids[ i ][ j ];
+		}
+	}
+
+	// received addresses are only looked up, so a flood of made up
+	// addresses reaches handlers as strings without filling the table
+	size_t numInterned = table.getNumAddresses();
+	OscBatchDecoder decoder;
+	OscMessageBatch batch;
+	for ( size_t i = 0; i < 1000; ++i ) {
+		string address = "/flood/" + to_string( i );
+		BufferRef packet = Buffer::create( ( ( address.size() + 4 ) & ~static_cast<size_t>( 3 ) ) + 4 );
+		memset( packet->getData(), 0, packet->getSize() );
+		memcpy( packet->getData(), address.c_str(), address.size() );
+		memcpy( static_cast<char*>( packet->getData() ) + packet->getSize() - 4, ",", 1 );
+
+		OscTree flooded( packet );
+		OscPacketRef floodedPacket = OscPacket::create( packet );
+		batch.clear();
+		passed = passed && flooded.isMessage() && flooded.getAddressId() == OscAddressTable::kInvalidId && 
+			flooded.getAddress() == address && floodedPacket->getAddressId() == OscAddressTable::kInvalidId && 
+			decoder.decode( &packet, 1, batch ) == 1 && batch.getAddressId( 0 ) == OscAddressTable::kInvalidId && 
+			batch.getAddress( 0 ) == address;
+	}
+	passed = passed && table.getNumAddresses() == numInterned;
+
+	// past the limit a message keeps its own copy of the address
+	size_t maxAddresses = table.getMaxAddresses();
+	table.setMaxAddresses( table.getNumAddresses() );
+	OscTree unlisted = OscTree::makeMessage( "/not/interned" );
+	unlisted.pushBack( OscTree( 1 ) );
+	OscTree unlistedParsed( unlisted.toBuffer() );
+	passed = passed && unlisted.getAddressId() == OscAddressTable::kInvalidId && unlisted.getAddress() == "/not/interned" && 
+		unlistedParsed.getAddress() == "/not/interned" && unlistedParsed.isMessage();
+	table.setMaxAddresses( maxAddresses );
+
+	string result = "Test address table ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testBatchDecoder()
+{
+	// a wakeup's worth of fader updates, a bundle and a malformed packet
+	vector<BufferRef> packets;
+	for ( int32_t i = 0; i < 62; ++i ) {
+		OscTree message = OscTree::makeMessage( "/fader/" + to_string( i % 8 ) );
+		message.pushBack( OscTree( i ) );
+		message.pushBack( OscTree( i * 0.5f ) );
+		message.pushBack( OscTree( string( "channel" ) ) );
+		packets.push_back( message.toBuffer() );
+	}
+
+	OscTree bundle = OscTree::makeBundle( OscTree::TimeTag( 42 ) );
+	OscTree cue = OscTree::makeMessage( "/cue/go" );
+	array<uint8_t, 5> blob = { 1, 2, 3, 4, 5 };
+	cue.pushBack( OscTree( blob.data(), blob.size() ) );
+	bundle.pushBack( cue );
+	bundle.pushBack( OscTree::makeMessage( "/cue/standby" ) );
+	packets.push_back( bundle.toBuffer() );
+
+	BufferRef malformed = Buffer::create( 8 );
+	memcpy( malformed->getData(), "/bad\0\0\0x", 8 );
+	packets.push_back( malformed );
+
+	OscBatchDecoder decoder;
+	OscMessageBatch batch;
+	size_t numDecoded = decoder.decode( packets, batch );
+
+	bool passed = numDecoded == 63 && batch.getNumPackets() == 64 && batch.getNumMessages() == 64 && 
+		batch.getParseError( 63 ) == OscTree::PARSE_MALFORMED_ADDRESS;
+	for ( size_t i = 0; passed && i < 62; ++i ) {
+		uint32_t argument = batch.getFirstArgument( i );
+		passed = batch.getAddress( i ) == "/fader/" + to_string( i % 8 ) && batch.getPacketIndex( i ) == i && 
+			batch.getTypeTags( i ) == "ifs" && batch.get<int32_t>( argument ) == static_cast<int32_t>( i ) && 
+			batch.get<float>( argument + 1 ) == i * 0.5f && strcmp( reinterpret_cast<const char*>( batch.getArgumentData( argument + 2 ) ), "channel" ) == 0;
+	}
+	passed = passed && batch.getAddress( 62 ) == "/cue/go" && batch.getTimeTag( 62 ).mTimeTag == 42 && batch.getTypeTags( 62 ) == "b" && 
+		batch.getArgumentSize( batch.getFirstArgument( 62 ) ) == blob.size() && 
+		memcmp( batch.getArgumentData( batch.getFirstArgument( 62 ) ), blob.data(), blob.size() ) == 0 && 
+		batch.getAddress( 63 ) == "/cue/standby" && batch.getNumArguments( 63 ) == 0;
+
+	// a message for an address that was never interned keeps its place
+	// without an ID, and the rest of its bundle is still decoded
+	{
+		OscTree mixed = OscTree::makeBundle( OscTree::TimeTag( 7 ) );
+		OscTree known = OscTree::makeMessage( "/fader/1" );
+		known.pushBack( OscTree( 1 ) );
+		mixed.pushBack( known );
+		mixed.pushBack( OscTree::makeMessage( "/fader/1" ) );
+		BufferRef encoded	= mixed.toBuffer();
+		BufferRef packet	= Buffer::create( encoded->getSize() );
+		packet->copyFrom( encoded->getData(), encoded->getSize() );
+
+		// renames the second message to an address of the same length no one interned
+		char* data		= static_cast<char*>( packet->getData() );
+		char* second	= data + packet->getSize() - ( 12 + 4 );
+		passed = passed && memcmp( second, "/fader/1", 8 ) == 0;
+		memcpy( second, "/fader/?", 8 );
+		passed = passed && OscAddressTable::get().find( "/fader/?" ) == OscAddressTable::kInvalidId;
+
+		OscMessageBatch mixedBatch;
+		passed = passed && decoder.decode( &packet, 1, mixedBatch ) == 1 && mixedBatch.getParseError( 0 ) == OscTree::PARSE_OK && 
+			mixedBatch.getNumMessages() == 2 && mixedBatch.getAddressId( 0 ) == OscAddressTable::get().find( "/fader/1" ) && 
+			mixedBatch.get<int32_t>( mixedBatch.getFirstArgument( 0 ) ) == 1 && 
+			mixedBatch.getAddressId( 1 ) == OscAddressTable::kInvalidId && mixedBatch.getAddress( 1 ) == "/fader/?" && 
+			mixedBatch.getTimeTag( 1 ).mTimeTag == 7 && mixedBatch.getNumArguments( 1 ) == 0;
+	}
+
+	// against parsing each packet into a tree
+	const size_t numRounds = 2000;
+	auto start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numRounds; ++i ) {
+		batch.clear();
+		decoder.decode( packets, batch );
+	}
+	auto batchTime = chrono::steady_clock::now() - start;
+
+	size_t numMessages = 0;
+	start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numRounds; ++i ) {
+		for ( const BufferRef& packet : packets ) {
+			OscTree tree( packet );
+			numMessages += tree.isMessage() ? 1 : 0;
+		}
+	}
+	auto treeTime = chrono::steady_clock::now() - start;
+
+	CI_LOG_I( "Batch decode: " << chrono::duration_cast<chrono::nanoseconds>( batchTime ).count() / ( numRounds * packets.size() ) << "ns per packet, " << 
+		chrono::duration_cast<chrono::nanoseconds>( treeTime ).count() / ( numRounds * packets.size() ) << "ns as OscTree" );
+
+	string result = "Test batch decoder ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testColumnarSink()
+{
+	// sensors sending three floats each, with a message the sink should skip
+	vector<BufferRef> packets;
+	for ( int32_t i = 0; i < 64; ++i ) {
+		OscTree message = OscTree::makeMessage( "/sensor/" + to_string( i % 4 ) );
+		message.pushBack( OscTree( i * 1.0f ) );
+		message.pushBack( OscTree( i * 2.0f ) );
+		message.pushBack( OscTree( i * 3.0f ) );
+		packets.push_back( message.toBuffer() );
+	}
+	OscTree other = OscTree::makeMessage( "/sensor/4" );
+	other.pushBack( OscTree( 1 ) );
+	packets.push_back( other.toBuffer() );
+
+	OscBatchDecoder decoder;
+	OscMessageBatch batch;
+	decoder.decode( packets, batch );
+
+	OscColumnarSink sink;
+	size_t sensors = sink.addSignature( "/sensor/*", "fff" );
+	sink.append( batch );
+
+	bool passed = sink.getNumRows( sensors ) == 64;
+	const float* x = sink.getColumn<float>( sensors, 0 );
+	const float* z = sink.getColumn<float>( sensors, 2 );
+	for ( size_t i = 0; passed && i < 64; ++i ) {
+		passed = x[ i ] == i * 1.0f && z[ i ] == i * 3.0f && 
+			OscAddressTable::get().getAddress( sink.getAddressIds( sensors )[ i ] ) == "/sensor/" + to_string( i % 4 );
+	}
+
+	// a peer with the other byte order, swapping twice gets the values back
+	OscColumnarSink swapped( OscColumnarSink::BYTE_ORDER_SWAPPED );
+	swapped.addSignature( "/sensor/*", "fff" );
+	swapped.append( batch );
+	const uint32_t* y = swapped.getColumn<uint32_t>( 0, 1 );
+	for ( size_t i = 0; passed && i < 64; ++i ) {
+		float value = i * 2.0f;
+		uint32_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		passed = y[ i ] == ( ( bits >> 24 ) | ( ( bits >> 8 ) & 0xFF00 ) | ( ( bits << 8 ) & 0xFF0000 ) | ( bits << 24 ) );
+	}
+
+	// as are the time tags of bundles, a message on its own keeps the TimeTag() the decoder gave it
+	OscTree bundle = OscTree::makeBundle( OscTree::TimeTag( 0x0102030405060708ull ) );
+	OscTree bundled = OscTree::makeMessage( "/sensor/0" );
+	for ( size_t i = 0; i < 3; ++i ) {
+		bundled.pushBack( OscTree( 0.0f ) );
+	}
+	bundle.pushBack( bundled );
+	BufferRef bundlePacket = bundle.toBuffer();
+	OscMessageBatch bundleBatch;
+	decoder.decode( &bundlePacket, 1, bundleBatch );
+	swapped.append( bundleBatch );
+	passed = passed && swapped.getNumRows( 0 ) == 65 && swapped.getTimeTags( 0 )[ 0 ] == OscTree::TimeTag().mTimeTag && 
+		swapped.getTimeTags( 0 )[ 64 ] == 0x0807060504030201ull;
+
+	try {
+		sink.addSignature( "/text", "s" );
+		passed = false;
+	} catch ( OscColumnarSink::ExcUnsupportedTypeTag& ) {
+	}
+
+	// decoding into columns, against walking the children of each message
+	const size_t numRounds = 2000;
+	float sum = 0.0f;
+	auto start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numRounds; ++i ) {
+		batch.clear();
+		decoder.decode( packets, batch );
+		sink.clear();
+		sink.append( batch );
+		const float* values = sink.getColumn<float>( sensors, 1 );
+		for ( size_t j = 0; j < sink.getNumRows( sensors ); ++j ) {
+			sum += values[ j ];
+		}
+	}
+	auto sinkTime = chrono::steady_clock::now() - start;
+
+	start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numRounds; ++i ) {
+		for ( const BufferRef& packet : packets ) {
+			OscTree tree( packet );
+			if ( tree.getAddress().compare( 0, 8, "/sensor/" ) == 0 && tree.getChildren().size() == 3 ) {
+				sum += tree.getChildren()[ 1 ].getValue<float>();
+			}
+		}
+	}
+	auto treeTime = chrono::steady_clock::now() - start;
+
+	CI_LOG_I( "Columnar sink: " << chrono::duration_cast<chrono::nanoseconds>( sinkTime ).count() / ( numRounds * packets.size() ) << "ns per message, " << 
+		chrono::duration_cast<chrono::nanoseconds>( treeTime ).count() / ( numRounds * packets.size() ) << "ns parsing as OscTree ( " << sum << " )" );
+
+	string result = "Test columnar sink ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testArchive()
+{
+	bool passed = OscAddressTable::matchPattern( "/mixer/ch/*", "/mixer/ch/12" ) && !OscAddressTable::matchPattern( "/mixer/ch/*", "/mixer/ch/1/mute" ) && 
+		OscAddressTable::matchPattern( "/mixer/ch/[0-3]/{fader,mute}", "/mixer/ch/2/mute" ) && !OscAddressTable::matchPattern( "/mixer/ch/[!0-3]", "/mixer/ch/2" ) && 
+		OscAddressTable::matchPattern( "/*/ch/?", "/mixer/ch/7" );
+
+	// a show's worth of faders and lights, a packet a millisecond, with
+	// every tenth packet a bundle of mutes scheduled a second ahead
+	const uint64_t kMillisecond	= ( 1ull << 32 ) / 1000;
+	const uint64_t start		= OscArchive::toTimeTag( chrono::system_clock::now() ).mTimeTag;
+	const size_t numPackets		= 20000;
+
+	fs::path directory = getTemporaryDirectory() / "OscDevArchive";
+	OscArchiveWriterRef writer = OscArchiveWriter::create( directory, 256 * 1024 );
+	for ( size_t i = 0; i < numPackets; ++i ) {
+		OscTree::TimeTag timeTag( start + i * kMillisecond );
+		if ( i % 10 == 9 ) {
+			OscTree bundle = OscTree::makeBundle( OscTree::TimeTag( timeTag.mTimeTag + 1000 * kMillisecond ) );
+			for ( int32_t channel = 0; channel < 4; ++channel ) {
+				OscTree mute = OscTree::makeMessage( "/mixer/ch/" + to_string( channel ) + "/mute" );
+				mute.pushBack( OscTree( channel ) );
+				bundle.pushBack( mute );
+			}
+			BufferRef buffer = bundle.toBuffer();
+			writer->write( buffer->getData(), buffer->getSize(), timeTag );
+		} else {
+			OscTree message = OscTree::makeMessage( i % 2 == 0 ? "/mixer/ch/" + to_string( i % 16 ) : "/lights/" + to_string( i % 16 ) );
+			message.pushBack( OscTree( static_cast<float>( i ) ) );
+			BufferRef buffer = message.toBuffer();
+			writer->write( buffer->getData(), buffer->getSize(), timeTag );
+		}
+	}
+	size_t numSegments = writer->getNumSegments();
+	passed = passed && writer->getNumPackets() == numPackets && writer->getNumMessages() == numPackets / 10 * 13 && numSegments > 3 && !writer->isFailed();
+	writer.reset();
+
+	// every fader between the 5th and 6th second, without parsing anything else
+	OscTree::TimeTag begin( start + 5000 * kMillisecond );
+	OscTree::TimeTag end( start + 6000 * kMillisecond );
+	OscArchiveReaderRef reader = OscArchiveReader::create( directory );
+	vector<OscArchiveReader::Message> messages;
+	size_t numFound = reader->query( "/mixer/ch/*", begin, end, messages );
+	passed = passed && reader->getNumSegments() == numSegments && reader->getNumIndicesRebuilt() == 0 && 
+		reader->getNumMessages() == numPackets / 10 * 13 && numFound == 500;
+	for ( size_t i = 0; passed && i < messages.size(); ++i ) {
+		OscTree message( messages[ i ].getBuffer() );
+		float value = message.getChildren()[ 0 ].getValue<float>();
+		passed = message.getAddress() == OscAddressTable::get().getAddress( messages[ i ].mAddressId ) && 
+			messages[ i ].mTimeTag.mTimeTag == start + static_cast<uint64_t>( value ) * kMillisecond && 
+			messages[ i ].mTimeTag.mTimeTag >= begin.mTimeTag && messages[ i ].mTimeTag.mTimeTag < end.mTimeTag;
+	}
+
+	// mutes are indexed under their bundle's time tag, a second after they were written
+	messages.clear();
+	numFound = reader->query( "/mixer/ch/0/mute", begin, end, messages );
+	passed = passed && numFound == 100 && messages.front().mTimeTag.mTimeTag == start + 5009 * kMillisecond;
+
+	// a segment that was never sealed is indexed by scanning it
+	reader.reset();
+	fs::remove( OscArchive::getIndexPath( OscArchive::getSegmentPath( directory, 1 ) ) );
+	reader = OscArchiveReader::create( directory );
+	vector<OscArchiveReader::Message> rebuilt;
+	reader->query( "/mixer/ch/*", OscTree::TimeTag( start ), OscTree::TimeTag( start + numPackets * kMillisecond * 2 ), rebuilt );
+	passed = passed && reader->getNumIndicesRebuilt() == 1 && rebuilt.size() == numPackets / 2;
+
+	// as is one with an entry outside its segment or its address table
+	reader.reset();
+	for ( size_t segment = 2; segment < 4; ++segment ) {
+		OscArchive::IndexEntry entry;
+		FILE* file = fopen( OscArchive::getIndexPath( OscArchive::getSegmentPath( directory, segment ) ).string().c_str(), "r+b" );
+		fseek( file, -static_cast<long>( sizeof( entry ) ), SEEK_END );
+		passed = passed && fread( &entry, sizeof( entry ), 1, file ) == 1;
+		if ( segment == 2 ) {
+			entry.mOffset = 1ull << 40;
+		} else {
+			entry.mAddress = 1 << 20;
+		}
+		fseek( file, -static_cast<long>( sizeof( entry ) ), SEEK_END );
+		fwrite( &entry, sizeof( entry ), 1, file );
+		fclose( file );
+	}
+	reader = OscArchiveReader::create( directory );
+	rebuilt.clear();
+	reader->query( "/mixer/ch/*", OscTree::TimeTag( start ), OscTree::TimeTag( start + numPackets * kMillisecond * 2 ), rebuilt );
+	passed = passed && reader->getNumIndicesRebuilt() == 3 && rebuilt.size() == numPackets / 2;
+
+	// bulk writes at capture rate
+	vector<BufferRef> packets;
+	for ( size_t i = 0; i < 1000; ++i ) {
+		OscTree message = OscTree::makeMessage( "/mixer/ch/" + to_string( i % 64 ) );
+		message.pushBack( OscTree( static_cast<float>( i ) ) );
+		packets.push_back( message.toBuffer() );
+	}
+	writer = OscArchiveWriter::create( directory );
+	auto writeStart = chrono::steady_clock::now();
+	for ( size_t i = 0; i < 500; ++i ) {
+		writer->write( packets.data(), packets.size() );
+	}
+	writer.reset();
+	double seconds = chrono::duration_cast<chrono::duration<double>>( chrono::steady_clock::now() - writeStart ).count();
+	CI_LOG_I( "Archive write: " << static_cast<size_t>( 500 * packets.size() / seconds ) << " packets/s" );
+
+	// a segment that can't be opened stops the archive, rather than throwing out of write()
+	fs::path blockedDirectory = getTemporaryDirectory() / "OscDevArchiveBlocked";
+	writer = OscArchiveWriter::create( blockedDirectory, 4096 );
+	fs::create_directories( OscArchive::getSegmentPath( blockedDirectory, 1 ) );
+	for ( size_t i = 0; i < 200; ++i ) {
+		writer->write( packets[ i ] );
+	}
+	writer->flush();
+	passed = passed && writer->isFailed() && fs::exists( OscArchive::getIndexPath( OscArchive::getSegmentPath( blockedDirectory, 0 ) ) );
+	writer.reset();
+	fs::remove_all( blockedDirectory );
+
+	reader.reset();
+	fs::remove_all( directory );
+
+	string result = "Test archive ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testBlobRef()
+{
+	// a video frame, referred to rather than copied into the argument
+	vector<uint8_t> frame( 320 * 240 * 3 );
+	for ( size_t i = 0; i < frame.size(); ++i ) {
+		frame[ i ] = static_cast<uint8_t>( i * 7 );
+	}
+
+	OscTree message = OscTree::makeMessage( "/video/frame" );
+	message.pushBack( OscTree( 7 ) );
+	message.pushBack( OscTree::makeBlobRef( frame.data(), frame.size() ) );
+	message.pushBack( OscTree( string( "rgb" ) ) );
+
+	bool passed = message.getChildren()[ 1 ].isValueRef() && message.getChildren()[ 1 ].getBlobSpan().data() == frame.data();
+
+	// header, frame and trailing arguments, with the frame listed in place
+	vector<OscTree::GatherBuffer> buffers;
+	BufferRef encoded = message.toBuffers( buffers );
+	BufferRef expected = message.toBuffer();
+
+	vector<uint8_t> gathered;
+	for ( const OscTree::GatherBuffer& buffer : buffers ) {
+		gathered.insert( gathered.end(), static_cast<const uint8_t*>( buffer.mData ), static_cast<const uint8_t*>( buffer.mData ) + buffer.mSize );
+	}
+	passed = passed && buffers.size() == 3 && buffers[ 1 ].mData == frame.data() && encoded->getSize() == expected->getSize() - frame.size() && 
+		gathered.size() == expected->getSize() && memcmp( gathered.data(), expected->getData(), gathered.size() ) == 0;
+
+	// a shared buffer is referred to as well, and setting a value never writes into either
+	BufferRef shared = Buffer::create( 64 );
+	memset( shared->getData(), 1, shared->getSize() );
+	OscTree sharedBlob = OscTree::makeBlobRef( shared );
+	vector<uint8_t> zeros( 64, 0 );
+	sharedBlob.setValue( zeros.data(), zeros.size() );
+	passed = passed && static_cast<uint8_t*>( shared->getData() )[ 0 ] == 1 && !sharedBlob.isValueRef();
+
+	// over the network, a frame slice that fits a datagram goes out with one gathering write
+	asio::io_service io;
+	OscExecutorRef executor		= OscExecutor::create( io );
+	OscUdpTransportRef sender	= OscUdpTransport::create( executor );
+	OscUdpTransportRef receiver	= OscUdpTransport::create( executor );
+	sender->connect( "127.0.0.1", receiver->getLocalPort() );
+
+	OscTree slice = OscTree::makeMessage( "/video/slice" );
+	slice.pushBack( OscTree::makeBlobRef( frame.data(), 48 * 1024 ) );
+	slice.pushBack( OscTree( 3 ) );
+
+	bool received = false;
+	receiver->setReceiveHandler( [ & ]( const BufferRef& packet )
+	{
+		OscTree parsed( packet );
+		received = parsed.getParseError() == OscTree::PARSE_OK && parsed.getChildren().size() == 2 && 
+			parsed.getChildren()[ 0 ].getBlobSpan().size() == 48 * 1024 && 
+			memcmp( parsed.getChildren()[ 0 ].getBlobSpan().data(), frame.data(), 48 * 1024 ) == 0 && 
+			parsed.getChildren()[ 1 ].get<int32_t>() == 3;
+	} );
+	sender->send( slice );
+
+	auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+	while ( !received && chrono::steady_clock::now() < deadline ) {
+		io.poll();
+		io.reset();
+	}
+	passed = passed && received;
+
+	sender->close();
+	receiver->close();
+	io.poll();
+
+	// against copying the frame into an argument and then into a packet
+	const size_t numRounds = 200;
+	auto start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numRounds; ++i ) {
+		OscTree copied = OscTree::makeMessage( "/video/frame" );
+		copied.pushBack( OscTree( frame.data(), frame.size() ) );
+		copied.toBuffer();
+	}
+	auto copyTime = chrono::steady_clock::now() - start;
+
+	start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numRounds; ++i ) {
+		OscTree referenced = OscTree::makeMessage( "/video/frame" );
+		referenced.pushBack( OscTree::makeBlobRef( frame.data(), frame.size() ) );
+		referenced.toBuffers( buffers );
+	}
+	auto referenceTime = chrono::steady_clock::now() - start;
+
+	CI_LOG_I( "Blob ref: " << chrono::duration_cast<chrono::microseconds>( referenceTime ).count() / numRounds << "us per frame, " << 
+		chrono::duration_cast<chrono::microseconds>( copyTime ).count() / numRounds << "us copied" );
+
+	string result = "Test blob ref ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testBlobDelta()
+{
+	OscBlobDeltaEncoderRef encoder = OscBlobDeltaEncoder::create();
+	OscBlobDeltaDecoderRef decoder = OscBlobDeltaDecoder::create();
+
+	// a texture where a small patch moves each frame
+	const size_t width = 320, height = 240;
+	vector<uint8_t> frame( width * height * 3, 0 );
+	for ( size_t i = 0; i < frame.size(); ++i ) {
+		frame[ i ] = static_cast<uint8_t>( ( i * 31 ) >> 4 );
+	}
+
+	bool passed = true;
+	size_t numBytesSent = 0;
+	size_t numBytesRaw = 0;
+	chrono::steady_clock::duration encodeTime( 0 );
+	const size_t numFrames = 120;
+	for ( size_t n = 0; n < numFrames; ++n ) {
+		for ( size_t y = 0; y < 16; ++y ) {
+			uint8_t* row = frame.data() + ( ( ( n * 3 + y ) % height ) * width + ( n * 5 ) % ( width - 16 ) ) * 3;
+			for ( size_t x = 0; x < 16 * 3; ++x ) {
+				row[ x ] += 17;
+			}
+		}
+
+		OscTree message = OscTree::makeMessage( "/texture" );
+		message.pushBack( OscTree( static_cast<int32_t>( n ) ) );
+		message.pushBack( OscTree::makeBlobRef( frame.data(), frame.size() ) );
+		numBytesRaw += message.getEncodedSize();
+
+		auto start = chrono::steady_clock::now();
+		encoder->encode( message );
+		BufferRef packet = message.toBuffer();
+		encodeTime += chrono::steady_clock::now() - start;
+		numBytesSent += packet->getSize();
+
+		OscTree received( packet );
+		passed = passed && received.getChildren()[ 1 ].getTypeTag() == OscBlobDelta::kTypeTag && decoder->decode( received );
+		passed = passed && received.getChildren()[ 1 ].getTypeTag() == 'b' && received.getChildren()[ 0 ].get<int32_t>() == static_cast<int32_t>( n ) && 
+			received.getChildren()[ 1 ].getBlobSpan().size() == frame.size() && 
+			memcmp( received.getChildren()[ 1 ].getBlobSpan().data(), frame.data(), frame.size() ) == 0;
+	}
+	passed = passed && encoder->getNumKeyframes() == numFrames / 30 && encoder->getNumDifferences() == numFrames - numFrames / 30 && 
+		numBytesRaw > numBytesSent * 4;
+
+	// against sending each frame whole
+	auto start = chrono::steady_clock::now();
+	for ( size_t n = 0; n < numFrames; ++n ) {
+		OscTree message = OscTree::makeMessage( "/texture" );
+		message.pushBack( OscTree( static_cast<int32_t>( n ) ) );
+		message.pushBack( OscTree( frame.data(), frame.size() ) );
+		message.toBuffer();
+	}
+	auto wholeTime = chrono::steady_clock::now() - start;
+
+	CI_LOG_I( "Blob delta: " << numBytesSent / numFrames << " bytes and " << chrono::duration_cast<chrono::microseconds>( encodeTime ).count() / numFrames << 
+		"us per frame, " << numBytesRaw / numFrames << " bytes and " << chrono::duration_cast<chrono::microseconds>( wholeTime ).count() / numFrames << "us whole" );
+
+	// a lost difference is skipped until the next keyframe
+	OscTree lost = OscTree::makeMessage( "/texture" );
+	lost.pushBack( OscTree( 0 ) );
+	lost.pushBack( OscTree::makeBlobRef( frame.data(), frame.size() ) );
+	encoder->encode( lost );
+	frame[ 0 ] += 1;
+
+	OscTree next = OscTree::makeMessage( "/texture" );
+	next.pushBack( OscTree( 1 ) );
+	next.pushBack( OscTree::makeBlobRef( frame.data(), frame.size() ) );
+	encoder->encode( next );
+	OscTree afterLoss( next.toBuffer() );
+	passed = passed && !decoder->decode( afterLoss ) && decoder->getNumMissed() == 1;
+
+	encoder->forceKeyframes();
+	OscTree keyframe = OscTree::makeMessage( "/texture" );
+	keyframe.pushBack( OscTree( 2 ) );
+	keyframe.pushBack( OscTree::makeBlobRef( frame.data(), frame.size() ) );
+	encoder->encode( keyframe );
+	OscTree recovered( keyframe.toBuffer() );
+	passed = passed && decoder->decode( recovered ) && memcmp( recovered.getChildren()[ 1 ].getBlobSpan().data(), frame.data(), frame.size() ) == 0;
+
+	string result = "Test blob delta ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testOscQuery()
+{
+	asio::io_service io;
+	OscExecutorRef executor = OscExecutor::create( io );
+
+	OscQueryNamespaceRef space = OscQueryNamespace::create();
+	space->addAddress( "/mixer/ch/1/gain", "f", OscQueryNamespace::ACCESS_READ_WRITE, "Channel 1 gain" );
+	space->addAddress( "/mixer/ch/2/gain", "f" );
+	space->addAddress( "/mixer/name", "s", OscQueryNamespace::ACCESS_READ );
+	OscQueryServerRef server = OscQueryServer::create( executor, space, 0, "OscDev", 9000 );
+
+	// a client on the same io_service, read without blocking while the server runs
+	auto connect = [ & ]( asio::ip::tcp::socket& socket )
+	{
+		socket.connect( asio::ip::tcp::endpoint( asio::ip::address_v4::loopback(), server->getPort() ) );
+		socket.non_blocking( true );
+	};
+	auto receive = [ & ]( asio::ip::tcp::socket& socket, string& received, const function<bool()>& isDone )
+	{
+		auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+		while ( !isDone() && chrono::steady_clock::now() < deadline ) {
+			io.poll();
+			io.reset();
+			char data[ 4096 ];
+			asio::error_code error;
+			size_t size = socket.read_some( asio::buffer( data ), error );
+			received.append( data, size );
+		}
+		return isDone();
+	};
+
+	asio::ip::tcp::socket http( io );
+	connect( http );
+	string received;
+	// returns the status line and body of the next response
+	auto get = [ & ]( const string& target, string& body )
+	{
+		asio::write( http, asio::buffer( "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n" ) );
+		size_t headerEnd = string::npos, contentLength = 0;
+		receive( http, received, [ & ]()
+		{
+			headerEnd = received.find( "\r\n\r\n" );
+			if ( headerEnd == string::npos ) {
+				return false;
+			}
+			size_t pos = received.find( "Content-Length: " );
+			contentLength = pos < headerEnd ? stoul( received.substr( pos + 16 ) ) : 0;
+			return received.size() >= headerEnd + 4 + contentLength;
+		} );
+		if ( headerEnd == string::npos ) {
+			return string();
+		}
+		string status = received.substr( 0, received.find( "\r\n" ) );
+		body = received.substr( headerEnd + 4, contentLength );
+		received.erase( 0, headerEnd + 4 + contentLength );
+		return status;
+	};
+
+	bool passed = true;
+	string body, cached, value, hostInfo;
+	passed = passed && get( "/mixer", body ) == "HTTP/1.1 200 OK";
+	passed = passed && body.find( "\"FULL_PATH\":\"/mixer/ch/1/gain\"" ) != string::npos && body.find( "Channel 1 gain" ) != string::npos;
+
+	// nothing changed, the same bytes are sent again without serializing anything
+	size_t numSerialized = space->getNumSerialized();
+	passed = passed && get( "/mixer/", cached ) == "HTTP/1.1 200 OK" && cached == body;
+	passed = passed && space->getNumSerialized() == numSerialized;
+
+	// a value only re-serializes the nodes on its path, the gain, ch/1, ch and mixer
+	OscTree gain = OscTree::makeMessage( "/mixer/ch/1/gain" );
+	gain.pushBack( OscTree( 0.5f ) );
+	passed = passed && space->setValue( gain ) && !space->setValue( OscTree::makeMessage( "/mixer/ch/3/gain" ) );
+	passed = passed && get( "/mixer/ch/1/gain?VALUE", value ) == "HTTP/1.1 200 OK" && value == "{\"VALUE\":[0.5]}";
+	passed = passed && get( "/mixer", body ) == "HTTP/1.1 200 OK" && body.find( "\"VALUE\":[0.5]" ) != string::npos;
+	passed = passed && space->getNumSerialized() == numSerialized + 4;
+
+	passed = passed && get( "/mixer/ch/9", body ) == "HTTP/1.1 404 Not Found";
+	passed = passed && get( "/?HOST_INFO", hostInfo ) == "HTTP/1.1 200 OK" && hostInfo.find( "\"OSC_PORT\":9000" ) != string::npos;
+
+	// the cost of a query served from the cache, and of one after every value changes
+	const size_t numQueries = 1000;
+	auto start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numQueries; ++i ) {
+		passed = passed && space->getJson( "/" ) != nullptr;
+	}
+	chrono::steady_clock::duration cachedTime = chrono::steady_clock::now() - start;
+	start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numQueries; ++i ) {
+		gain.getChild( 0 ).setValue( static_cast<float>( i ) );
+		space->setValue( gain );
+		passed = passed && space->getJson( "/" ) != nullptr;
+	}
+	chrono::steady_clock::duration changedTime = chrono::steady_clock::now() - start;
+	CI_LOG_V( "OSCQuery: " << chrono::duration_cast<chrono::nanoseconds>( cachedTime ).count() / numQueries << "ns per cached query, "
+		<< chrono::duration_cast<chrono::nanoseconds>( changedTime ).count() / numQueries << "ns after a change" );
+
+	// a WebSocket client, with the key and accept from RFC 6455
+	asio::ip::tcp::socket ws( io );
+	connect( ws );
+	string frames;
+	asio::write( ws, asio::buffer( string( "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n" ) ) );
+	passed = passed && receive( ws, frames, [ & ]() { return frames.find( "\r\n\r\n" ) != string::npos; } );
+	passed = passed && frames.find( "HTTP/1.1 101" ) == 0 && frames.find( "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n" ) != string::npos;
+	frames.erase( 0, frames.find( "\r\n\r\n" ) + 4 );
+
+	auto sendFrame = [ & ]( uint8_t opcode, const string& payload )
+	{
+		const uint8_t mask[ 4 ] = { 0x12, 0x34, 0x56, 0x78 };
+		string frame;
+		frame += static_cast<char>( 0x80 | opcode );
+		frame += static_cast<char>( 0x80 | payload.size() );
+		frame.append( reinterpret_cast<const char*>( mask ), 4 );
+		for ( size_t i = 0; i < payload.size(); ++i ) {
+			frame += static_cast<char>( payload[ i ] ^ mask[ i % 4 ] );
+		}
+		asio::write( ws, asio::buffer( frame ) );
+	};
+
+	// the pong says the command ahead of it has been handled
+	sendFrame( 0x1, "{ \"COMMAND\": \"LISTEN\", \"DATA\": \"/mixer/ch/1/gain\" }" );
+	sendFrame( 0x9, "ping" );
+	passed = passed && receive( ws, frames, [ & ]() { return frames.size() >= 6; } ) && frames == "\x8A\x04ping";
+	frames.clear();
+
+	size_t numPushed = server->getNumPushed();
+	gain.getChild( 0 ).setValue( 0.25f );
+	space->setValue( gain );
+	OscTree other = OscTree::makeMessage( "/mixer/ch/2/gain" );
+	other.pushBack( OscTree( 0.125f ) );
+	space->setValue( other );
+
+	passed = passed && receive( ws, frames, [ & ]() { return frames.size() >= 2 && frames.size() >= 2 + static_cast<uint8_t>( frames[ 1 ] ); } );
+	if ( passed && static_cast<uint8_t>( frames[ 0 ] ) == 0x82 ) {
+		BufferRef packet = Buffer::create( static_cast<uint8_t>( frames[ 1 ] ) );
+		memcpy( packet->getData(), frames.data() + 2, packet->getSize() );
+		OscTree pushed( packet );
+		passed = pushed.getAddress() == "/mixer/ch/1/gain" && pushed.getChildren().size() == 1 && pushed.getChildren()[ 0 ].get<float>() == 0.25f;
+	} else {
+		passed = false;
+	}
+	passed = passed && server->getNumPushed() == numPushed + 1;
+
+	// a client sets a value by sending the message
+	other.getChild( 0 ).setValue( 0.75f );
+	BufferRef otherPacket = other.toBuffer();
+	sendFrame( 0x2, string( static_cast<const char*>( otherPacket->getData() ), otherPacket->getSize() ) );
+	sendFrame( 0x9, "" );
+	frames.clear();
+	passed = passed && receive( ws, frames, [ & ]() { return frames.size() >= 2; } );
+	passed = passed && get( "/mixer/ch/2/gain?VALUE", value ) == "HTTP/1.1 200 OK" && value == "{\"VALUE\":[0.75]}";
+
+	// values set faster than they're sent are coalesced, the first goes out and the
+	// rest replace each other in the queue behind it until the newest is sent
+	auto getPushed = [ & ]( size_t offset )
+	{
+		BufferRef packet = Buffer::create( static_cast<uint8_t>( frames[ offset + 1 ] ) );
+		memcpy( packet->getData(), frames.data() + offset + 2, packet->getSize() );
+		OscTree pushed( packet );
+		return pushed.getChildren().size() == 1 ? pushed.getChildren()[ 0 ].get<float>() : 0.0f;
+	};
+	numPushed = server->getNumPushed();
+	for ( size_t i = 1; i <= 100; ++i ) {
+		gain.getChild( 0 ).setValue( static_cast<float>( i ) );
+		space->setValue( gain );
+	}
+	frames.clear();
+	passed = passed && receive( ws, frames, [ & ]() { return frames.size() >= 60; } ) && frames.size() == 60;
+	passed = passed && getPushed( 0 ) == 1.0f && getPushed( 30 ) == 100.0f;
+	passed = passed && server->getNumPushed() == numPushed + 2;
+
+	// headers that never end are cut off instead of buffered
+	asio::ip::tcp::socket flood( io );
+	connect( flood );
+	string header = "GET / HTTP/1.1\r\nX-Padding: " + string( 1 << 20, 'a' );
+	size_t numSent = 0;
+	bool isClosed = false;
+	auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+	while ( !isClosed && chrono::steady_clock::now() < deadline ) {
+		io.poll();
+		io.reset();
+		asio::error_code error;
+		if ( numSent < header.size() ) {
+			numSent += flood.write_some( asio::buffer( header.data() + numSent, header.size() - numSent ), error );
+		}
+		if ( !error || error == asio::error::would_block ) {
+			char data[ 256 ];
+			flood.read_some( asio::buffer( data ), error );
+		}
+		isClosed = error && error != asio::error::would_block;
+	}
+	passed = passed && isClosed;
+
+	// connections still open don't keep the server alive, releasing it closes them
+	weak_ptr<OscQueryServer> weakServer = server;
+	server.reset();
+	io.poll();
+	io.reset();
+	passed = passed && weakServer.expired();
+	asio::error_code error;
+	deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+	while ( error != asio::error::eof && chrono::steady_clock::now() < deadline ) {
+		char data[ 256 ];
+		ws.read_some( asio::buffer( data ), error );
+	}
+	passed = passed && error == asio::error::eof;
+
+	string result = "Test osc query ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testWriter()
+{
+	bool passed = true;
+
+	// the same bytes as the tree, without a single allocation
+	OscTree tree = OscTree::makeMessage( "/synth/voice/1" );
+	tree.pushBack( OscTree( 60 ) );
+	tree.pushBack( OscTree( 0.8f ) );
+	tree.pushBack( OscTree( string( "saw" ) ) );
+	tree.pushBack( OscTree( static_cast<int64_t>( 1 ) << 40 ) );
+	tree.pushBack( OscTree( static_cast<OscTree::TypeTag>( 'T' ) ) );
+	const uint8_t blob[ 5 ] = { 1, 2, 3, 4, 5 };
+	tree.pushBack( OscTree( blob, sizeof( blob ) ) );
+	tree.pushBack( OscTree( 0.25 ) );
+	BufferRef expected = tree.toBuffer();
+
+	OscWriter<256> writer;
+	writer.address( "/synth/voice/1" ).i( 60 ).f( 0.8f ).s( "saw" ).h( static_cast<int64_t>( 1 ) << 40 ).boolean( true ).b( blob, sizeof( blob ) ).d( 0.25 );
+	passed = passed && writer.finish() && writer.getSize() == expected->getSize() &&
+		memcmp( writer.getData(), expected->getData(), expected->getSize() ) == 0;
+
+	// a bundle of messages, read back by the parser
+	OscWriter<512> bundleWriter;
+	bundleWriter.bundle( OscTree::TimeTag( 42 ) );
+	for ( int32_t i = 0; i < 8; ++i ) {
+		bundleWriter.address( "/meter" ).i( i ).f( i * 0.5f );
+	}
+	passed = passed && bundleWriter.finish();
+	BufferRef packet = Buffer::create( bundleWriter.getSize() );
+	memcpy( packet->getData(), bundleWriter.getData(), bundleWriter.getSize() );
+	OscTree parsed( packet );
+	passed = passed && parsed.getParseError() == OscTree::PARSE_OK && parsed.isBundle() && parsed.getTimeTag().mTimeTag == 42 && parsed.getChildren().size() == 8;
+	for ( size_t i = 0; passed && i < parsed.getChildren().size(); ++i ) {
+		const OscTree& message = parsed.getChildren()[ i ];
+		passed = message.getAddress() == "/meter" && message.getChildren().size() == 2 &&
+			message.getChildren()[ 0 ].get<int32_t>() == static_cast<int32_t>( i ) && message.getChildren()[ 1 ].get<float>() == i * 0.5f;
+	}
+
+	// running out of room fails every time at the same place, and nothing after it succeeds
+	OscWriter<32> small;
+	small.address( "/x" ).i( 1 ).i( 2 ).i( 3 ).i( 4 );
+	passed = passed && !small.hasFailed();
+	small.i( 5 );
+	passed = passed && small.hasFailed() && !small.finish() && small.getSize() == 0;
+	small.address( "/x" ).i( 1 ).i( 2 ).i( 3 ).i( 4 ).f( 5.0f );
+	passed = passed && !small.finish();
+	small.address( "/x" ).i( 1 ).i( 2 ).i( 3 ).i( 4 );
+	passed = passed && small.finish() && small.getSize() == 4 + 8 + 16;
+	OscWriter<32> noAddress;
+	passed = passed && !noAddress.i( 1 ).finish();
+
+	const size_t numMessages = 100000;
+	auto start = chrono::steady_clock::now();
+	size_t numBytes = 0;
+	for ( size_t n = 0; n < numMessages; ++n ) {
+		OscTree message = OscTree::makeMessage( "/synth/voice/1" );
+		message.pushBack( OscTree( static_cast<int32_t>( n ) ) );
+		message.pushBack( OscTree( 0.8f ) );
+		message.pushBack( OscTree( string( "saw" ) ) );
+		numBytes += message.toBuffer()->getSize();
+	}
+	chrono::steady_clock::duration treeTime = chrono::steady_clock::now() - start;
+	start = chrono::steady_clock::now();
+	for ( size_t n = 0; n < numMessages; ++n ) {
+		writer.address( "/synth/voice/1" ).i( static_cast<int32_t>( n ) ).f( 0.8f ).s( "saw" ).finish();
+		numBytes -= writer.getSize();
+	}
+	chrono::steady_clock::duration writerTime = chrono::steady_clock::now() - start;
+	passed = passed && numBytes == 0;
+	CI_LOG_V( "Writer: " << chrono::duration_cast<chrono::nanoseconds>( writerTime ).count() / numMessages << "ns per message, "
+		<< chrono::duration_cast<chrono::nanoseconds>( treeTime ).count() / numMessages << "ns with a tree" );
+
+	string result = "Test writer ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testTrace()
+{
+	OscTrace& trace = OscTrace::get();
+	trace.reset();
+	trace.setEnabled( true );
+
+	asio::io_service io;
+	OscExecutorRef executor = OscExecutor::create( io );
+	OscDispatcherRef dispatcher = OscDispatcher::create( 2 );
+	atomic<size_t> numHandled( 0 );
+	dispatcher->addHandler( "/trace/level", [ &numHandled ]( const OscTree& message )
+	{
+		// a handler with some work to show up in the trace
+		float level = message.getChildren()[ 0 ].get<float>();
+		for ( int i = 0; i < 1000; ++i ) {
+			level = sqrt( level + 1.0f );
+		}
+		numHandled += level > 0.0f ? 1 : 0;
+	} );
+
+	OscUdpTransportRef sender	= OscUdpTransport::create( executor );
+	OscUdpTransportRef receiver	= OscUdpTransport::create( executor );
+	sender->connect( "127.0.0.1", receiver->getLocalPort() );
+	receiver->setReceiveHandler( [ dispatcher ]( const BufferRef& packet )
+	{
+		dispatcher->dispatch( OscTree( packet ) );
+	} );
+
+	const size_t numPackets = 500;
+	for ( size_t i = 0; i < numPackets; ++i ) {
+		OscTree message = OscTree::makeMessage( "/trace/level" );
+		message.pushBack( OscTree( static_cast<float>( i ) ) );
+		sender->send( message.toBuffer() );
+		io.poll();
+		io.reset();
+	}
+
+	auto deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+	while ( numHandled < numPackets && chrono::steady_clock::now() < deadline ) {
+		io.poll();
+		io.reset();
+	}
+	dispatcher->waitUntilIdle();
+	trace.setEnabled( false );
+
+	// every stage of every packet, in order
+	OscTrace::Summary summary = trace.summarize();
+	CI_LOG_V( summary.toString() );
+	bool passed = numHandled == numPackets && summary.mNumPackets == numPackets &&
+		summary.mParse.getCount() == numPackets && summary.mQueue.getCount() == numPackets &&
+		summary.mHandler.getCount() == numPackets && summary.mTotal.getCount() == numPackets;
+	passed = passed && summary.mTotal.getPercentile( 50.0 ) >= summary.mHandler.getPercentile( 50.0 ) &&
+		summary.mTotal.getPercentile( 50.0 ) <= summary.mTotal.getPercentile( 99.0 );
+
+	vector<OscTrace::Event> events = trace.collect();
+	passed = passed && events.size() == numPackets * ( OscTrace::STAGE_COUNT + 1 );
+
+	string json = trace.toChromeTrace();
+	passed = passed && json.find( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" ) == 0 && json.find( "\"name\":\"queue\"" ) != string::npos &&
+		json.find( "\"name\":\"thread_name\"" ) != string::npos && json.substr( json.size() - 2 ) == "]}";
+	CI_LOG_V( "Trace: " << events.size() << " events, " << json.size() << " bytes of trace JSON" );
+
+	// packets received while tracing is off leave nothing behind
+	trace.reset();
+	OscTree message = OscTree::makeMessage( "/trace/level" );
+	message.pushBack( OscTree( 1.0f ) );
+	sender->send( message.toBuffer() );
+	deadline = chrono::steady_clock::now() + chrono::seconds( 2 );
+	while ( numHandled < numPackets + 1 && chrono::steady_clock::now() < deadline ) {
+		io.poll();
+		io.reset();
+	}
+	dispatcher->waitUntilIdle();
+	passed = passed && numHandled == numPackets + 1 && trace.collect().empty();
+
+	sender->close();
+	receiver->close();
+	io.poll();
+
+	string result = "Test trace ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testLoadGenerator()
+{
+	OscLoadGenerator::Options options = OscLoadGenerator::Options::parse( { "OscDev", "--load", "--rate=5000", "--duration=0.2",
+		"--addresses=1000", "--arguments=1-6", "--types=ifhdsbTN", "--strings=4-32", "--blobs=16-512", "--bundle-depth=2", "--bundle-size=3" } );
+	bool passed = options.mRate == 5000.0 && options.mDuration == 0.2 && options.mNumAddresses == 1000 && options.mMinArguments == 1 &&
+		options.mMaxArguments == 6 && options.mTypeTags == "ifhdsbTN" && options.mMinBlobSize == 16 && options.mMaxBlobSize == 512 &&
+		options.mBundleDepth == 2 && options.mBundleSize == 3;
+
+	// bad options are reported rather than ignored
+	for ( const string& arg : { "--rate=fast", "--arguments=8-1", "--types=ix", "--unknown=1" } ) {
+		try {
+			OscLoadGenerator::Options::parse( { arg } );
+			passed = false;
+		} catch ( const OscLoadGenerator::ExcInvalidOption& ) {
+		}
+	}
+
+	// packets parse, and carry their sequence number and due time in the first message
+	OscLoadGeneratorRef generator = OscLoadGenerator::create( options );
+	OscTree packet( generator->makePacket( 42, 1234 ) );
+	passed = passed && packet.getParseError() == OscTree::PARSE_OK && packet.isBundle() && packet.getChildren().size() == 3 &&
+		packet.getChildren()[ 0 ].isBundle() && packet.getChildren()[ 0 ].getChildren()[ 0 ].isMessage();
+	if ( passed ) {
+		const OscTree& first = packet.getChildren()[ 0 ].getChildren()[ 0 ];
+		passed = first.getChildren()[ 0 ].get<int64_t>() == 42 && first.getChildren()[ 1 ].get<int64_t>() == 1234 &&
+			first.getAddress().find( "/load/" ) == 0;
+	}
+
+	// a modest rate over loopback loses nothing
+	OscLoadGenerator::Report report = generator->run();
+	CI_LOG_V( report.toString() );
+	passed = passed && report.mNumSent > 500 && report.mNumSent <= 1001 && report.getNumLost() == 0 && report.mNumInvalid == 0 &&
+		report.mLatency.getCount() == report.mNumReceived && report.mNumBytesReceived == report.mNumBytesSent;
+
+	// as fast as possible, only logged as loss depends on the machine
+	OscLoadGenerator::Options maxOptions;
+	maxOptions.mRate		= 0.0;
+	maxOptions.mDuration	= 0.2;
+	OscLoadGenerator::Report maxReport = OscLoadGenerator::create( maxOptions )->run();
+	CI_LOG_V( maxReport.toString() );
+	passed = passed && maxReport.mNumSent > 0 && maxReport.mNumReceived > 0 && maxReport.mNumInvalid == 0;
+
+	string result = "Test load generator ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testLazyParse()
+{
+	vector<uint8_t> blob( 1024 * 1024 );
+	for ( size_t i = 0; i < blob.size(); ++i ) {
+		blob[ i ] = static_cast<uint8_t>( i * 7 );
+	}
+	OscTree message = OscTree::makeMessage( "/lazy/frame" );
+	message.pushBack( OscTree( 42 ) );
+	message.pushBack( OscTree( string( "frame" ) ) );
+	message.pushBack( OscTree( blob.data(), blob.size() ) );
+	message.pushBack( OscTree( 0.5 ) );
+	message.pushBack( OscTree( static_cast<OscTree::TypeTag>( 'T' ) ) );
+	BufferRef packet = message.toBuffer();
+
+	// only the header is read until the arguments are asked for
+	OscTree lazy( packet, OscTree::PARSE_LAZY );
+	bool passed = lazy.getParseError() == OscTree::PARSE_OK && lazy.isMessage() && lazy.getAddress() == "/lazy/frame" &&
+		lazy.hasChildren() && lazy.getNumChildren() == 5;
+	passed = passed && lazy.getChild( 0 ).get<int32_t>() == 42 && lazy.getChild( 1 ).get<OscTree::StringView>() == "frame" &&
+		lazy.getChild( 3 ).get<double>() == 0.5 && lazy.getChild( 4 ).get<bool>() && lazy.getChildren().size() == 5;
+
+	// values refer to the packet instead of copying it
+	const uint8_t* packetBegin	= static_cast<const uint8_t*>( packet->getData() );
+	OscTree::BlobSpan span		= lazy.getChild( 2 ).get<OscTree::BlobSpan>();
+	passed = passed && span.size() == blob.size() && memcmp( span.data(), blob.data(), blob.size() ) == 0 &&
+		span.data() > packetBegin && span.data() < packetBegin + packet->getSize() && lazy.getChild( 2 ).isValueRef();
+
+	// changing a value copies it, the packet is left alone
+	BufferRef original = Buffer::create( packet->getSize() );
+	original->copyFrom( packet->getData(), packet->getSize() );
+	lazy.getChild( 0 ).setValue( 43 );
+	lazy.getChild( 1 ).setValue( string( "frames" ) );
+	passed = passed && memcmp( packet->getData(), original->getData(), packet->getSize() ) == 0 && !lazy.getChild( 1 ).isValueRef();
+	message.getChild( 0 ).setValue( 43 );
+	message.getChild( 1 ).setValue( string( "frames" ) );
+	BufferRef expected	= message.toBuffer();
+	BufferRef encoded	= lazy.toBuffer();
+	passed = passed && encoded->getSize() == expected->getSize() && memcmp( encoded->getData(), expected->getData(), expected->getSize() ) == 0;
+
+	// bundles are built a level at a time, and encode like an eagerly parsed tree
+	OscTree bundle = OscTree::makeBundle( OscTree::TimeTag( 99 ) );
+	for ( int i = 0; i < 3; ++i ) {
+		OscTree inner = OscTree::makeBundle();
+		for ( int j = 0; j < 4; ++j ) {
+			OscTree element = OscTree::makeMessage( "/lazy/" + to_string( i ) + "/" + to_string( j ) );
+			element.pushBack( OscTree( i * 4 + j ) );
+			element.pushBack( OscTree( static_cast<float>( j ) ) );
+			inner.pushBack( element );
+		}
+		bundle.pushBack( inner );
+	}
+	BufferRef bundlePacket = bundle.toBuffer();
+	OscTree lazyBundle( bundlePacket, OscTree::PARSE_LAZY );
+	passed = passed && lazyBundle.isBundle() && lazyBundle.getTimeTag().mTimeTag == 99 && lazyBundle.getNumChildren() == 3;
+	passed = passed && lazyBundle.getChild( 1 ).getNumChildren() == 4 && lazyBundle.getChild( 1 ).getChild( 2 ).getAddress() == "/lazy/1/2" &&
+		lazyBundle.getChild( 1 ).getChild( 2 ).getNumChildren() == 2 && lazyBundle.getChild( 1 ).getChild( 2 ).getChild( 0 ).get<int32_t>() == 6 &&
+		&lazyBundle.getChild( 1 ).getChild( 2 ).getParent() == &lazyBundle.getChild( 1 );
+	OscTree copy = lazyBundle;
+	BufferRef bundleEncoded = copy.toBuffer();
+	passed = passed && bundleEncoded->getSize() == bundlePacket->getSize() &&
+		memcmp( bundleEncoded->getData(), bundlePacket->getData(), bundlePacket->getSize() ) == 0;
+	lazyBundle.materialize();
+	passed = passed && lazyBundle.getChild( 2 ).getChild( 3 ).getChild( 1 ).get<float>() == 3.0f;
+
+	// errors are found by the scan, and children up to them are kept as with an eager parse
+	BufferRef truncated = Buffer::create( expected->getSize() - 8 );
+	truncated->copyFrom( expected->getData(), truncated->getSize() );
+	OscTree eagerTruncated( truncated );
+	OscTree lazyTruncated( truncated, OscTree::PARSE_LAZY );
+	passed = passed && eagerTruncated.getParseError() == OscTree::PARSE_TRUNCATED && lazyTruncated.getParseError() == OscTree::PARSE_TRUNCATED &&
+		lazyTruncated.getNumChildren() == eagerTruncated.getChildren().size() && lazyTruncated.getChildren().size() == 3;
+	BufferRef badBundle = Buffer::create( bundlePacket->getSize() );
+	badBundle->copyFrom( bundlePacket->getData(), bundlePacket->getSize() );
+	static_cast<char*>( badBundle->getData() )[ 16 + 4 + 16 + 4 ] = '#';
+	OscTree lazyBad( badBundle, OscTree::PARSE_LAZY );
+	OscTree eagerBad( badBundle );
+	passed = passed && lazyBad.getParseError() != OscTree::PARSE_OK && lazyBad.getParseError() == eagerBad.getParseError() &&
+		lazyBad.getNumChildren() == eagerBad.getChildren().size();
+
+	// routing on the address costs a header scan, however large the arguments
+	const size_t numIterations = 200;
+	auto start = chrono::steady_clock::now();
+	uint32_t checksum = 0;
+	for ( size_t i = 0; i < numIterations; ++i ) {
+		checksum += OscTree( packet ).getAddressId();
+	}
+	auto eager = chrono::steady_clock::now() - start;
+	start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numIterations; ++i ) {
+		checksum += OscTree( packet, OscTree::PARSE_LAZY ).getAddressId();
+	}
+	auto lazyElapsed = chrono::steady_clock::now() - start;
+	CI_LOG_V( "Parse 1MB message eager: " << chrono::duration_cast<chrono::nanoseconds>( eager ).count() / numIterations << "ns lazy: " <<
+		chrono::duration_cast<chrono::nanoseconds>( lazyElapsed ).count() / numIterations << "ns " << checksum );
+	passed = passed && lazyElapsed < eager;
+
+	// a dispatcher reads lazily parsed bundles from its workers
+	OscDispatcherRef dispatcher = OscDispatcher::create( 2 );
+	atomic<int> sum( 0 );
+	for ( int i = 0; i < 3; ++i ) {
+		for ( int j = 0; j < 4; ++j ) {
+			auto handler = [ &sum ]( const OscTree& element ) { sum += element.getChildren()[ 0 ].get<int32_t>(); };
+			dispatcher->addHandler( "/lazy/" + to_string( i ) + "/" + to_string( j ), handler );
+			dispatcher->addHandler( "/lazy/" + to_string( i ) + "/" + to_string( j ), handler, OscDispatcher::UNORDERED );
+		}
+	}
+	for ( int k = 0; k < 100; ++k ) {
+		dispatcher->dispatch( OscTree( bundlePacket, OscTree::PARSE_LAZY ) );
+	}
+	dispatcher->waitUntilIdle();
+	passed = passed && sum == 100 * 2 * 66;
+
+	// threads reading the same lazily parsed tree share building it
+	shared_ptr<const OscTree> shared	= make_shared<OscTree>( bundlePacket, OscTree::PARSE_LAZY );
+	BufferRef expectedPacket			= OscTree( bundlePacket ).toBuffer();
+	atomic<size_t> numMatching( 0 );
+	vector<thread> threads;
+	for ( size_t i = 0; i < 4; ++i ) {
+		threads.push_back( thread( [ & ]()
+		{
+			OscTree copy( *shared );
+			BufferRef encoded = shared->toBuffer();
+			bool matches = encoded->getSize() == expectedPacket->getSize() && memcmp( encoded->getData(), expectedPacket->getData(), expectedPacket->getSize() ) == 0 &&
+				copy.toBuffer()->getSize() == expectedPacket->getSize() && copy.getNumChildren() == shared->getChildren().size();
+			numMatching += matches ? 1 : 0;
+		} ) );
+	}
+	for ( auto& thread : threads ) {
+		thread.join();
+	}
+	passed = passed && numMatching == threads.size();
+
+	string result = "Test lazy parse ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testValidate()
+{
+	OscTree message = OscTree::makeMessage( "/validate" );
+	message.pushBack( OscTree( 7 ) );
+	message.pushBack( OscTree( string( "hello" ) ) );
+	uint8_t bytes[] = { 1, 2, 3, 4, 5 };
+	message.pushBack( OscTree( bytes, sizeof( bytes ) ) );
+	message.pushBack( OscTree( 2.5f ) );
+	BufferRef canonical = message.toBuffer();
+
+	OscTree::Validation validation = OscTree::validate( canonical->getData(), canonical->getSize() );
+	bool passed = validation.isValid() && validation.isCanonical() && validation.mNumMessages == 1 && sizeof( OscTree::Validation ) <= 12;
+
+	// the string starts after the address, type tags and int, 24 bytes in, the blob after the string
+	const size_t stringPadding	= 24 + 6;
+	const size_t blobPadding	= 24 + 8 + 4 + 5;
+	BufferRef padded = Buffer::create( canonical->getSize() );
+	padded->copyFrom( canonical->getData(), canonical->getSize() );
+	static_cast<char*>( padded->getData() )[ stringPadding ]	= 'x';
+	static_cast<char*>( padded->getData() )[ blobPadding + 2 ]	= 'y';
+
+	// the parser accepts argument padding that isn't zero, canonicalizing zeroes it
+	validation = OscTree::validate( padded->getData(), padded->getSize() );
+	passed = passed && validation.isValid() && validation.mHasNonZeroPadding && !validation.isCanonical() &&
+		OscTree( padded ).getParseError() == OscTree::PARSE_OK;
+	validation = OscTree::canonicalize( padded->getData(), padded->getSize() );
+	passed = passed && validation.isCanonical() && memcmp( padded->getData(), canonical->getData(), canonical->getSize() ) == 0;
+
+	// but not after the address or type tags, canonicalizing makes the packet parse
+	static_cast<char*>( padded->getData() )[ 11 ] = 'z';
+	validation = OscTree::validate( padded->getData(), padded->getSize() );
+	passed = passed && validation.mError == OscTree::PARSE_MALFORMED_ADDRESS && validation.mErrorOffset == 10 &&
+		OscTree( padded ).getParseError() == OscTree::PARSE_MALFORMED_ADDRESS;
+	validation = OscTree::canonicalize( padded->getData(), padded->getSize() );
+	passed = passed && validation.isCanonical() && OscTree( padded ).getChildren().size() == 4;
+
+	// bytes after the arguments are allowed, but aren't canonical
+	BufferRef stray = Buffer::create( canonical->getSize() + 4 );
+	memset( stray->getData(), 0, stray->getSize() );
+	memcpy( stray->getData(), canonical->getData(), canonical->getSize() );
+	validation = OscTree::validate( stray->getData(), stray->getSize() );
+	passed = passed && validation.isValid() && validation.mHasStrayBytes && !validation.isCanonical();
+
+	OscTree bundle = OscTree::makeBundle();
+	for ( int i = 0; i < 4; ++i ) {
+		OscTree inner = OscTree::makeBundle();
+		inner.pushBack( message );
+		inner.pushBack( message );
+		bundle.pushBack( inner );
+	}
+	bundle.pushBack( message );
+	BufferRef bundlePacket = bundle.toBuffer();
+	validation = OscTree::validate( bundlePacket->getData(), bundlePacket->getSize() );
+	passed = passed && validation.isCanonical() && validation.mNumMessages == 9;
+
+	// validated packets parse to the same trees without the checks
+	OscTree validated( bundlePacket, OscTree::PARSE_VALIDATED );
+	OscTree validatedLazy( bundlePacket, OscTree::PARSE_LAZY | OscTree::PARSE_VALIDATED );
+	passed = passed && validatedLazy.getNumChildren() == 5 && validatedLazy.getChild( 2 ).getNumChildren() == 2 &&
+		validatedLazy.getChild( 2 ).getChild( 1 ).getNumChildren() == 4 && validatedLazy.getChild( 4 ).getChild( 1 ).get<OscTree::StringView>() == "hello";
+	BufferRef encoded		= validated.toBuffer();
+	BufferRef encodedLazy	= validatedLazy.toBuffer();
+	passed = passed && encoded->getSize() == bundlePacket->getSize() && memcmp( encoded->getData(), bundlePacket->getData(), bundlePacket->getSize() ) == 0 &&
+		encodedLazy->getSize() == bundlePacket->getSize() && memcmp( encodedLazy->getData(), bundlePacket->getData(), bundlePacket->getSize() ) == 0;
+
+	// damaged packets get the verdict the parser reaches
+	mt19937 random( 49 );
+	BufferRef damaged = Buffer::create( bundlePacket->getSize() );
+	size_t numMatching = 0;
+	const size_t numDamaged = 5000;
+	for ( size_t i = 0; i < numDamaged; ++i ) {
+		damaged->resize( bundlePacket->getSize() );
+		damaged->copyFrom( bundlePacket->getData(), bundlePacket->getSize() );
+		char* data = static_cast<char*>( damaged->getData() );
+		for ( size_t j = random() % 3; j < 3; ++j ) {
+			data[ random() % damaged->getSize() ] = static_cast<char>( random() % 4 == 0 ? random() : random() % 8 );
+		}
+		if ( random() % 4 == 0 ) {
+			damaged->resize( random() % damaged->getSize() );
+		}
+		validation = OscTree::validate( damaged->getData(), damaged->getSize() );
+		OscTree tree( damaged );
+		numMatching += validation.mError == tree.getParseError() ? 1 : 0;
+	}
+	passed = passed && numMatching == numDamaged;
+
+	// the prefilter pays for itself with a lazy parse
+	const size_t numIterations = 20000;
+	auto start = chrono::steady_clock::now();
+	size_t numChildren = 0;
+	for ( size_t i = 0; i < numIterations; ++i ) {
+		numChildren += OscTree( bundlePacket ).getChildren().size();
+	}
+	auto eager = chrono::steady_clock::now() - start;
+	start = chrono::steady_clock::now();
+	for ( size_t i = 0; i < numIterations; ++i ) {
+		if ( OscTree::validate( bundlePacket->getData(), bundlePacket->getSize() ).isValid() ) {
+			numChildren += OscTree( bundlePacket, OscTree::PARSE_LAZY | OscTree::PARSE_VALIDATED ).getChildren().size();
+		}
+	}
+	auto prefiltered = chrono::steady_clock::now() - start;
+	CI_LOG_V( "Validate: " << chrono::duration_cast<chrono::nanoseconds>( eager ).count() / numIterations << "ns per eager parse, " <<
+		chrono::duration_cast<chrono::nanoseconds>( prefiltered ).count() / numIterations << "ns validated and lazy " << numChildren );
+	passed = passed && prefiltered < eager;
+
+	string result = "Test validate ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testPriorityLanes()
+{
+	OscMetrics& metrics = OscMetrics::get();
+	bool wasEnabled = metrics.isEnabled();
+	metrics.setEnabled( true );
+
+	// one shard, so every message goes through the same lanes
+	const size_t queueCapacity = 256;
+	OscDispatcherRef dispatcher = OscDispatcher::create( 1, queueCapacity );
+	dispatcher->setPriority( "/cue/*", OscDispatcher::PRIORITY_CRITICAL );
+	dispatcher->setPriority( "/meter/*", OscDispatcher::PRIORITY_BULK );
+
+	// the handlers run on the one worker, in the order the lanes are served
+	vector<string> handled;
+	vector<int32_t> meters;
+	atomic<bool> gateTaken( false );
+	atomic<bool> gateOpen( false );
+	dispatcher->addHandler( "/cue/go", [ &handled ]( const OscTree& message )
+	{
+		handled.push_back( message.getAddress() );
+	} );
+	dispatcher->addHandler( "/fader/1", [ &handled ]( const OscTree& message )
+	{
+		handled.push_back( message.getAddress() );
+	} );
+	dispatcher->addHandler( "/meter/1", [ & ]( const OscTree& message )
+	{
+		// the first meter holds the worker up while the lanes fill
+		int32_t sequence = message.getChildren()[ 0 ].getValue<int32_t>();
+		if ( sequence < 0 ) {
+			gateTaken = true;
+			while ( !gateOpen ) {
+				this_thread::yield();
+			}
+			return;
+		}
+		handled.push_back( message.getAddress() );
+		meters.push_back( sequence );
+	} );
+
+	bool passed = dispatcher->getPriority( "/cue/go" ) == OscDispatcher::PRIORITY_CRITICAL &&
+		dispatcher->getPriority( "/meter/1" ) == OscDispatcher::PRIORITY_BULK &&
+		dispatcher->getPriority( "/fader/1" ) == OscDispatcher::PRIORITY_NORMAL;
+
+	// a registered address keeps its lane until its handlers are removed
+	{
+		OscDispatcherRef relaned = OscDispatcher::create( 1 );
+		relaned->addHandler( "/scene/recall", []( const OscTree& ) {} );
+		relaned->setPriority( "/scene/*", OscDispatcher::PRIORITY_CRITICAL );
+		relaned->addHandler( "/scene/recall", []( const OscTree& ) {} );
+		passed = passed && relaned->getPriority( "/scene/recall" ) == OscDispatcher::PRIORITY_NORMAL;
+		relaned->removeHandlers( "/scene/recall" );
+		relaned->addHandler( "/scene/recall", []( const OscTree& ) {} );
+		passed = passed && relaned->getPriority( "/scene/recall" ) == OscDispatcher::PRIORITY_CRITICAL;
+	}
+
+	const int32_t numMeters	= 1000;
+	const size_t numCues	= 10;
+	const size_t numFaders	= 40;
+	auto makeMeter = []( int32_t sequence ) -> OscDispatcher::MessageRef
+	{
+		OscTree meter = OscTree::makeMessage( "/meter/1" );
+		meter.pushBack( OscTree( sequence ) );
+		return make_shared<OscTree>( meter );
+	};
+	OscDispatcher::MessageRef cue	= make_shared<OscTree>( OscTree::makeMessage( "/cue/go" ) );
+	OscDispatcher::MessageRef fader	= make_shared<OscTree>( OscTree::makeMessage( "/fader/1" ) );
+
+	// a flood of meters with cues and faders among them, while the worker is held up
+	auto flood = [ & ]()
+	{
+		handled.clear();
+		meters.clear();
+		gateTaken	= false;
+		gateOpen	= false;
+		dispatcher->dispatch( makeMeter( -1 ) );
+		while ( !gateTaken ) {
+			this_thread::yield();
+		}
+		for ( int32_t i = 0; i < numMeters; ++i ) {
+			dispatcher->dispatch( makeMeter( i ) );
+			if ( i % ( numMeters / numFaders ) == 0 ) {
+				dispatcher->dispatch( fader );
+			}
+			if ( i % ( numMeters / numCues ) == 0 ) {
+				dispatcher->dispatch( cue );
+			}
+		}
+		gateOpen = true;
+		dispatcher->waitUntilIdle();
+	};
+
+	// the cues go first, then 8 faders to every meter until the faders run out
+	auto isServedInOrder = [ & ]() -> bool
+	{
+		size_t numHandled = numCues + numFaders + queueCapacity;
+		if ( handled.size() != numHandled || count( handled.begin(), handled.begin() + numCues, "/cue/go" ) != numCues ) {
+			return false;
+		}
+		size_t numWeighted = numFaders + numFaders / 8;
+		return count( handled.begin() + numCues, handled.begin() + numCues + numWeighted, "/fader/1" ) == numFaders;
+	};
+
+	// bulk drops the oldest meters instead of holding up the producer
+	flood();
+	OscDispatcher::LaneStats critical	= dispatcher->getLaneStats( OscDispatcher::PRIORITY_CRITICAL );
+	OscDispatcher::LaneStats normal		= dispatcher->getLaneStats( OscDispatcher::PRIORITY_NORMAL );
+	OscDispatcher::LaneStats bulk		= dispatcher->getLaneStats( OscDispatcher::PRIORITY_BULK );
+	passed = passed && isServedInOrder() && meters.front() == numMeters - static_cast<int32_t>( queueCapacity ) &&
+		meters.back() == numMeters - 1 && is_sorted( meters.begin(), meters.end() );
+	passed = passed && critical.mNumHandled == numCues && critical.mNumDropped == 0 && critical.mQueueLatency.getCount() == numCues &&
+		normal.mNumHandled == numFaders && normal.mNumDropped == 0 && bulk.mNumDispatched == numMeters + 1 &&
+		bulk.mNumDropped == numMeters - queueCapacity && bulk.mNumHandled + bulk.mNumDropped == bulk.mNumDispatched && bulk.mDepth == 0;
+	CI_LOG_V( "Priority lanes: critical p99 " << critical.mQueueLatency.getPercentile( 99.0 ) << "ns, bulk p50 " <<
+		bulk.mQueueLatency.getPercentile( 50.0 ) << "ns, " << bulk.mNumDropped << " of " << numMeters << " meters dropped" );
+
+	// dropping the newest keeps the meters that were queued first
+	dispatcher->setDropPolicy( OscDispatcher::PRIORITY_BULK, OscDispatcher::DROP_NEWEST );
+	flood();
+	OscDispatcher::LaneStats bulkNewest = dispatcher->getLaneStats( OscDispatcher::PRIORITY_BULK );
+	passed = passed && isServedInOrder() && meters.front() == 0 && meters.back() == static_cast<int32_t>( queueCapacity ) - 1 &&
+		bulkNewest.mNumDropped - bulk.mNumDropped == numMeters - queueCapacity;
+
+	// blocking handles every meter, here with the bulk lane made strict
+	dispatcher->setDropPolicy( OscDispatcher::PRIORITY_BULK, OscDispatcher::BLOCK );
+	dispatcher->setWeight( OscDispatcher::PRIORITY_BULK, 0 );
+	meters.clear();
+	for ( int32_t i = 0; i < numMeters; ++i ) {
+		dispatcher->dispatch( makeMeter( i ) );
+	}
+	dispatcher->dispatch( fader );
+	dispatcher->waitUntilIdle();
+	OscDispatcher::LaneStats bulkBlocked = dispatcher->getLaneStats( OscDispatcher::PRIORITY_BULK );
+	passed = passed && bulkBlocked.mNumDropped == bulkNewest.mNumDropped && meters.size() == numMeters &&
+		meters.back() == numMeters - 1 && is_sorted( meters.begin(), meters.end() );
+
+	metrics.setEnabled( wasEnabled );
+
+	string result = "Test priority lanes ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testCapture()
+{
+	fs::path path = getTemporaryDirectory() / "OscDevCapture.osccap";
+	const size_t numPackets = 5000;
+	OscCaptureWriterRef writer = OscCaptureWriter::create( path );
+	for ( size_t i = 0; i < numPackets; ++i ) {
+		OscTree message = OscTree::makeMessage( "/capture/" + to_string( i % 16 ) );
+		message.pushBack( OscTree( static_cast<int32_t>( i ) ) );
+		writer->write( message.toBuffer() );
+	}
+	bool passed = writer->getNumPackets() == numPackets && !writer->isFailed();
+
+	// the writer thread writes in the background, a flush waits for it
+	writer->flush();
+	OscCaptureReaderRef flushed = OscCaptureReader::create( path );
+	passed = passed && !flushed->isIndexRebuilt() && flushed->getNumPackets() == numPackets;
+	flushed.reset();
+	writer.reset();
+
+	auto isIntact = [ & ]( const OscCaptureReaderRef& reader )
+	{
+		bool intact = reader->getNumPackets() == numPackets;
+		for ( size_t i = 0; intact && i < numPackets; ++i ) {
+			OscCaptureReader::Packet packet = reader->getPacket( i );
+			OscTree message( Buffer::create( const_cast<uint8_t*>( packet.mData ), packet.mSize ) );
+			intact = message.getAddress() == "/capture/" + to_string( i % 16 ) && message.getChildren()[ 0 ].getValue<int32_t>() == static_cast<int32_t>( i );
+		}
+		return intact;
+	};
+	OscCaptureReaderRef reader = OscCaptureReader::create( path );
+	passed = passed && !reader->isIndexRebuilt() && isIntact( reader );
+	reader.reset();
+
+	// an offset anywhere in the index that isn't a record falls back to scanning the capture
+	fs::path indexPath	= OscCapture::getIndexPath( path );
+	uint64_t offsets[]	= { 1ull << 40, 12, 0 };
+	for ( uint64_t offset : offsets ) {
+		FILE* file = fopen( indexPath.string().c_str(), "r+b" );
+		fseek( file, static_cast<long>( sizeof( OscCapture::IndexHeader ) + sizeof( uint64_t ) * numPackets / 2 ), SEEK_SET );
+		uint64_t original;
+		passed = passed && fread( &original, sizeof( original ), 1, file ) == 1;
+		fseek( file, -static_cast<long>( sizeof( original ) ), SEEK_CUR );
+		fwrite( &offset, sizeof( offset ), 1, file );
+		fclose( file );
+		reader = OscCaptureReader::create( path );
+		passed = passed && reader->isIndexRebuilt() && isIntact( reader );
+		reader.reset();
+
+		file = fopen( indexPath.string().c_str(), "r+b" );
+		fseek( file, static_cast<long>( sizeof( OscCapture::IndexHeader ) + sizeof( uint64_t ) * numPackets / 2 ), SEEK_SET );
+		fwrite( &original, sizeof( original ), 1, file );
+		fclose( file );
+	}
+
+	// as does an index whose count doesn't match its offsets
+	fs::resize_file( indexPath, fs::file_size( indexPath ) - sizeof( uint64_t ) );
+	reader = OscCaptureReader::create( path );
+	passed = passed && reader->isIndexRebuilt() && isIntact( reader );
+	reader.reset();
+
+	fs::remove( path );
+	fs::remove( indexPath );
+
+	string result = "Test capture ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
+void OscDevApp::testMetrics()
+{
+	OscMetrics& metrics			= OscMetrics::get();
+	bool wasEnabled				= metrics.isEnabled();
+	size_t maxAddresses			= metrics.getMaxAddresses();
+	uint32_t sampleInterval		= metrics.getSampleInterval();
+
+	// stats are kept per address up to the limit, the rest share the overflow entry
+	metrics.reset();
+	metrics.setEnabled( true );
+	metrics.setMaxAddresses( 4 );
+	metrics.setSampleInterval( 1 );
+	for ( size_t i = 0; i < 80; ++i ) {
+		string address = "/metrics/" + to_string( i % 8 );
+		OscAddressTable::get().intern( address );
+		OscTree message = OscTree::makeMessage( address );
+		message.pushBack( OscTree( static_cast<float>( i ) ) );
+		OscTree parsed( message.toBuffer() );
+	}
+	OscMetrics::Snapshot snapshot = metrics.snapshot();
+	bool passed = snapshot.mAddresses.size() == 4 && snapshot.mAddresses[ "/metrics/3" ].mNumMessages == 10 &&
+		snapshot.mOtherAddresses.mNumMessages == 40 && snapshot.mDecodeLatency.getCount() == 80;
+
+	// addresses no one interned are kept by hash, within the same limit
+	metrics.reset();
+	for ( size_t i = 0; i < 80; ++i ) {
+		OscTree message = OscTree::makeMessage( "/metrics/" + to_string( i % 8 ) );
+		BufferRef encoded	= message.toBuffer();
+		BufferRef packet	= make_shared<Buffer>( encoded->getSize() );
+		memcpy( packet->getData(), encoded->getData(), encoded->getSize() );
+
+		// renames it to an address of the same length that was never interned
+		static_cast<char*>( packet->getData() )[ 1 ] = 'h';
+		OscTree parsed( packet );
+		passed = passed && parsed.getAddressId() == OscAddressTable::kInvalidId;
+	}
+	snapshot = metrics.snapshot();
+	passed = passed && snapshot.mAddresses.size() == 4 && snapshot.mAddresses[ "/hetrics/3" ].mNumMessages == 10 &&
+		snapshot.mOtherAddresses.mNumMessages == 40;
+	metrics.setMaxAddresses( maxAddresses );
+	metrics.setSampleInterval( sampleInterval );
+
+	// every message is counted, one in so many is timed
+	metrics.reset();
+	for ( size_t i = 0; i < 128; ++i ) {
+		OscTree message = OscTree::makeMessage( "/metrics/0" );
+		OscTree parsed( message.toBuffer() );
+	}
+	snapshot = metrics.snapshot();
+	passed = passed && snapshot.mAddresses.size() == 1 && snapshot.mAddresses[ "/metrics/0" ].mNumMessages == 128 && 
+		snapshot.mDecodeLatency.getCount() == 128 / sampleInterval;
+
+	// the cost of recording, on a fader message parsed over and over
+	OscTree fader = OscTree::makeMessage( "/mixer/ch/1/fader" );
+	fader.pushBack( OscTree( 0.5f ) );
+	fader.pushBack( OscTree( 1 ) );
+	fader.pushBack( OscTree( string( "main" ) ) );
+	BufferRef packet = fader.toBuffer();
+	auto parseAll = [ & ]( bool enabled )
+	{
+		metrics.setEnabled( enabled );
+		size_t numChildren = 0;
+		auto start = chrono::steady_clock::now();
+		for ( size_t i = 0; i < 100000; ++i ) {
+			numChildren += OscTree( packet ).getNumChildren();
+		}
+		passed = passed && numChildren == 300000;
+		return chrono::duration_cast<chrono::duration<double>>( chrono::steady_clock::now() - start ).count();
+	};
+
+	// the best of several runs each, taken in turns, so noise from the rest of the machine cancels out
+	double disabled		= numeric_limits<double>::max();
+	double enabled		= numeric_limits<double>::max();
+	for ( size_t run = 0; run < 15; ++run ) {
+		disabled	= min( disabled, parseAll( false ) );
+		enabled		= min( enabled, parseAll( true ) );
+	}
+	double overhead = ( enabled / disabled - 1.0 ) * 100.0;
+	CI_LOG_I( "Metrics overhead: " << overhead << "%, " << enabled * 10000.0 << "ns to parse with metrics enabled, " 
+		<< disabled * 10000.0 << "ns disabled" );
+
+	// wall clock timings are noisy, so the bound only catches a gross regression
+	passed = passed && enabled < disabled * 1.5;
+
+	metrics.reset();
+	metrics.setEnabled( wasEnabled );
+
+	string result = "Test metrics ";
+	if ( passed ) {
+		result += "PASSED";
+	} else {
+		result += "FAILED";
+		CI_LOG_F( "<<< FATAL Test Failure >>> " + result );
+	}
+	mText.push_back( result );
+}
+
 void OscDevApp::write()
 {
 	if ( mUdpSession && mUdpSession->getSocket()->is_open() ) {
@@ -769,12 +3465,12 @@ void OscDevApp::write()
 		message.pushBack( attrBlobImage );
 
 		//mUdpSession->write( UdpSession::stringToBuffer( mRequest ) );
-		BufferRef messageBuffer = message.toBuffer();
-		size_t origDataSize = messageBuffer->getSize();
-		size_t origAllocSize = messageBuffer->getAllocatedSize();
+		OscPacketRef packet = OscPacket::create( message );
+		size_t origDataSize = packet->getSize();
+		size_t origAllocSize = packet->getBuffer()->getAllocatedSize();
 
-		Buffer compressedBuffer = compressBuffer( *messageBuffer );
-		messageBuffer = Buffer::create( compressedBuffer.getData(), compressedBuffer.getSize() );
+		// the compressed buffer is moved rather than copied into the one that is sent
+		BufferRef messageBuffer = make_shared<Buffer>( compressBuffer( *packet->getBuffer() ) );
 
 		CI_LOG_I( "Compressed buffer: " 
 			<< "\n\toriginal data size: " << origDataSize 
@@ -2,9 +2,14 @@
 #include "cinder/gl/gl.h"
 #include "cinder/params/Params.h"
 
-#include "UdpServer.h"
+#include "OscBufferPool.h"
+#include "OscCapture.h"
+#include "OscMetrics.h"
+#include "OscTransport.h"
 #include "OscTree.h"
 
+#include <thread>
+
 class OscDevServerApp : public ci::app::App
 {
 public:
@@ -19,17 +24,19 @@ public:
 	
 private:
 	void	accept();
-	void	onAccept( UdpSessionRef session );
 	void	onError( std::string error, size_t bytesTransferred );
 	void	onRead( ci::BufferRef buffer );
-	void	onReadComplete();
-	void	onWrite( size_t bytesTransferred );
 	void	readOsc( const ci::BufferRef& buffer );
+	ci::BufferRef	decompress( const ci::BufferRef& buffer );
+	void	dumpMetrics();
+	void	replayCapture();
+	void	setRecording( bool recording );
 
 private:
 	int32_t						mPort;
-	UdpServerRef				mUdpServer;
-	UdpSessionRef				mUdpSession;
+	OscExecutorRef				mExecutor;
+	OscUdpTransportRef			mTransport;
+	OscBufferPoolRef			mBufferPool;
 
 	ci::Font					mFont;
 	std::vector<std::string>	mText;
@@ -39,6 +46,13 @@ private:
 	ci::Surface8uRef			mSurfaceOsc;
 	ci::Surface8uRef			mSurfaceDiff;
 
+	ci::fs::path				mCapturePath;
+	OscCaptureWriterRef			mCaptureWriter;
+	float						mReplaySpeed;
+	// set while a replay runs on mReplayThread
+	std::shared_ptr<OscReplay>	mReplay;
+	std::thread					mReplayThread;
+
 	ci::params::InterfaceGlRef	mParams;
 	float						mFps;
 };
@@ -47,6 +61,8 @@ private:
 #include "cinder/ip/Fill.h"
 #include "cinder/Log.h"
 #include "cinder/Perlin.h"
+#include "cinder/Utilities.h"
+#include "zlib.h"
 
 using namespace ci;
 using namespace ci::app;
@@ -64,24 +80,45 @@ void OscDevServerApp::prepareSettings( App::Settings * settings )
 OscDevServerApp::OscDevServerApp() :
 	mPort( 2000 ), 
 	mFont( "Georgia", 24 ), 
+	mReplaySpeed( 1.0f ), 
 	mFps( 0.0f )
 {
+	mCapturePath = getDocumentsDirectory() / "OscDevServer.osccap";
 }
 
 OscDevServerApp::~OscDevServerApp()
 {
+	if ( mReplay ) {
+		mReplay->cancel();
+	}
+	if ( mReplayThread.joinable() ) {
+		mReplayThread.join();
+	}
+	if ( mTransport ) {
+		mTransport->close();
+	}
 }
 
 void OscDevServerApp::accept()
 {
-	if ( mUdpSession ) {
-		mUdpSession.reset();
+	if ( mTransport ) {
+		mTransport->close();
+		mTransport.reset();
 	}
 
-	if ( mUdpServer ) {
-		mUdpServer->accept( static_cast<uint16_t>( mPort ) );
+	// packets are received into recycled buffers, a slot goes back
+	// to the pool once readOsc() and the capture are done with it
+	try {
+		mTransport = OscUdpTransport::create( mExecutor, static_cast<uint16_t>( mPort ) );
+		mTransport->setBufferPool( mBufferPool );
+		mTransport->setReceiveHandler( [ & ]( const BufferRef& buffer ) -> void
+		{
+			onRead( buffer );
+		} );
 
 		mText.push_back( "Listening on port: " + to_string( mPort ) );
+	} catch ( const std::exception& exc ) {
+		onError( exc.what(), 0 );
 	}
 }
 
@@ -115,17 +152,6 @@ void OscDevServerApp::draw()
 	mParams->draw();
 }
 
-void OscDevServerApp::onAccept( UdpSessionRef session )
-{
-	mUdpSession = session;
-	mUdpSession->connectErrorEventHandler( &OscDevServerApp::onError, this );
-	mUdpSession->connectReadEventHandler( &OscDevServerApp::onRead, this );
-	mUdpSession->connectReadCompleteEventHandler( &OscDevServerApp::onReadComplete, this );
-	mUdpSession->connectWriteEventHandler( &OscDevServerApp::onWrite, this );
-
-	mUdpSession->read( numeric_limits<uint16_t>::max() );
-}
-
 void OscDevServerApp::onError( std::string error, size_t bytesTransferred )
 {
 	string text = "Error";
@@ -147,22 +173,6 @@ void OscDevServerApp::onRead( ci::BufferRef buffer )
 	//mText.push_back( text );
 
 	readOsc( buffer );
-
-	mUdpSession->read();
-}
-
-void OscDevServerApp::onReadComplete()
-{
-	mText.push_back( "Read complete" );
-
-	mUdpSession->read();
-}
-
-void OscDevServerApp::onWrite( size_t bytesTransferred )
-{
-	mText.push_back( to_string( bytesTransferred ) + " bytes written" );
-
-	mUdpSession->read();
 }
 
 void OscDevServerApp::readOsc( const BufferRef &buffer )
@@ -172,9 +182,13 @@ void OscDevServerApp::readOsc( const BufferRef &buffer )
 	size_t origDataSize = buffer->getSize();
 	size_t origAllocSize = buffer->getAllocatedSize();
 
-	Buffer uncompressedBuffer = decompressBuffer( *buffer );
-	BufferRef oscBuffer = Buffer::create( uncompressedBuffer.getData(), uncompressedBuffer.getSize() );
-	OscTree oscPacket( oscBuffer );
+	// the packet is inflated into a slot from the pool, and read
+	// where it lies there rather than copied into the tree
+	BufferRef oscBuffer = decompress( buffer );
+	if ( mCaptureWriter ) {
+		mCaptureWriter->write( oscBuffer );
+	}
+	const OscTree oscPacket( oscBuffer, OscTree::PARSE_LAZY );
 
 	CI_LOG_I( "Compressed buffer: " 
 		<< "\n\toriginal data size: " << origDataSize 
@@ -209,7 +223,7 @@ void OscDevServerApp::readOsc( const BufferRef &buffer )
 	CI_LOG_I( result );
 	mText.push_back( result );
 
-	passed = ( valueString == oscPacket.getChildren()[ 1 ].getValue<string>() );
+	passed = ( oscPacket.getChildren()[ 1 ].get<OscTree::StringView>() == valueString );
 	result = "Test string: ";
 	result += ( passed ) ? "PASSED" : "FAILED";
 	result += "\n\tvalue: " + oscPacket.getChildren()[ 1 ].getValue<string>();
@@ -285,13 +299,103 @@ void OscDevServerApp::readOsc( const BufferRef &buffer )
 	CI_LOG_I( result );
 }
 
+BufferRef OscDevServerApp::decompress( const BufferRef& buffer )
+{
+	// compressBuffer() writes zlib's own format, which uncompress() reads
+	// into a slot sized for the largest datagram
+	BufferRef packet	= mBufferPool->acquire( OscBufferPool::kDatagramSlotSize );
+	uLongf size			= static_cast<uLongf>( packet->getAllocatedSize() );
+	if ( uncompress( static_cast<Bytef*>( packet->getData() ), &size, static_cast<const Bytef*>( buffer->getData() ), static_cast<uLong>( buffer->getSize() ) ) == Z_OK ) {
+		packet->setSize( size );
+		return packet;
+	}
+
+	// larger than any slot, or not compressed as expected
+	CI_LOG_W( "Decompressing a " << buffer->getSize() << " byte packet outside the buffer pool" );
+	return make_shared<Buffer>( decompressBuffer( *buffer ) );
+}
+
+void OscDevServerApp::dumpMetrics()
+{
+	string result = OscMetrics::get().snapshot().toString();
+	if ( mBufferPool ) {
+		result += "\n\tbuffer pool: " + to_string( mBufferPool->getNumAvailable() ) + "/" + to_string( mBufferPool->getNumSlots() ) 
+			+ " slots free, " + to_string( mBufferPool->getNumFallbacks() ) + " heap fallbacks";
+	}
+	CI_LOG_I( result );
+	mText.push_back( result );
+}
+
+void OscDevServerApp::replayCapture()
+{
+	if ( mReplay ) {
+		mText.push_back( "A replay is already running" );
+		return;
+	}
+
+	setRecording( false );
+
+	if ( !fs::exists( mCapturePath ) ) {
+		mText.push_back( "No capture to replay: " + mCapturePath.string() );
+		return;
+	}
+
+	try {
+		mReplay = make_shared<OscReplay>( OscCaptureReader::create( mCapturePath ) );
+	} catch ( const ci::Exception& exc ) {
+		mText.push_back( string( "Replay failed: " ) + exc.what() );
+		return;
+	}
+	mText.push_back( "Replaying: " + mCapturePath.string() );
+
+	// a paced replay lasts as long as the capture, so it runs on its
+	// own thread and posts the result back to the main thread
+	shared_ptr<OscReplay> replay	= mReplay;
+	double speed					= static_cast<double>( mReplaySpeed );
+	mReplayThread = thread( [ this, replay, speed ]() -> void
+	{
+		size_t numArguments = 0;
+		OscReplay::Stats stats = replay->run( [ & ]( const OscTree& packet ) -> void
+		{
+			numArguments += packet.getChildren().size();
+		}, speed );
+
+		string result = "Replayed " + to_string( stats.mNumPackets ) + " packets, " 
+			+ to_string( numArguments ) + " arguments in " + to_string( stats.mSeconds ) + "s" 
+			+ "\n\t" + to_string( stats.getPacketsPerSecond() ) + " packets/s, " 
+			+ to_string( stats.getMegabytesPerSecond() ) + " MB/s";
+		io_service().post( [ this, result ]() -> void
+		{
+			mReplayThread.join();
+			mReplay.reset();
+			CI_LOG_I( result );
+			mText.push_back( result );
+		} );
+	} );
+}
+
+void OscDevServerApp::setRecording( bool recording )
+{
+	if ( recording && !mCaptureWriter ) {
+		try {
+			mCaptureWriter = OscCaptureWriter::create( mCapturePath );
+			mText.push_back( "Recording to: " + mCapturePath.string() );
+		} catch ( const ci::Exception& exc ) {
+			mText.push_back( string( "Record failed: " ) + exc.what() );
+		}
+	} else if ( !recording && mCaptureWriter ) {
+		mText.push_back( "Recorded " + to_string( mCaptureWriter->getNumPackets() ) + " packets" 
+			+ ( mCaptureWriter->isFailed() ? ", writing stopped early" : "" ) );
+		mCaptureWriter.reset();
+	}
+}
+
 void OscDevServerApp::setup()
 {
-	mUdpServer = UdpServer::create( io_service() );
-	mUdpServer->connectAcceptEventHandler( &OscDevServerApp::onAccept, this );
-	mUdpServer->connectErrorEventHandler( &OscDevServerApp::onError, this );
+	mExecutor	= OscExecutor::create( io_service() );
+	mBufferPool	= OscBufferPool::create();
 
-	mParams = params::InterfaceGl::create( "Params", ivec2( 200, 75 ) );
+	mParams = params::InterfaceGl::create( "Params", ivec2( 200, 170 ) );
 	mParams->addParam<float>(	"FPS",	&mFps, true );
 
 	auto setPort = [ & ]( int32_t port ) -> void
@@ -306,6 +410,34 @@ void OscDevServerApp::setup()
 
 	mParams->addParam<int32_t>( "Port", setPort, getPort ).min( 0 ).max( 65535 ).keyDecr( "p" ).keyIncr( "P" ).step( 1 );
 
+	auto setRecord = [ & ]( bool recording ) -> void
+	{
+		setRecording( recording );
+	};
+
+	auto getRecord = [ & ]() -> bool
+	{
+		return mCaptureWriter != nullptr;
+	};
+
+	// a replay speed of 0 replays as fast as possible
+	mParams->addParam<bool>(	"Record",		setRecord, getRecord ).key( "c" );
+	mParams->addParam<float>(	"Replay speed",	&mReplaySpeed ).min( 0.0f ).max( 100.0f ).step( 0.5f );
+	mParams->addButton( "Replay capture", bind( &OscDevServerApp::replayCapture, this ), "key=y" );
+
+	auto setMetricsEnabled = [ & ]( bool enabled ) -> void
+	{
+		OscMetrics::get().setEnabled( enabled );
+	};
+
+	auto getMetricsEnabled = [ & ]() -> bool
+	{
+		return OscMetrics::get().isEnabled();
+	};
+
+	mParams->addParam<bool>( "Metrics", setMetricsEnabled, getMetricsEnabled ).key( "m" );
+	mParams->addButton( "Dump metrics", bind( &OscDevServerApp::dumpMetrics, this ), "key=d" );
+
 	// Draw text more legibly
 	gl::enableAlphaBlending();
 